@@ -116,6 +116,7 @@ static void print_scrub_full(struct btrfs_scrub_progress *sp)
 #ifdef DUET_SCRUB
 	printf("\tdata_bytes_verified: %lld\n", sp->data_bytes_verified);
 	printf("\ttree_bytes_verified: %lld\n", sp->tree_bytes_verified);
+	printf("\ttree_bytes_skipped: %lld\n", sp->tree_bytes_skipped);
 #endif
 #ifdef ADAPT_SCRUB
 	printf("\tsync_errors: %lld\n", sp->sync_errors);
@@ -168,6 +169,8 @@ static void print_scrub_summary(struct btrfs_scrub_progress *p)
 		pretty_size(p->data_bytes_verified + p->tree_bytes_verified),
 		pretty_size(p->data_bytes_verified),
 		pretty_size(p->tree_bytes_verified));
+	printf("\ttree bytes skipped: %s (read and verified since)\n",
+		pretty_size(p->tree_bytes_skipped));
 #else
 	printf("\ttotal bytes scrubbed: %s with %llu errors\n",
 		pretty_size(p->data_bytes_scrubbed + p->tree_bytes_scrubbed),
@@ -230,6 +233,7 @@ static void add_to_fs_stat(struct btrfs_scrub_progress *p,
 #ifdef DUET_SCRUB
 	_SCRUB_FS_STAT(p, data_bytes_verified, fs_stat);
 	_SCRUB_FS_STAT(p, tree_bytes_verified, fs_stat);
+	_SCRUB_FS_STAT(p, tree_bytes_skipped, fs_stat);
 #endif
 #ifdef ADAPT_SCRUB
 	_SCRUB_FS_STAT(p, sync_errors, fs_stat);
@@ -623,6 +627,8 @@ again:
 					&p[curr]->p);
 			_SCRUB_KVREAD(ret, &i, tree_bytes_verified, avail, l,
 					&p[curr]->p);
+			_SCRUB_KVREAD(ret, &i, tree_bytes_skipped, avail, l,
+					&p[curr]->p);
 #endif
 #ifdef ADAPT_SCRUB
 			_SCRUB_KVREAD(ret, &i, sync_errors, avail, l,
@@ -726,6 +732,7 @@ static struct scrub_progress *scrub_resumed_stats(struct scrub_progress *data,
 #ifdef DUET_SCRUB
 	_SCRUB_SUM(dest, data, data_bytes_verified);
 	_SCRUB_SUM(dest, data, tree_bytes_verified);
+	_SCRUB_SUM(dest, data, tree_bytes_skipped);
 #endif
 #ifdef ADAPT_SCRUB
 	_SCRUB_SUM(dest, data, sync_errors);
@@ -797,6 +804,7 @@ static int scrub_write_file(int fd, const char *fsid,
 #ifdef DUET_SCRUB
 		    _SCRUB_KVWRITE(fd, buf, data_bytes_verified, use) ||
 		    _SCRUB_KVWRITE(fd, buf, tree_bytes_verified, use) ||
+		    _SCRUB_KVWRITE(fd, buf, tree_bytes_skipped, use) ||
 #endif
 #ifdef ADAPT_SCRUB
 		    _SCRUB_KVWRITE(fd, buf, sync_errors, use) ||
@@ -93,6 +93,7 @@ struct btrfs_scrub_progress {
 #ifdef DUET_SCRUB
 	__u64 data_bytes_verified;
 	__u64 tree_bytes_verified;
+	__u64 tree_bytes_skipped;
 #endif
 #ifdef ADAPT_SCRUB
 	__u64 sync_errors;
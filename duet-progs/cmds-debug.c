@@ -16,6 +16,14 @@
  * Boston, MA 021110-1307, USA.
  */
 
+#define _GNU_SOURCE
+#include <limits.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
 #include "ioctl.h"
 #include "commands.h"
 
@@ -52,6 +60,827 @@ static const char * const cmd_debug_getpath_usage[] = {
 	NULL
 };
 
+static const char * const cmd_debug_links_usage[] = {
+	"duet debug links [-d dir] [-n files]",
+	"Stress tests the relevance of hard-linked files to file tasks.",
+	"Registers a file task on a new dir under dir, and creates files with",
+	"links inside and outside of it, in the order, and with the renames,",
+	"that make their relevance change, either way. Then checks that events",
+	"are fetched for exactly the files left with a link inside the task's",
+	"dir.",
+	"",
+	"-d     dir to run in (default: current dir)",
+	"-n     number of files to create (default: 256)",
+	NULL
+};
+
+static const char * const cmd_debug_dio_usage[] = {
+	"duet debug dio [-d dir] [-n pages]",
+	"Checks that direct I/O writes are reported to file tasks.",
+	"Registers a file task on a new dir under dir, writes a file in it, and",
+	"marks the file done. Then overwrites the file with O_DIRECT, and checks",
+	"that the file is no longer done, and that a Dirty event is fetched for",
+	"every page written. The dir must be on a filesystem using the generic",
+	"direct I/O code (e.g. ext4 on a loop device).",
+	"",
+	"-d     dir to run in (default: current dir)",
+	"-n     number of pages to write (default: 256)",
+	NULL
+};
+
+static const char * const cmd_debug_filter_usage[] = {
+	"duet debug filter [-d dir] [-n files] [-s size]",
+	"Measures the events dropped at the hook by a task filter.",
+	"Registers a file task on a new dir under dir, with a filter on files",
+	"of at least size bytes. Then creates files of one page, first with the",
+	"filter set and then without it. Reports the page events dropped at",
+	"the hook, as counted by the kernel, the items fetched, and the time",
+	"spent per page writing (which includes the hook) and fetching, in each",
+	"case.",
+	"",
+	"-d     dir to run in (default: current dir)",
+	"-n     number of files to create per run (default: 4096)",
+	"-s     min size of files let through, in bytes (default: 65536)",
+	NULL
+};
+
+static const char * const cmd_debug_blocks_usage[] = {
+	"duet debug blocks [-d dir] [-n pages]",
+	"Checks the device blocks reported for items against FIEMAP.",
+	"Registers a file task on a new dir under dir, with DUET_MAP_BLOCKS,",
+	"writes and syncs a file in it, and fetches its items along with their",
+	"blocks. Then checks that every page was mapped to the sector FIEMAP",
+	"reports for it. The dir must be on a filesystem that maps pages for",
+	"Duet (ext4, xfs, btrfs).",
+	"",
+	"-d     dir to run in (default: current dir)",
+	"-n     number of pages to write (default: 256)",
+	NULL
+};
+
+/*
+ * Scratch run of the debug commands that exercise a file task: the dir to run
+ * in, the number of files or pages to use, and the scratch dir and task.
+ */
+struct debug_run {
+	const char	*dir;
+	int		n;
+	char		base[PATH_MAX / 2];
+	int		tid;
+};
+
+/*
+ * getopt() for the commands taking -d dir and -n num, which it handles itself.
+ * Returns any other option for the caller to handle, or -1 when done.
+ */
+static int debug_getopt(int argc, char **argv, const char *optstring,
+	struct debug_run *run, const char * const *usagestr)
+{
+	int c;
+
+	while ((c = getopt(argc, argv, optstring)) != -1) {
+		switch (c) {
+		case 'd':
+			run->dir = optarg;
+			break;
+		case 'n':
+			errno = 0;
+			run->n = (int)strtol(optarg, NULL, 10);
+			if (errno || run->n <= 0) {
+				perror("strtol: invalid count");
+				usage(usagestr);
+			}
+			break;
+		default:
+			return c;
+		}
+	}
+
+	return -1;
+}
+
+/*
+ * Creates the scratch dir of a run, named after the command, and registers a
+ * file task on its scope subdir (or on the scratch dir itself, if NULL).
+ */
+static int debug_start(int fd, struct debug_run *run, const char *name,
+	const char *scope, __u32 regmask)
+{
+	char path[PATH_MAX];
+
+	snprintf(run->base, sizeof(run->base), "%s/duet-%s.%d", run->dir, name,
+		 (int)getpid());
+	if (mkdir(run->base, 0755)) {
+		perror(run->base);
+		return -1;
+	}
+
+	if (scope)
+		snprintf(path, PATH_MAX, "%s/%s", run->base, scope);
+	else
+		snprintf(path, PATH_MAX, "%s", run->base);
+	if (scope && mkdir(path, 0755)) {
+		perror(path);
+		goto err;
+	}
+
+	if (duet_register(fd, path, DUET_FILE_TASK | regmask, 1, name,
+			  &run->tid)) {
+		fprintf(stderr, "duet: failed to register task on %s\n", path);
+		goto err;
+	}
+
+	return 0;
+
+err:
+	if (scope)
+		rmdir(path);
+	rmdir(run->base);
+	return -1;
+}
+
+/* Deregisters the task of a run, and removes the scratch dir once emptied */
+static void debug_stop(int fd, struct debug_run *run)
+{
+	duet_deregister(fd, run->tid);
+	rmdir(run->base);
+}
+
+/*
+ * Fetches items until the task has none left, passing each one to fn, if
+ * given. Returns the number of items fetched, or -1.
+ */
+static int debug_drain(int fd, int tid,
+	void (*fn)(struct duet_item *, void *), void *data)
+{
+	int i, count, fetched = 0;
+	struct duet_item items[DUET_MAX_ITEMS];
+
+	do {
+		count = DUET_MAX_ITEMS;
+		if (duet_fetch(fd, tid, items, &count)) {
+			fprintf(stderr, "duet: failed to fetch items\n");
+			return -1;
+		}
+
+		for (i = 0; fn && i < count; i++)
+			fn(&items[i], data);
+		fetched += count;
+	} while (count);
+
+	return fetched;
+}
+
+/* How files are linked across the task's dir in cmd_debug_links */
+enum {
+	LINKS_OUT = 0,	/* Only outside */
+	LINKS_IN_OUT,	/* Created inside, then linked outside */
+	LINKS_OUT_IN,	/* Created and written outside, then linked inside */
+	LINKS_MOVED,	/* Two links inside, then one moved outside */
+	LINKS_LOST_MV,	/* Linked outside, then the inside link moved outside */
+	LINKS_LOST_RM,	/* Linked outside, then the inside link removed */
+	LINKS_KINDS,
+};
+
+struct links_seen {
+	ino_t	*inos;
+	char	*seen;
+	int	n;
+};
+
+/* Whether a file of the given kind ends up with a link inside */
+static int links_inside(int kind)
+{
+	return kind != LINKS_OUT && kind != LINKS_LOST_MV &&
+	       kind != LINKS_LOST_RM;
+}
+
+static int links_write(const char *path)
+{
+	int fd, ret = 0;
+	char buf[8192];
+
+	memset(buf, 0x5a, sizeof(buf));
+	fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (fd < 0 || write(fd, buf, sizeof(buf)) != sizeof(buf)) {
+		perror(path);
+		ret = -1;
+	}
+
+	if (fd >= 0)
+		close(fd);
+	return ret;
+}
+
+static int links_create(const char *base, int i, ino_t *ino)
+{
+	struct stat st;
+	char in[PATH_MAX], out[PATH_MAX], in2[PATH_MAX], out2[PATH_MAX];
+
+	snprintf(in, PATH_MAX, "%s/in/f%d", base, i);
+	snprintf(out, PATH_MAX, "%s/out/f%d", base, i);
+	snprintf(in2, PATH_MAX, "%s/in/g%d", base, i);
+	snprintf(out2, PATH_MAX, "%s/out/g%d", base, i);
+
+	switch (i % LINKS_KINDS) {
+	case LINKS_OUT:
+		if (links_write(out))
+			return -1;
+		break;
+	case LINKS_IN_OUT:
+		if (links_write(in) || link(in, out) || links_write(out))
+			return -1;
+		break;
+	case LINKS_OUT_IN:
+		if (links_write(out) || link(out, in))
+			return -1;
+		break;
+	case LINKS_MOVED:
+		if (links_write(in) || link(in, in2) || rename(in2, out2))
+			return -1;
+		break;
+	case LINKS_LOST_MV:
+		if (links_write(in) || link(in, out) || rename(in, out2))
+			return -1;
+		break;
+	case LINKS_LOST_RM:
+		if (links_write(in) || link(in, out) || unlink(in))
+			return -1;
+		break;
+	}
+
+	if (stat(links_inside(i % LINKS_KINDS) ? in : out, &st))
+		return -1;
+
+	*ino = st.st_ino;
+	return 0;
+}
+
+/* Removes the files of a links run, and the dirs they were in */
+static void links_remove(const char *base, int n)
+{
+	int i;
+	char path[PATH_MAX];
+
+	for (i = 0; i < n; i++) {
+		snprintf(path, PATH_MAX, "%s/in/f%d", base, i);
+		unlink(path);
+		snprintf(path, PATH_MAX, "%s/out/f%d", base, i);
+		unlink(path);
+		snprintf(path, PATH_MAX, "%s/out/g%d", base, i);
+		unlink(path);
+	}
+
+	snprintf(path, PATH_MAX, "%s/in", base);
+	rmdir(path);
+	snprintf(path, PATH_MAX, "%s/out", base);
+	rmdir(path);
+}
+
+/* Notes the files we got events for */
+static void links_note(struct duet_item *item, void *data)
+{
+	int i;
+	struct links_seen *ls = data;
+
+	for (i = 0; i < ls->n; i++) {
+		if (DUET_UUID_INO(item->uuid) == (unsigned long)ls->inos[i]) {
+			ls->seen[i] = 1;
+			break;
+		}
+	}
+}
+
+static int cmd_debug_links(int fd, int argc, char **argv)
+{
+	int c, i, ret = 0;
+	int skipped = 0, included = 0;
+	char path[PATH_MAX];
+	struct debug_run run = { .dir = ".", .n = 256 };
+	struct links_seen ls;
+
+	optind = 1;
+	while ((c = debug_getopt(argc, argv, "d:n:", &run,
+				 cmd_debug_links_usage)) != -1) {
+		fprintf(stderr, "Unknown option %c\n", (char)c);
+		usage(cmd_debug_links_usage);
+	}
+
+	if (argc != optind)
+		usage(cmd_debug_links_usage);
+
+	ls.n = run.n;
+	ls.inos = calloc(ls.n, sizeof(*ls.inos));
+	ls.seen = calloc(ls.n, 1);
+	if (!ls.inos || !ls.seen) {
+		fprintf(stderr, "duet: failed to allocate file table\n");
+		ret = -1;
+		goto out_free;
+	}
+
+	if (debug_start(fd, &run, "links", "in", DUET_PAGE_EXISTS)) {
+		ret = -1;
+		goto out_free;
+	}
+
+	snprintf(path, PATH_MAX, "%s/out", run.base);
+	if (mkdir(path, 0755)) {
+		perror(path);
+		ret = -1;
+		goto out_stop;
+	}
+
+	for (i = 0; i < ls.n; i++) {
+		if (links_create(run.base, i, &ls.inos[i])) {
+			fprintf(stderr, "duet: failed to create file %d\n", i);
+			ret = -1;
+			goto out_stop;
+		}
+	}
+
+	if (debug_drain(fd, run.tid, links_note, &ls) < 0) {
+		ret = -1;
+		goto out_stop;
+	}
+
+	for (i = 0; i < ls.n; i++) {
+		if (!links_inside(i % LINKS_KINDS) && ls.seen[i]) {
+			fprintf(stdout, "File %d (ino %lu) spuriously included\n",
+				i, (unsigned long)ls.inos[i]);
+			included++;
+		} else if (links_inside(i % LINKS_KINDS) && !ls.seen[i]) {
+			fprintf(stdout, "File %d (ino %lu) spuriously skipped\n",
+				i, (unsigned long)ls.inos[i]);
+			skipped++;
+		}
+	}
+
+	fprintf(stdout, "%d files: %d spuriously skipped, %d spuriously "
+		"included\n", ls.n, skipped, included);
+	if (skipped || included)
+		ret = 1;
+
+out_stop:
+	links_remove(run.base, ls.n);
+	debug_stop(fd, &run);
+out_free:
+	free(ls.seen);
+	free(ls.inos);
+	return ret;
+}
+
+#define DIO_PAGE	4096
+
+/* Dirty events seen on the pages of the file in cmd_debug_dio */
+struct dio_seen {
+	ino_t			ino;
+	char			*seen;
+	int			n;
+	int			dirty;
+	unsigned long long	uuid;
+};
+
+/* Counts the Dirty events on pages of the file, and notes its uuid */
+static void dio_note(struct duet_item *item, void *data)
+{
+	struct dio_seen *ds = data;
+
+	if (DUET_UUID_INO(item->uuid) != (unsigned long)ds->ino ||
+	    !(item->state & DUET_PAGE_DIRTY))
+		return;
+
+	ds->uuid = item->uuid;
+	if (item->idx < (unsigned long)ds->n && !ds->seen[item->idx]) {
+		ds->seen[item->idx] = 1;
+		ds->dirty++;
+	}
+}
+
+static int cmd_debug_dio(int fd, int argc, char **argv)
+{
+	int c, i, dfd = -1, ret = 0;
+	char path[PATH_MAX];
+	char *buf = NULL;
+	struct debug_run run = { .dir = ".", .n = 256 };
+	struct dio_seen ds = { 0 };
+	struct stat st;
+
+	optind = 1;
+	while ((c = debug_getopt(argc, argv, "d:n:", &run,
+				 cmd_debug_dio_usage)) != -1) {
+		fprintf(stderr, "Unknown option %c\n", (char)c);
+		usage(cmd_debug_dio_usage);
+	}
+
+	if (argc != optind)
+		usage(cmd_debug_dio_usage);
+
+	ds.n = run.n;
+	ds.seen = calloc(ds.n, 1);
+	if (!ds.seen || posix_memalign((void **)&buf, DIO_PAGE, DIO_PAGE)) {
+		fprintf(stderr, "duet: failed to allocate buffers\n");
+		ret = -1;
+		goto out_free;
+	}
+
+	if (debug_start(fd, &run, "dio", NULL, DUET_PAGE_DIRTY)) {
+		ret = -1;
+		goto out_free;
+	}
+	snprintf(path, PATH_MAX, "%s/f", run.base);
+
+	/* Write the file through the page cache, and mark it done */
+	memset(buf, 0x5a, DIO_PAGE);
+	dfd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (dfd < 0) {
+		perror(path);
+		ret = -1;
+		goto out_stop;
+	}
+
+	for (i = 0; i < ds.n; i++) {
+		if (write(dfd, buf, DIO_PAGE) != DIO_PAGE) {
+			perror(path);
+			ret = -1;
+			goto out_close;
+		}
+	}
+
+	if (fsync(dfd) || fstat(dfd, &st)) {
+		perror(path);
+		ret = -1;
+		goto out_close;
+	}
+	close(dfd);
+	dfd = -1;
+
+	ds.ino = st.st_ino;
+	if (debug_drain(fd, run.tid, dio_note, &ds) < 0 || !ds.dirty ||
+	    !ds.uuid) {
+		fprintf(stderr, "duet: no events for buffered writes\n");
+		ret = -1;
+		goto out_stop;
+	}
+
+	if (duet_set_done(fd, run.tid, ds.uuid, 1) < 0 ||
+	    duet_check_done(fd, run.tid, ds.uuid, 1) != 1) {
+		fprintf(stderr, "duet: failed to mark file done\n");
+		ret = -1;
+		goto out_stop;
+	}
+
+	/* Overwrite it around the page cache */
+	memset(ds.seen, 0, ds.n);
+	ds.dirty = 0;
+	memset(buf, 0xa5, DIO_PAGE);
+	dfd = open(path, O_WRONLY | O_DIRECT);
+	if (dfd < 0) {
+		perror(path);
+		ret = -1;
+		goto out_stop;
+	}
+
+	for (i = 0; i < ds.n; i++) {
+		if (pwrite(dfd, buf, DIO_PAGE, (off_t)i * DIO_PAGE) != DIO_PAGE) {
+			perror(path);
+			ret = -1;
+			goto out_close;
+		}
+	}
+	close(dfd);
+	dfd = -1;
+
+	if (duet_check_done(fd, run.tid, ds.uuid, 1) != 0) {
+		fprintf(stdout, "File (ino %lu) still done after direct writes\n",
+			(unsigned long)st.st_ino);
+		ret = 1;
+	}
+
+	if (debug_drain(fd, run.tid, dio_note, &ds) < 0) {
+		ret = -1;
+		goto out_stop;
+	}
+
+	fprintf(stdout, "%d pages written: %d reported dirty\n", ds.n,
+		ds.dirty);
+	if (ds.dirty != ds.n)
+		ret = 1;
+
+out_close:
+	if (dfd >= 0)
+		close(dfd);
+out_stop:
+	unlink(path);
+	debug_stop(fd, &run);
+out_free:
+	free(buf);
+	free(ds.seen);
+	return ret;
+}
+
+/* Sectors of the pages of the file in cmd_debug_blocks, as FIEMAP sees them */
+static int blocks_fiemap(int fd, int n, __u64 *sectors)
+{
+	int i;
+	__u64 off, end;
+	struct fiemap *fm;
+	struct fiemap_extent *fe;
+
+	fm = calloc(1, sizeof(*fm) + n * sizeof(struct fiemap_extent));
+	if (!fm) {
+		perror("duet: fiemap allocation failed");
+		return -1;
+	}
+
+	fm->fm_length = (__u64)n * DIO_PAGE;
+	fm->fm_flags = FIEMAP_FLAG_SYNC;
+	fm->fm_extent_count = n;
+	if (ioctl(fd, FS_IOC_FIEMAP, fm) < 0) {
+		perror("duet: FIEMAP failed");
+		free(fm);
+		return -1;
+	}
+
+	memset(sectors, 0, n * sizeof(*sectors));
+	for (i = 0; i < (int)fm->fm_mapped_extents; i++) {
+		fe = &fm->fm_extents[i];
+		if (fe->fe_flags & (FIEMAP_EXTENT_UNKNOWN |
+		    FIEMAP_EXTENT_DATA_INLINE | FIEMAP_EXTENT_ENCODED))
+			continue;
+
+		end = fe->fe_logical + fe->fe_length;
+		for (off = fe->fe_logical; off < end; off += DIO_PAGE) {
+			if (off / DIO_PAGE >= (__u64)n)
+				break;
+			sectors[off / DIO_PAGE] =
+				(fe->fe_physical + (off - fe->fe_logical)) >> 9;
+		}
+	}
+
+	free(fm);
+	return 0;
+}
+
+static int cmd_debug_blocks(int fd, int argc, char **argv)
+{
+	int c, i, dfd = -1, count, ret = 0;
+	int matched = 0, mismatched = 0, unmapped = 0;
+	char path[PATH_MAX], buf[DIO_PAGE];
+	__u64 *sectors = NULL;
+	struct debug_run run = { .dir = ".", .n = 256 };
+	struct duet_item items[DUET_MAX_BITEMS];
+	struct duet_block blks[DUET_MAX_BITEMS];
+	struct stat st;
+
+	optind = 1;
+	while ((c = debug_getopt(argc, argv, "d:n:", &run,
+				 cmd_debug_blocks_usage)) != -1) {
+		fprintf(stderr, "Unknown option %c\n", (char)c);
+		usage(cmd_debug_blocks_usage);
+	}
+
+	if (argc != optind)
+		usage(cmd_debug_blocks_usage);
+
+	sectors = calloc(run.n, sizeof(*sectors));
+	if (!sectors) {
+		fprintf(stderr, "duet: failed to allocate sector table\n");
+		return -1;
+	}
+
+	if (debug_start(fd, &run, "blocks", NULL,
+			DUET_PAGE_EXISTS | DUET_MAP_BLOCKS)) {
+		ret = -1;
+		goto out_free;
+	}
+	snprintf(path, PATH_MAX, "%s/f", run.base);
+
+	/* Write the file, and make sure its blocks are allocated */
+	memset(buf, 0x5a, sizeof(buf));
+	dfd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (dfd < 0) {
+		perror(path);
+		ret = -1;
+		goto out_stop;
+	}
+
+	for (i = 0; i < run.n; i++) {
+		if (write(dfd, buf, sizeof(buf)) != sizeof(buf)) {
+			perror(path);
+			ret = -1;
+			goto out_close;
+		}
+	}
+
+	if (fsync(dfd) || fstat(dfd, &st) || blocks_fiemap(dfd, run.n, sectors)) {
+		perror(path);
+		ret = -1;
+		goto out_close;
+	}
+
+	do {
+		count = DUET_MAX_BITEMS;
+		if (duet_fetch_blocks(fd, run.tid, items, blks, &count)) {
+			fprintf(stderr, "duet: failed to fetch items\n");
+			ret = -1;
+			goto out_close;
+		}
+
+		for (i = 0; i < count; i++) {
+			if (DUET_UUID_INO(items[i].uuid) != (unsigned long)st.st_ino ||
+			    items[i].idx >= (unsigned long)run.n)
+				continue;
+
+			if (!blks[i].len) {
+				unmapped++;
+			} else if (blks[i].sector != sectors[items[i].idx] ||
+				   blks[i].dev != (__u32)st.st_dev) {
+				fprintf(stdout, "Page %lu: sector %llu (dev %x), "
+					"FIEMAP says %llu (dev %x)\n",
+					items[i].idx,
+					(unsigned long long)blks[i].sector,
+					blks[i].dev,
+					(unsigned long long)sectors[items[i].idx],
+					(unsigned)st.st_dev);
+				mismatched++;
+			} else {
+				matched++;
+			}
+		}
+	} while (count);
+
+	fprintf(stdout, "%d pages written: %d matched FIEMAP, %d mismatched, "
+		"%d unmapped\n", run.n, matched, mismatched, unmapped);
+	if (matched != run.n)
+		ret = 1;
+
+out_close:
+	close(dfd);
+out_stop:
+	unlink(path);
+	debug_stop(fd, &run);
+out_free:
+	free(sectors);
+	return ret;
+}
+
+/* Reads the number of page events the filter of the task dropped so far */
+static int filter_dropped(int fd, int tid, unsigned long long *dropped)
+{
+	int i, ret = -1;
+	struct duet_ioctl_list_args *args;
+
+	args = calloc(1, sizeof(*args) + 255 * sizeof(struct duet_task_attrs));
+	if (!args) {
+		perror("duet: task list args allocation failed");
+		return -1;
+	}
+
+	args->numtasks = 255;
+	if (ioctl(fd, DUET_IOC_TLIST, args) < 0) {
+		perror("duet: task list ioctl failed");
+		goto out;
+	}
+
+	for (i = 0; i < args->numtasks && args->tasks[i].tid; i++) {
+		if (args->tasks[i].tid == tid) {
+			*dropped = args->tasks[i].pages_filtered;
+			ret = 0;
+			break;
+		}
+	}
+
+out:
+	free(args);
+	return ret;
+}
+
+static double filter_secs(struct timespec *start, struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) +
+		(end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/*
+ * Creates n files of one page under the scratch dir, then drains the task.
+ * Returns the number of items fetched, and sets the seconds spent writing
+ * (which includes the hook) and fetching (which drains the ItemTable), or
+ * returns -1.
+ */
+static int filter_run(int fd, struct debug_run *run, char tag,
+	double *write_secs, double *fetch_secs)
+{
+	int i, dfd, fetched;
+	char buf[4096], path[PATH_MAX];
+	struct timespec start, mid, end;
+
+	memset(buf, 0x5a, sizeof(buf));
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < run->n; i++) {
+		snprintf(path, PATH_MAX, "%s/%c%d", run->base, tag, i);
+		dfd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (dfd < 0 || write(dfd, buf, sizeof(buf)) != sizeof(buf)) {
+			perror(path);
+			if (dfd >= 0)
+				close(dfd);
+			return -1;
+		}
+		close(dfd);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &mid);
+	fetched = debug_drain(fd, run->tid, NULL, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	*write_secs = filter_secs(&start, &mid);
+	*fetch_secs = filter_secs(&mid, &end);
+	return fetched;
+}
+
+static int cmd_debug_filter(int fd, int argc, char **argv)
+{
+	int c, i, fetched, ret = 0;
+	char path[PATH_MAX];
+	unsigned long long before, after;
+	double write_secs, fetch_secs, usecs[2];
+	struct debug_run run = { .dir = ".", .n = 4096 };
+	struct duet_filter filter;
+
+	memset(&filter, 0, sizeof(filter));
+	filter.mask = DUET_FILTER_SIZE;
+	filter.min_size = 65536;
+	filter.max_size = (__u64)-1;
+
+	optind = 1;
+	while ((c = debug_getopt(argc, argv, "d:n:s:", &run,
+				 cmd_debug_filter_usage)) != -1) {
+		switch (c) {
+		case 's':
+			errno = 0;
+			filter.min_size = strtoull(optarg, NULL, 10);
+			if (errno || filter.min_size <= 4096) {
+				fprintf(stderr, "duet: size must exceed a page\n");
+				usage(cmd_debug_filter_usage);
+			}
+			break;
+		default:
+			fprintf(stderr, "Unknown option %c\n", (char)c);
+			usage(cmd_debug_filter_usage);
+		}
+	}
+
+	if (argc != optind)
+		usage(cmd_debug_filter_usage);
+
+	if (debug_start(fd, &run, "filter", NULL, DUET_PAGE_EXISTS))
+		return -1;
+
+	for (i = 0; i < 2; i++) {
+		if (duet_set_filter(fd, run.tid, i ? NULL : &filter)) {
+			fprintf(stderr, "duet: failed to set filter\n");
+			ret = -1;
+			goto out_stop;
+		}
+
+		if (filter_dropped(fd, run.tid, &before)) {
+			ret = -1;
+			goto out_stop;
+		}
+
+		fetched = filter_run(fd, &run, i ? 'u' : 'f', &write_secs,
+				     &fetch_secs);
+		if (fetched < 0 || filter_dropped(fd, run.tid, &after)) {
+			ret = -1;
+			goto out_stop;
+		}
+
+		usecs[i] = (write_secs + fetch_secs) * 1e6 / run.n;
+		fprintf(stdout, "%s: %d pages written in %.3f s, %llu events "
+			"dropped at the hook, %d items fetched in %.3f s "
+			"(%.2f us per page)\n",
+			i ? "Unfiltered" : "Filtered", run.n, write_secs,
+			after - before, fetched, fetch_secs, usecs[i]);
+
+		/* Filtered runs should let nothing through, the others all */
+		if (fetched != (i ? run.n : 0) ||
+		    (i ? after != before : after == before))
+			ret = 1;
+	}
+
+	fprintf(stdout, "Filter saves %.2f us per page written and fetched\n",
+		usecs[1] - usecs[0]);
+
+out_stop:
+	for (i = 0; i < run.n; i++) {
+		snprintf(path, PATH_MAX, "%s/f%d", run.base, i);
+		unlink(path);
+		snprintf(path, PATH_MAX, "%s/u%d", run.base, i);
+		unlink(path);
+	}
+	debug_stop(fd, &run);
+	return ret;
+}
+
 static int cmd_debug_printbit(int fd, int argc, char **argv)
 {
 	int c, ret=0;
@@ -173,6 +1002,10 @@ const struct cmd_group debug_cmd_group = {
 		{ "printbit", cmd_debug_printbit, cmd_debug_printbit_usage, NULL, 0 },
 		{ "printitm", cmd_debug_printitm, cmd_debug_printitm_usage, NULL, 0 },
 		{ "getpath", cmd_debug_getpath, cmd_debug_getpath_usage, NULL, 0 },
+		{ "links", cmd_debug_links, cmd_debug_links_usage, NULL, 0 },
+		{ "dio", cmd_debug_dio, cmd_debug_dio_usage, NULL, 0 },
+		{ "filter", cmd_debug_filter, cmd_debug_filter_usage, NULL, 0 },
+		{ "blocks", cmd_debug_blocks, cmd_debug_blocks_usage, NULL, 0 },
 	}
 };
 
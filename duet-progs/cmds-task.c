@@ -34,17 +34,82 @@ static const char * const cmd_task_list_usage[] = {
 	NULL
 };
 
+/* Short names of the LRU classes reported to DUET_LRU_HINTS tasks */
+static const char * const lru_names[] = { "-", "ina", "ref", "act" };
+
+static const char * const cmd_task_lease_usage[] = {
+	"duet task lease [-i taskid] [-p pages | -s bytes] [-t msecs]",
+	"Lets a task keep the pages it is told about cached until it's done.",
+	"Clean pages added to the page cache are leased to the task, up to",
+	"the given limit, until the task marks their file done, or the lease",
+	"expires. Leases are also taken back under memory pressure.",
+	"",
+	"-i     task ID used to find the task",
+	"-p     max number of pages leased at once (0 disables leases)",
+	"-s     max number of bytes leased at once",
+	"-t     lease duration in milliseconds (default: 30000, max: 600000)",
+	NULL
+};
+
+static const char * const cmd_task_scope_usage[] = {
+	"duet task scope [-i taskid] [-p path]",
+	"Extends a task to the filesystem that path is on.",
+	"Files under path become relevant to the task, in addition to those",
+	"under its registered dir. A task can have one dir per filesystem, up",
+	"to DUET_MAX_SCOPES (check duet.h). Items carry the index of their",
+	"filesystem in the UUID, and their paths are relative to its dir.",
+	"",
+	"-i     task ID used to find the task",
+	"-p     dir on the new filesystem",
+	NULL
+};
+
+static const char * const cmd_task_filter_usage[] = {
+	"duet task filter [-i taskid] [-s min[:max]] [-f flags] [-x flags]",
+	"                 [-u uid] [-g gid] [-a] [-c]",
+	"Drops the page events of files the task doesn't care for in the kernel.",
+	"Only events on files that pass all the given checks are queued. The",
+	"filter replaces any previous one, and applies to events from now on.",
+	"Flags are given as in chattr(1): a (append), A (noatime), i",
+	"(immutable), and S (sync).",
+	"",
+	"-i     task ID used to find the task",
+	"-s     file size range in bytes (default max: unlimited)",
+	"-f     inode flags the file must have",
+	"-x     inode flags the file must not have",
+	"-u     uid the file must be owned by",
+	"-g     gid the file must be owned by",
+	"-a     only files on the task's allowlist (see duet task allow)",
+	"-c     clear the filter",
+	NULL
+};
+
+static const char * const cmd_task_allow_usage[] = {
+	"duet task allow [-i taskid] [-u uuid] [-n count] [-r]",
+	"Adds files to the allowlist of a task.",
+	"Adds UUIDs [uuid, uuid + count) to the allowlist checked by task",
+	"filters set with -a.",
+	"",
+	"-i     task ID used to find the task",
+	"-u     first UUID, in hex as printed by fetch",
+	"-n     number of UUIDs (default: 1)",
+	"-r     remove the UUIDs from the allowlist instead",
+	NULL
+};
+
 static const char * const cmd_task_fetch_usage[] = {
-	"duet task fetch [-i taskid] [-n num]",
+	"duet task fetch [-i taskid] [-n num] [-b]",
 	"Fetched up to num items for task with ID taskid, and prints them.",
 	"",
 	"-i	task ID used to find the task",
 	"-n	number of events, up to MAX_ITEMS (check ioctl.h)",
+	"-b	also print the device blocks of each item (requires a task",
+	"	registered with DUET_MAP_BLOCKS, up to MAX_BITEMS events)",
 	NULL
 };
 
 static const char * const cmd_task_reg_usage[] = {
-	"duet task register [-n name] [-b bitrange] [-m nmodel] [-p path]",
+	"duet task register [-n name] [-b bitrange] [-m nmodel] [-p path] [-c class[:level]]",
 	"Registers a new task with the currently active framework. The task",
 	"will be assigned an ID, and will be registered under the provided",
 	"name. The bitmaps that keep information on what has been processed",
@@ -54,6 +119,20 @@ static const char * const cmd_task_reg_usage[] = {
 	"-b     range of items/bytes per bitmap bit",
 	"-m     event mask for task",
 	"-p     path of the root of the namespace of interest",
+	"-c     I/O scheduling class (0: none, 1: rt, 2: be, 3: idle) and level",
+	NULL
+};
+
+static const char * const cmd_task_ioprio_usage[] = {
+	"duet task ioprio [-i taskid] [-c class[:level]]",
+	"Sets the I/O priority used for the work of a task.",
+	"The priority is only recorded here. Kernel tasks (e.g. scrub, defrag,",
+	"f2fs GC) use the idle class by default, and pick up the new priority",
+	"the next time they start. User tasks pick it up the next time their",
+	"process fetches items.",
+	"",
+	"-i     task ID used to find the task",
+	"-c     I/O scheduling class (0: none, 1: rt, 2: be, 3: idle) and level",
 	NULL
 };
 
@@ -103,13 +182,39 @@ static const char * const cmd_task_check_usage[] = {
 	NULL
 };
 
+/* Parses a class[:level] I/O priority, as given to ionice(1) */
+static int parse_ioprio(const char *arg, __u16 *ioprio)
+{
+	char *end;
+	long class, level = 0;
+
+	errno = 0;
+	class = strtol(arg, &end, 10);
+	if (errno || end == arg)
+		return -1;
+
+	if (*end == ':') {
+		level = strtol(end + 1, &end, 10);
+		if (errno)
+			return -1;
+	}
+
+	if (*end || class < DUET_IOPRIO_CLASS_NONE ||
+	    class > DUET_IOPRIO_CLASS_IDLE || level < 0 || level > 7)
+		return -1;
+
+	*ioprio = DUET_IOPRIO(class, level);
+	return 0;
+}
+
 static int cmd_task_fetch(int fd, int argc, char **argv)
 {
-	int c, count = DUET_MAX_ITEMS, tid = 0, ret = 0;
+	int c, count = DUET_MAX_ITEMS, tid = 0, ret = 0, blocks = 0;
 	struct duet_item items[DUET_MAX_ITEMS];
+	struct duet_block blks[DUET_MAX_BITEMS];
 
 	optind = 1;
-	while ((c = getopt(argc, argv, "i:")) != -1) {
+	while ((c = getopt(argc, argv, "i:b")) != -1) {
 		switch (c) {
 		case 'i':
 			errno = 0;
@@ -119,6 +224,10 @@ static int cmd_task_fetch(int fd, int argc, char **argv)
 				usage(cmd_task_fetch_usage);
 			}
 			break;
+		case 'b':
+			blocks = 1;
+			count = DUET_MAX_BITEMS;
+			break;
 		default:
 			fprintf(stderr, "Unknown option %c\n", (char)c);
 			usage(cmd_task_fetch_usage);
@@ -128,7 +237,10 @@ static int cmd_task_fetch(int fd, int argc, char **argv)
 	if (!tid || argc != optind)
 		usage(cmd_task_fetch_usage);
 
-	ret = duet_fetch(fd, tid, items, &count);
+	if (blocks)
+		ret = duet_fetch_blocks(fd, tid, items, blks, &count);
+	else
+		ret = duet_fetch(fd, tid, items, &count);
 	if (ret < 0) {
 		perror("tasks list ioctl error");
 		usage(cmd_task_fetch_usage);
@@ -140,15 +252,295 @@ static int cmd_task_fetch(int fd, int argc, char **argv)
 	}
 
 	/* Print out the list we received */
-	fprintf(stdout, "UUID            \tInode number\tGeneration\tOffset      \tState   \n"
-			"----------------\t------------\t----------\t------------\t--------\n");
+	if (blocks) {
+		fprintf(stdout, "UUID            \tInode number\tOffset      \tState   \tDevice  \tSector        \tLength  \n"
+				"----------------\t------------\t------------\t--------\t--------\t--------------\t--------\n");
+		for (c=0; c<count; c++) {
+			fprintf(stdout, "%16llx\t%12lu\t%12lu\t%8x\t%8x\t%14llu\t%8u\n",
+				items[c].uuid, DUET_UUID_INO(items[c].uuid),
+				items[c].idx << 12, items[c].state,
+				blks[c].dev, (unsigned long long)blks[c].sector,
+				blks[c].len);
+		}
+		return ret;
+	}
+
+	fprintf(stdout, "UUID            \tFs\tInode number\tGeneration\tOffset      \tState   \tLRU\n"
+			"----------------\t--\t------------\t----------\t------------\t--------\t---\n");
 	for (c=0; c<count; c++) {
-		fprintf(stdout, "%16llx\t%12lu\t%10lu\t%12lu\t%8x\n",
-			items[c].uuid, DUET_UUID_INO(items[c].uuid),
+		fprintf(stdout, "%16llx\t%2u\t%12lu\t%10lu\t%12lu\t%8x\t%3s\n",
+			items[c].uuid, DUET_UUID_FS(items[c].uuid),
+			DUET_UUID_INO(items[c].uuid),
 			DUET_UUID_GEN(items[c].uuid), items[c].idx << 12,
-			items[c].state);
+			items[c].state, lru_names[items[c].lru & 3]);
+	}
+
+	return ret;
+}
+
+static int cmd_task_lease(int fd, int argc, char **argv)
+{
+	int c, tid = 0, ret = 0, have_max = 0;
+	long long max = 0;
+	__u32 pages = 0, msecs = 0;
+	long pagesize = sysconf(_SC_PAGESIZE);
+
+	optind = 1;
+	while ((c = getopt(argc, argv, "i:p:s:t:")) != -1) {
+		switch (c) {
+		case 'i':
+			errno = 0;
+			tid = (int)strtol(optarg, NULL, 10);
+			if (errno) {
+				perror("strtol: invalid ID");
+				usage(cmd_task_lease_usage);
+			}
+			break;
+		case 'p':
+		case 's':
+			errno = 0;
+			max = strtoll(optarg, NULL, 10);
+			if (errno || max < 0) {
+				perror("strtoll: invalid lease limit");
+				usage(cmd_task_lease_usage);
+			}
+			if (c == 's')
+				max = (max + pagesize - 1) / pagesize;
+			pages = (max > (__u32)-1) ? (__u32)-1 : (__u32)max;
+			have_max = 1;
+			break;
+		case 't':
+			errno = 0;
+			msecs = (__u32)strtoul(optarg, NULL, 10);
+			if (errno) {
+				perror("strtoul: invalid lease duration");
+				usage(cmd_task_lease_usage);
+			}
+			break;
+		default:
+			fprintf(stderr, "Unknown option %c\n", (char)c);
+			usage(cmd_task_lease_usage);
+		}
+	}
+
+	if (!tid || !have_max || argc != optind)
+		usage(cmd_task_lease_usage);
+
+	ret = duet_set_lease(fd, tid, pages, msecs);
+	if (ret) {
+		fprintf(stdout, "Error setting page leases (ID %d)\n", tid);
+		usage(cmd_task_lease_usage);
+	}
+
+	fprintf(stdout, "Success setting page leases (ID %d)\n", tid);
+	return ret;
+}
+
+static int cmd_task_scope(int fd, int argc, char **argv)
+{
+	int c, tid = 0, ret = 0;
+	char *path = NULL;
+
+	optind = 1;
+	while ((c = getopt(argc, argv, "i:p:")) != -1) {
+		switch (c) {
+		case 'i':
+			errno = 0;
+			tid = (int)strtol(optarg, NULL, 10);
+			if (errno) {
+				perror("strtol: invalid ID");
+				usage(cmd_task_scope_usage);
+			}
+			break;
+		case 'p':
+			path = optarg;
+			break;
+		default:
+			fprintf(stderr, "Unknown option %c\n", (char)c);
+			usage(cmd_task_scope_usage);
+		}
+	}
+
+	if (!tid || !path || argc != optind)
+		usage(cmd_task_scope_usage);
+
+	ret = duet_add_scope(fd, tid, path);
+	if (ret) {
+		fprintf(stdout, "Error adding %s to task (ID %d)\n", path, tid);
+		usage(cmd_task_scope_usage);
+	}
+
+	fprintf(stdout, "Success adding %s to task (ID %d)\n", path, tid);
+	return ret;
+}
+
+/* chattr(1) letters of the inode flags tasks can filter on */
+static const struct {
+	char	letter;
+	__u32	flag;
+} filter_flags[] = {
+	{ 'a', 0x00000020 },	/* FS_APPEND_FL */
+	{ 'A', 0x00000080 },	/* FS_NOATIME_FL */
+	{ 'i', 0x00000010 },	/* FS_IMMUTABLE_FL */
+	{ 'S', 0x00000008 },	/* FS_SYNC_FL */
+};
+
+static int parse_filter_flags(const char *arg, __u32 *flags)
+{
+	unsigned int i;
+
+	for (*flags = 0; *arg; arg++) {
+		for (i = 0; i < sizeof(filter_flags) / sizeof(filter_flags[0]); i++)
+			if (filter_flags[i].letter == *arg)
+				break;
+
+		if (i == sizeof(filter_flags) / sizeof(filter_flags[0])) {
+			fprintf(stderr, "Unknown inode flag %c\n", *arg);
+			return -1;
+		}
+
+		*flags |= filter_flags[i].flag;
 	}
 
+	return 0;
+}
+
+static int cmd_task_filter(int fd, int argc, char **argv)
+{
+	int c, tid = 0, ret = 0, clear = 0;
+	char *end;
+	struct duet_filter filter;
+
+	memset(&filter, 0, sizeof(filter));
+	optind = 1;
+	while ((c = getopt(argc, argv, "i:s:f:x:u:g:ac")) != -1) {
+		switch (c) {
+		case 'i':
+			errno = 0;
+			tid = (int)strtol(optarg, NULL, 10);
+			if (errno) {
+				perror("strtol: invalid ID");
+				usage(cmd_task_filter_usage);
+			}
+			break;
+		case 's':
+			errno = 0;
+			filter.min_size = strtoull(optarg, &end, 10);
+			filter.max_size = (__u64)-1;
+			if (!errno && *end == ':')
+				filter.max_size = strtoull(end + 1, &end, 10);
+			if (errno || *end) {
+				perror("strtoull: invalid size range");
+				usage(cmd_task_filter_usage);
+			}
+			filter.mask |= DUET_FILTER_SIZE;
+			break;
+		case 'f':
+		case 'x':
+			if (parse_filter_flags(optarg, (c == 'f') ?
+					&filter.set_flags : &filter.clear_flags))
+				usage(cmd_task_filter_usage);
+			filter.mask |= DUET_FILTER_FLAGS;
+			break;
+		case 'u':
+		case 'g':
+			errno = 0;
+			if (c == 'u')
+				filter.uid = (__u32)strtoul(optarg, NULL, 10);
+			else
+				filter.gid = (__u32)strtoul(optarg, NULL, 10);
+			if (errno) {
+				perror("strtoul: invalid owner");
+				usage(cmd_task_filter_usage);
+			}
+			filter.mask |= (c == 'u') ? DUET_FILTER_UID : DUET_FILTER_GID;
+			break;
+		case 'a':
+			filter.mask |= DUET_FILTER_ALLOW;
+			break;
+		case 'c':
+			clear = 1;
+			break;
+		default:
+			fprintf(stderr, "Unknown option %c\n", (char)c);
+			usage(cmd_task_filter_usage);
+		}
+	}
+
+	if (!tid || (clear == !!filter.mask) || argc != optind)
+		usage(cmd_task_filter_usage);
+
+	ret = duet_set_filter(fd, tid, clear ? NULL : &filter);
+	if (ret) {
+		fprintf(stdout, "Error setting filter (ID %d)\n", tid);
+		usage(cmd_task_filter_usage);
+	}
+
+	fprintf(stdout, "Success %s filter (ID %d)\n",
+		clear ? "clearing" : "setting", tid);
+	return ret;
+}
+
+static int cmd_task_allow(int fd, int argc, char **argv)
+{
+	int c, tid = 0, ret = 0, remove = 0, have_uuid = 0;
+	unsigned long long uuid = 0;
+	__u32 count = 1;
+	char *end;
+
+	optind = 1;
+	while ((c = getopt(argc, argv, "i:u:n:r")) != -1) {
+		switch (c) {
+		case 'i':
+			errno = 0;
+			tid = (int)strtol(optarg, NULL, 10);
+			if (errno) {
+				perror("strtol: invalid ID");
+				usage(cmd_task_allow_usage);
+			}
+			break;
+		case 'u':
+			/* In hex, as printed by fetch */
+			errno = 0;
+			uuid = strtoull(optarg, &end, 16);
+			if (errno || end == optarg || *end) {
+				fprintf(stderr, "Invalid UUID %s\n", optarg);
+				usage(cmd_task_allow_usage);
+			}
+			have_uuid = 1;
+			break;
+		case 'n':
+			errno = 0;
+			count = (__u32)strtoul(optarg, NULL, 10);
+			if (errno || !count) {
+				perror("strtoul: invalid count");
+				usage(cmd_task_allow_usage);
+			}
+			break;
+		case 'r':
+			remove = 1;
+			break;
+		default:
+			fprintf(stderr, "Unknown option %c\n", (char)c);
+			usage(cmd_task_allow_usage);
+		}
+	}
+
+	if (!tid || !have_uuid || argc != optind)
+		usage(cmd_task_allow_usage);
+
+	if (remove)
+		ret = duet_filter_disallow(fd, tid, uuid, count);
+	else
+		ret = duet_filter_allow(fd, tid, uuid, count);
+	if (ret) {
+		fprintf(stdout, "Error updating allowlist (ID %d)\n", tid);
+		usage(cmd_task_allow_usage);
+	}
+
+	fprintf(stdout, "Success %s UUIDs [%llx, %llx) %s allowlist (ID %d)\n",
+		remove ? "removing" : "adding", uuid, uuid + count,
+		remove ? "from" : "to", tid);
 	return ret;
 }
 
@@ -191,11 +583,12 @@ static int cmd_task_reg(int fd, int argc, char **argv)
 	char path[DUET_MAX_PATH], name[DUET_MAX_NAME];
 	__u32 regmask = 0;
 	__u32 bitrange = 0;
+	__u16 ioprio = 0;
 
 	path[0] = name[0] = 0;
 
 	optind = 1;
-	while ((c = getopt(argc, argv, "n:b:m:p:")) != -1) {
+	while ((c = getopt(argc, argv, "n:b:m:p:c:")) != -1) {
 		switch (c) {
 		case 'n':
 			len = strnlen(optarg, DUET_MAX_NAME);
@@ -228,6 +621,12 @@ static int cmd_task_reg(int fd, int argc, char **argv)
 			if (errno)
 				perror("memcpy: invalid path");
 			break;
+		case 'c':
+			if (parse_ioprio(optarg, &ioprio)) {
+				fprintf(stderr, "Invalid I/O priority\n");
+				usage(cmd_task_reg_usage);
+			}
+			break;
 		default:
 			fprintf(stderr, "Unknown option %c\n", (char)c);
 			usage(cmd_task_reg_usage);
@@ -243,10 +642,59 @@ static int cmd_task_reg(int fd, int argc, char **argv)
 		usage(cmd_task_reg_usage);
 	}
 
+	if (ioprio) {
+		ret = duet_set_ioprio(fd, tid, ioprio);
+		if (ret)
+			fprintf(stdout, "Error setting I/O priority of task "
+				"'%s'\n", name);
+	}
+
 	fprintf(stdout, "Success registering task '%s' (ID %d)\n", name, tid);
 	return ret;
 }
 
+static int cmd_task_ioprio(int fd, int argc, char **argv)
+{
+	int c, tid = 0, ret = 0, have_prio = 0;
+	__u16 ioprio = 0;
+
+	optind = 1;
+	while ((c = getopt(argc, argv, "i:c:")) != -1) {
+		switch (c) {
+		case 'i':
+			errno = 0;
+			tid = (int)strtol(optarg, NULL, 10);
+			if (errno) {
+				perror("strtol: invalid ID");
+				usage(cmd_task_ioprio_usage);
+			}
+			break;
+		case 'c':
+			if (parse_ioprio(optarg, &ioprio)) {
+				fprintf(stderr, "Invalid I/O priority\n");
+				usage(cmd_task_ioprio_usage);
+			}
+			have_prio = 1;
+			break;
+		default:
+			fprintf(stderr, "Unknown option %c\n", (char)c);
+			usage(cmd_task_ioprio_usage);
+		}
+	}
+
+	if (!tid || !have_prio || argc != optind)
+		usage(cmd_task_ioprio_usage);
+
+	ret = duet_set_ioprio(fd, tid, ioprio);
+	if (ret) {
+		fprintf(stdout, "Error setting I/O priority (ID %d)\n", tid);
+		usage(cmd_task_ioprio_usage);
+	}
+
+	fprintf(stdout, "Success setting I/O priority (ID %d)\n", tid);
+	return ret;
+}
+
 static int cmd_task_dereg(int fd, int argc, char **argv)
 {
 	int c, tid = 0, ret = 0;
@@ -445,6 +893,11 @@ const struct cmd_group task_cmd_group = {
 		{ "list", cmd_task_list, cmd_task_list_usage, NULL, 0 },
 		{ "register", cmd_task_reg, cmd_task_reg_usage, NULL, 0 },
 		{ "deregister", cmd_task_dereg, cmd_task_dereg_usage, NULL, 0 },
+		{ "ioprio", cmd_task_ioprio, cmd_task_ioprio_usage, NULL, 0 },
+		{ "lease", cmd_task_lease, cmd_task_lease_usage, NULL, 0 },
+		{ "scope", cmd_task_scope, cmd_task_scope_usage, NULL, 0 },
+		{ "filter", cmd_task_filter, cmd_task_filter_usage, NULL, 0 },
+		{ "allow", cmd_task_allow, cmd_task_allow_usage, NULL, 0 },
 		{ "mark", cmd_task_mark, cmd_task_mark_usage, NULL, 0 },
 		{ "unmark", cmd_task_unmark, cmd_task_unmark_usage, NULL, 0 },
 		{ "check", cmd_task_check, cmd_task_check_usage, NULL, 0 },
@@ -0,0 +1,613 @@
+/*
+ * Copyright (C) 2014-2015 George Amvrosiadis.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 021110-1307, USA.
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+#include "commands.h"
+
+/*
+ * Cache warm-up. A snapshot records the inodes under a path that have the
+ * most pages in the page cache, along with the page ranges that are cached.
+ * Replaying a snapshot (e.g. right after mounting the filesystem) issues
+ * idle-priority readahead for those ranges, ordered by their location on
+ * disk, so that the working set comes back with mostly sequential I/O. Large
+ * snapshots are read back a batch of files at a time, so we don't run out of
+ * file descriptors.
+ *
+ * Snapshots are text files. After a header line, every inode takes one line
+ * with its UUID, number of cached pages, number of ranges and path (relative
+ * to the snapshot root), followed by one "<first page> <pages>" line per range.
+ */
+
+#define WARMUP_HEADER		"# duet warmup v1"
+#define WARMUP_DEF_INODES	256
+#define WARMUP_FIEMAP_EXTENTS	32
+#define WARMUP_MAX_FILES	512	/* files kept open at once on replay */
+
+static const char * const warmup_cmd_group_usage[] = {
+	"duet warmup <command> [options]",
+	NULL
+};
+
+static const char * const cmd_warmup_save_usage[] = {
+	"duet warmup save [-n num] [-t secs] -p path -o file",
+	"Saves the inodes under path that have the most pages in memory.",
+	"Registers a temporary task to find the pages of each inode that are",
+	"currently in the page cache, and writes the page ranges of the top",
+	"inodes to the given file.",
+	"",
+	"-n     number of inodes to save (default: 256)",
+	"-t     keep running, and save a new snapshot every secs seconds",
+	"-p     path of the root of the namespace of interest",
+	"-o     file to save the snapshot to",
+	NULL
+};
+
+static const char * const cmd_warmup_replay_usage[] = {
+	"duet warmup replay [-n num] -p path file",
+	"Reads a saved snapshot back into the page cache.",
+	"Issues readahead for the page ranges in the snapshot, in the order",
+	"they are stored on disk, using the idle I/O scheduling class. Meant",
+	"to be run right after the filesystem is mounted. Files that have",
+	"been replaced since the snapshot was saved are skipped.",
+	"",
+	"-n     number of inodes to read back (default: all)",
+	"-p     path the snapshot was saved for",
+	NULL
+};
+
+struct warmup_page {
+	unsigned long long	uuid;
+	unsigned long		idx;
+};
+
+struct warmup_inode {
+	unsigned long long	uuid;
+	struct warmup_page	*pages;		/* sorted by page index */
+	unsigned long		npages;
+};
+
+struct warmup_chunk {
+	__u64			physical;
+	int			fd;
+	off_t			offset;
+	size_t			len;
+};
+
+static int page_cmp(const void *a, const void *b)
+{
+	const struct warmup_page *pa = a, *pb = b;
+
+	if (pa->uuid != pb->uuid)
+		return (pa->uuid < pb->uuid) ? -1 : 1;
+	if (pa->idx != pb->idx)
+		return (pa->idx < pb->idx) ? -1 : 1;
+	return 0;
+}
+
+/* Most cached pages first */
+static int inode_cmp(const void *a, const void *b)
+{
+	const struct warmup_inode *ia = a, *ib = b;
+
+	if (ia->npages != ib->npages)
+		return (ia->npages > ib->npages) ? -1 : 1;
+	return (ia->uuid < ib->uuid) ? -1 : (ia->uuid > ib->uuid);
+}
+
+static int chunk_cmp(const void *a, const void *b)
+{
+	const struct warmup_chunk *ca = a, *cb = b;
+
+	if (ca->physical != cb->physical)
+		return (ca->physical < cb->physical) ? -1 : 1;
+	if (ca->fd != cb->fd)
+		return (ca->fd < cb->fd) ? -1 : 1;
+	return (ca->offset < cb->offset) ? -1 : (ca->offset > cb->offset);
+}
+
+/*
+ * Registers a temporary file task on path, which makes Duet report every
+ * cached page of the files under it, and collects them. Returns the number
+ * of pages, or -1.
+ */
+static long warmup_collect(int fd, const char *path, int *tid,
+	struct warmup_page **pages)
+{
+	int i, count;
+	long npages = 0, size = DUET_MAX_ITEMS;
+	struct duet_item items[DUET_MAX_ITEMS];
+	struct warmup_page *tmp;
+
+	*pages = malloc(size * sizeof(**pages));
+	if (!*pages) {
+		perror("warmup: page array allocation failed");
+		return -1;
+	}
+
+	if (duet_register(fd, path, DUET_FILE_TASK | DUET_PAGE_EXISTS, 1,
+			  "warmup", tid)) {
+		fprintf(stderr, "warmup: failed to register with duet\n");
+		goto err;
+	}
+
+	do {
+		count = DUET_MAX_ITEMS;
+		if (duet_fetch(fd, *tid, items, &count)) {
+			fprintf(stderr, "warmup: duet_fetch failed\n");
+			goto err_dereg;
+		}
+
+		if (npages + count > size) {
+			size *= 2;
+			tmp = realloc(*pages, size * sizeof(**pages));
+			if (!tmp) {
+				perror("warmup: page array allocation failed");
+				goto err_dereg;
+			}
+			*pages = tmp;
+		}
+
+		for (i = 0; i < count; i++) {
+			if (!(items[i].state & DUET_PAGE_ADDED))
+				continue;
+			(*pages)[npages].uuid = items[i].uuid;
+			(*pages)[npages].idx = items[i].idx;
+			npages++;
+		}
+	} while (count == DUET_MAX_ITEMS);
+
+	return npages;
+
+err_dereg:
+	duet_deregister(fd, *tid);
+err:
+	free(*pages);
+	*pages = NULL;
+	return -1;
+}
+
+/* Groups sorted pages by inode, and drops duplicate pages. */
+static long warmup_group(struct warmup_page *pages, long npages,
+	struct warmup_inode **inodes)
+{
+	long i, j, ninodes = 0;
+
+	*inodes = malloc((npages ? npages : 1) * sizeof(**inodes));
+	if (!*inodes) {
+		perror("warmup: inode array allocation failed");
+		return -1;
+	}
+
+	for (i = 0, j = 0; i < npages; i++) {
+		if (i && !page_cmp(&pages[i], &pages[j - 1]))
+			continue;
+		pages[j++] = pages[i];
+
+		if (!ninodes || (*inodes)[ninodes - 1].uuid != pages[j - 1].uuid) {
+			(*inodes)[ninodes].uuid = pages[j - 1].uuid;
+			(*inodes)[ninodes].npages = 0;
+			ninodes++;
+		}
+		(*inodes)[ninodes - 1].npages++;
+	}
+
+	/* Pages have moved around while deduplicating; point into them now */
+	for (i = 0, j = 0; i < ninodes; i++) {
+		(*inodes)[i].pages = &pages[j];
+		j += (*inodes)[i].npages;
+	}
+
+	return ninodes;
+}
+
+static void warmup_write_inode(FILE *out, struct warmup_inode *inode,
+	const char *path)
+{
+	unsigned long i, start, nranges = 0;
+
+	for (i = 0; i < inode->npages; i++)
+		if (!i || inode->pages[i].idx != inode->pages[i - 1].idx + 1)
+			nranges++;
+
+	fprintf(out, "%llx %lu %lu %s\n", inode->uuid, inode->npages, nranges,
+		path);
+
+	for (i = 0, start = 0; i < inode->npages; i++) {
+		if (i + 1 < inode->npages &&
+		    inode->pages[i + 1].idx == inode->pages[i].idx + 1)
+			continue;
+		fprintf(out, "%lu %lu\n", inode->pages[start].idx, i - start + 1);
+		start = i + 1;
+	}
+}
+
+static int warmup_save_one(int fd, const char *path, const char *file,
+	int ninodes)
+{
+	int tid, ret = 0, saved = 0;
+	long i, npages, nitems;
+	char tmpfile[PATH_MAX], ipath[DUET_MAX_PATH];
+	struct warmup_page *pages;
+	struct warmup_inode *inodes = NULL;
+	FILE *out;
+
+	npages = warmup_collect(fd, path, &tid, &pages);
+	if (npages < 0)
+		return 1;
+
+	qsort(pages, npages, sizeof(*pages), page_cmp);
+	nitems = warmup_group(pages, npages, &inodes);
+	if (nitems < 0) {
+		ret = 1;
+		goto out;
+	}
+	qsort(inodes, nitems, sizeof(*inodes), inode_cmp);
+
+	/* Write to a temporary file first, so a crash never leaves us empty */
+	snprintf(tmpfile, PATH_MAX, "%s.tmp", file);
+	out = fopen(tmpfile, "w");
+	if (!out) {
+		perror("warmup: failed to open snapshot file");
+		ret = 1;
+		goto out;
+	}
+
+	fprintf(out, "%s\n", WARMUP_HEADER);
+	for (i = 0; i < nitems && saved < ninodes; i++) {
+		if (duet_get_path(fd, tid, inodes[i].uuid, ipath) ||
+		    ipath[0] == '\0' || strchr(ipath, '\n'))
+			continue;
+
+		warmup_write_inode(out, &inodes[i], ipath);
+		saved++;
+	}
+
+	if (fclose(out) || rename(tmpfile, file)) {
+		perror("warmup: failed to write snapshot file");
+		unlink(tmpfile);
+		ret = 1;
+		goto out;
+	}
+
+	fprintf(stdout, "Saved %d inodes (%ld cached pages under %s)\n",
+		saved, npages, path);
+out:
+	duet_deregister(fd, tid);
+	free(inodes);
+	free(pages);
+	return ret;
+}
+
+static int cmd_warmup_save(int fd, int argc, char **argv)
+{
+	int c, ret, ninodes = WARMUP_DEF_INODES, interval = 0;
+	char path[DUET_MAX_PATH], file[PATH_MAX];
+
+	path[0] = file[0] = 0;
+
+	optind = 1;
+	while ((c = getopt(argc, argv, "n:t:p:o:")) != -1) {
+		switch (c) {
+		case 'n':
+			errno = 0;
+			ninodes = (int)strtol(optarg, NULL, 10);
+			if (errno || ninodes <= 0) {
+				perror("strtol: invalid number of inodes");
+				usage(cmd_warmup_save_usage);
+			}
+			break;
+		case 't':
+			errno = 0;
+			interval = (int)strtol(optarg, NULL, 10);
+			if (errno || interval < 0) {
+				perror("strtol: invalid interval");
+				usage(cmd_warmup_save_usage);
+			}
+			break;
+		case 'p':
+			strncpy(path, optarg, DUET_MAX_PATH - 1);
+			path[DUET_MAX_PATH - 1] = 0;
+			break;
+		case 'o':
+			strncpy(file, optarg, PATH_MAX - 1);
+			file[PATH_MAX - 1] = 0;
+			break;
+		default:
+			fprintf(stderr, "Unknown option %c\n", (char)c);
+			usage(cmd_warmup_save_usage);
+		}
+	}
+
+	if (!path[0] || !file[0] || argc != optind)
+		usage(cmd_warmup_save_usage);
+
+	do {
+		ret = warmup_save_one(fd, path, file, ninodes);
+		if (interval)
+			sleep(interval);
+	} while (interval);
+
+	return ret;
+}
+
+/*
+ * Splits the byte range [offset, offset + len) of the file into chunks that
+ * are contiguous on disk, and appends them to the chunk array. Ranges we
+ * can't map are still read, at the front of the queue.
+ */
+static int warmup_map_range(int fd, off_t offset, size_t len,
+	struct warmup_chunk **chunks, long *nchunks, long *size)
+{
+	unsigned int i;
+	__u64 start = offset, end = offset + len, cstart, cend;
+	struct fiemap *fm;
+	struct fiemap_extent *fe;
+	struct warmup_chunk *tmp;
+	int last = 0, mapped = 0;
+
+	fm = calloc(1, sizeof(*fm) +
+		WARMUP_FIEMAP_EXTENTS * sizeof(struct fiemap_extent));
+	if (!fm)
+		return 1;
+
+	while (!last && start < end) {
+		fm->fm_start = start;
+		fm->fm_length = end - start;
+		fm->fm_flags = 0;
+		fm->fm_extent_count = WARMUP_FIEMAP_EXTENTS;
+		if (ioctl(fd, FS_IOC_FIEMAP, fm) < 0 || !fm->fm_mapped_extents)
+			break;
+
+		for (i = 0; i < fm->fm_mapped_extents; i++) {
+			fe = &fm->fm_extents[i];
+			if (fe->fe_flags & FIEMAP_EXTENT_LAST)
+				last = 1;
+
+			cstart = (fe->fe_logical > start) ? fe->fe_logical : start;
+			cend = fe->fe_logical + fe->fe_length;
+			if (cend > end)
+				cend = end;
+			if (cend <= cstart)
+				continue;
+
+			if (*nchunks == *size) {
+				*size *= 2;
+				tmp = realloc(*chunks, *size * sizeof(**chunks));
+				if (!tmp) {
+					free(fm);
+					return 1;
+				}
+				*chunks = tmp;
+			}
+
+			tmp = &(*chunks)[(*nchunks)++];
+			tmp->fd = fd;
+			tmp->offset = cstart;
+			tmp->len = cend - cstart;
+			if (fe->fe_flags & (FIEMAP_EXTENT_UNKNOWN |
+			    FIEMAP_EXTENT_DATA_INLINE | FIEMAP_EXTENT_DELALLOC))
+				tmp->physical = 0;
+			else
+				tmp->physical = fe->fe_physical +
+						(cstart - fe->fe_logical);
+			mapped = 1;
+		}
+
+		fe = &fm->fm_extents[fm->fm_mapped_extents - 1];
+		start = fe->fe_logical + fe->fe_length;
+	}
+
+	free(fm);
+
+	/* No FIEMAP support, or a hole; readahead will sort it out */
+	if (!mapped) {
+		if (*nchunks == *size) {
+			*size *= 2;
+			tmp = realloc(*chunks, *size * sizeof(**chunks));
+			if (!tmp)
+				return 1;
+			*chunks = tmp;
+		}
+
+		tmp = &(*chunks)[(*nchunks)++];
+		tmp->fd = fd;
+		tmp->offset = offset;
+		tmp->len = len;
+		tmp->physical = 0;
+	}
+
+	return 0;
+}
+
+/*
+ * Reads back the chunks of a batch of files in disk order, and closes the
+ * files. Returns the number of bytes we issued readahead for.
+ */
+static unsigned long long warmup_read_batch(struct warmup_chunk *chunks,
+	long nchunks, int *fds, int nfds)
+{
+	long i;
+	unsigned long long bytes = 0;
+
+	qsort(chunks, nchunks, sizeof(*chunks), chunk_cmp);
+	for (i = 0; i < nchunks; i++) {
+		if (readahead(chunks[i].fd, chunks[i].offset, chunks[i].len))
+			continue;
+		bytes += chunks[i].len;
+	}
+
+	for (i = 0; i < nfds; i++)
+		close(fds[i]);
+
+	return bytes;
+}
+
+static int cmd_warmup_replay(int fd, int argc, char **argv)
+{
+	int c, ffd, ret = 0, ninodes = INT_MAX, nfiles = 0, nfds = 0;
+	int fds[WARMUP_MAX_FILES];
+	long pgsize, nchunks = 0, ntotal = 0, size = 1024;
+	unsigned long npages, nranges, r, first, count;
+	unsigned long long uuid, bytes = 0;
+	char root[DUET_MAX_PATH], line[DUET_MAX_PATH + 128];
+	char ipath[DUET_MAX_PATH], fpath[2 * DUET_MAX_PATH + 1];
+	struct warmup_chunk *chunks;
+	struct stat st;
+	FILE *in;
+
+	root[0] = 0;
+	(void)fd;
+
+	optind = 1;
+	while ((c = getopt(argc, argv, "n:p:")) != -1) {
+		switch (c) {
+		case 'n':
+			errno = 0;
+			ninodes = (int)strtol(optarg, NULL, 10);
+			if (errno || ninodes <= 0) {
+				perror("strtol: invalid number of inodes");
+				usage(cmd_warmup_replay_usage);
+			}
+			break;
+		case 'p':
+			strncpy(root, optarg, DUET_MAX_PATH - 1);
+			root[DUET_MAX_PATH - 1] = 0;
+			break;
+		default:
+			fprintf(stderr, "Unknown option %c\n", (char)c);
+			usage(cmd_warmup_replay_usage);
+		}
+	}
+
+	if (!root[0] || argc != optind + 1)
+		usage(cmd_warmup_replay_usage);
+
+	in = fopen(argv[optind], "r");
+	if (!in) {
+		perror("warmup: failed to open snapshot file");
+		return 1;
+	}
+
+	if (!fgets(line, sizeof(line), in) ||
+	    strncmp(line, WARMUP_HEADER, strlen(WARMUP_HEADER))) {
+		fprintf(stderr, "warmup: %s is not a snapshot file\n",
+			argv[optind]);
+		fclose(in);
+		return 1;
+	}
+
+	chunks = malloc(size * sizeof(*chunks));
+	if (!chunks) {
+		perror("warmup: chunk array allocation failed");
+		fclose(in);
+		return 1;
+	}
+
+	/* Warming up the cache should not get in the way of anyone else */
+	if (syscall(SYS_ioprio_set, 1 /* IOPRIO_WHO_PROCESS */, 0,
+		    DUET_IOPRIO(DUET_IOPRIO_CLASS_IDLE, 0)))
+		perror("warmup: failed to set I/O priority");
+
+	pgsize = sysconf(_SC_PAGESIZE);
+	while (nfiles < ninodes && fgets(line, sizeof(line), in)) {
+		if (sscanf(line, "%llx %lu %lu %1023[^\n]", &uuid, &npages,
+			   &nranges, ipath) != 4) {
+			fprintf(stderr, "warmup: malformed snapshot entry\n");
+			ret = 1;
+			break;
+		}
+
+		snprintf(fpath, sizeof(fpath), "%s/%s", root, ipath);
+		ffd = open(fpath, O_RDONLY | O_NOATIME);
+		if (ffd < 0)
+			ffd = open(fpath, O_RDONLY);
+		if (ffd < 0 && errno != ENOENT)
+			fprintf(stderr, "warmup: failed to open %s: %s\n", fpath,
+				strerror(errno));
+
+		/* Skip files that are gone or have been replaced */
+		if (ffd >= 0 && (fstat(ffd, &st) || !S_ISREG(st.st_mode) ||
+		    (unsigned long)st.st_ino != DUET_UUID_INO(uuid))) {
+			close(ffd);
+			ffd = -1;
+		}
+		if (ffd >= 0)
+			fds[nfds++] = ffd;
+
+		for (r = 0; r < nranges; r++) {
+			if (!fgets(line, sizeof(line), in) ||
+			    sscanf(line, "%lu %lu", &first, &count) != 2) {
+				fprintf(stderr, "warmup: malformed snapshot range\n");
+				ret = 1;
+				goto done;
+			}
+
+			if (ffd < 0)
+				continue;
+
+			if (warmup_map_range(ffd, (off_t)first * pgsize,
+					     count * pgsize, &chunks, &nchunks,
+					     &size)) {
+				perror("warmup: chunk array allocation failed");
+				ret = 1;
+				goto done;
+			}
+		}
+
+		if (ffd >= 0)
+			nfiles++;
+
+		/* Don't run out of file descriptors on large snapshots */
+		if (nfds == WARMUP_MAX_FILES) {
+			bytes += warmup_read_batch(chunks, nchunks, fds, nfds);
+			ntotal += nchunks;
+			nchunks = nfds = 0;
+		}
+	}
+
+done:
+	fclose(in);
+
+	/* Now read everything back, in disk order */
+	bytes += warmup_read_batch(chunks, nchunks, fds, nfds);
+	ntotal += nchunks;
+
+	fprintf(stdout, "Read back %llu bytes in %ld chunks from %d files\n",
+		bytes, ntotal, nfiles);
+	free(chunks);
+	return ret;
+}
+
+const struct cmd_group warmup_cmd_group = {
+	warmup_cmd_group_usage, NULL, {
+		{ "save", cmd_warmup_save, cmd_warmup_save_usage, NULL, 0 },
+		{ "replay", cmd_warmup_replay, cmd_warmup_replay_usage, NULL, 0 },
+	}
+};
+
+int cmd_warmup(int fd, int argc, char **argv)
+{
+	return handle_command_group(&warmup_cmd_group, fd, argc, argv);
+}
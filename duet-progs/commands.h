@@ -86,13 +86,16 @@ void help_command_group(const struct cmd_group *grp, int fd, int argc, char **ar
 extern const struct cmd_group status_cmd_group;
 extern const struct cmd_group task_cmd_group;
 extern const struct cmd_group debug_cmd_group;
+extern const struct cmd_group warmup_cmd_group;
 
 /* Command usage strings */
 extern const char * const cmd_status_usage[];
 extern const char * const cmd_task_usage[];
 extern const char * const cmd_debug_usage[];
+extern const char * const cmd_warmup_usage[];
 
 /* Command handlers */
 int cmd_status(int fd, int argc, char **argv);
 int cmd_task(int fd, int argc, char **argv);
 int cmd_debug(int fd, int argc, char **argv);
+int cmd_warmup(int fd, int argc, char **argv);
@@ -95,6 +95,34 @@ int duet_register(int duet_fd, const char *path, __u32 regmask, __u32 bitrange,
 	return (ret < 0) ? ret : args.ret;
 }
 
+/* Extends a task to the filesystem of path, with path as its dir there */
+int duet_add_scope(int duet_fd, int tid, const char *path)
+{
+	int ret = 0;
+	struct duet_ioctl_cmd_args args;
+
+	if (duet_fd == -1) {
+		fprintf(stderr, "duet: failed to open duet device\n");
+		return -1;
+	}
+
+	memset(&args, 0, sizeof(args));
+	args.cmd_flags = DUET_ADD_SCOPE;
+	args.tid = tid;
+	strncpy(args.path, path, DUET_MAX_PATH - 1);
+
+	ret = ioctl(duet_fd, DUET_IOC_CMD, &args);
+	if (ret < 0)
+		perror("duet: add scope ioctl error");
+
+	if (args.ret)
+		duet_dbg(stdout, "Error adding scope (ID %d).\n", tid);
+	else
+		duet_dbg(stdout, "Successfully added scope (ID %d).\n", tid);
+
+	return (ret < 0) ? ret : args.ret;
+}
+
 int duet_deregister(int duet_fd, int tid)
 {
 	int ret = 0;
@@ -121,6 +149,151 @@ int duet_deregister(int duet_fd, int tid)
 	return (ret < 0) ? ret : args.ret;
 }
 
+int duet_set_ioprio(int duet_fd, int tid, __u16 ioprio)
+{
+	int ret = 0;
+	struct duet_ioctl_cmd_args args;
+
+	if (duet_fd == -1) {
+		fprintf(stderr, "duet: failed to open duet device\n");
+		return -1;
+	}
+
+	memset(&args, 0, sizeof(args));
+	args.cmd_flags = DUET_SET_IOPRIO;
+	args.tid = tid;
+	args.ioprio = ioprio;
+
+	ret = ioctl(duet_fd, DUET_IOC_CMD, &args);
+	if (ret < 0)
+		perror("duet: set ioprio ioctl error");
+
+	if (args.ret)
+		duet_dbg(stdout, "Error setting I/O priority (ID %d).\n", tid);
+	else
+		duet_dbg(stdout, "Successfully set I/O priority (ID %d).\n", tid);
+
+	return (ret < 0) ? ret : args.ret;
+}
+
+int duet_set_lease(int duet_fd, int tid, __u32 pages, __u32 msecs)
+{
+	int ret = 0;
+	struct duet_ioctl_cmd_args args;
+
+	if (duet_fd == -1) {
+		fprintf(stderr, "duet: failed to open duet device\n");
+		return -1;
+	}
+
+	memset(&args, 0, sizeof(args));
+	args.cmd_flags = DUET_SET_LEASE;
+	args.tid = tid;
+	args.lease_pages = pages;
+	args.lease_msecs = msecs;
+
+	ret = ioctl(duet_fd, DUET_IOC_CMD, &args);
+	if (ret < 0)
+		perror("duet: set lease ioctl error");
+
+	if (args.ret)
+		duet_dbg(stdout, "Error setting page leases (ID %d).\n", tid);
+	else
+		duet_dbg(stdout, "Successfully set page leases (ID %d).\n", tid);
+
+	return (ret < 0) ? ret : args.ret;
+}
+
+int duet_release_lease(int duet_fd, int tid, unsigned long long uuid,
+	__u64 idx, __u32 count)
+{
+	int ret = 0;
+	struct duet_ioctl_cmd_args args;
+
+	if (duet_fd == -1) {
+		fprintf(stderr, "duet: failed to open duet device\n");
+		return -1;
+	}
+
+	memset(&args, 0, sizeof(args));
+	args.cmd_flags = DUET_RELEASE_LEASE;
+	args.tid = tid;
+	args.l_uuid = uuid;
+	args.l_idx = idx;
+	args.l_count = count;
+
+	ret = ioctl(duet_fd, DUET_IOC_CMD, &args);
+	if (ret < 0)
+		perror("duet: release lease ioctl error");
+
+	return (ret < 0) ? ret : args.ret;
+}
+
+int duet_set_filter(int duet_fd, int tid, struct duet_filter *filter)
+{
+	int ret = 0;
+	struct duet_ioctl_cmd_args args;
+
+	if (duet_fd == -1) {
+		fprintf(stderr, "duet: failed to open duet device\n");
+		return -1;
+	}
+
+	memset(&args, 0, sizeof(args));
+	args.cmd_flags = DUET_SET_FILTER;
+	args.tid = tid;
+	if (filter)
+		args.filter = *filter;
+
+	ret = ioctl(duet_fd, DUET_IOC_CMD, &args);
+	if (ret < 0)
+		perror("duet: set filter ioctl error");
+
+	if (args.ret)
+		duet_dbg(stdout, "Error setting filter (ID %d).\n", tid);
+	else
+		duet_dbg(stdout, "Successfully set filter (ID %d).\n", tid);
+
+	return (ret < 0) ? ret : args.ret;
+}
+
+static int filter_update_allow(int duet_fd, int tid, unsigned long long uuid,
+	__u32 count, __u8 cmd)
+{
+	int ret = 0;
+	struct duet_ioctl_cmd_args args;
+
+	if (duet_fd == -1) {
+		fprintf(stderr, "duet: failed to open duet device\n");
+		return -1;
+	}
+
+	memset(&args, 0, sizeof(args));
+	args.cmd_flags = cmd;
+	args.tid = tid;
+	args.itmidx = uuid;
+	args.itmnum = count;
+
+	ret = ioctl(duet_fd, DUET_IOC_CMD, &args);
+	if (ret < 0)
+		perror("duet: allowlist ioctl error");
+
+	return (ret < 0) ? ret : args.ret;
+}
+
+int duet_filter_allow(int duet_fd, int tid, unsigned long long uuid,
+	__u32 count)
+{
+	return filter_update_allow(duet_fd, tid, uuid, count, DUET_SET_ALLOWED);
+}
+
+int duet_filter_disallow(int duet_fd, int tid, unsigned long long uuid,
+	__u32 count)
+{
+	return filter_update_allow(duet_fd, tid, uuid, count,
+				   DUET_UNSET_ALLOWED);
+}
+
 int duet_fetch(int duet_fd, int tid, struct duet_item *items, int *count)
 {
 	int ret = 0;
@@ -154,6 +327,52 @@ out:
 	return ret;
 }
 
+/*
+ * Same as duet_fetch, but also returns the physical location of every item.
+ * The task must have been registered with DUET_MAP_BLOCKS; otherwise, all
+ * returned locations will be empty.
+ */
+int duet_fetch_blocks(int duet_fd, int tid, struct duet_item *items,
+	struct duet_block *blks, int *count)
+{
+	int i, ret = 0;
+	struct duet_ioctl_bfetch_args *args;
+
+	if (*count > DUET_MAX_BITEMS) {
+		fprintf(stderr, "duet: requested too many items (%d > %d)\n",
+			*count, DUET_MAX_BITEMS);
+		return -1;
+	}
+
+	if (duet_fd == -1) {
+		fprintf(stderr, "duet: failed to open duet device\n");
+		return -1;
+	}
+
+	args = calloc(1, sizeof(*args));
+	if (!args) {
+		perror("duet: fetch args allocation failed");
+		return -1;
+	}
+
+	args->tid = tid;
+	args->num = *count;
+
+	ret = ioctl(duet_fd, DUET_IOC_BFETCH, args);
+	if (ret < 0)
+		goto out;
+
+	*count = args->num;
+	for (i = 0; i < args->num; i++) {
+		items[i] = args->bitm[i].itm;
+		blks[i] = args->bitm[i].blk;
+	}
+
+out:
+	free(args);
+	return ret;
+}
+
 int duet_check_done(int duet_fd, int tid, __u64 idx, __u32 count)
 {
 	int ret = 0;
@@ -315,16 +534,34 @@ int duet_task_list(int duet_fd, int numtasks)
 
 	/* Print out the list we received */
 	fprintf(stdout,
-		"ID\tTask Name           \tFile task?\tBit range\tEvt. mask\n"
-		"--\t--------------------\t----------\t---------\t---------\n");
+		"ID\tTask Name           \tFile task?\tBit range\tEvt. mask\tI/O prio\tBytes read  \tBytes skipped\tPages lost\tLeased (cur/max)\tLeased/expired/reclaimed\tEvictions (calls/avg ns/overruns)\tScopes\tFilter\tFiltered  \n"
+		"--\t--------------------\t----------\t---------\t---------\t--------\t------------\t-------------\t----------\t----------------\t------------------------\t---------------------------------\t------\t------\t----------\n");
 	for (i=0; i<args->numtasks; i++) {
 		if (!args->tasks[i].tid)
 			break;
 
-		fprintf(stdout, "%2d\t%20s\t%10s\t%9u\t%8x\n",
+		fprintf(stdout, "%2d\t%20s\t%10s\t%9u\t%8x\t%6u:%u\t%12llu\t%13llu\t%10llu\t%7u/%-8u\t%llu/%llu/%llu\t%llu/%llu/%u%s\t%6u\t%6x\t%10llu\n",
 			args->tasks[i].tid, args->tasks[i].tname,
 			args->tasks[i].is_file ? "TRUE" : "FALSE",
-			args->tasks[i].bitrange, args->tasks[i].evtmask);
+			args->tasks[i].bitrange, args->tasks[i].evtmask,
+			DUET_IOPRIO_CLASS(args->tasks[i].ioprio),
+			DUET_IOPRIO_DATA(args->tasks[i].ioprio),
+			(unsigned long long)args->tasks[i].bytes_read,
+			(unsigned long long)args->tasks[i].bytes_skipped,
+			(unsigned long long)args->tasks[i].pages_lost,
+			args->tasks[i].lease_cur, args->tasks[i].lease_max,
+			(unsigned long long)args->tasks[i].pages_leased,
+			(unsigned long long)args->tasks[i].pages_expired,
+			(unsigned long long)args->tasks[i].pages_reclaimed,
+			(unsigned long long)args->tasks[i].evict_calls,
+			args->tasks[i].evict_calls ?
+			(unsigned long long)(args->tasks[i].evict_ns /
+					     args->tasks[i].evict_calls) : 0,
+			args->tasks[i].evict_overruns,
+			args->tasks[i].evict_off ? " (off)" : "",
+			args->tasks[i].numscopes,
+			args->tasks[i].filter_mask,
+			(unsigned long long)args->tasks[i].pages_filtered);
 	}
 
 out:
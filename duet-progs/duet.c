@@ -221,6 +221,7 @@ static const struct cmd_group duet_cmd_group = {
 		{ "status", cmd_status, NULL, &status_cmd_group, 0 },
 		{ "task", cmd_task, NULL, &task_cmd_group, 0 },
 		{ "debug", cmd_debug, NULL, &debug_cmd_group, 0 },
+		{ "warmup", cmd_warmup, NULL, &warmup_cmd_group, 0 },
 		{ "help", cmd_help, cmd_help_usage, NULL, 0 },
 		{ "version", cmd_version, cmd_version_usage, NULL, 0 },
 		NULL_CMD_STRUCT
@@ -23,6 +23,7 @@
 #include <stddef.h>
 
 #define DUET_MAX_ITEMS	512
+#define DUET_MAX_BITEMS	256
 #define DUET_MAX_PATH	1024
 #define DUET_MAX_NAME	22
 #define DUET_MAX_TASKS	128
@@ -46,7 +47,9 @@
  * Add and remove events are triggered when a page __descriptor__ is inserted or
  * removed from the page cache. Modification events are triggered when the page
  * is dirtied (nb: during writes, pages are added, then dirtied), and flush
- * events are triggered when a page is marked for writeback.
+ * events are triggered when a page is marked for writeback. Direct I/O writes
+ * bypass the page cache, so they are reported as dirtying every page in the
+ * range they wrote, whether the page is cached or not.
  * State-based Duet monitors changes in the page cache. Registering for EXISTS
  * events means that fetch will be returning ADDED or REMOVED events if the
  * state of the page changes since the last fetch (i.e. the two events cancel
@@ -74,9 +77,33 @@
 /* Used only during registration */
 #define DUET_REG_SBLOCK		0x8000
 #define DUET_FILE_TASK		0x10000	/* we register a 32-bit flag due to this */
+#define DUET_MAP_BLOCKS		0x20000	/* translate pages to device blocks */
+#define DUET_LRU_HINTS		0x40000	/* report LRU class, inactive first */
 
+/*
+ * I/O priority of the work done on behalf of a task, as in ioprio_set(2).
+ * Kernel tasks default to the idle class; user tasks keep their own priority
+ * unless one is set, in which case it applies to the process that fetches
+ * the task's items, from its next fetch on.
+ */
+#define DUET_IOPRIO_CLASS_NONE	0
+#define DUET_IOPRIO_CLASS_RT	1
+#define DUET_IOPRIO_CLASS_BE	2
+#define DUET_IOPRIO_CLASS_IDLE	3
+#define DUET_IOPRIO_CLASS_SHIFT	13
+#define DUET_IOPRIO(class, data)	(((class) << DUET_IOPRIO_CLASS_SHIFT) | (data))
+#define DUET_IOPRIO_CLASS(ioprio)	((ioprio) >> DUET_IOPRIO_CLASS_SHIFT)
+#define DUET_IOPRIO_DATA(ioprio)	((ioprio) & ((1 << DUET_IOPRIO_CLASS_SHIFT) - 1))
+
+/*
+ * The UUID holds the inode number, the lower 24 bits of its generation, and
+ * the index of the task scope (i.e. filesystem) the inode was found in. Paths
+ * returned by duet_get_path() are relative to the dir of that scope.
+ */
+#define DUET_MAX_SCOPES		8
 #define DUET_UUID_INO(uuid)	((unsigned long)(uuid & 0xffffffff))
-#define DUET_UUID_GEN(uuid)	((unsigned long)(uuid >> 32))
+#define DUET_UUID_GEN(uuid)	((unsigned long)((uuid >> 32) & 0xffffff))
+#define DUET_UUID_FS(uuid)	((unsigned int)(uuid >> 56))
 
 /*
  * Item struct returned for processing. For both state- and event- based duet,
@@ -88,6 +115,50 @@ struct duet_item {
 	unsigned long long	uuid;
 	unsigned long		idx;
 	__u16			state;
+	__u8			lru;	/* LRU class, for DUET_LRU_HINTS tasks */
+};
+
+/*
+ * LRU class of an item's page when it was last seen, for tasks registered with
+ * DUET_LRU_HINTS. Such tasks get pages on the inactive list first.
+ */
+#define DUET_LRU_UNKNOWN	0
+#define DUET_LRU_INACTIVE	1
+#define DUET_LRU_REFERENCED	2
+#define DUET_LRU_ACTIVE		3
+
+/*
+ * Physical location of an item's page, returned to tasks registered with
+ * DUET_MAP_BLOCKS. The first len bytes of the page are stored contiguously on
+ * dev, starting at the given 512-byte sector. A zero len means the page could
+ * not be mapped (hole, delayed allocation, evicted inode).
+ */
+struct duet_block {
+	__u32			dev;	/* new_encode_dev() format */
+	__u32			len;
+	__u64			sector;
+};
+
+/*
+ * Filter on the files a task gets page events for, applied in the kernel before
+ * the events are queued. Only the checks in mask apply. Inode flags are given
+ * as in FS_IOC_GETFLAGS; only sync, immutable, append, and noatime are known
+ * to the VFS. The allowlist holds the UUIDs of the files the task wants.
+ */
+#define DUET_FILTER_SIZE	0x01	/* min_size <= i_size <= max_size */
+#define DUET_FILTER_FLAGS	0x02	/* all of set_flags, none of clear_flags */
+#define DUET_FILTER_UID		0x04	/* owned by uid */
+#define DUET_FILTER_GID		0x08	/* owned by gid */
+#define DUET_FILTER_ALLOW	0x10	/* UUID on the task's allowlist */
+
+struct duet_filter {
+	__u32			mask;
+	__u32			set_flags;
+	__u32			clear_flags;
+	__u32			uid;
+	__u32			gid;
+	__u64			min_size;
+	__u64			max_size;
 };
 
 int open_duet_dev(void);
@@ -96,7 +167,19 @@ void close_duet_dev(int duet_fd);
 int duet_register(int duet_fd, const char *path, __u32 regmask, __u32 bitrange,
 	const char *name, int *tid);
 int duet_deregister(int duet_fd, int tid);
+int duet_add_scope(int duet_fd, int tid, const char *path);
+int duet_set_ioprio(int duet_fd, int tid, __u16 ioprio);
+int duet_set_lease(int duet_fd, int tid, __u32 pages, __u32 msecs);
+int duet_release_lease(int duet_fd, int tid, unsigned long long uuid,
+	__u64 idx, __u32 count);
+int duet_set_filter(int duet_fd, int tid, struct duet_filter *filter);
+int duet_filter_allow(int duet_fd, int tid, unsigned long long uuid,
+	__u32 count);
+int duet_filter_disallow(int duet_fd, int tid, unsigned long long uuid,
+	__u32 count);
 int duet_fetch(int duet_fd, int tid, struct duet_item *items, int *count);
+int duet_fetch_blocks(int duet_fd, int tid, struct duet_item *items,
+	struct duet_block *blks, int *count);
 int duet_check_done(int duet_fd, int tid, __u64 idx, __u32 count);
 int duet_set_done(int duet_fd, int tid, __u64 idx, __u32 count);
 int duet_unset_done(int duet_fd, int tid, __u64 idx, __u32 count);
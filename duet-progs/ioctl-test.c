@@ -6,6 +6,7 @@ static unsigned long ioctls[] = {
 	DUET_IOC_CMD,
 	DUET_IOC_TLIST,
 	DUET_IOC_FETCH,
+	DUET_IOC_BFETCH,
 	0 };
 
 int main(int ac, char **av)
@@ -0,0 +1,54 @@
+#!/bin/bash
+#
+# dd throughput per NUMA node, with and without a duet task watching the
+# files, to measure the cost of the ItemTable hooks on each node
+#
+# Copyright 2014-2015, George Amvrosiadis <gamvrosi@gmail.com>
+# Released under the GNU GPLv2
+
+usage() {
+	echo "usage: $0 <dir> [MB per run (default: 1024)]"
+	exit 1
+}
+
+[ $# -lt 1 -o $# -gt 2 ] && usage
+dir="$1"
+mb=${2:-1024}
+duet=${DUET:-./duet}
+
+[ -d "$dir" ] || usage
+which numactl &> /dev/null || { echo "numactl not found"; exit 1; }
+[ -x "$duet" ] || { echo "$duet not found (set DUET)"; exit 1; }
+
+nodes=`numactl --hardware | sed -n 's/^available: [0-9]* nodes (\(.*\))$/\1/p'`
+[ -z "$nodes" ] && { echo "cannot find NUMA nodes"; exit 1; }
+nodes=`echo $nodes | awk -F- '{ if (NF == 2) { for (i = $1; i <= $2; i++) printf "%d ", i } else print $0 }' | tr ',' ' '`
+
+# Runs dd pinned to a node, and prints its throughput in MB/s
+run_dd() {
+	local node=$1 f="$dir/numa-bench.$1" secs
+
+	sync
+	echo 3 > /proc/sys/vm/drop_caches
+	secs=`numactl --cpunodebind=$node --membind=$node /usr/bin/time -f %e \
+		dd if=/dev/zero of="$f" bs=1M count=$mb conv=fsync 2>&1 \
+		> /dev/null | tail -n 1`
+	rm -f "$f"
+	echo "$mb $secs" | awk '{ printf "%.1f", ($2 > 0) ? $1 / $2 : 0 }'
+}
+
+printf "node\tno task (MB/s)\twith task (MB/s)\n"
+for node in $nodes; do
+	base=`run_dd $node`
+
+	tid=`$duet task register -n numa-bench -m 10003 -p "$dir" | \
+		sed -n 's/.*(ID \([0-9]*\)).*/\1/p'`
+	[ -z "$tid" ] && { echo "failed to register task"; exit 1; }
+	task=`run_dd $node`
+
+	# Per-partition item counts end up in the kernel log
+	$duet debug printitm -i $tid > /dev/null
+	$duet task deregister -i $tid > /dev/null
+
+	printf "%d\t%s\t\t%s\n" $node $base $task
+done
@@ -80,9 +80,9 @@ static int duet_bmap_read(unsigned long *bmap, __u64 bstart, __u32 bgran,
 	do_div(bofft64, bgran);
 	bofft = (unsigned int)bofft64;
 
-	/* Check the bits */
+	/* Check the bit */
 	p = bmap + BIT_WORD(bofft);
-	mask = BITMAP_FIRST_WORD_MASK(bofft);
+	mask = BIT_MASK(bofft);
 
 	if (((*p) & mask) == mask)
 		return 1;
@@ -567,7 +567,15 @@ static int do_bittree_check(struct duet_bittree *bt, __u64 idx, __u32 len,
 					ret = 0;
 
 			} else if (ret == 1) {
-				/* Mark as irrelevant and return done */
+				/*
+				 * Mark as irrelevant and return done. Inodes
+				 * with more links may have an alias under the
+				 * task's dir that isn't cached yet, so we
+				 * don't remember that for them.
+				 */
+				if (inode && inode->i_nlink > 1)
+					return 1;
+
 				ret = __update_tree(bt, idx, 1, BMAP_SEEN_SET);
 				if (ret != -1)
 					ret = 1;
@@ -593,7 +601,49 @@ static int do_bittree_check(struct duet_bittree *bt, __u64 idx, __u32 len,
 int bittree_check_inode(struct duet_bittree *bt, struct duet_task *task,
 	struct inode *inode)
 {
-	return do_bittree_check(bt, DUET_GET_UUID(inode), 1, task, inode);
+	return do_bittree_check(bt, duet_task_uuid(task, inode), 1, task, inode);
+}
+
+/*
+ * Re-evaluates the relevance of a file that gained, lost, or moved a link.
+ * Relevance is decided over all cached aliases, so a file stays relevant as
+ * long as one of its links is under the task's dir. Returns 1 if the file
+ * became relevant, 2 if it stopped being relevant, 0 if nothing changed, or
+ * -1 on error.
+ */
+int bittree_recheck_inode(struct duet_bittree *bt, struct duet_task *task,
+	struct inode *inode)
+{
+	int bits, ret;
+	__u64 idx = duet_task_uuid(task, inode);
+
+	bits = __update_tree(bt, idx, 1, BMAP_READ);
+	if (bits == -1)
+		return -1;
+
+	ret = do_find_path(task, inode, 0, NULL);
+	if (ret == 0) {
+		if ((bits & 0x4) && (bits & 0x2))
+			return 0;
+
+		ret = __update_tree(bt, idx, 1, BMAP_SEEN_SET | BMAP_RELV_SET);
+		return (ret == -1) ? -1 : 1;
+	} else if (ret == 1) {
+		/* Files with more links get checked again next time */
+		if (inode->i_nlink > 1 && (bits & 0x4))
+			ret = __update_tree(bt, idx, 1, BMAP_SEEN_RST | BMAP_RELV_RST);
+		else if (bits & 0x2)
+			ret = __update_tree(bt, idx, 1, BMAP_RELV_RST);
+		else
+			return 0;
+
+		if (ret == -1)
+			return -1;
+		return (bits & 0x2) ? 2 : 0;
+	}
+
+	printk(KERN_ERR "duet: couldn't determine inode relevance\n");
+	return -1;
 }
 
 /* Checks if the given entries are done */
@@ -633,6 +683,13 @@ int bittree_unset_relv(struct duet_bittree *bt, __u64 idx, __u32 len)
 	return __update_tree(bt, idx, len, BMAP_RELV_RST);
 }
 
+/* Records whether an inode is relevant, as if we had just checked it */
+int bittree_set_seen(struct duet_bittree *bt, __u64 idx, int relv)
+{
+	return __update_tree(bt, idx, 1, BMAP_SEEN_SET |
+			     (relv ? BMAP_RELV_SET : BMAP_RELV_RST));
+}
+
 /* Clear all 3 bits for given entries */
 int bittree_clear_bits(struct duet_bittree *bt, __u64 idx, __u32 len)
 {
@@ -678,9 +735,9 @@ int bittree_print(struct duet_task *task)
 	spin_unlock(&task->bittree.lock);
 	local_irq_restore(iflags);
 
-	printk(KERN_INFO "duet: Task #%d bitmap has %d out of %lu bits set\n",
-		task->id, bitmap_weight(task->bucket_bmap,
-		duet_env.itm_hash_size), duet_env.itm_hash_size);
+	printk(KERN_INFO "duet: Task #%d bitmap has %lu out of %lu bits set\n",
+		task->id, hash_weight(task),
+		duet_env.itm_hash_size * duet_env.itm_hash_parts);
 
 	return 0;
 }
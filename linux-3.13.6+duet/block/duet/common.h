@@ -19,17 +19,22 @@
 #define _COMMON_H
 
 #include <linux/fs.h>
+#include <linux/mm.h>
 #include <linux/sched.h>
 #include <linux/slab.h>
+#include <linux/timer.h>
+#include <linux/kfifo.h>
 #include <linux/rbtree.h>
 #include <linux/list_bl.h>
 #include <linux/bitmap.h>
 #include <linux/rculist.h>
+#include <linux/workqueue.h>
 #include <linux/duet.h>
 
 #define DUET_DEF_NUMTASKS	8
 #define MAX_NAME		22
 #define DUET_BITS_PER_NODE	(32768 * 8)	/* 32KB bitmaps */
+#define DUET_DIO_MAX_PAGES	1024		/* Dirty events per direct write */
 
 /* Some useful flags for clearing bitmaps */
 #define BMAP_SEEN	0x1
@@ -37,8 +42,11 @@
 #define BMAP_DONE	0x4
 
 #define DUET_INODE_FREEING	(I_WILL_FREE | I_FREEING | I_CLEAR)
-#define DUET_GET_UUID(inode)	(((unsigned long long) inode->i_generation << 32) | \
-				(unsigned long long) inode->i_ino)
+#define DUET_GET_UUID(inode)	((((unsigned long long) inode->i_generation & 0xffffff) << 32) | \
+				((unsigned long long) inode->i_ino & 0xffffffff))
+#define DUET_SCOPE_UUID(fs, inode)	(((unsigned long long) (fs) << 56) | \
+				DUET_GET_UUID(inode))
+#define DUET_UUID_LOCAL(uuid)	((uuid) & ((1ULL << 56) - 1))
 
 enum {
 	DUET_STATUS_OFF = 0,
@@ -75,6 +83,17 @@ struct item_hnode {
 	__u16			*state;		/* One entry per task */
 };
 
+/*
+ * A task's view of one ItemTable partition: the buckets holding its items,
+ * and those holding its items on the inactive list (for DUET_LRU_HINTS).
+ */
+struct duet_bmap_part {
+	unsigned long		*bucket_bmap;
+	unsigned long		bmap_cursor;
+	unsigned long		*lru_bmap;	/* Buckets with inactive items */
+	unsigned long		lru_cursor;
+};
+
 struct duet_bittree {
 	__u8			is_file;	/* Task type, as in duet_task */
 	__u32			range;
@@ -86,6 +105,18 @@ struct duet_bittree {
 #endif /* CONFIG_DUET_STATS */
 };
 
+/*
+ * A filesystem the task is interested in, and the dir under which files are
+ * relevant to it (user tasks only). Scopes are only added, never removed, so
+ * the first numscopes entries can be read without locking.
+ */
+struct duet_scope {
+	struct super_block	*sb;
+	struct dentry		*dentry;
+};
+
+struct duet_task_filter;
+
 struct duet_task {
 	__u8			id;
 	__u8			is_file;	/* Task type: set if file task */
@@ -97,14 +128,54 @@ struct duet_task {
 	char			*pathbuf;	/* Buffer for getpath */
 
 	/* Optional heuristics to filter the events received */
-	struct super_block	*f_sb;		/* Filesystem of task */
-	struct dentry		*p_dentry;	/* Parent dentry */
+	struct duet_scope	scopes[DUET_MAX_SCOPES]; /* Fs, and parent dentry */
+	__u8			numscopes;
 	__u8			use_imap;	/* Use the inode bitmap */
+	__u8			map_blocks;	/* Translate items to blocks */
+	__u8			lru_hints;	/* Report LRU class of items */
+
+	/* I/O priority of work done on behalf of the task, and accounting */
+	__u16			ioprio;
+	atomic64_t		io_read;	/* Bytes read by the task */
+	atomic64_t		io_skipped;	/* Bytes Duet saved the task */
+	atomic64_t		evicted;	/* Pages lost before processing */
 
-	/* Hash table bucket bitmap */
+	/* Hash table bucket bitmaps, one set per ItemTable partition */
 	spinlock_t		bbmap_lock;
-	unsigned long		*bucket_bmap;
-	unsigned long		bmap_cursor;
+	struct duet_bmap_part	*bparts;
+	unsigned int		part_cursor;	/* Partition to fetch from next */
+
+	/* Page leases, and their accounting; see lease.c */
+	spinlock_t		lease_lock;
+	struct rb_root		leases;		/* By uuid and page index */
+	struct list_head	lease_list;	/* By expiry */
+	struct timer_list	lease_timer;
+	__u32			lease_max;	/* Max pages leased at once */
+	__u32			lease_cur;	/* Pages currently leased */
+	unsigned long		lease_time;	/* Lease duration, in jiffies */
+	__u64			leased;		/* Leases granted */
+	__u64			lease_expired;	/* Leases that ran out */
+	__u64			lease_reclaimed; /* Leases taken by the shrinker */
+
+	/* Pre-eviction callback of kernel tasks, and its stats; see evict.c */
+	duet_evict_cb_t		*evict_cb;
+	void			*evict_data;
+	__u64			evict_budget;	/* Max ns per invocation */
+	__u8			evict_off;	/* Switched off for overruns */
+	atomic_t		evict_overruns;	/* Invocations over budget */
+	atomic64_t		evict_calls;	/* Invocations */
+	atomic64_t		evict_ns;	/* Total time in callback */
+
+	/* Metadata blocks verified by the filesystem; see verify.c */
+	__u8			meta_verified;	/* Queue verified blocks */
+	spinlock_t		vblk_lock;
+	DECLARE_KFIFO_PTR(vblks, struct duet_block);
+	atomic64_t		vblk_dropped;	/* Blocks that didn't fit */
+
+	/* Filter on the files events are reported for; see filter.c */
+	struct duet_task_filter	*filter;
+	struct duet_bittree	allow;		/* UUID allowlist */
+	atomic64_t		filtered;	/* Events dropped by the filter */
 
 	/* BitTree -- progress bitmap tree */
 	struct duet_bittree	bittree;
@@ -122,11 +193,19 @@ struct duet_info {
 	struct mutex		task_list_mutex;
 	struct list_head	tasks;
 
-	/* ItemTable -- Global page state hash table */
-	struct hlist_bl_head	*itm_hash_table;
-	unsigned long		itm_hash_size;
+	/* ItemTable -- Global page state hash table, one partition per node */
+	struct hlist_bl_head	**itm_hash_table;
+	int			itm_hash_parts;
+	unsigned long		itm_hash_size;	/* Buckets per partition */
 	unsigned long		itm_hash_shift;
 	unsigned long		itm_hash_mask;
+
+	/* Serializes scope tag invalidations; see scope.c */
+	spinlock_t		scope_lock;
+	seqcount_t		scope_seq;
+	struct list_head	scope_moves;	/* Moved subtrees to invalidate */
+	atomic_t		scope_pending;	/* ...and how many are left */
+	struct work_struct	scope_work;
 #ifdef CONFIG_DUET_STATS
 	unsigned long		itm_stat_lkp;	/* total lookups per request */
 	unsigned long		itm_stat_num;	/* number of node requests */
@@ -134,17 +213,75 @@ struct duet_info {
 };
 
 extern struct duet_info duet_env;
+
+/* LRU class of a page, as reported to tasks registered with DUET_LRU_HINTS */
+static inline __u8 duet_page_lru(struct page *page)
+{
+	if (PageActive(page))
+		return DUET_LRU_ACTIVE;
+	if (PageReferenced(page))
+		return DUET_LRU_REFERENCED;
+	return DUET_LRU_INACTIVE;
+}
+
+/* ItemTable partition for events on a page: that of the node it lives on */
+static inline int duet_page_part(struct page *page)
+{
+	return page ? page_to_nid(page) : numa_node_id();
+}
+
+/* Is this a user task, i.e. registered on a dir rather than a filesystem? */
+static inline int duet_is_utask(struct duet_task *task)
+{
+	return task->scopes[0].dentry != NULL;
+}
+
+/* The task's bit in scope tags; see duet_scope_tagged() */
+static inline unsigned long duet_scope_bit(struct duet_task *task)
+{
+	return 1UL << (task->id - 1);
+}
+
+/* Index of the task's scope on the given filesystem, or -1 if there's none */
+static inline int duet_scope_fs(struct duet_task *task, struct super_block *sb)
+{
+	int i, n = ACCESS_ONCE(task->numscopes);
+
+	smp_rmb();	/* pairs with duet_add_scope() */
+	for (i = 0; i < n; i++) {
+		if (!task->scopes[i].sb || task->scopes[i].sb == sb)
+			return i;
+	}
+
+	return -1;
+}
+
+/* UUID of an inode as seen by the task, i.e. tagged with its scope */
+static inline unsigned long long duet_task_uuid(struct duet_task *task,
+	struct inode *inode)
+{
+	int fs = duet_scope_fs(task, inode->i_sb);
+
+	return DUET_SCOPE_UUID(fs < 0 ? 0 : fs, inode);
+}
+
 extern unsigned int *duet_i_hash_shift;
 extern struct hlist_head **duet_inode_hashtable;
 extern spinlock_t *duet_inode_hash_lock;
 extern int d_find_path(struct inode *cnode, struct dentry *p_dentry,
 			int getpath, char *buf, int len, char **p);
+extern void d_duet_walk(struct dentry *parent, void *data,
+			void (*fn)(void *, struct dentry *));
 
 /* hash.c */
 int hash_init(void);
+void hash_destroy(void);
+int hash_task_init(struct duet_task *task);
+void hash_task_destroy(struct duet_task *task);
 int hash_add(struct duet_task *task, unsigned long long uuid, unsigned long idx,
-	__u16 evtmask, short in_scan);
+	int part, __u16 evtmask, __u8 lru, short in_scan);
 int hash_fetch(struct duet_task *task, struct duet_item *itm);
+unsigned long hash_weight(struct duet_task *task);
 void hash_print(struct duet_task *task);
 
 /* task.c -- not in linux/duet.h */
@@ -160,9 +297,46 @@ int do_find_path(struct duet_task *task, struct inode *inode, int getpath,
 int duet_find_path(struct duet_task *task, unsigned long long uuid, int getpath,
 	char *path);
 
+/* scope.c */
+void duet_scope_init(void);
+void duet_scope_stop(void);
+int duet_scope_tagged(struct duet_task *task);
+unsigned long duet_scope_mask(struct inode *inode);
+int duet_scope_check(struct duet_task *task, struct inode *inode);
+void duet_scope_reset(void);
+void duet_scope_moved(struct dentry *dentry, int changed);
+
+/* lease.c */
+void duet_lease_init(struct duet_task *task);
+void duet_lease_destroy(struct duet_task *task);
+void duet_lease_add(struct duet_task *task, unsigned long long uuid,
+	struct page *page);
+void duet_lease_drop(struct duet_task *task, unsigned long long uuid,
+	unsigned long idx);
+void duet_lease_done(struct duet_task *task, __u64 uuid, __u32 count);
+int duet_lease_start(void);
+void duet_lease_stop(void);
+
+/* verify.c */
+int duet_verified_init(struct duet_task *task);
+void duet_verified_destroy(struct duet_task *task);
+
+/* filter.c */
+void duet_filter_init(struct duet_task *task);
+void duet_filter_destroy(struct duet_task *task);
+__u32 duet_filter_mask(struct duet_task *task);
+int duet_filter_inode(struct duet_task *task, struct inode *inode,
+	unsigned long long uuid);
+
+/* map.c */
+int duet_map_items(__u8 taskid, struct duet_item *items,
+	struct duet_block *blks, __u16 count);
+
 /* bittree.c */
 int bittree_check_inode(struct duet_bittree *bt, struct duet_task *task,
 	struct inode *inode);
+int bittree_recheck_inode(struct duet_bittree *bt, struct duet_task *task,
+	struct inode *inode);
 int bittree_check(struct duet_bittree *bt, __u64 idx, __u32 len,
 	struct duet_task *task);
 int bittree_set_done(struct duet_bittree *bt, __u64 idx, __u32 len);
@@ -170,6 +344,7 @@ int bittree_unset_done(struct duet_bittree *bt, __u64 idx, __u32 len);
 int bittree_check_done_bit(struct duet_bittree *bt, __u64 idx, __u32 len);
 int bittree_set_relv(struct duet_bittree *bt, __u64 idx, __u32 len);
 int bittree_unset_relv(struct duet_bittree *bt, __u64 idx, __u32 len);
+int bittree_set_seen(struct duet_bittree *bt, __u64 idx, int relv);
 int bittree_clear_bits(struct duet_bittree *bt, __u64 idx, __u32 len);
 int bittree_clear_bitmap(struct duet_bittree *bt, __u8 flags);
 
@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2014-2015 George Amvrosiadis.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 021110-1307, USA.
+ */
+
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/sched.h>
+#include "common.h"
+
+duet_evict_hook_t *duet_evict_hook_fp = NULL;
+EXPORT_SYMBOL(duet_evict_hook_fp);
+
+/*
+ * By the time DUET_PAGE_REMOVED is delivered, the page is gone, and any work
+ * on it will cost a disk read. Kernel tasks can instead get a last look at
+ * clean pages from reclaim, right before they are freed. Reclaim latency is
+ * at stake here, so every callback is timed against the task's budget, and
+ * callbacks that overrun it too often are switched off until set again.
+ */
+#define DUET_EVICT_DEF_BUDGET	20	/* Default budget, in usecs */
+#define DUET_EVICT_MAX_OVERRUNS	8	/* Overruns before we switch off */
+
+/*
+ * Called by reclaim for a locked, clean, uptodate page, under RCU. The page
+ * has no other references at that point, but may still pick one up and stay.
+ */
+void duet_evict_hook(struct page *page)
+{
+	struct address_space *mapping;
+	struct inode *inode;
+	struct duet_task *cur;
+	duet_evict_cb_t *cb;
+	u64 start, delta;
+
+	if (!duet_online())
+		return;
+
+	mapping = page_mapping(page);
+	if (!mapping || !mapping->host)
+		return;
+
+	inode = mapping->host;
+	if (!S_ISREG(inode->i_mode))
+		return;
+
+	list_for_each_entry_rcu(cur, &duet_env.tasks, task_list) {
+		cb = ACCESS_ONCE(cur->evict_cb);
+		if (!cb || cur->evict_off)
+			continue;
+
+		smp_read_barrier_depends();	/* pairs with duet_set_evict_cb */
+		if (duet_scope_fs(cur, inode->i_sb) < 0)
+			continue;
+
+		/* File tasks only care for relevant files they're not done with */
+		if (cur->is_file &&
+		    bittree_check_inode(&cur->bittree, cur, inode) == 1)
+			continue;
+
+		start = local_clock();
+		cb(cur->id, page, cur->evict_data);
+		delta = local_clock() - start;
+
+		atomic64_inc(&cur->evict_calls);
+		atomic64_add(delta, &cur->evict_ns);
+		if (delta <= cur->evict_budget)
+			continue;
+
+		if (atomic_inc_return(&cur->evict_overruns) ==
+		    DUET_EVICT_MAX_OVERRUNS) {
+			cur->evict_off = 1;
+			printk(KERN_WARNING "duet: task %d eviction callback "
+				"disabled, took %llu ns (budget %llu ns)\n",
+				cur->id, (unsigned long long)delta,
+				(unsigned long long)cur->evict_budget);
+		}
+	}
+}
+
+/*
+ * Sets the pre-eviction callback of a kernel task, along with the time budget
+ * of each invocation (0 picks the default). Setting a callback re-enables it
+ * if it was switched off. Passing a NULL callback removes it; once we return,
+ * no invocations of the old callback are in flight.
+ */
+int duet_set_evict_cb(__u8 taskid, duet_evict_cb_t *cb, void *data,
+	__u32 budget_us)
+{
+	struct duet_task *task;
+
+	if (!duet_online())
+		return -1;
+
+	task = duet_find_task(taskid);
+	if (!task)
+		return -ENOENT;
+
+	if (duet_is_utask(task)) {
+		printk(KERN_ERR "duet: eviction callbacks are for kernel tasks\n");
+		if (atomic_dec_and_test(&task->refcount))
+			wake_up(&task->cleaner_queue);
+		return -EINVAL;
+	}
+
+	ACCESS_ONCE(task->evict_cb) = NULL;
+	synchronize_rcu();
+
+	if (cb) {
+		task->evict_data = data;
+		task->evict_budget = (u64)(budget_us ? budget_us :
+				DUET_EVICT_DEF_BUDGET) * NSEC_PER_USEC;
+		atomic_set(&task->evict_overruns, 0);
+		task->evict_off = 0;
+		smp_wmb();
+		ACCESS_ONCE(task->evict_cb) = cb;
+	}
+
+	/* decref and wake up cleaner if needed */
+	if (atomic_dec_and_test(&task->refcount))
+		wake_up(&task->cleaner_queue);
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(duet_set_evict_cb);
@@ -0,0 +1,233 @@
+/*
+ * Copyright (C) 2014-2015 George Amvrosiadis.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 021110-1307, USA.
+ */
+
+#include <linux/fs.h>
+#include <linux/cred.h>
+#include <linux/slab.h>
+#include "common.h"
+
+/*
+ * Tasks often care for a fraction of the files in their scope, e.g. large
+ * files, or the files on a list they keep, and used to throw the rest of the
+ * events away after fetching them. A filter lets them have those events
+ * dropped at the hook instead, before they reach the ItemTable. The filter is
+ * replaced as a whole under RCU, so the hook can read it without locking. The
+ * allowlist is a BitTree of UUIDs, using the done bits of a block task.
+ *
+ * Filters are checked against the inode at the time of each event, so a file
+ * whose attributes change may only have some of its events reported.
+ */
+struct duet_task_filter {
+	struct duet_filter	f;
+	unsigned int		set_iflags;	/* S_* flags, as in i_flags */
+	unsigned int		clear_iflags;
+	kuid_t			uid;
+	kgid_t			gid;
+	struct rcu_head		rcu;
+};
+
+/* Inode flags we can filter on, and their i_flags counterparts */
+static const struct {
+	__u32		fs_flag;
+	unsigned int	i_flag;
+} filter_iflags[] = {
+	{ FS_SYNC_FL,		S_SYNC },
+	{ FS_IMMUTABLE_FL,	S_IMMUTABLE },
+	{ FS_APPEND_FL,		S_APPEND },
+	{ FS_NOATIME_FL,	S_NOATIME },
+};
+
+/* Translates FS_*_FL flags to S_* flags. Returns -1 if some aren't tracked. */
+static int filter_iflags_xlate(__u32 fs_flags, unsigned int *i_flags)
+{
+	int i;
+
+	*i_flags = 0;
+	for (i = 0; i < ARRAY_SIZE(filter_iflags); i++) {
+		if (fs_flags & filter_iflags[i].fs_flag) {
+			*i_flags |= filter_iflags[i].i_flag;
+			fs_flags &= ~filter_iflags[i].fs_flag;
+		}
+	}
+
+	return fs_flags ? -1 : 0;
+}
+
+void duet_filter_init(struct duet_task *task)
+{
+	task->filter = NULL;
+	bittree_init(&task->allow, 1, 0);
+	atomic64_set(&task->filtered, 0);
+}
+
+/* Called when no one can reach the task anymore */
+void duet_filter_destroy(struct duet_task *task)
+{
+	kfree(task->filter);
+	task->filter = NULL;
+	bittree_destroy(&task->allow);
+}
+
+/* Returns the checks the task's filter makes, if it has one */
+__u32 duet_filter_mask(struct duet_task *task)
+{
+	__u32 mask;
+	struct duet_task_filter *tf;
+
+	rcu_read_lock();
+	tf = rcu_dereference(task->filter);
+	mask = tf ? tf->f.mask : 0;
+	rcu_read_unlock();
+
+	return mask;
+}
+
+/*
+ * Returns 1 if events on the inode should be dropped for the task, 0 otherwise.
+ * Called under RCU.
+ */
+int duet_filter_inode(struct duet_task *task, struct inode *inode,
+	unsigned long long uuid)
+{
+	struct duet_task_filter *tf;
+	__u64 size;
+
+	tf = rcu_dereference(task->filter);
+	if (!tf)
+		return 0;
+
+	if (tf->f.mask & DUET_FILTER_SIZE) {
+		size = (__u64)i_size_read(inode);
+		if (size < tf->f.min_size || size > tf->f.max_size)
+			return 1;
+	}
+
+	if ((tf->f.mask & DUET_FILTER_FLAGS) &&
+	    ((inode->i_flags & tf->set_iflags) != tf->set_iflags ||
+	     (inode->i_flags & tf->clear_iflags)))
+		return 1;
+
+	if ((tf->f.mask & DUET_FILTER_UID) && !uid_eq(inode->i_uid, tf->uid))
+		return 1;
+
+	if ((tf->f.mask & DUET_FILTER_GID) && !gid_eq(inode->i_gid, tf->gid))
+		return 1;
+
+	if ((tf->f.mask & DUET_FILTER_ALLOW) &&
+	    bittree_check(&task->allow, uuid, 1, task) != 1)
+		return 1;
+
+	return 0;
+}
+
+/*
+ * Sets the filter of a task, replacing the previous one. A NULL filter, or one
+ * with an empty mask, removes it. Items already in the ItemTable are kept.
+ */
+int duet_set_filter(__u8 taskid, struct duet_filter *filter)
+{
+	struct duet_task *task;
+	struct duet_task_filter *tf = NULL, *old;
+
+	if (!duet_online())
+		return -1;
+
+	if (filter && filter->mask) {
+		if (filter->mask & ~DUET_FILTER_ALL)
+			return -EINVAL;
+
+		if ((filter->mask & DUET_FILTER_SIZE) &&
+		    filter->min_size > filter->max_size)
+			return -EINVAL;
+
+		tf = kzalloc(sizeof(*tf), GFP_KERNEL);
+		if (!tf)
+			return -ENOMEM;
+
+		tf->f = *filter;
+		tf->uid = make_kuid(current_user_ns(), filter->uid);
+		tf->gid = make_kgid(current_user_ns(), filter->gid);
+
+		if (((filter->mask & DUET_FILTER_FLAGS) &&
+		     (filter_iflags_xlate(filter->set_flags, &tf->set_iflags) ||
+		      filter_iflags_xlate(filter->clear_flags,
+					  &tf->clear_iflags))) ||
+		    ((filter->mask & DUET_FILTER_UID) && !uid_valid(tf->uid)) ||
+		    ((filter->mask & DUET_FILTER_GID) && !gid_valid(tf->gid))) {
+			printk(KERN_ERR "duet: invalid filter (mask %x)\n",
+				filter->mask);
+			kfree(tf);
+			return -EINVAL;
+		}
+	}
+
+	task = duet_find_task(taskid);
+	if (!task) {
+		kfree(tf);
+		return -ENOENT;
+	}
+
+	old = xchg(&task->filter, tf);
+	if (old)
+		kfree_rcu(old, rcu);
+
+	/* decref and wake up cleaner if needed */
+	if (atomic_dec_and_test(&task->refcount))
+		wake_up(&task->cleaner_queue);
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(duet_set_filter);
+
+/* Adds or removes UUIDs [uuid, uuid + count) to/from the task's allowlist */
+static int filter_update_allow(__u8 taskid, __u64 uuid, __u32 count,
+	int allow)
+{
+	int ret;
+	struct duet_task *task;
+
+	if (!duet_online())
+		return -1;
+
+	task = duet_find_task(taskid);
+	if (!task)
+		return -ENOENT;
+
+	if (allow)
+		ret = bittree_set_done(&task->allow, uuid, count);
+	else
+		ret = bittree_unset_done(&task->allow, uuid, count);
+
+	/* decref and wake up cleaner if needed */
+	if (atomic_dec_and_test(&task->refcount))
+		wake_up(&task->cleaner_queue);
+
+	return ret;
+}
+
+int duet_filter_allow(__u8 taskid, __u64 uuid, __u32 count)
+{
+	return filter_update_allow(taskid, uuid, count, 1);
+}
+EXPORT_SYMBOL_GPL(duet_filter_allow);
+
+int duet_filter_disallow(__u8 taskid, __u64 uuid, __u32 count)
+{
+	return filter_update_allow(taskid, uuid, count, 0);
+}
+EXPORT_SYMBOL_GPL(duet_filter_disallow);
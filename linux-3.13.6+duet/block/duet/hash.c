@@ -19,6 +19,7 @@
 #include <linux/mm.h>
 #include <linux/bootmem.h>
 #include <linux/hash.h>
+#include <linux/vmalloc.h>
 #include "common.h"
 
 #define DUET_NEGATE_EXISTS	(DUET_PAGE_ADDED | DUET_PAGE_REMOVED)
@@ -27,6 +28,18 @@
 /*
  * Page state for Duet is retained in a global hash table shared by all tasks.
  * Indexing is based on inode uuid and the page's offset within said inode.
+ *
+ * The table is split in one partition per NUMA node, allocated on that node,
+ * and events on a page go to the partition of the node the page lives on.
+ * Page events are mostly generated by CPUs close to the page, so buckets (and
+ * their bit spinlocks) rarely bounce across nodes. Tasks keep separate bucket
+ * bitmaps for every partition, and fetch from partitions in turn.
+ *
+ * A page that is evicted and read back in on another node has its events split
+ * across two partitions, yet an Added event must still cancel out a Removed one
+ * (and Dirty a Flushed one) left there. A page index maps to the same bucket in
+ * every partition, so if the task has items in that bucket of other partitions,
+ * we look for the page there before adding it to the local partition.
  */
 
 static unsigned long hash(unsigned long long uuid, unsigned long idx)
@@ -40,25 +53,107 @@ static unsigned long hash(unsigned long long uuid, unsigned long idx)
 	return (unsigned long) (h & duet_env.itm_hash_mask);
 }
 
+/* Node to allocate the memory of a partition on */
+static inline int part_node(int part)
+{
+	return node_online(part) ? part : NUMA_NO_NODE;
+}
+
 int hash_init(void)
 {
-	/* Allocate power-of-2 number of buckets */
-	duet_env.itm_hash_shift = ilog2(totalram_pages);
+	int part;
+
+	/* Allocate power-of-2 number of buckets in each partition */
+	duet_env.itm_hash_parts = nr_node_ids;
+	duet_env.itm_hash_shift = ilog2(max(totalram_pages / nr_node_ids, 1UL));
 	duet_env.itm_hash_size = 1 << duet_env.itm_hash_shift;
 	duet_env.itm_hash_mask = duet_env.itm_hash_size - 1;
 
-	printk(KERN_DEBUG "duet: allocated global hash table (%lu buckets)\n",
-			duet_env.itm_hash_size);
-	duet_env.itm_hash_table = vmalloc(sizeof(struct hlist_bl_head) *
-						duet_env.itm_hash_size);
+	duet_env.itm_hash_table = kzalloc(sizeof(struct hlist_bl_head *) *
+					duet_env.itm_hash_parts, GFP_KERNEL);
 	if (!duet_env.itm_hash_table)
 		return 1;
 
-	memset(duet_env.itm_hash_table, 0, sizeof(struct hlist_bl_head) *
-						duet_env.itm_hash_size);
+	for (part = 0; part < duet_env.itm_hash_parts; part++) {
+		duet_env.itm_hash_table[part] = vzalloc_node(
+				sizeof(struct hlist_bl_head) *
+				duet_env.itm_hash_size, part_node(part));
+		if (!duet_env.itm_hash_table[part]) {
+			hash_destroy();
+			return 1;
+		}
+	}
+
+	printk(KERN_DEBUG "duet: allocated global hash table (%d partitions, "
+		"%lu buckets each)\n", duet_env.itm_hash_parts,
+		duet_env.itm_hash_size);
 	return 0;
 }
 
+void hash_destroy(void)
+{
+	int part;
+
+	if (!duet_env.itm_hash_table)
+		return;
+
+	for (part = 0; part < duet_env.itm_hash_parts; part++)
+		vfree(duet_env.itm_hash_table[part]);
+
+	kfree(duet_env.itm_hash_table);
+	duet_env.itm_hash_table = NULL;
+}
+
+/* Allocates the task's bucket bitmaps, each on the node of its partition */
+int hash_task_init(struct duet_task *task)
+{
+	int part;
+	size_t size = sizeof(unsigned long) *
+			BITS_TO_LONGS(duet_env.itm_hash_size);
+
+	task->bparts = kzalloc(sizeof(*task->bparts) * duet_env.itm_hash_parts,
+				GFP_KERNEL);
+	if (!task->bparts)
+		return 1;
+
+	for (part = 0; part < duet_env.itm_hash_parts; part++) {
+		task->bparts[part].bucket_bmap = kzalloc_node(size, GFP_KERNEL,
+							      part_node(part));
+		if (!task->bparts[part].bucket_bmap)
+			goto err;
+
+		if (!task->lru_hints)
+			continue;
+
+		task->bparts[part].lru_bmap = kzalloc_node(size, GFP_KERNEL,
+							   part_node(part));
+		if (!task->bparts[part].lru_bmap)
+			goto err;
+	}
+
+	task->part_cursor = 0;
+	return 0;
+err:
+	hash_task_destroy(task);
+	return 1;
+}
+
+void hash_task_destroy(struct duet_task *task)
+{
+	int part;
+
+	if (!task->bparts)
+		return;
+
+	for (part = 0; part < duet_env.itm_hash_parts; part++) {
+		kfree(task->bparts[part].bucket_bmap);
+		kfree(task->bparts[part].lru_bmap);
+	}
+
+	kfree(task->bparts);
+	task->bparts = NULL;
+}
+
 /* Deallocate a hash table node */
 static void hnode_destroy(struct item_hnode *itnode)
 {
@@ -92,22 +187,25 @@ static struct item_hnode *hnode_init(unsigned long long uuid, unsigned long idx)
 	return itnode;
 }
 
-/* Add one event into the hash table */
-int hash_add(struct duet_task *task, unsigned long long uuid, unsigned long idx,
-	__u16 evtmask, short in_scan)
+/*
+ * Add one event into the given bucket of a partition. If probe is set, the
+ * event is only applied to an item the task already has there; if there is
+ * none, nothing is added and -ENOENT is returned.
+ */
+static int hash_add_part(struct duet_task *task, int part, unsigned long bnum,
+	unsigned long long uuid, unsigned long idx, __u16 evtmask, __u8 lru,
+	short in_scan, short lost, short probe)
 {
+	int ret = 0;
 	__u16 curmask = 0;
 	short found = 0;
-	unsigned long bnum, flags;
+	unsigned long flags;
 	struct hlist_bl_head *b;
 	struct hlist_bl_node *n;
 	struct item_hnode *itnode;
+	struct duet_bmap_part *bp = &task->bparts[part];
 
-	evtmask &= task->evtmask;
-
-	/* Get the bucket */
-	bnum = hash(uuid, idx);
-	b = duet_env.itm_hash_table + bnum;
+	b = duet_env.itm_hash_table[part] + bnum;
 	local_irq_save(flags);
 	hlist_bl_lock(b);
 
@@ -125,12 +223,22 @@ int hash_add(struct duet_task *task, unsigned long long uuid, unsigned long idx,
 #ifdef CONFIG_DUET_STATS
 	duet_env.itm_stat_num++;
 #endif /* CONFIG_DUET_STATS */
+	if (probe && (!found || !(itnode->state[task->id] & DUET_MASK_VALID))) {
+		ret = -ENOENT;
+		goto done;
+	}
+
 	duet_dbg(KERN_DEBUG "duet: %s hash node (uuid %llu, ino%lu, idx%lu)\n",
 		found ? (in_scan ? "replacing" : "updating") : "inserting",
 		uuid, DUET_UUID_INO(uuid), idx);
 
 	if (found) {
 		curmask = itnode->state[task->id];
+		(itnode->item).lru = lru;
+
+		if (lost && (task->is_file || ((curmask & DUET_MASK_VALID) &&
+					       (curmask & DUET_PAGE_ADDED))))
+			atomic64_inc(&task->evicted);
 
 		/* Only up the refcount if we are adding a new mask */
 		if (!(curmask & DUET_MASK_VALID) || in_scan) {
@@ -171,174 +279,328 @@ check_dispose:
 				}
 			}
 
-			if (!found)
-				clear_bit(bnum, task->bucket_bmap);
+			if (!found) {
+				clear_bit(bnum, bp->bucket_bmap);
+				if (bp->lru_bmap)
+					clear_bit(bnum, bp->lru_bmap);
+			}
 		} else {
 			itnode->state[task->id] = curmask;
 
-			/* Update bitmap */
-			set_bit(bnum, task->bucket_bmap);
+			/* Update bitmaps */
+			set_bit(bnum, bp->bucket_bmap);
+			if (bp->lru_bmap && lru == DUET_LRU_INACTIVE)
+				set_bit(bnum, bp->lru_bmap);
 		}
 	} else if (!found) {
+		if (lost && task->is_file)
+			atomic64_inc(&task->evicted);
+
 		if (!evtmask)
 			goto done;
 
 		itnode = hnode_init(uuid, idx);
-		if (!itnode)
-			return 1;
+		if (!itnode) {
+			ret = 1;
+			goto done;
+		}
 
+		(itnode->item).lru = lru;
 		itnode->state[task->id] = evtmask | DUET_MASK_VALID;
 		hlist_bl_add_head(&itnode->node, b);
 
-		/* Update bitmap */
-		set_bit(bnum, task->bucket_bmap);
+		/* Update bitmaps */
+		set_bit(bnum, bp->bucket_bmap);
+		if (bp->lru_bmap && lru == DUET_LRU_INACTIVE)
+			set_bit(bnum, bp->lru_bmap);
 	}
 
 done:
 	hlist_bl_unlock(b);
 	local_irq_restore(flags);
-	return 0;
+	return ret;
 }
 
-/* Fetch one item for a given task. Return found (1), empty (0), error (-1) */
-int hash_fetch(struct duet_task *task, struct duet_item *itm)
+/* Add one event into the partition of the node the page lives on */
+int hash_add(struct duet_task *task, unsigned long long uuid, unsigned long idx,
+	int part, __u16 evtmask, __u8 lru, short in_scan)
 {
-	int found;
-	unsigned long bnum, flags;
-	struct hlist_bl_head *b;
-	struct hlist_bl_node *n;
-	struct item_hnode *itnode;
+	int i, p, ret, remote = 0;
+	short lost;
+	unsigned long bnum = hash(uuid, idx);
+
+	/*
+	 * The page is being evicted. If the task was told it was added, and
+	 * hasn't fetched it yet (or, for file tasks, isn't done with its file),
+	 * we count it as lost to the task.
+	 */
+	lost = !in_scan && (evtmask & DUET_PAGE_REMOVED) &&
+	       (task->evtmask & DUET_PAGE_ADDED);
+	evtmask &= task->evtmask;
 
-	local_irq_save(flags);
-again:
-	spin_lock(&task->bbmap_lock);
-	bnum = find_next_bit(task->bucket_bmap, duet_env.itm_hash_size,
-			     task->bmap_cursor);
+	/* Scans start from what is cached, so they stay in the local partition */
+	for (i = 1; !in_scan && i < duet_env.itm_hash_parts; i++) {
+		p = (part + i) % duet_env.itm_hash_parts;
+		if (test_bit(bnum, task->bparts[p].bucket_bmap)) {
+			remote = 1;
+			break;
+		}
+	}
 
-	if (bnum == duet_env.itm_hash_size) {
-		/* Reached end of bitmap */
-		found = 0;
+	if (!remote)
+		return hash_add_part(task, part, bnum, uuid, idx, evtmask, lru,
+				     in_scan, lost, 0);
+
+	/* Look for the page here first, then on the other nodes */
+	ret = hash_add_part(task, part, bnum, uuid, idx, evtmask, lru, 0,
+			    lost, 1);
+	for (i = 1; ret == -ENOENT && i < duet_env.itm_hash_parts; i++) {
+		p = (part + i) % duet_env.itm_hash_parts;
+		if (test_bit(bnum, task->bparts[p].bucket_bmap))
+			ret = hash_add_part(task, p, bnum, uuid, idx, evtmask,
+					    lru, 0, lost, 1);
+	}
 
-		if (task->bmap_cursor != 0) {
-			/* Started part way, try again */
-			bnum = find_next_bit(task->bucket_bmap,
-					     task->bmap_cursor, 0);
+	if (ret == -ENOENT)
+		ret = hash_add_part(task, part, bnum, uuid, idx, evtmask, lru,
+				    0, lost, 0);
+	return ret;
+}
 
-			if (bnum != task->bmap_cursor)
-				found = 1;
-		}
+/*
+ * Finds the next marked bucket in one of the task's bitmaps, starting from the
+ * given cursor and wrapping around, and unmarks it. Returns the bucket number,
+ * or itm_hash_size if no bucket was marked.
+ */
+static unsigned long next_bucket(struct duet_task *task, unsigned long *bmap,
+	unsigned long *cursor)
+{
+	unsigned long bnum;
 
-		if (!found) {
-			spin_unlock(&task->bbmap_lock);
-			local_irq_restore(flags);
-			return 1;
-		}
+	spin_lock(&task->bbmap_lock);
+	bnum = find_next_bit(bmap, duet_env.itm_hash_size, *cursor);
+
+	if (bnum == duet_env.itm_hash_size && *cursor != 0) {
+		/* Started part way, try again */
+		bnum = find_next_bit(bmap, *cursor, 0);
+		if (bnum == *cursor)
+			bnum = duet_env.itm_hash_size;
 	}
 
-	task->bmap_cursor = bnum;
-	clear_bit(bnum, task->bucket_bmap);
+	if (bnum != duet_env.itm_hash_size) {
+		*cursor = bnum;
+		clear_bit(bnum, bmap);
+	}
 	spin_unlock(&task->bbmap_lock);
-	b = duet_env.itm_hash_table + bnum;
 
-	/* Grab first item from bucket */
+	return bnum;
+}
+
+/*
+ * Grabs the first item of the task from a bucket, or the first one on the
+ * inactive list if inactive is set, and marks the bucket in the task bitmaps
+ * according to what's left in it. Returns 1 if an item was found, 0 otherwise.
+ * Called with interrupts disabled.
+ */
+static int fetch_bucket(struct duet_task *task, int part, unsigned long bnum,
+	struct duet_item *itm, int inactive)
+{
+	int found = 0, more = 0, more_inactive = 0;
+	struct hlist_bl_head *b;
+	struct hlist_bl_node *n, *tmp;
+	struct item_hnode *itnode;
+	struct duet_bmap_part *bp = &task->bparts[part];
+
+	b = duet_env.itm_hash_table[part] + bnum;
 	hlist_bl_lock(b);
 	if (!b->first) {
-		printk(KERN_ERR "duet: empty hash bucket marked in bitmap\n");
+		if (!inactive)
+			printk(KERN_ERR "duet: empty hash bucket marked in bitmap\n");
 		hlist_bl_unlock(b);
-		goto again;
+		return 0;
 	}
 
-	found = 0;
-	hlist_bl_for_each_entry(itnode, n, b, node) {
+	hlist_bl_for_each_entry_safe(itnode, n, tmp, b, node) {
 #ifdef CONFIG_DUET_STATS
 		duet_env.itm_stat_lkp++;
 #endif /* CONFIG_DUET_STATS */
-		if (itnode->state[task->id] & DUET_MASK_VALID) {
-			*itm = itnode->item;
-			itm->state = itnode->state[task->id] & (~DUET_MASK_VALID);
-
-			itnode->refcount--;
-			/* Free or update node */
-			if (!itnode->refcount) {
-				hlist_bl_del(n);
-				hnode_destroy(itnode);
-			} else {
-				itnode->state[task->id] = 0;
-			}
+		if (!(itnode->state[task->id] & DUET_MASK_VALID))
+			continue;
 
-			found = 1;
-			break;
+		if (found || (inactive && itnode->item.lru != DUET_LRU_INACTIVE)) {
+			/* Are we still interested in this bucket? */
+			more = 1;
+			if (itnode->item.lru == DUET_LRU_INACTIVE)
+				more_inactive = 1;
+			continue;
+		}
+
+		*itm = itnode->item;
+		itm->state = itnode->state[task->id] & (~DUET_MASK_VALID);
+
+		itnode->refcount--;
+		/* Free or update node */
+		if (!itnode->refcount) {
+			hlist_bl_del(n);
+			hnode_destroy(itnode);
+		} else {
+			itnode->state[task->id] = 0;
 		}
+
+		found = 1;
 	}
 
 	if (!found) {
-		duet_dbg(KERN_NOTICE "duet: uninteresting bucket marked in bitmap\n");
+		if (!inactive)
+			duet_dbg(KERN_NOTICE "duet: uninteresting bucket marked in bitmap\n");
 		hlist_bl_unlock(b);
-		goto again;
+		return 0;
 	}
 
-	/* Are we still interested in this bucket? */
-	found = 0;
-	hlist_bl_for_each_entry(itnode, n, b, node) {
-#ifdef CONFIG_DUET_STATS
-		duet_env.itm_stat_lkp++;
-#endif /* CONFIG_DUET_STATS */
-		if (itnode->state[task->id] & DUET_MASK_VALID) {
-			found = 1;
-			break;
-		}
-	}
+	if (more)
+		set_bit(bnum, bp->bucket_bmap);
+	else
+		clear_bit(bnum, bp->bucket_bmap);
 
-	if (found)
-		set_bit(bnum, task->bucket_bmap);
+	if (bp->lru_bmap) {
+		if (more_inactive)
+			set_bit(bnum, bp->lru_bmap);
+		else
+			clear_bit(bnum, bp->lru_bmap);
+	}
 
 #ifdef CONFIG_DUET_STATS
 	duet_env.itm_stat_num++;
 #endif /* CONFIG_DUET_STATS */
 	hlist_bl_unlock(b);
+	return 1;
+}
+
+/*
+ * Grabs an item of the task from the partitions, starting with the one after
+ * the partition we last fetched from, so that no node's items are starved.
+ * Only items on the inactive list are considered if inactive is set. Returns
+ * 1 if an item was found, 0 otherwise. Called with interrupts disabled.
+ */
+static int fetch_parts(struct duet_task *task, struct duet_item *itm,
+	int inactive)
+{
+	int i, part;
+	unsigned long bnum;
+	struct duet_bmap_part *bp;
+
+	for (i = 0; i < duet_env.itm_hash_parts; i++) {
+		part = (task->part_cursor + i) % duet_env.itm_hash_parts;
+		bp = &task->bparts[part];
+
+		for (;;) {
+			if (inactive)
+				bnum = next_bucket(task, bp->lru_bmap,
+						   &bp->lru_cursor);
+			else
+				bnum = next_bucket(task, bp->bucket_bmap,
+						   &bp->bmap_cursor);
+			if (bnum == duet_env.itm_hash_size)
+				break;
+
+			if (fetch_bucket(task, part, bnum, itm, inactive)) {
+				task->part_cursor = (part + 1) %
+						    duet_env.itm_hash_parts;
+				return 1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Fetch one item for a given task. Return found (0), or empty (1).
+ * Tasks registered with DUET_LRU_HINTS get items on the inactive list first,
+ * as those are the ones reclaim will take away next.
+ */
+int hash_fetch(struct duet_task *task, struct duet_item *itm)
+{
+	unsigned long flags;
+
+	local_irq_save(flags);
+	if (!(task->lru_hints && fetch_parts(task, itm, 1)) &&
+	    !fetch_parts(task, itm, 0)) {
+		local_irq_restore(flags);
+		return 1;
+	}
+
+	if (!task->lru_hints)
+		itm->lru = DUET_LRU_UNKNOWN;
 	local_irq_restore(flags);
 	return 0;
 }
 
+/* Number of buckets holding items of the task, across all partitions */
+unsigned long hash_weight(struct duet_task *task)
+{
+	int part;
+	unsigned long weight = 0;
+
+	for (part = 0; part < duet_env.itm_hash_parts; part++)
+		weight += bitmap_weight(task->bparts[part].bucket_bmap,
+					duet_env.itm_hash_size);
+
+	return weight;
+}
+
 /* Warning: expensive printing function. Use with care. */
 void hash_print(struct duet_task *task)
 {
+	int part;
 	unsigned long loop, count, start, end, buckets, flags;
-	unsigned long long nodes, tnodes;
+	unsigned long long nodes, tnodes, pnodes, ptnodes;
 	struct hlist_bl_head *b;
 	struct hlist_bl_node *n;
 	struct item_hnode *itnode;
 
 	count = duet_env.itm_hash_size / 100;
-	tnodes = nodes = buckets = start = end = 0;
 	printk(KERN_INFO "duet: Printing hash table in 100 buckets"
 			" (%lu real buckets each)\n", count);
-	for (loop = 0; loop < duet_env.itm_hash_size; loop++) {
-		if (loop - start >= count) {
-			printk(KERN_INFO "duet:   Buckets %lu - %lu: %llu nodes (task: %llu)\n",
-				start, end, nodes, tnodes);
-			start = end = loop;
-			nodes = tnodes = 0;
-		}
+	for (part = 0; part < duet_env.itm_hash_parts; part++) {
+		tnodes = nodes = buckets = start = end = 0;
+		pnodes = ptnodes = 0;
+		printk(KERN_INFO "duet: Partition %d (node %d)\n", part,
+			part_node(part));
+
+		for (loop = 0; loop < duet_env.itm_hash_size; loop++) {
+			if (loop - start >= count) {
+				printk(KERN_INFO "duet:   Buckets %lu - %lu: %llu nodes (task: %llu)\n",
+					start, end, nodes, tnodes);
+				start = end = loop;
+				nodes = tnodes = 0;
+			}
+
+			/* Count bucket nodes */
+			b = duet_env.itm_hash_table[part] + loop;
+			local_irq_save(flags);
+			hlist_bl_lock(b);
+			hlist_bl_for_each_entry(itnode, n, b, node) {
+				nodes++;
+				pnodes++;
+				if (itnode->state[task->id] & DUET_MASK_VALID) {
+					tnodes++;
+					ptnodes++;
+				}
+			}
+			hlist_bl_unlock(b);
+			local_irq_restore(flags);
 
-		/* Count bucket nodes */
-		b = duet_env.itm_hash_table + loop;
-		local_irq_save(flags);
-		hlist_bl_lock(b);
-		hlist_bl_for_each_entry(itnode, n, b, node) {
-			nodes++;
-			if (itnode->state[task->id] & DUET_MASK_VALID)
-				tnodes++;
+			end = loop;
 		}
-		hlist_bl_unlock(b);
-		local_irq_restore(flags);
 
-		end = loop;
-	}
+		if (start != loop - 1)
+			printk(KERN_INFO "duet:   Buckets %lu - %lu: %llu nodes (task: %llu)\n",
+				start, end, nodes, tnodes);
 
-	if (start != loop - 1)
-		printk(KERN_INFO "duet:   Buckets %lu - %lu: %llu nodes (task: %llu)\n",
-			start, end, nodes, tnodes);
+		printk(KERN_INFO "duet: Partition %d total: %llu nodes (task: %llu)\n",
+			part, pnodes, ptnodes);
+	}
 
 #ifdef CONFIG_DUET_STATS
 	printk(KERN_INFO "duet: %lu (%lu/%lu) lookups per request on average\n",
@@ -18,11 +18,15 @@
 
 #include <linux/fs.h>
 #include <linux/mm.h>
+#include <linux/slab.h>
 #include "common.h"
 
 duet_hook_t *duet_hook_fp = NULL;
 EXPORT_SYMBOL(duet_hook_fp);
 
+duet_dio_hook_t *duet_dio_hook_fp = NULL;
+EXPORT_SYMBOL(duet_dio_hook_fp);
+
 /*
  * The framework implements two models that define how we update the page state
  * when a new event occurs: the state-based, and the event-based model.
@@ -81,13 +85,16 @@ static int process_dir_inode(struct duet_task *task, struct inode *inode,
 	struct radix_tree_iter iter;
 	void **slot;
 	__u16 state;
-	unsigned long long uuid = DUET_GET_UUID(inode);
+	unsigned long long uuid = duet_task_uuid(task, inode);
 
 	/* If the file is done, don't bother sending events. We probably didn't
 	 * receive any to begin with */
 	if (bittree_check_done_bit(&task->bittree, uuid, 1))
 		return 0;
 
+	if (duet_filter_inode(task, inode, uuid))
+		return 0;
+
 	/* Go through all pages of this inode */
 	rcu_read_lock();
 	radix_tree_for_each_slot(slot, &inode->i_mapping->page_tree, &iter, 0) {
@@ -96,86 +103,115 @@ static int process_dir_inode(struct duet_task *task, struct inode *inode,
 			continue;
 
 		state = was_removed ? DUET_PAGE_REMOVED : DUET_PAGE_ADDED;
-		hash_add(task, uuid, page->index, state, 1);
+		hash_add(task, uuid, page->index, duet_page_part(page), state,
+			 was_removed ? DUET_LRU_UNKNOWN : duet_page_lru(page), 1);
 	}
 	rcu_read_unlock();
 
 	return 0;
 }
 
+struct scan_dir_data {
+	struct duet_task	*task;
+	int			was_removed;
+	struct inode		**relink;	/* files to recheck after the walk */
+	int			nrelink;
+	int			relink_size;
+};
+
 /*
- * Scan through the page cache for inodes falling under a given directory.
- * Used when a directory is moved inside/outside the task's scope and we need
- * to generate Added/Removed (depending on was_removed value) events to keep
- * task updated.
+ * A file gained, lost, or moved a link. Its relevance is decided by all of its
+ * links, so update it, and generate Added/Removed events if it changed.
  */
-static int scan_cached_dir(struct duet_task *task, struct inode *dir_inode,
-	int was_removed)
+static void relink_file(struct duet_task *task, struct inode *inode)
 {
-	unsigned int loop;
-	struct hlist_head *head;
-	struct inode *inode = NULL;
-	struct duet_bittree inodetree;
-	struct dentry *tmp, *dir_dentry = NULL;
-
-	bittree_init(&inodetree, 1, 0);
-
-	/* No hard links allowed for dirs, so just grab first dentry */
-	if (!hlist_empty(&dir_inode->i_dentry)) {
-		hlist_for_each_entry(tmp, &dir_inode->i_dentry, d_alias) {
-			if (!(IS_ROOT(tmp) && (tmp->d_flags & DCACHE_DISCONNECTED))) {
-				dir_dentry = tmp;
-				break;
-			}
-		}
+	switch (bittree_recheck_inode(&task->bittree, task, inode)) {
+	case 1:
+		process_dir_inode(task, inode, 0);
+		break;
+	case 2:
+		process_dir_inode(task, inode, 1);
+		break;
 	}
+}
 
-	if (!dir_dentry)
-		printk(KERN_INFO "duet: dir cache scan failed\n");
-	printk(KERN_INFO "duet: dir cache scan started\n");
-
-	loop = 0;
-again:
-	for (; loop < (1U << *duet_i_hash_shift); loop++) {
-		head = *duet_inode_hashtable + loop;
-		spin_lock(duet_inode_hash_lock);
+static void scan_dir_dentry(void *data, struct dentry *dentry)
+{
+	struct scan_dir_data *sd = data;
+	struct inode *inode = dentry->d_inode;
+	unsigned long long uuid;
 
-		/* Process this hash bucket */
-		hlist_for_each_entry(inode, head, i_hash) {
-			if (inode->i_sb != task->f_sb)
-				continue;
+	if (!inode || (!S_ISREG(inode->i_mode) && !S_ISDIR(inode->i_mode)))
+		return;
 
-			/* If we haven't seen this inode before, and it's a
-			 * descendant of the dir we're moving, process it. */
-			if (bittree_check(&inodetree, DUET_GET_UUID(inode), 1, NULL) != 1) {
-				spin_lock(&inode->i_lock);
-				if (inode->i_state & DUET_INODE_FREEING) {
-					unsigned long long uuid = DUET_GET_UUID(inode);
-					spin_unlock(&inode->i_lock);
-					spin_unlock(duet_inode_hash_lock);
-					bittree_set_done(&inodetree, uuid, 1);
-				} else {
-					__iget(inode);
-					spin_unlock(&inode->i_lock);
-					spin_unlock(duet_inode_hash_lock);
-
-					/* Check that the inode falls under our dir */
-					if (!d_find_path(inode, dir_dentry, 0, NULL, 0, NULL))
-						process_dir_inode(task, inode, was_removed);
-					bittree_set_done(&inodetree, DUET_GET_UUID(inode), 1);
-					iput(inode);
-				}
-				goto again;
+	/*
+	 * Files with links outside the moved dir may not change scope. Finding
+	 * their paths needs rename_lock, which the walk may hold, so we look at
+	 * them after it.
+	 */
+	if (S_ISREG(inode->i_mode) && inode->i_nlink > 1) {
+		if (sd->nrelink == sd->relink_size) {
+			struct inode **tmp;
+
+			tmp = krealloc(sd->relink, sizeof(*tmp) *
+				(sd->relink_size ? 2 * sd->relink_size : 16),
+				GFP_ATOMIC);
+			if (!tmp) {
+				printk(KERN_ERR "duet: no memory to recheck inode "
+					"%lu\n", inode->i_ino);
+				return;
 			}
+			sd->relink = tmp;
+			sd->relink_size = sd->relink_size ?
+					  2 * sd->relink_size : 16;
 		}
 
-		spin_unlock(duet_inode_hash_lock);
+		sd->relink[sd->nrelink++] = inode;
+		return;
 	}
 
-	printk(KERN_INFO "duet: dir cache scan finished\n");
-	bittree_destroy(&inodetree);
+	/* We know where it is now, so no need to look it up again */
+	uuid = duet_task_uuid(sd->task, inode);
+	bittree_set_seen(&sd->task->bittree, uuid, !sd->was_removed);
 
-	return 0;
+	if (S_ISREG(inode->i_mode))
+		process_dir_inode(sd->task, inode, sd->was_removed);
+}
+
+/*
+ * Walk the cached subtree of a directory that was moved inside/outside the
+ * task's scope, updating the relevance of the inodes under it and generating
+ * Added/Removed (depending on was_removed value) events to keep task updated.
+ * Inodes without a cached dentry can't be reached, so what we know of those
+ * that were seen while they had one goes stale, until they get a new link or
+ * are unlinked.
+ */
+static void scan_cached_dir(struct duet_task *task, struct dentry *dir_dentry,
+	int was_removed)
+{
+	int i, gone;
+	struct inode *inode;
+	struct scan_dir_data sd = { .task = task, .was_removed = was_removed };
+
+	d_duet_walk(dir_dentry, &sd, scan_dir_dentry);
+
+	/*
+	 * We hold no references to the files we put aside, but we're still in
+	 * the RCU read section of the hook, so their inodes can't be freed
+	 * under us. Skip the ones that are on their way out.
+	 */
+	for (i = 0; i < sd.nrelink; i++) {
+		inode = sd.relink[i];
+
+		spin_lock(&inode->i_lock);
+		gone = inode->i_state & (I_NEW | DUET_INODE_FREEING);
+		spin_unlock(&inode->i_lock);
+
+		if (!gone)
+			relink_file(task, inode);
+	}
+
+	kfree(sd.relink);
 }
 
 /* Handle an event. We're in RCU context so whatever happens, stay awake! */
@@ -187,7 +223,9 @@ void duet_hook(__u16 evtcode, void *data)
 	struct duet_task *cur;
 	unsigned long page_idx = 0;
 	unsigned long long uuid = 0;
-	int p_old, p_new;
+	__u8 lru = DUET_LRU_UNKNOWN;
+	unsigned long old_mask = 0, new_mask = 0;
+	int fs, p_old, p_new;
 
 	/* Duet must be online */
 	if (!duet_online())
@@ -198,6 +236,7 @@ void duet_hook(__u16 evtcode, void *data)
 		/* Handle file event */
 		switch (evtcode) {
 			case DUET_IN_DELETE:
+			case DUET_IN_CREATE:	/* new hard link to the inode */
 				inode = (struct inode *)data;
 				break;
 			case DUET_IN_MOVED:
@@ -222,13 +261,27 @@ void duet_hook(__u16 evtcode, void *data)
 
 		inode = page_mapping(page)->host;
 		page_idx = page->index;
+
+		/* Removed pages are no longer on any LRU list */
+		if (!(evtcode & DUET_PAGE_REMOVED))
+			lru = duet_page_lru(page);
 	}
 
 	/* Check that we're referring to an actual inode and get its UUID */
 	if (!inode)
 		return;
 
-	uuid = DUET_GET_UUID(inode);
+	/*
+	 * Moved dirs take their subtree's scope tags with them. The tags of the
+	 * old and new parents tell tagged tasks whether the move took the dir
+	 * in or out of their scope.
+	 */
+	if (mdata && mdata->dentry && mdata->old_dir && mdata->new_dir &&
+	    mdata->old_dir != mdata->new_dir) {
+		old_mask = duet_scope_mask(mdata->old_dir);
+		new_mask = duet_scope_mask(mdata->new_dir);
+		duet_scope_moved(mdata->dentry, old_mask != new_mask);
+	}
 
 	/* Verify that the inode does not belong to a special file */
 	if (!S_ISREG(inode->i_mode) && !S_ISDIR(inode->i_mode)) {
@@ -244,22 +297,40 @@ void duet_hook(__u16 evtcode, void *data)
 	/* Look for tasks interested in this event type and invoke callbacks */
 	rcu_read_lock();
 	list_for_each_entry_rcu(cur, &duet_env.tasks, task_list) {
-		/* Verify that the event refers to the fs we're interested in */
-		if (cur->f_sb && cur->f_sb != inode->i_sb) {
+		/* Verify that the event refers to a fs we're interested in */
+		fs = duet_scope_fs(cur, inode->i_sb);
+		if (fs < 0) {
 			//duet_dbg(KERN_INFO "duet: event sb not matching\n");
 			continue;
 		}
 
+		uuid = DUET_SCOPE_UUID(fs, inode);
+
 		duet_dbg(KERN_INFO "duet: received event %x on (uuid %llu, inode %lu, "
 				"offt %lu)\n", evtcode, uuid, inode->i_ino, page_idx);
 
+		/* Leased pages that get dirtied or leave the cache are let go */
+		if (page && (evtcode & (DUET_PAGE_REMOVED | DUET_PAGE_DIRTY)))
+			duet_lease_drop(cur, uuid, page_idx);
+
 		/* Handle some file task specific events */
 		if (cur->is_file) {
 			switch (evtcode) {
 			case DUET_IN_DELETE:
+				/* A link is gone, but others may be left */
+				if (inode->i_nlink && !S_ISDIR(inode->i_mode)) {
+					relink_file(cur, inode);
+					continue;
+				}
+
 				/* Reset state for this inode */
 				bittree_clear_bits(&cur->bittree, uuid, 1);
 				continue;
+			case DUET_IN_CREATE:
+				/* The new link may bring the file in scope */
+				if (!S_ISDIR(inode->i_mode))
+					relink_file(cur, inode);
+				continue;
 			case DUET_IN_MOVED:
 				/* Case 1: Sanity checking */
 				if (!(mdata->old_dir) || !(mdata->new_dir))
@@ -269,9 +340,23 @@ void duet_hook(__u16 evtcode, void *data)
 				if (mdata->old_dir == mdata->new_dir)
 					continue;
 
+				/*
+				 * Files may have other links keeping them in
+				 * (or out of) scope, so look at all of them.
+				 */
+				if (!S_ISDIR(inode->i_mode)) {
+					relink_file(cur, inode);
+					continue;
+				}
+
 				/* Check whether old and new parents are in task scope */
-				p_old = do_find_path(cur, mdata->old_dir, 0, NULL);
-				p_new = do_find_path(cur, mdata->new_dir, 0, NULL);
+				if (duet_scope_tagged(cur)) {
+					p_old = !(old_mask & duet_scope_bit(cur));
+					p_new = !(new_mask & duet_scope_bit(cur));
+				} else {
+					p_old = do_find_path(cur, mdata->old_dir, 0, NULL);
+					p_new = do_find_path(cur, mdata->new_dir, 0, NULL);
+				}
 				if (p_old == -1 || p_new == -1) {
 					printk(KERN_ERR "duet: can't determine parent dir relevance\n");
 					continue;
@@ -282,32 +367,13 @@ void duet_hook(__u16 evtcode, void *data)
 				 * Nothing to do.
 				 */
 
-				/* Case 4: Item was moved outside task scope */
-				if (!p_old && p_new) {
-					if (!S_ISDIR(inode->i_mode)) {
-						/* Item is a file. Unmark relevant bit */
-						bittree_unset_relv(&cur->bittree, uuid, 1);
-						process_dir_inode(cur, inode, 1);
-					} else {
-						/* Item is a dir. Clear seen, relevant bitmaps */
-						bittree_clear_bitmap(&cur->bittree,
-							BMAP_SEEN | BMAP_RELV);
-						scan_cached_dir(cur, inode, 1);
-					}
-				}
+				/* Case 4: Dir was moved outside task scope */
+				if (!p_old && p_new && mdata->dentry)
+					scan_cached_dir(cur, mdata->dentry, 1);
 
-				/* Case 5: Item was moved inside task scope */
-				if (p_old && !p_new) {
-					if (!S_ISDIR(inode->i_mode)) {
-						/* Item is a file. Mark the relevant bit */
-						bittree_set_relv(&cur->bittree, uuid, 1);
-						process_dir_inode(cur, inode, 0);
-					} else {
-						/* Item is a dir. Clear seen bitmap only */
-						bittree_clear_bitmap(&cur->bittree, BMAP_SEEN);
-						scan_cached_dir(cur, inode, 0);
-					}
-				}
+				/* Case 5: Dir was moved inside task scope */
+				if (p_old && !p_new && mdata->dentry)
+					scan_cached_dir(cur, mdata->dentry, 0);
 				continue;
 			}
 
@@ -316,10 +382,89 @@ void duet_hook(__u16 evtcode, void *data)
 				continue;
 		}
 
+		/* Drop page events on files the task filtered out */
+		if (page && duet_filter_inode(cur, inode, uuid)) {
+			atomic64_inc(&cur->filtered);
+			continue;
+		}
+
 		/* Update the hash table */
-		if (hash_add(cur, uuid, page_idx, evtcode, 0))
+		if (hash_add(cur, uuid, page_idx, duet_page_part(page), evtcode,
+			     lru, 0))
 			printk(KERN_ERR "duet: hash table add failed\n");
+
+		/* Keep pages the task is told about cached until it's done */
+		if (page && (evtcode & cur->evtmask & DUET_PAGE_ADDED))
+			duet_lease_add(cur, uuid, page);
 	}
 	rcu_read_unlock();
 }
 EXPORT_SYMBOL_GPL(duet_hook);
+
+/*
+ * A direct I/O write of len bytes at offset completed. The data went around
+ * the page cache, so we haven't seen it dirty any pages. File tasks are done
+ * with the file no more, and tasks get a Dirty event on every page in the
+ * range. Block tasks decide what their done bits stand for, so it's up to them
+ * to unset the right ones when they get the events.
+ *
+ * Called in process context. To bound the time spent here, and the items a
+ * single large write leaves in the ItemTable, only the first
+ * DUET_DIO_MAX_PAGES pages of the range get events.
+ */
+void duet_dio_hook(struct inode *inode, loff_t offset, ssize_t len)
+{
+	struct duet_task *cur;
+	unsigned long long uuid;
+	pgoff_t idx, last;
+	int fs;
+
+	if (!duet_online() || len <= 0)
+		return;
+
+	if (!S_ISREG(inode->i_mode) || !inode->i_ino)
+		return;
+
+	last = (offset + len - 1) >> PAGE_CACHE_SHIFT;
+	if (last - (offset >> PAGE_CACHE_SHIFT) >= DUET_DIO_MAX_PAGES)
+		last = (offset >> PAGE_CACHE_SHIFT) + DUET_DIO_MAX_PAGES - 1;
+
+	duet_dbg(KERN_INFO "duet: direct write on inode %lu (offt %lld, len %zd)\n",
+		inode->i_ino, offset, len);
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(cur, &duet_env.tasks, task_list) {
+		fs = duet_scope_fs(cur, inode->i_sb);
+		if (fs < 0)
+			continue;
+
+		uuid = DUET_SCOPE_UUID(fs, inode);
+
+		if (cur->is_file) {
+			bittree_unset_done(&cur->bittree, uuid, 1);
+
+			/* Not done now, so this only filters irrelevant files */
+			if (bittree_check_inode(&cur->bittree, cur, inode) == 1)
+				continue;
+		}
+
+		if (!(cur->evtmask & DUET_PAGE_DIRTY))
+			continue;
+
+		if (duet_filter_inode(cur, inode, uuid)) {
+			atomic64_add(last - (offset >> PAGE_CACHE_SHIFT) + 1,
+				     &cur->filtered);
+			continue;
+		}
+
+		for (idx = offset >> PAGE_CACHE_SHIFT; idx <= last; idx++) {
+			if (hash_add(cur, uuid, idx, numa_node_id(),
+				     DUET_PAGE_DIRTY, DUET_LRU_UNKNOWN, 0)) {
+				printk(KERN_ERR "duet: hash table add failed\n");
+				break;
+			}
+		}
+	}
+	rcu_read_unlock();
+}
+EXPORT_SYMBOL_GPL(duet_dio_hook);
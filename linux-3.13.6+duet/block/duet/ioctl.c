@@ -18,6 +18,7 @@
 
 #include <linux/slab.h>
 #include <linux/fs.h>
+#include <linux/ioprio.h>
 #include <linux/duet.h>
 #include <linux/vmalloc.h>
 #include "ioctl.h"
@@ -47,6 +48,17 @@ int duet_bootstrap(__u8 numtasks)
 	/* Initialize task list */
 	INIT_LIST_HEAD(&duet_env.tasks);
 	mutex_init(&duet_env.task_list_mutex);
+
+	/* Let reclaim take back leased pages under memory pressure */
+	if (duet_lease_start()) {
+		printk(KERN_ERR "duet: failed to register lease shrinker\n");
+		hash_destroy();
+		atomic_set(&duet_env.status, DUET_STATUS_OFF);
+		return 1;
+	}
+
+	/* Scope tags may have gone stale while we were offline */
+	duet_scope_init();
 	atomic_set(&duet_env.status, DUET_STATUS_ON);
 
 #ifdef CONFIG_DUET_STATS
@@ -55,6 +67,8 @@ int duet_bootstrap(__u8 numtasks)
 #endif /* CONFIG_DUET_STATS */
 
 	rcu_assign_pointer(duet_hook_fp, duet_hook);
+	rcu_assign_pointer(duet_evict_hook_fp, duet_evict_hook);
+	rcu_assign_pointer(duet_dio_hook_fp, duet_dio_hook);
 	synchronize_rcu();
 	return 0;
 }
@@ -70,7 +84,11 @@ int duet_shutdown(void)
 	}
 
 	rcu_assign_pointer(duet_hook_fp, NULL);
+	rcu_assign_pointer(duet_evict_hook_fp, NULL);
+	rcu_assign_pointer(duet_dio_hook_fp, NULL);
 	synchronize_rcu();
+	duet_lease_stop();
+	duet_scope_stop();
 
 	/* Remove all tasks */
 	mutex_lock(&duet_env.task_list_mutex);
@@ -91,7 +109,7 @@ int duet_shutdown(void)
 	mutex_unlock(&duet_env.task_list_mutex);
 
 	/* Destroy global hash table */
-	vfree((void *)duet_env.itm_hash_table);
+	hash_destroy();
 
 	INIT_LIST_HEAD(&duet_env.tasks);
 	mutex_destroy(&duet_env.task_list_mutex);
@@ -138,18 +156,31 @@ static int find_get_inode(struct super_block *sb, unsigned long long c_uuid,
 int do_find_path(struct duet_task *task, struct inode *inode, int getpath,
 	char *path)
 {
-	int len, ret = 0;
+	int len, fs, ret = 0;
 	char *p;
 
-	if (!task || !task->p_dentry) {
+	if (!task || !duet_is_utask(task)) {
 		printk(KERN_ERR "do_find_path%s: invalid task registration\n",
 			(getpath ? "" : " (null)"));
 		return 1;
 	}
 
-	/* Now get the path */
+	/* Inodes on filesystems the task has no scope on are never relevant */
+	fs = duet_scope_fs(task, inode->i_sb);
+	if (fs < 0) {
+		if (getpath)
+			path[0] = '\0';
+		return 1;
+	}
+
+	/* Relevance checks can usually be answered by the scope tags */
+	if (!getpath && duet_scope_tagged(task))
+		return duet_scope_check(task, inode);
+
+	/* Now get the path, relative to the registered dir on that filesystem */
 	len = MAX_PATH;
-	ret = d_find_path(inode, task->p_dentry, getpath, task->pathbuf, len, &p);
+	ret = d_find_path(inode, task->scopes[fs].dentry, getpath, task->pathbuf,
+			  len, &p);
 	if (ret == 1) {
 		duet_dbg(KERN_INFO "do_find_path%s: parent dentry not found\n",
 				(getpath ? "" : " (null)"));
@@ -174,16 +205,17 @@ int duet_find_path(struct duet_task *task, unsigned long long uuid, int getpath,
 	char *path)
 {
 	int ret = 0;
+	unsigned int fs = DUET_UUID_FS(uuid);
 	struct inode *ino;
 
-	if (!task || !task->p_dentry) {
+	if (!task || !duet_is_utask(task) || fs >= task->numscopes) {
 		printk(KERN_ERR "duet_find_path%s: invalid task registration\n",
 			(getpath ? "" : " (null)"));
 		return 1;
 	}
 
 	/* First, we need to find struct inode for child and parent */
-	if (find_get_inode(task->f_sb, uuid, &ino)) {
+	if (find_get_inode(task->scopes[fs].sb, DUET_UUID_LOCAL(uuid), &ino)) {
 		duet_dbg(KERN_NOTICE "duet_find_path%s: failed to find child inode\n",
 			(getpath ? "" : " (null)"));
 		return 1;
@@ -214,6 +246,79 @@ static int duet_get_path(__u8 tid, __u64 c_uuid, char *cpath)
 	return ret;
 }
 
+/*
+ * Records the I/O priority of a task; nothing is applied here, since the
+ * caller may just be a tool configuring the task for someone else. Kernel
+ * tasks pick it up the next time they start working, and user tasks the
+ * next time their process fetches items (see duet_ioctl_adopt_ioprio).
+ */
+static int duet_ioctl_set_ioprio(__u8 tid, __u16 ioprio)
+{
+	return duet_set_ioprio(tid, ioprio) ? 1 : 0;
+}
+
+/*
+ * User tasks do their work in the process that fetches their items, so that
+ * process switches to the priority of the task. IOPRIO_CLASS_NONE leaves the
+ * priority of the process alone.
+ */
+static void duet_ioctl_adopt_ioprio(__u8 tid)
+{
+	int is_user, cur_ioprio;
+	__u16 ioprio;
+	struct duet_task *task = duet_find_task(tid);
+
+	if (!task)
+		return;
+
+	is_user = duet_is_utask(task);
+	ioprio = task->ioprio;
+
+	/* decref and wake up cleaner if needed */
+	if (atomic_dec_and_test(&task->refcount))
+		wake_up(&task->cleaner_queue);
+
+	if (!is_user || IOPRIO_PRIO_CLASS(ioprio) == IOPRIO_CLASS_NONE)
+		return;
+
+	task_lock(current);
+	cur_ioprio = current->io_context ? current->io_context->ioprio :
+				IOPRIO_PRIO_VALUE(IOPRIO_CLASS_NONE, 0);
+	task_unlock(current);
+
+	if (cur_ioprio != ioprio && set_task_ioprio(current, ioprio))
+		printk(KERN_NOTICE "duet: failed to set I/O priority of task "
+			"%d\n", tid);
+}
+
+/*
+ * Adds a dir on another filesystem to a user task. Kernel tasks take a
+ * superblock instead of a path, so they can't be extended from userspace.
+ */
+static int duet_ioctl_add_scope(__u8 tid, char *path)
+{
+	int is_user;
+	struct duet_task *task = duet_find_task(tid);
+
+	if (!task) {
+		printk(KERN_ERR "duet_add_scope: invalid taskid (%d)\n", tid);
+		return 1;
+	}
+
+	is_user = duet_is_utask(task);
+
+	/* decref and wake up cleaner if needed */
+	if (atomic_dec_and_test(&task->refcount))
+		wake_up(&task->cleaner_queue);
+
+	if (!is_user) {
+		printk(KERN_ERR "duet_add_scope: task %d is a kernel task\n", tid);
+		return 1;
+	}
+
+	return duet_add_scope(tid, path) ? 1 : 0;
+}
+
 static int duet_ioctl_fetch(void __user *arg)
 {
 	struct duet_ioctl_fetch_args *fa;
@@ -228,6 +333,8 @@ static int duet_ioctl_fetch(void __user *arg)
 	if (fa->num > MAX_ITEMS)
 		fa->num = MAX_ITEMS;
 
+	duet_ioctl_adopt_ioprio(fa->tid);
+
 	if (duet_fetch(fa->tid, fa->itm, &fa->num)) {
 		printk(KERN_ERR "duet: failed to fetch for user\n");
 		goto err;
@@ -246,6 +353,61 @@ err:
 	return -EINVAL;
 }
 
+static int duet_ioctl_bfetch(void __user *arg)
+{
+	__u16 i;
+	struct duet_ioctl_bfetch_args *fa;
+	struct duet_item *items = NULL;
+	struct duet_block *blks = NULL;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	fa = memdup_user(arg, sizeof(*fa));
+	if (IS_ERR(fa))
+		return PTR_ERR(fa);
+
+	if (fa->num > MAX_BITEMS)
+		fa->num = MAX_BITEMS;
+
+	items = kmalloc(sizeof(*items) * MAX_BITEMS, GFP_KERNEL);
+	blks = kmalloc(sizeof(*blks) * MAX_BITEMS, GFP_KERNEL);
+	if (!items || !blks)
+		goto err;
+
+	duet_ioctl_adopt_ioprio(fa->tid);
+
+	if (duet_fetch(fa->tid, items, &fa->num)) {
+		printk(KERN_ERR "duet: failed to fetch for user\n");
+		goto err;
+	}
+
+	/* The items are dequeued already; unmapped ones go out all the same */
+	if (duet_map_items(fa->tid, items, blks, fa->num))
+		printk(KERN_NOTICE "duet: failed to map items for user\n");
+
+	for (i = 0; i < fa->num; i++) {
+		fa->bitm[i].itm = items[i];
+		fa->bitm[i].blk = blks[i];
+	}
+
+	if (copy_to_user(arg, fa, sizeof(*fa))) {
+		printk(KERN_ERR "duet: failed to copy out args\n");
+		goto err;
+	}
+
+	kfree(blks);
+	kfree(items);
+	kfree(fa);
+	return 0;
+
+err:
+	kfree(blks);
+	kfree(items);
+	kfree(fa);
+	return -EINVAL;
+}
+
 static int duet_ioctl_cmd(void __user *arg)
 {
 	struct duet_ioctl_cmd_args *ca;
@@ -295,6 +457,11 @@ static int duet_ioctl_cmd(void __user *arg)
 		ca->ret = duet_deregister(ca->tid);
 		break;
 
+	case DUET_ADD_SCOPE:
+		ca->path[MAX_PATH - 1] = '\0';
+		ca->ret = duet_ioctl_add_scope(ca->tid, ca->path);
+		break;
+
 	case DUET_SET_DONE:
 		ca->ret = duet_set_done(ca->tid, ca->itmidx, ca->itmnum);
 		break;
@@ -319,6 +486,34 @@ static int duet_ioctl_cmd(void __user *arg)
 		ca->ret = duet_get_path(ca->tid, ca->c_uuid, ca->cpath);
 		break;
 
+	case DUET_SET_IOPRIO:
+		ca->ret = duet_ioctl_set_ioprio(ca->tid, ca->ioprio);
+		break;
+
+	case DUET_SET_LEASE:
+		ca->ret = duet_set_lease(ca->tid, ca->lease_pages,
+					 ca->lease_msecs) ? 1 : 0;
+		break;
+
+	case DUET_RELEASE_LEASE:
+		ca->ret = duet_release_lease(ca->tid, ca->l_uuid, ca->l_idx,
+					     ca->l_count) ? 1 : 0;
+		break;
+
+	case DUET_SET_FILTER:
+		ca->ret = duet_set_filter(ca->tid, &ca->filter) ? 1 : 0;
+		break;
+
+	case DUET_SET_ALLOWED:
+		ca->ret = duet_filter_allow(ca->tid, ca->itmidx,
+					    ca->itmnum) ? 1 : 0;
+		break;
+
+	case DUET_UNSET_ALLOWED:
+		ca->ret = duet_filter_disallow(ca->tid, ca->itmidx,
+					       ca->itmnum) ? 1 : 0;
+		break;
+
 	default:
 		printk(KERN_INFO "duet: unknown tasks command received\n");
 		goto err;
@@ -365,6 +560,24 @@ static int duet_ioctl_tlist(void __user *arg)
 		argp->tasks[i].is_file = cur->is_file;
 		argp->tasks[i].bitrange = cur->bittree.range;
 		argp->tasks[i].evtmask = cur->evtmask;
+		argp->tasks[i].ioprio = cur->ioprio;
+		argp->tasks[i].bytes_read = atomic64_read(&cur->io_read);
+		argp->tasks[i].bytes_skipped = atomic64_read(&cur->io_skipped);
+		argp->tasks[i].pages_lost = atomic64_read(&cur->evicted);
+		spin_lock_irq(&cur->lease_lock);
+		argp->tasks[i].lease_max = cur->lease_max;
+		argp->tasks[i].lease_cur = cur->lease_cur;
+		argp->tasks[i].pages_leased = cur->leased;
+		argp->tasks[i].pages_expired = cur->lease_expired;
+		argp->tasks[i].pages_reclaimed = cur->lease_reclaimed;
+		spin_unlock_irq(&cur->lease_lock);
+		argp->tasks[i].evict_calls = atomic64_read(&cur->evict_calls);
+		argp->tasks[i].evict_ns = atomic64_read(&cur->evict_ns);
+		argp->tasks[i].evict_overruns = atomic_read(&cur->evict_overruns);
+		argp->tasks[i].evict_off = cur->evict_off;
+		argp->tasks[i].numscopes = cur->numscopes;
+		argp->tasks[i].filter_mask = duet_filter_mask(cur);
+		argp->tasks[i].pages_filtered = atomic64_read(&cur->filtered);
 		i++;
 		if (i == argp->numtasks)
 			break;
@@ -407,6 +620,8 @@ long duet_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		return duet_ioctl_tlist(argp);
 	case DUET_IOC_FETCH:
 		return duet_ioctl_fetch(argp);
+	case DUET_IOC_BFETCH:
+		return duet_ioctl_bfetch(argp);
 	}
 
 	return -EINVAL;
@@ -22,6 +22,7 @@
 #include "common.h"
 
 #define MAX_ITEMS	512
+#define MAX_BITEMS	256
 #define MAX_NAME	22
 #define MAX_PATH	1024
 #define DUET_IOC_MAGIC	0xDE
@@ -38,6 +39,13 @@ enum duet_ioctl_codes {
 	DUET_PRINTBIT,
 	DUET_PRINTITEM,
 	DUET_GET_PATH,
+	DUET_SET_IOPRIO,
+	DUET_SET_LEASE,
+	DUET_RELEASE_LEASE,
+	DUET_ADD_SCOPE,
+	DUET_SET_FILTER,
+	DUET_SET_ALLOWED,
+	DUET_UNSET_ALLOWED,
 };
 
 struct duet_task_attrs {
@@ -46,6 +54,22 @@ struct duet_task_attrs {
 	__u8	is_file;				/* out */
 	__u32 	bitrange;				/* out */
 	__u16	evtmask;				/* out */
+	__u16	ioprio;					/* out */
+	__u64	bytes_read;				/* out */
+	__u64	bytes_skipped;				/* out */
+	__u64	pages_lost;				/* out */
+	__u32	lease_max;				/* out */
+	__u32	lease_cur;				/* out */
+	__u64	pages_leased;				/* out */
+	__u64	pages_expired;				/* out */
+	__u64	pages_reclaimed;			/* out */
+	__u64	evict_calls;				/* out */
+	__u64	evict_ns;				/* out */
+	__u32	evict_overruns;				/* out */
+	__u8	evict_off;				/* out */
+	__u8	numscopes;				/* out */
+	__u32	filter_mask;				/* out */
+	__u64	pages_filtered;				/* out */
 };
 
 /* We return up to MAX_ITEMS at a time (9b each). */
@@ -55,6 +79,21 @@ struct duet_ioctl_fetch_args {
 	struct duet_item	itm[MAX_ITEMS];		/* out */
 };
 
+/*
+ * Tasks registered with DUET_MAP_BLOCKS can also fetch the physical location
+ * of each item. Fewer items fit in one call, to respect the ioctl size limit.
+ */
+struct duet_bitem {
+	struct duet_item	itm;
+	struct duet_block	blk;
+};
+
+struct duet_ioctl_bfetch_args {
+	__u8 			tid;			/* in */
+	__u16 			num;			/* in/out */
+	struct duet_bitem	bitm[MAX_BITEMS];	/* out */
+};
+
 struct duet_ioctl_list_args {
 	__u8			numtasks;		/* out */
 	struct duet_task_attrs	tasks[0];		/* out */
@@ -69,14 +108,14 @@ struct duet_ioctl_cmd_args {
 		struct {
 			__u8	numtasks;		/* in */
 		};
-		/* Registration args */
+		/* Registration args (only path, when adding a scope) */
 		struct {
 			__u32 	regmask;		/* in */
 			__u32 	bitrange;		/* in */
 			char 	name[MAX_NAME];		/* in */
 			char	path[MAX_PATH];		/* in */
 		};
-		/* Bitmap manipulation args */
+		/* Bitmap and allowlist manipulation args */
 		struct {
 			__u32 	itmnum;			/* in */
 			__u64 	itmidx;			/* in */
@@ -86,11 +125,31 @@ struct duet_ioctl_cmd_args {
 			__u64	c_uuid;			/* in */
 			char 	cpath[MAX_PATH];	/* out */
 		};
+		/* I/O priority args */
+		struct {
+			__u16	ioprio;			/* in */
+		};
+		/* Page lease args */
+		struct {
+			__u32	lease_pages;		/* in */
+			__u32	lease_msecs;		/* in */
+		};
+		/* Page lease release args */
+		struct {
+			__u64	l_uuid;			/* in */
+			__u64	l_idx;			/* in */
+			__u32	l_count;		/* in */
+		};
+		/* Event filter args */
+		struct {
+			struct duet_filter filter;	/* in */
+		};
 	};	
 };
 
 #define DUET_IOC_CMD	_IOWR(DUET_IOC_MAGIC, 1, struct duet_ioctl_cmd_args)
 #define DUET_IOC_TLIST	_IOWR(DUET_IOC_MAGIC, 2, struct duet_ioctl_list_args)
 #define DUET_IOC_FETCH	_IOWR(DUET_IOC_MAGIC, 3, struct duet_ioctl_fetch_args)
+#define DUET_IOC_BFETCH	_IOWR(DUET_IOC_MAGIC, 4, struct duet_ioctl_bfetch_args)
 
 #endif /* _DUET_IOCTL_H */
@@ -0,0 +1,402 @@
+/*
+ * Copyright (C) 2014-2015 George Amvrosiadis.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 021110-1307, USA.
+ */
+
+#include <linux/mm.h>
+#include <linux/pagemap.h>
+#include <linux/jiffies.h>
+#include <linux/shrinker.h>
+#include "common.h"
+
+/*
+ * Page leases keep the pages a task is told about in the page cache until the
+ * task gets to them. When a clean page is added to the cache, tasks with a
+ * lease limit take a reference on it, which keeps reclaim from evicting it.
+ * The reference is dropped when the task marks the page's file done (file
+ * tasks), releases it explicitly, the page is dirtied or removed from the
+ * cache, the lease expires, or the task goes away. Under memory pressure, the
+ * shrinker takes the oldest leases back.
+ *
+ * All leases of a task last equally long, so the lease list is kept in order
+ * of expiry, and a single timer per task suffices.
+ */
+#define DUET_LEASE_DEF_MSECS	(30 * MSEC_PER_SEC)
+#define DUET_LEASE_MAX_MSECS	(600 * MSEC_PER_SEC)
+#define DUET_LEASE_RAM_SHIFT	3	/* Lease at most 1/8th of memory */
+
+struct duet_lease {
+	struct rb_node		node;		/* In task->leases, by uuid/idx */
+	struct list_head	list;		/* In task->lease_list, by expiry */
+	struct page		*page;
+	unsigned long long	uuid;
+	unsigned long		idx;
+	unsigned long		expires;	/* In jiffies */
+};
+
+static int lease_cmp(struct duet_lease *l, unsigned long long uuid,
+	unsigned long idx)
+{
+	if (l->uuid != uuid)
+		return (l->uuid < uuid) ? -1 : 1;
+	if (l->idx != idx)
+		return (l->idx < idx) ? -1 : 1;
+	return 0;
+}
+
+/* Returns the first lease at or after (uuid, idx). Called under lease_lock. */
+static struct duet_lease *lease_first(struct duet_task *task,
+	unsigned long long uuid, unsigned long idx)
+{
+	struct rb_node *node = task->leases.rb_node;
+	struct duet_lease *l, *first = NULL;
+
+	while (node) {
+		l = rb_entry(node, struct duet_lease, node);
+		if (lease_cmp(l, uuid, idx) >= 0) {
+			first = l;
+			node = node->rb_left;
+		} else {
+			node = node->rb_right;
+		}
+	}
+
+	return first;
+}
+
+static struct duet_lease *lease_next(struct duet_lease *l)
+{
+	struct rb_node *node = rb_next(&l->node);
+
+	return node ? rb_entry(node, struct duet_lease, node) : NULL;
+}
+
+/* Unlinks a lease and queues it for disposal. Called under lease_lock. */
+static void lease_unlink(struct duet_task *task, struct duet_lease *l,
+	struct list_head *dispose)
+{
+	rb_erase(&l->node, &task->leases);
+	list_move_tail(&l->list, dispose);
+	task->lease_cur--;
+}
+
+/* Drops the page references of unlinked leases, outside of lease_lock */
+static void lease_dispose(struct list_head *dispose)
+{
+	struct duet_lease *l, *tmp;
+
+	list_for_each_entry_safe(l, tmp, dispose, list) {
+		page_cache_release(l->page);
+		kfree(l);
+	}
+}
+
+/*
+ * Lets go of up to nr of the oldest leases of a task. Unless reclaiming, only
+ * expired leases are released, and the timer is rearmed for the next one.
+ * Returns the number of leases released.
+ */
+static unsigned long lease_shrink(struct duet_task *task, unsigned long nr,
+	int reclaim)
+{
+	unsigned long n = 0, flags;
+	struct duet_lease *l;
+	LIST_HEAD(dispose);
+
+	spin_lock_irqsave(&task->lease_lock, flags);
+	while (n < nr && !list_empty(&task->lease_list)) {
+		l = list_first_entry(&task->lease_list, struct duet_lease, list);
+		if (!reclaim && time_before(jiffies, l->expires))
+			break;
+
+		lease_unlink(task, l, &dispose);
+		n++;
+	}
+
+	if (reclaim)
+		task->lease_reclaimed += n;
+	else
+		task->lease_expired += n;
+
+	if (!reclaim && !list_empty(&task->lease_list)) {
+		l = list_first_entry(&task->lease_list, struct duet_lease, list);
+		mod_timer(&task->lease_timer, l->expires);
+	}
+	spin_unlock_irqrestore(&task->lease_lock, flags);
+
+	lease_dispose(&dispose);
+	return n;
+}
+
+static void lease_timer_fn(unsigned long data)
+{
+	lease_shrink((struct duet_task *)data, ULONG_MAX, 0);
+}
+
+void duet_lease_init(struct duet_task *task)
+{
+	spin_lock_init(&task->lease_lock);
+	task->leases = RB_ROOT;
+	INIT_LIST_HEAD(&task->lease_list);
+	setup_timer(&task->lease_timer, lease_timer_fn, (unsigned long)task);
+	task->lease_max = task->lease_cur = 0;
+	task->lease_time = msecs_to_jiffies(DUET_LEASE_DEF_MSECS);
+	task->leased = task->lease_expired = task->lease_reclaimed = 0;
+}
+
+/* Releases all leases of a task that is going away */
+void duet_lease_destroy(struct duet_task *task)
+{
+	unsigned long flags;
+	struct duet_lease *l, *tmp;
+	LIST_HEAD(dispose);
+
+	del_timer_sync(&task->lease_timer);
+
+	spin_lock_irqsave(&task->lease_lock, flags);
+	task->lease_max = 0;
+	list_for_each_entry_safe(l, tmp, &task->lease_list, list)
+		lease_unlink(task, l, &dispose);
+	spin_unlock_irqrestore(&task->lease_lock, flags);
+
+	lease_dispose(&dispose);
+}
+
+/* Leases a clean page the task is being told about, if under its limit */
+void duet_lease_add(struct duet_task *task, unsigned long long uuid,
+	struct page *page)
+{
+	int c;
+	unsigned long flags;
+	struct rb_node **p, *parent = NULL;
+	struct duet_lease *l, *cur;
+
+	if (ACCESS_ONCE(task->lease_cur) >= ACCESS_ONCE(task->lease_max))
+		return;
+
+	if (PageDirty(page) || PageWriteback(page))
+		return;
+
+	l = kmalloc(sizeof(*l), GFP_NOWAIT);
+	if (!l)
+		return;
+
+	l->page = page;
+	l->uuid = uuid;
+	l->idx = page->index;
+
+	spin_lock_irqsave(&task->lease_lock, flags);
+	if (task->lease_cur >= task->lease_max)
+		goto out_free;
+
+	p = &task->leases.rb_node;
+	while (*p) {
+		parent = *p;
+		cur = rb_entry(parent, struct duet_lease, node);
+		c = lease_cmp(cur, uuid, l->idx);
+		if (c > 0)
+			p = &parent->rb_left;
+		else if (c < 0)
+			p = &parent->rb_right;
+		else
+			goto out_free;	/* Already leased */
+	}
+
+	page_cache_get(page);
+	l->expires = jiffies + task->lease_time;
+	rb_link_node(&l->node, parent, p);
+	rb_insert_color(&l->node, &task->leases);
+	list_add_tail(&l->list, &task->lease_list);
+	task->lease_cur++;
+	task->leased++;
+
+	if (task->lease_cur == 1)
+		mod_timer(&task->lease_timer, l->expires);
+	spin_unlock_irqrestore(&task->lease_lock, flags);
+	return;
+
+out_free:
+	spin_unlock_irqrestore(&task->lease_lock, flags);
+	kfree(l);
+}
+
+/*
+ * Releases the leases on pages [idx, idx + count) of inode uuid, or on all
+ * pages of inodes [uuid, uuid + count) if whole is set. Returns the number of
+ * leases released.
+ */
+static unsigned long lease_release(struct duet_task *task,
+	unsigned long long uuid, unsigned long idx, __u32 count, int whole)
+{
+	unsigned long n = 0, flags;
+	struct duet_lease *l, *next;
+	LIST_HEAD(dispose);
+
+	if (!ACCESS_ONCE(task->lease_cur) || !count)
+		return 0;
+
+	spin_lock_irqsave(&task->lease_lock, flags);
+	for (l = lease_first(task, uuid, whole ? 0 : idx); l; l = next) {
+		if (whole ? (l->uuid - uuid >= count) :
+			    (l->uuid != uuid || l->idx - idx >= count))
+			break;
+
+		next = lease_next(l);
+		lease_unlink(task, l, &dispose);
+		n++;
+	}
+	spin_unlock_irqrestore(&task->lease_lock, flags);
+
+	lease_dispose(&dispose);
+	return n;
+}
+
+/* A leased page was dirtied or removed from the cache, so let it go */
+void duet_lease_drop(struct duet_task *task, unsigned long long uuid,
+	unsigned long idx)
+{
+	lease_release(task, uuid, idx, 1, 0);
+}
+
+/* A file task is done with inodes [uuid, uuid + count) */
+void duet_lease_done(struct duet_task *task, __u64 uuid, __u32 count)
+{
+	lease_release(task, uuid, 0, count, 1);
+}
+
+/*
+ * Sets the number of pages a task can keep leased at once, and for how long.
+ * A zero limit disables leasing and releases any leases held, while a zero
+ * duration picks the default. Leases already held never get extended.
+ */
+int duet_set_lease(__u8 taskid, __u32 pages, __u32 msecs)
+{
+	unsigned long flags, lease_time;
+	struct duet_task *task;
+	struct duet_lease *l, *tmp;
+	LIST_HEAD(dispose);
+
+	if (!duet_online())
+		return -1;
+
+	if (msecs > DUET_LEASE_MAX_MSECS)
+		return -EINVAL;
+
+	task = duet_find_task(taskid);
+	if (!task)
+		return -ENOENT;
+
+	if (pages > (totalram_pages >> DUET_LEASE_RAM_SHIFT))
+		pages = totalram_pages >> DUET_LEASE_RAM_SHIFT;
+	lease_time = msecs_to_jiffies(msecs ? msecs : DUET_LEASE_DEF_MSECS);
+
+	spin_lock_irqsave(&task->lease_lock, flags);
+	task->lease_max = pages;
+	task->lease_time = lease_time;
+
+	/* Keep the list in order of expiry, and the lease count in bounds */
+	list_for_each_entry_safe(l, tmp, &task->lease_list, list) {
+		if (task->lease_cur > task->lease_max)
+			lease_unlink(task, l, &dispose);
+		else if (time_after(l->expires, jiffies + lease_time))
+			l->expires = jiffies + lease_time;
+	}
+
+	if (!list_empty(&task->lease_list)) {
+		l = list_first_entry(&task->lease_list, struct duet_lease, list);
+		mod_timer(&task->lease_timer, l->expires);
+	}
+	spin_unlock_irqrestore(&task->lease_lock, flags);
+
+	lease_dispose(&dispose);
+
+	/* decref and wake up cleaner if needed */
+	if (atomic_dec_and_test(&task->refcount))
+		wake_up(&task->cleaner_queue);
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(duet_set_lease);
+
+/* Releases the task's leases on pages [idx, idx + count) of inode uuid */
+int duet_release_lease(__u8 taskid, __u64 uuid, __u64 idx, __u32 count)
+{
+	struct duet_task *task;
+
+	if (!duet_online())
+		return -1;
+
+	task = duet_find_task(taskid);
+	if (!task)
+		return -ENOENT;
+
+	lease_release(task, uuid, idx, count, 0);
+
+	/* decref and wake up cleaner if needed */
+	if (atomic_dec_and_test(&task->refcount))
+		wake_up(&task->cleaner_queue);
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(duet_release_lease);
+
+static unsigned long lease_count_objects(struct shrinker *shrink,
+	struct shrink_control *sc)
+{
+	unsigned long count = 0;
+	struct duet_task *cur;
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(cur, &duet_env.tasks, task_list)
+		count += ACCESS_ONCE(cur->lease_cur);
+	rcu_read_unlock();
+
+	return count;
+}
+
+static unsigned long lease_scan_objects(struct shrinker *shrink,
+	struct shrink_control *sc)
+{
+	unsigned long freed = 0;
+	struct duet_task *cur;
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(cur, &duet_env.tasks, task_list) {
+		if (freed >= sc->nr_to_scan)
+			break;
+
+		freed += lease_shrink(cur, sc->nr_to_scan - freed, 1);
+	}
+	rcu_read_unlock();
+
+	return freed ? freed : SHRINK_STOP;
+}
+
+static struct shrinker lease_shrinker = {
+	.count_objects	= lease_count_objects,
+	.scan_objects	= lease_scan_objects,
+	.seeks		= DEFAULT_SEEKS,
+};
+
+int duet_lease_start(void)
+{
+	return register_shrinker(&lease_shrinker);
+}
+
+void duet_lease_stop(void)
+{
+	unregister_shrinker(&lease_shrinker);
+}
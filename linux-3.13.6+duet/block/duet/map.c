@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2014-2015 George Amvrosiadis.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 021110-1307, USA.
+ */
+
+#include <linux/fs.h>
+#include "common.h"
+
+/*
+ * Events carry an (inode, page index) pair. Block-oriented tasks can ask the
+ * framework to translate these to physical (device, sector) ranges, using the
+ * duet_map_page callback of the filesystem's super_operations. Translation
+ * happens at fetch time, since filesystems may need to sleep while looking up
+ * their extent maps, which we can't do from the page cache hooks.
+ *
+ * Returns 0 if the page was mapped, or 1 if it wasn't, in which case blk is
+ * zeroed out.
+ */
+static int do_map_item(struct duet_task *task, struct duet_item *itm,
+	struct duet_block *blk)
+{
+	int ret;
+	struct inode *inode;
+	struct super_block *sb;
+
+	memset(blk, 0, sizeof(*blk));
+
+	if (DUET_UUID_FS(itm->uuid) >= task->numscopes)
+		return 1;
+
+	sb = task->scopes[DUET_UUID_FS(itm->uuid)].sb;
+	if (!sb || !sb->s_op->duet_map_page)
+		return 1;
+
+	/* We only care about inodes still in memory; don't go to disk */
+	inode = ilookup(sb, DUET_UUID_INO(itm->uuid));
+	if (!inode)
+		return 1;
+
+	if (DUET_GET_UUID(inode) != DUET_UUID_LOCAL(itm->uuid)) {
+		iput(inode);
+		return 1;
+	}
+
+	ret = sb->s_op->duet_map_page(inode, itm->idx, blk);
+	if (ret)
+		memset(blk, 0, sizeof(*blk));
+
+	duet_dbg(KERN_DEBUG "duet: mapped (ino %lu, idx %lu) to (dev %u, sector "
+		"%llu, len %u)\n", inode->i_ino, itm->idx, blk->dev, blk->sector,
+		blk->len);
+
+	iput(inode);
+	return ret ? 1 : 0;
+}
+
+/*
+ * Translates up to count items for a task registered with DUET_MAP_BLOCKS.
+ * Items that can't be translated, or all of them if the task is gone, get
+ * zeroed out blocks, so the items themselves are never lost.
+ */
+int duet_map_items(__u8 taskid, struct duet_item *items,
+	struct duet_block *blks, __u16 count)
+{
+	__u16 i;
+	struct duet_task *task = duet_find_task(taskid);
+
+	memset(blks, 0, sizeof(*blks) * count);
+	if (!task) {
+		printk(KERN_ERR "duet_map_items: invalid taskid (%d)\n", taskid);
+		return -ENOENT;
+	}
+
+	for (i = 0; i < count && task->map_blocks; i++)
+		do_map_item(task, &items[i], &blks[i]);
+
+	/* decref and wake up cleaner if needed */
+	if (atomic_dec_and_test(&task->refcount))
+		wake_up(&task->cleaner_queue);
+
+	return 0;
+}
+
+/* Translates a single item on behalf of a kernel task */
+int duet_map_item(__u8 taskid, struct duet_item *item, struct duet_block *blk)
+{
+	int ret;
+	struct duet_task *task;
+
+	if (!duet_online())
+		return -1;
+
+	task = duet_find_task(taskid);
+	if (!task)
+		return -ENOENT;
+
+	ret = do_map_item(task, item, blk);
+
+	/* decref and wake up cleaner if needed */
+	if (atomic_dec_and_test(&task->refcount))
+		wake_up(&task->cleaner_queue);
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(duet_map_item);
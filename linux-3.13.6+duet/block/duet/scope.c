@@ -0,0 +1,264 @@
+/*
+ * Copyright (C) 2014-2015 George Amvrosiadis.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 021110-1307, USA.
+ */
+
+#include <linux/fs.h>
+#include <linux/dcache.h>
+#include "common.h"
+
+/*
+ * Scope tags spare us a walk up to the root every time we need to know whether
+ * an inode falls under one of a task's registered dirs. Every dentry caches a
+ * tag in d_duet_scope, with one bit per task (for the first DUET_SCOPE_TASKS
+ * task ids) that is set if a dir of the task is the dentry itself, or one of
+ * its ancestors.
+ * The tag of a dentry is the tag of its parent, plus the tasks registered on
+ * the dentry, so a check normally stops at the parent dir.
+ *
+ * The upper bits of the tag hold the generation it was computed in, and tags
+ * of older generations are ignored. Bumping the generation thus invalidates
+ * all tags at once; we do that when the set of registered dirs changes. When a
+ * dir is moved under a parent that falls under a different set of tasks, only
+ * the tags of its cached subtree are invalidated. The subtree may be large, so
+ * that is left to a worker. Until the worker is done, lookups ignore all tags
+ * and walk up to the root instead, without tagging anything on the way.
+ */
+#define DUET_SCOPE_TASKS	(BITS_PER_LONG / 2)
+#define DUET_SCOPE_MASK		((1UL << DUET_SCOPE_TASKS) - 1)
+
+/* A moved subtree whose tags are left to scope_work_fn() */
+struct scope_move {
+	struct list_head	list;
+	struct dentry		*dentry;
+};
+
+static inline unsigned long scope_gen(void)
+{
+	return (unsigned long)atomic_read(&duet_scope_gen) << DUET_SCOPE_TASKS;
+}
+
+/* Whether task relevance can be determined using the scope tags */
+int duet_scope_tagged(struct duet_task *task)
+{
+	return duet_is_utask(task) && task->id && task->id <= DUET_SCOPE_TASKS;
+}
+
+/* Bits of tasks with a scope on this dentry. Called under RCU. */
+static unsigned long scope_roots(struct dentry *dentry)
+{
+	struct duet_task *cur;
+	unsigned long mask = 0;
+	int fs;
+
+	list_for_each_entry_rcu(cur, &duet_env.tasks, task_list) {
+		if (!duet_scope_tagged(cur))
+			continue;
+
+		fs = duet_scope_fs(cur, dentry->d_sb);
+		if (fs >= 0 && cur->scopes[fs].dentry == dentry)
+			mask |= 1UL << (cur->id - 1);
+	}
+
+	return mask;
+}
+
+/*
+ * Returns the task bits of a dentry, tagging it and any untagged ancestors on
+ * the way. We may be called from interrupt context, so we don't wait for
+ * renames or tag invalidations to finish; if one raced with us, we just don't
+ * leave any tags behind. Called under RCU.
+ */
+static unsigned long scope_get(struct dentry *dentry)
+{
+	struct dentry *d, *parent, *stop = NULL;
+	unsigned long gen, tag, mask = 0, roots = 0, below = 0, r;
+	unsigned seq, rseq;
+
+	gen = scope_gen();
+	smp_rmb();	/* pairs with duet_scope_reset() */
+	seq = raw_seqcount_begin(&duet_env.scope_seq);
+	rseq = raw_seqcount_begin(&rename_lock.seqcount);
+
+	/* Some moved subtree still has stale tags, so trust none of them */
+	if (atomic_read(&duet_env.scope_pending)) {
+		for (d = dentry; ; d = parent) {
+			roots |= scope_roots(d);
+			parent = ACCESS_ONCE(d->d_parent);
+			if (parent == d)
+				break;
+		}
+
+		return roots;
+	}
+	smp_rmb();	/* pairs with scope_work_fn() */
+
+	/* Find the closest tagged ancestor, and the tasks registered below it */
+	for (d = dentry; ; d = parent) {
+		tag = ACCESS_ONCE(d->d_duet_scope);
+		if ((tag & ~DUET_SCOPE_MASK) == gen) {
+			mask = tag & DUET_SCOPE_MASK;
+			stop = d;
+			break;
+		}
+
+		roots |= scope_roots(d);
+		parent = ACCESS_ONCE(d->d_parent);
+		if (parent == d)
+			break;
+	}
+
+	if (d == dentry || read_seqcount_retry(&rename_lock.seqcount, rseq))
+		return mask | roots;
+
+	/* Tag the dentries we walked through */
+	for (d = dentry; d != stop; d = parent) {
+		r = scope_roots(d);
+		ACCESS_ONCE(d->d_duet_scope) = gen | mask | (roots & ~below);
+		below |= r;
+
+		parent = d->d_parent;
+		if (parent == d)
+			break;
+	}
+
+	/* Tags were invalidated while we were at it, so take ours back */
+	smp_mb();
+	if (read_seqcount_retry(&duet_env.scope_seq, seq)) {
+		for (d = dentry; d != stop; d = parent) {
+			ACCESS_ONCE(d->d_duet_scope) = 0;
+			parent = d->d_parent;
+			if (parent == d)
+				break;
+		}
+	}
+
+	return mask | roots;
+}
+
+/* Bits of the tasks whose registered dirs one of the inode's links is under */
+unsigned long duet_scope_mask(struct inode *inode)
+{
+	struct dentry *alias;
+	unsigned long mask = 0;
+
+	rcu_read_lock();
+	hlist_for_each_entry(alias, &inode->i_dentry, d_alias) {
+		if (IS_ROOT(alias) && (alias->d_flags & DCACHE_DISCONNECTED))
+			continue;
+
+		mask |= scope_get(alias);
+	}
+	rcu_read_unlock();
+
+	return mask;
+}
+
+/*
+ * Checks whether an inode falls under the task's registered dir, like
+ * do_find_path() would. Returns 0 if it does, or 1 otherwise.
+ */
+int duet_scope_check(struct duet_task *task, struct inode *inode)
+{
+	return (duet_scope_mask(inode) & duet_scope_bit(task)) ? 0 : 1;
+}
+
+/* Forget all scope tags, e.g. because a task was registered or removed */
+void duet_scope_reset(void)
+{
+	d_duet_scope_bump();
+}
+
+static void scope_invalidate_one(void *data, struct dentry *dentry)
+{
+	ACCESS_ONCE(dentry->d_duet_scope) = 0;
+}
+
+/* Invalidates the tags of the subtrees queued by duet_scope_moved() */
+static void scope_work_fn(struct work_struct *work)
+{
+	struct scope_move *sm;
+	LIST_HEAD(moves);
+
+	spin_lock(&duet_env.scope_lock);
+	list_splice_init(&duet_env.scope_moves, &moves);
+	spin_unlock(&duet_env.scope_lock);
+
+	while (!list_empty(&moves)) {
+		sm = list_first_entry(&moves, struct scope_move, list);
+		list_del(&sm->list);
+
+		d_duet_walk(sm->dentry, NULL, scope_invalidate_one);
+		dput(sm->dentry);
+		kfree(sm);
+
+		/* Lookups may trust the tags once no subtree is left */
+		smp_mb__before_atomic_dec();
+		atomic_dec(&duet_env.scope_pending);
+	}
+}
+
+void duet_scope_init(void)
+{
+	spin_lock_init(&duet_env.scope_lock);
+	seqcount_init(&duet_env.scope_seq);
+	INIT_LIST_HEAD(&duet_env.scope_moves);
+	atomic_set(&duet_env.scope_pending, 0);
+	INIT_WORK(&duet_env.scope_work, scope_work_fn);
+	duet_scope_reset();
+}
+
+/* Called once the hooks are gone, so no more subtrees get queued */
+void duet_scope_stop(void)
+{
+	flush_work(&duet_env.scope_work);
+}
+
+/*
+ * A dentry was moved to a new parent. If it's a dir with children, and the
+ * tasks that its old and new parents fall under differ (changed), queue its
+ * subtree for invalidation. Called from the rename hook, after d_move().
+ */
+void duet_scope_moved(struct dentry *dentry, int changed)
+{
+	struct inode *inode = dentry->d_inode;
+	struct scope_move *sm = NULL;
+
+	if (changed && inode && S_ISDIR(inode->i_mode) &&
+	    !list_empty(&dentry->d_subdirs)) {
+		sm = kmalloc(sizeof(*sm), GFP_ATOMIC);
+		if (!sm) {
+			printk(KERN_WARNING "duet: no memory to queue moved "
+				"dir, dropping all scope tags\n");
+			duet_scope_reset();
+			return;
+		}
+		sm->dentry = dget(dentry);
+	}
+
+	spin_lock(&duet_env.scope_lock);
+	write_seqcount_begin(&duet_env.scope_seq);
+	if (sm) {
+		atomic_inc(&duet_env.scope_pending);
+		list_add_tail(&sm->list, &duet_env.scope_moves);
+	}
+	ACCESS_ONCE(dentry->d_duet_scope) = 0;
+	write_seqcount_end(&duet_env.scope_seq);
+	spin_unlock(&duet_env.scope_lock);
+
+	if (sm)
+		schedule_work(&duet_env.scope_work);
+}
@@ -20,6 +20,7 @@
 #include <linux/syscalls.h>
 #include <linux/file.h>
 #include <linux/uaccess.h>
+#include <linux/ioprio.h>
 #include "common.h"
 
 /*
@@ -30,7 +31,7 @@
  * consistency.
  */
 
-static int process_inode(struct duet_task *task, struct inode *inode)
+static int process_inode(struct duet_task *task, struct inode *inode, int fs)
 {
 	struct radix_tree_iter iter;
 	void **slot;
@@ -40,8 +41,13 @@ static int process_inode(struct duet_task *task, struct inode *inode)
 	if (task->is_file && (bittree_check_inode(&task->bittree, task, inode) == 1))
 		return 0;
 
-	/* Go through all pages of this inode */
+	/* Go through all pages of this inode, unless the task filtered it out */
 	rcu_read_lock();
+	if (duet_filter_inode(task, inode, DUET_SCOPE_UUID(fs, inode))) {
+		rcu_read_unlock();
+		return 0;
+	}
+
 	radix_tree_for_each_slot(slot, &inode->i_mapping->page_tree, &iter, 0) {
 		struct page *page = radix_tree_deref_slot(slot);
 		if (unlikely(!page))
@@ -50,15 +56,16 @@ static int process_inode(struct duet_task *task, struct inode *inode)
 		state = DUET_PAGE_ADDED;
 		if (PageDirty(page))
 			state |= DUET_PAGE_DIRTY;
-		hash_add(task, DUET_GET_UUID(inode), page->index, state, 1);
+		hash_add(task, DUET_SCOPE_UUID(fs, inode), page->index,
+			 duet_page_part(page), state, duet_page_lru(page), 1);
 	}
 	rcu_read_unlock();
 
 	return 0;
 }
 
-/* Scan through the page cache, and populate the task's tree. */
-static int scan_page_cache(struct duet_task *task)
+/* Scan through the page cache of a task scope, and populate the task's tree. */
+static int scan_page_cache(struct duet_task *task, int fs)
 {
 	unsigned int loop;
 	struct hlist_head *head;
@@ -75,7 +82,8 @@ again:
 
 		/* Process this hash bucket */
 		hlist_for_each_entry(inode, head, i_hash) {
-			if (inode->i_sb != task->f_sb)
+			if (task->scopes[fs].sb &&
+			    inode->i_sb != task->scopes[fs].sb)
 				continue;
 
 			/* If we haven't seen this inode before, process it. */
@@ -91,7 +99,7 @@ again:
 					spin_unlock(&inode->i_lock);
 					spin_unlock(duet_inode_hash_lock);
 
-					process_inode(task, inode);
+					process_inode(task, inode, fs);
 					bittree_set_done(&inodetree, DUET_GET_UUID(inode), 1);
 					iput(inode);
 				}
@@ -228,6 +236,10 @@ int duet_set_done(__u8 taskid, __u64 idx, __u32 count)
 
 	ret = bittree_set_done(&task->bittree, idx, count);
 
+	/* File tasks are done with these inodes, so let go of their pages */
+	if (task->is_file)
+		duet_lease_done(task, idx, count);
+
 	/* decref and wake up cleaner if needed */
 	if (atomic_dec_and_test(&task->refcount))
 		wake_up(&task->cleaner_queue);
@@ -236,6 +248,115 @@ int duet_set_done(__u8 taskid, __u64 idx, __u32 count)
 }
 EXPORT_SYMBOL_GPL(duet_set_done);
 
+static int duet_ioprio_valid(__u16 ioprio)
+{
+	unsigned long data = IOPRIO_PRIO_DATA(ioprio);
+
+	switch (IOPRIO_PRIO_CLASS(ioprio)) {
+	case IOPRIO_CLASS_NONE:
+		return !data;
+	case IOPRIO_CLASS_RT:
+	case IOPRIO_CLASS_BE:
+		return data < IOPRIO_BE_NR;
+	case IOPRIO_CLASS_IDLE:
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Records the I/O priority used for the task's work. It only takes effect in
+ * the thread that does the work, through duet_apply_ioprio (or for user
+ * tasks, when their process fetches). IOPRIO_CLASS_NONE leaves the priority
+ * of whoever does the work untouched.
+ */
+int duet_set_ioprio(__u8 taskid, __u16 ioprio)
+{
+	struct duet_task *task;
+
+	if (!duet_online())
+		return -1;
+
+	if (!duet_ioprio_valid(ioprio))
+		return -EINVAL;
+
+	task = duet_find_task(taskid);
+	if (!task)
+		return -ENOENT;
+
+	task->ioprio = ioprio;
+
+	/* decref and wake up cleaner if needed */
+	if (atomic_dec_and_test(&task->refcount))
+		wake_up(&task->cleaner_queue);
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(duet_set_ioprio);
+
+/*
+ * Makes the I/O that current submits from now on use the task's priority.
+ * Kernel tasks call this from the thread that does their work (e.g. the scrub
+ * ioctl, or the f2fs GC thread), and undo it with duet_restore_ioprio.
+ */
+int duet_apply_ioprio(__u8 taskid, int *old_ioprio)
+{
+	int ret = 0;
+	struct duet_task *task;
+
+	if (!duet_online())
+		return -1;
+
+	task = duet_find_task(taskid);
+	if (!task)
+		return -ENOENT;
+
+	task_lock(current);
+	*old_ioprio = current->io_context ? current->io_context->ioprio :
+				IOPRIO_PRIO_VALUE(IOPRIO_CLASS_NONE, 0);
+	task_unlock(current);
+
+	if (ioprio_valid(task->ioprio))
+		ret = set_task_ioprio(current, task->ioprio);
+
+	/* decref and wake up cleaner if needed */
+	if (atomic_dec_and_test(&task->refcount))
+		wake_up(&task->cleaner_queue);
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(duet_apply_ioprio);
+
+void duet_restore_ioprio(int old_ioprio)
+{
+	set_task_ioprio(current, old_ioprio);
+}
+EXPORT_SYMBOL_GPL(duet_restore_ioprio);
+
+/* Accounts for bytes the task read, and bytes it got to skip thanks to Duet */
+void duet_account_io(__u8 taskid, __u64 read, __u64 skipped)
+{
+	struct duet_task *task;
+
+	if (!duet_online())
+		return;
+
+	task = duet_find_task(taskid);
+	if (!task)
+		return;
+
+	if (read)
+		atomic64_add(read, &task->io_read);
+	if (skipped)
+		atomic64_add(skipped, &task->io_skipped);
+
+	/* decref and wake up cleaner if needed */
+	if (atomic_dec_and_test(&task->refcount))
+		wake_up(&task->cleaner_queue);
+}
+EXPORT_SYMBOL_GPL(duet_account_io);
+
 /* Properly allocate and initialize a task struct */
 static int duet_task_init(struct duet_task **task, const char *name,
 	__u32 regmask, __u32 bitrange, struct super_block *f_sb,
@@ -261,24 +382,44 @@ static int duet_task_init(struct duet_task **task, const char *name,
 	/* Is this a file or a block task? */
 	(*task)->is_file = ((regmask & DUET_FILE_TASK) ? 1 : 0);
 
+	/* Should we translate fetched items to physical blocks? */
+	(*task)->map_blocks = ((regmask & DUET_MAP_BLOCKS) ? 1 : 0);
+
+	/* Should we report the LRU class of items, and order them by it? */
+	(*task)->lru_hints = ((regmask & DUET_LRU_HINTS) ? 1 : 0);
+
+	/*
+	 * Kernel tasks do maintenance work on behalf of the filesystem, so
+	 * their I/O is only served when the disk is otherwise idle, unless
+	 * told otherwise. User tasks keep their own priority by default.
+	 */
+	if (regmask & DUET_REG_SBLOCK)
+		(*task)->ioprio = IOPRIO_PRIO_VALUE(IOPRIO_CLASS_IDLE, 0);
+	else
+		(*task)->ioprio = IOPRIO_PRIO_VALUE(IOPRIO_CLASS_NONE, 0);
+	atomic64_set(&(*task)->io_read, 0);
+	atomic64_set(&(*task)->io_skipped, 0);
+	atomic64_set(&(*task)->evicted, 0);
+	duet_lease_init(*task);
+	atomic_set(&(*task)->evict_overruns, 0);
+	atomic64_set(&(*task)->evict_calls, 0);
+	atomic64_set(&(*task)->evict_ns, 0);
+	duet_filter_init(*task);
+
 	/* Initialize bitmap tree */
 	if (!bitrange)
 		bitrange = 4096;
 	bittree_init(&(*task)->bittree, bitrange, (*task)->is_file);
 
-	/* Initialize hash table bitmap */
+	/* Initialize hash table bitmaps */
 	spin_lock_init(&(*task)->bbmap_lock);
-	(*task)->bucket_bmap = kzalloc(sizeof(unsigned long) *
-		BITS_TO_LONGS(duet_env.itm_hash_size), GFP_KERNEL);
-	if (!(*task)->bucket_bmap) {
-		printk(KERN_ERR "duet: failed to allocate bucket bitmap\n");
+	if (hash_task_init(*task)) {
+		printk(KERN_ERR "duet: failed to allocate bucket bitmaps\n");
 		kfree((*task)->pathbuf);
 		kfree(*task);
 		return -ENOMEM;
 	}
 
-	(*task)->bmap_cursor = 0;
-
 	/* Do some sanity checking on event mask. */
 	if (regmask & DUET_PAGE_EXISTS) {
 		if (regmask & (DUET_PAGE_ADDED | DUET_PAGE_REMOVED)) {
@@ -296,9 +437,22 @@ static int duet_task_init(struct duet_task **task, const char *name,
 		regmask |= (DUET_PAGE_DIRTY | DUET_PAGE_FLUSHED);
 	}
 
+	/* Should we queue metadata blocks the filesystem verified? */
+	if ((regmask & DUET_META_VERIFIED) && !p_dentry) {
+		if (duet_verified_init(*task)) {
+			printk(KERN_ERR "duet: failed to allocate verified block queue\n");
+			hash_task_destroy(*task);
+			kfree((*task)->pathbuf);
+			kfree(*task);
+			return -ENOMEM;
+		}
+		(*task)->meta_verified = 1;
+	}
+
 	(*task)->evtmask = (__u16) (regmask & 0xffff);
-	(*task)->f_sb = f_sb;
-	(*task)->p_dentry = p_dentry;
+	(*task)->scopes[0].sb = f_sb;
+	(*task)->scopes[0].dentry = p_dentry;
+	(*task)->numscopes = 1;
 
 	printk(KERN_DEBUG "duet: task registered with evtmask %x", (*task)->evtmask);
 	return 0;
@@ -314,81 +468,110 @@ err:
 void duet_task_dispose(struct duet_task *task)
 {
 	struct duet_item itm;
+	int i;
+
+	/* Let go of any leased pages */
+	duet_lease_destroy(task);
 
 	/* Dispose of the bitmap tree */
 	bittree_destroy(&task->bittree);
 
-	/* Dispose of hash table entries, bucket bitmap */
+	/* Dispose of hash table entries, bucket bitmaps */
 	while (!hash_fetch(task, &itm));
-	kfree(task->bucket_bmap);
+	hash_task_destroy(task);
+	duet_verified_destroy(task);
+	duet_filter_destroy(task);
 
-	if (task->p_dentry)
-		dput(task->p_dentry);
+	for (i = 0; i < task->numscopes; i++) {
+		if (task->scopes[i].dentry)
+			dput(task->scopes[i].dentry);
+	}
 	kfree(task->pathbuf);
 	kfree(task);
 }
 
-/* Registers a user-level task. Must also prep path. */
-int __register_utask(char *path, __u32 regmask, __u32 bitrange,
-	const char *name, __u8 *taskid)
+/* Opens the dir at path, and grabs its dentry and superblock */
+static int find_scope_dir(char *path, struct super_block **sb,
+	struct dentry **dentry)
 {
-	int ret, fd;
-	struct list_head *last;
-	struct duet_task *cur, *task = NULL;
+	int ret = 0, fd;
 	struct file *file;
 	mm_segment_t old_fs;
-	struct dentry *dentry = NULL;
-	struct super_block *sb;
 
-	/* First, open the path we were given */
 	old_fs = get_fs();
 	set_fs(KERNEL_DS);
 
 	fd = sys_open(path, O_RDONLY, 0644);
 	if (fd < 0) {
-		printk(KERN_ERR "duet_register: failed to open %s\n", path);
+		printk(KERN_ERR "duet: failed to open %s\n", path);
 		ret = -EINVAL;
-		goto reg_done;
+		goto find_done;
 	}
 
 	file = fget(fd);
 	if (!file) {
-		printk(KERN_ERR "duet_register: failed to get %s\n", path);
+		printk(KERN_ERR "duet: failed to get %s\n", path);
 		ret = -EINVAL;
-		goto reg_close;
+		goto find_close;
 	}
 
 	if (!file->f_inode) {
-		printk(KERN_ERR "duet_register: no inode for %s\n", path);
+		printk(KERN_ERR "duet: no inode for %s\n", path);
 		ret = -EINVAL;
-		goto reg_put;
+		goto find_put;
 	}
 
 	if (!S_ISDIR(file->f_inode->i_mode)) {
-		printk(KERN_ERR "duet_register: %s is not a dir\n", path);
+		printk(KERN_ERR "duet: %s is not a dir\n", path);
 		ret = -EINVAL;
-		goto reg_put;
+		goto find_put;
 	}
 
-	if (!(dentry = d_find_alias(file->f_inode))) {
-		printk(KERN_ERR "duet_register: no dentry for %s\n", path);
+	if (!(*dentry = d_find_alias(file->f_inode))) {
+		printk(KERN_ERR "duet: no dentry for %s\n", path);
 		ret = -EINVAL;
-		goto reg_put;
+		goto find_put;
 	}
 
-	sb = file->f_inode->i_sb;
+	*sb = file->f_inode->i_sb;
+
+find_put:
+	fput(file);
+find_close:
+	sys_close(fd);
+find_done:
+	set_fs(old_fs);
+	return ret;
+}
+
+/* Registers a user-level task. Must also prep path. */
+int __register_utask(char *path, __u32 regmask, __u32 bitrange,
+	const char *name, __u8 *taskid)
+{
+	int ret;
+	struct list_head *last;
+	struct duet_task *cur, *task = NULL;
+	struct dentry *dentry = NULL;
+	struct super_block *sb;
+
+	/* First, open the path we were given */
+	ret = find_scope_dir(path, &sb, &dentry);
+	if (ret) {
+		printk(KERN_ERR "duet_register: can't register %s\n", path);
+		return ret;
+	}
 
 	if (strnlen(name, MAX_NAME) == MAX_NAME) {
 		printk(KERN_ERR "duet_register: task name too long\n");
-		ret = -EINVAL;
-		goto reg_put;
+		dput(dentry);
+		return -EINVAL;
 	}
 
 	ret = duet_task_init(&task, name, regmask, bitrange, sb, dentry);
 	if (ret) {
 		printk(KERN_ERR "duet_register: failed to initialize task\n");
-		ret = -EINVAL;
-		goto reg_put;
+		dput(dentry);
+		return -EINVAL;
 	}
 
 	/*
@@ -407,21 +590,16 @@ int __register_utask(char *path, __u32 regmask, __u32 bitrange,
 	}
 	list_add_rcu(&task->task_list, last);
 	mutex_unlock(&duet_env.task_list_mutex);
+	duet_scope_reset();
 
 	/* Now that the task is receiving events, scan the page cache and
 	 * populate its ItemTree. */
-	scan_page_cache(task);
+	scan_page_cache(task, 0);
 	*taskid = task->id;
 
 	printk(KERN_INFO "duet: registered %s (ino %lu, sb %p)\n",
-		path, file->f_inode->i_ino, sb);
+		path, dentry->d_inode->i_ino, sb);
 
-reg_put:
-	fput(file);
-reg_close:
-	sys_close(fd);
-reg_done:
-	set_fs(old_fs);
 	return ret;
 }
 
@@ -463,10 +641,11 @@ int __register_ktask(char *path, __u32 regmask, __u32 bitrange,
 	}
 	list_add_rcu(&task->task_list, last);
 	mutex_unlock(&duet_env.task_list_mutex);
+	duet_scope_reset();
 
 	/* Now that the task is receiving events, scan the page cache and
 	 * populate its ItemTree. */
-	scan_page_cache(task);
+	scan_page_cache(task, 0);
 	*taskid = task->id;
 
 	printk(KERN_INFO "duet: registered kernel task (sb %p)\n", sb);
@@ -492,6 +671,72 @@ int duet_register(char *path, __u32 regmask, __u32 bitrange, const char *name,
 }
 EXPORT_SYMBOL_GPL(duet_register);
 
+/*
+ * Extends the task's scope to another filesystem. For user tasks, path is a
+ * dir on that filesystem, under which files are relevant to the task. For
+ * kernel tasks, it's the superblock, as in duet_register. A task can have one
+ * scope per filesystem, and the index of the scope is stored in the UUID of
+ * the items it yields.
+ */
+int duet_add_scope(__u8 taskid, char *path)
+{
+	int fs, ret = 0;
+	struct duet_task *task;
+	struct dentry *dentry = NULL;
+	struct super_block *sb;
+
+	if (!duet_online())
+		return -1;
+
+	if (!path)
+		return -EINVAL;
+
+	task = duet_find_task(taskid);
+	if (!task)
+		return -ENOENT;
+
+	if (duet_is_utask(task)) {
+		ret = find_scope_dir(path, &sb, &dentry);
+		if (ret)
+			goto out;
+	} else {
+		sb = (struct super_block *)path;
+	}
+
+	mutex_lock(&duet_env.task_list_mutex);
+	if (duet_scope_fs(task, sb) >= 0 || task->numscopes == DUET_MAX_SCOPES) {
+		mutex_unlock(&duet_env.task_list_mutex);
+		printk(KERN_ERR "duet: task %d can't add scope on sb %p\n",
+			task->id, sb);
+		if (dentry)
+			dput(dentry);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	fs = task->numscopes;
+	task->scopes[fs].sb = sb;
+	task->scopes[fs].dentry = dentry;
+	smp_wmb();	/* pairs with duet_scope_fs() */
+	ACCESS_ONCE(task->numscopes) = fs + 1;
+	mutex_unlock(&duet_env.task_list_mutex);
+	duet_scope_reset();
+
+	/* Pick up the pages of the new filesystem that are already cached */
+	scan_page_cache(task, fs);
+
+	printk(KERN_INFO "duet: task %d added scope %d (sb %p)\n", task->id, fs,
+		sb);
+
+out:
+	/* decref and wake up cleaner if needed */
+	if (atomic_dec_and_test(&task->refcount))
+		wake_up(&task->cleaner_queue);
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(duet_add_scope);
+
 int duet_deregister(__u8 taskid)
 {
 	struct duet_task *cur;
@@ -504,8 +749,16 @@ int duet_deregister(__u8 taskid)
 			hash_print(cur);
 			bittree_print(cur);
 #endif /* CONFIG_DUET_STATS */
+			printk(KERN_INFO "duet: task %d read %lld bytes, "
+				"skipped %lld bytes, lost %lld pages, filtered "
+				"%lld events\n", cur->id,
+				(long long)atomic64_read(&cur->io_read),
+				(long long)atomic64_read(&cur->io_skipped),
+				(long long)atomic64_read(&cur->evicted),
+				(long long)atomic64_read(&cur->filtered));
 			list_del_rcu(&cur->task_list);
 			mutex_unlock(&duet_env.task_list_mutex);
+			duet_scope_reset();
 
 			/* Wait until everyone's done with it */
 			synchronize_rcu();
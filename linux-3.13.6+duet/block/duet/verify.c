@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2014-2015 George Amvrosiadis.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 021110-1307, USA.
+ */
+
+#include <linux/fs.h>
+#include "common.h"
+
+/*
+ * Filesystem metadata is often cached in pages of internal inodes that page
+ * events don't cover, or don't describe in a useful way. Instead, filesystems
+ * report metadata blocks they read from disk and verified, along with the
+ * physical location of the copy that was read. Tasks registered with
+ * DUET_META_VERIFIED collect these in a bounded queue and fetch them with
+ * duet_fetch_verified(). If a task falls behind, blocks are dropped; the task
+ * will just do the work itself.
+ */
+#define DUET_VBLK_QUEUE		1024	/* Verified blocks queued per task */
+
+int duet_verified_init(struct duet_task *task)
+{
+	spin_lock_init(&task->vblk_lock);
+	atomic64_set(&task->vblk_dropped, 0);
+	return kfifo_alloc(&task->vblks, DUET_VBLK_QUEUE, GFP_KERNEL);
+}
+
+void duet_verified_destroy(struct duet_task *task)
+{
+	if (task->meta_verified)
+		kfifo_free(&task->vblks);
+}
+
+/* Returns 1 if some task wants verified blocks of this filesystem */
+int duet_wants_verified(struct super_block *sb)
+{
+	int ret = 0;
+	struct duet_task *cur;
+
+	if (!duet_online())
+		return 0;
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(cur, &duet_env.tasks, task_list) {
+		if (cur->meta_verified && duet_scope_fs(cur, sb) >= 0) {
+			ret = 1;
+			break;
+		}
+	}
+	rcu_read_unlock();
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(duet_wants_verified);
+
+/* A filesystem read and verified a metadata block; tell interested tasks */
+void duet_hook_verified(struct super_block *sb, struct duet_block *blk)
+{
+	struct duet_task *cur;
+
+	if (!duet_online())
+		return;
+
+	duet_dbg(KERN_INFO "duet: verified block (dev %u, sector %llu, len %u)\n",
+		blk->dev, blk->sector, blk->len);
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(cur, &duet_env.tasks, task_list) {
+		if (!cur->meta_verified || duet_scope_fs(cur, sb) < 0)
+			continue;
+
+		if (!kfifo_in_spinlocked(&cur->vblks, blk, 1, &cur->vblk_lock))
+			atomic64_inc(&cur->vblk_dropped);
+	}
+	rcu_read_unlock();
+}
+EXPORT_SYMBOL_GPL(duet_hook_verified);
+
+/* Fetches up to count verified blocks for a task registered for them */
+int duet_fetch_verified(__u8 taskid, struct duet_block *blks, __u16 *count)
+{
+	struct duet_task *task;
+
+	if (!duet_online())
+		return -1;
+
+	task = duet_find_task(taskid);
+	if (!task)
+		return -ENOENT;
+
+	if (task->meta_verified)
+		*count = kfifo_out_spinlocked(&task->vblks, blks, *count,
+					      &task->vblk_lock);
+	else
+		*count = 0;
+
+	/* decref and wake up cleaner if needed */
+	if (atomic_dec_and_test(&task->refcount))
+		wake_up(&task->cleaner_queue);
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(duet_fetch_verified);
@@ -3723,6 +3723,10 @@ void btrfs_destroy_cachep(void);
 long btrfs_ioctl_trans_end(struct file *file);
 struct inode *btrfs_iget(struct super_block *s, struct btrfs_key *location,
 			 struct btrfs_root *root, int *was_new);
+#ifdef CONFIG_BTRFS_DUET_RELOC
+struct inode *btrfs_ilookup(struct super_block *s, struct btrfs_key *location,
+			    struct btrfs_root *root);
+#endif /* CONFIG_BTRFS_DUET_RELOC */
 struct extent_map *btrfs_get_extent(struct inode *inode, struct page *page,
 				    size_t pg_offset, u64 start, u64 end,
 				    int create);
@@ -42,6 +42,7 @@ struct defrag_ctx {
 	atomic64_t bittree_time;
 #endif /* CONFIG_BTRFS_DUET_DEFRAG_CPUMON */
 	__u8 taskid;
+	int old_ioprio;			/* -1 if we never changed it */
 	struct inode_tree itree;
 #endif /* CONFIG_BTRFS_DUET_DEFRAG */
 };
@@ -74,6 +75,14 @@ static int defrag_inode(struct inode *inode, struct defrag_ctx *dctx,
 			atomic64_add((dirty_pages + cache_hits) * PAGE_SIZE,
 				&fs_info->defrag_bytes_from_mem);
 		}
+
+		if (dctx->taskid) {
+			unsigned long inmem = min_t(unsigned long, ret,
+						dirty_pages + cache_hits);
+
+			duet_account_io(dctx->taskid, (ret - inmem) * PAGE_SIZE,
+					inmem * PAGE_SIZE);
+		}
 #endif /* CONFIG_BTRFS_DUET_DEFRAG */
 
 		ret = 0;
@@ -391,6 +400,7 @@ long btrfs_ioctl_defrag_start(struct file *file, void __user *arg_)
 	atomic64_set(&dctx->bittree_time, 0);
 #endif /* CONFIG_BTRFS_DUET_DEFRAG_CPUMON */
 	itree_init(&dctx->itree);
+	dctx->old_ioprio = -1;
 
 	/* Register the task with the Duet framework */
 	if (duet_online() && duet_register((char *)fs_info->sb,
@@ -400,6 +410,12 @@ long btrfs_ioctl_defrag_start(struct file *file, void __user *arg_)
 		ret = -EFAULT;
 		goto out;
 	}
+
+	/* Read the extents we defrag with the I/O priority Duet has for us */
+	if (dctx->taskid && duet_apply_ioprio(dctx->taskid, &dctx->old_ioprio)) {
+		printk(KERN_ERR "defrag: failed to set I/O priority\n");
+		dctx->old_ioprio = -1;
+	}
 #endif /* CONFIG_BTRFS_DUET_DEFRAG */
 
 	ret = defrag_subvol(dctx);
@@ -426,6 +442,8 @@ out:
 		(long long) div64_u64(atomic64_read(&dctx->bittree_time), 1E6));
 #endif /* CONFIG_BTRFS_DUET_DEFRAG_CPUMON */
 
+	if (dctx->old_ioprio >= 0)
+		duet_restore_ioprio(dctx->old_ioprio);
 	if (duet_deregister(dctx->taskid))
 		printk(KERN_ERR "defrag: failed to deregister with duet\n");
 #endif /* CONFIG_BTRFS_DUET_DEFRAG */
@@ -48,6 +48,9 @@
 #include "rcu-string.h"
 #include "dev-replace.h"
 #include "raid56.h"
+#if defined(CONFIG_DUET) && defined(CONFIG_BTRFS_FS_MAPPING)
+#include "mapping.h"
+#endif /* CONFIG_DUET && CONFIG_BTRFS_FS_MAPPING */
 
 #ifdef CONFIG_X86
 #include <asm/cpufeature.h>
@@ -639,8 +642,13 @@ static int btree_readpage_end_io_hook(struct btrfs_io_bio *io_bio,
 		ret = -EIO;
 	}
 
-	if (!ret)
+	if (!ret) {
 		set_extent_buffer_uptodate(eb);
+#if defined(CONFIG_DUET) && defined(CONFIG_BTRFS_FS_MAPPING)
+		/* Let scrub know this copy of the block is good */
+		btrfs_duet_tree_verified(root->fs_info, eb, mirror);
+#endif /* CONFIG_DUET && CONFIG_BTRFS_FS_MAPPING */
+	}
 err:
 	if (reads_done &&
 	    test_and_clear_bit(EXTENT_BUFFER_READAHEAD, &eb->bflags))
@@ -4853,6 +4853,24 @@ static struct inode *btrfs_iget_locked(struct super_block *s,
 	return inode;
 }
 
+#ifdef CONFIG_BTRFS_DUET_RELOC
+/*
+ * Like btrfs_iget, but only returns the inode if it's already in the inode
+ * cache; it never reads it from disk. Returns NULL if it's not cached.
+ */
+struct inode *btrfs_ilookup(struct super_block *s, struct btrfs_key *location,
+			    struct btrfs_root *root)
+{
+	struct btrfs_iget_args args;
+	unsigned long hashval = btrfs_inode_hash(location->objectid, root);
+
+	args.location = location;
+	args.root = root;
+
+	return ilookup5(s, hashval, btrfs_find_actor, (void *)&args);
+}
+#endif /* CONFIG_BTRFS_DUET_RELOC */
+
 /* Get an inode object given its location and corresponding root.
  * Returns in *is_new if the inode was read from disk
  */
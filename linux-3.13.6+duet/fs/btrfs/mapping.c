@@ -17,7 +17,11 @@
  */
 #include "ctree.h"
 #include "btrfs_inode.h"
+#include "volumes.h"
 #include "mapping.h"
+#ifdef CONFIG_DUET
+#include <linux/duet.h>
+#endif /* CONFIG_DUET */
 
 #ifdef CONFIG_BTRFS_FS_MAPPING_DEBUG
 #define map_dbg(...)	printk(__VA_ARGS__)
@@ -102,3 +106,76 @@ int btrfs_get_logical(struct inode *inode, unsigned long index,
 
 	return 0;
 }
+
+#ifdef CONFIG_DUET
+/*
+ * Maps a page of the inode to its physical location for the duet framework.
+ * For multi-device and RAID setups, we report the first stripe only.
+ */
+int btrfs_duet_map_page(struct inode *inode, unsigned long index,
+	struct duet_block *blk)
+{
+	int ret = 1;
+	u64 offt, mapped_length;
+	struct extent_map *em = NULL;
+	struct btrfs_bio *bbio = NULL;
+	struct btrfs_fs_info *fs_info = BTRFS_I(inode)->root->fs_info;
+
+	if (btrfs_get_logical(inode, index, &em, NULL))
+		goto out;
+
+	/* Compressed extents don't map pages to blocks one-to-one */
+	if (test_bit(EXTENT_FLAG_COMPRESSED, &em->flags))
+		goto out;
+
+	offt = ((u64)index << PAGE_CACHE_SHIFT) - em->start;
+	mapped_length = PAGE_CACHE_SIZE;
+	if (btrfs_map_block(fs_info, READ, em->block_start + offt,
+			    &mapped_length, &bbio, 0) || !bbio ||
+	    !bbio->stripes[0].dev->bdev) {
+		map_dbg(KERN_INFO "btrfs_duet_map_page: btrfs_map_block failed\n");
+		goto out;
+	}
+
+	blk->dev = new_encode_dev(bbio->stripes[0].dev->bdev->bd_dev);
+	blk->sector = bbio->stripes[0].physical >> 9;
+	blk->len = min_t(u64, mapped_length, PAGE_CACHE_SIZE);
+	ret = 0;
+
+out:
+	kfree(bbio);
+	if (em && !IS_ERR(em))
+		free_extent_map(em);
+	return ret;
+}
+
+/*
+ * Reports a tree block that was just read and passed its checksum to the duet
+ * framework, along with the physical location of the mirror we read it from,
+ * so that tasks like scrub don't have to read it again.
+ */
+void btrfs_duet_tree_verified(struct btrfs_fs_info *fs_info,
+	struct extent_buffer *eb, int mirror)
+{
+	u64 mapped_length = eb->len;
+	struct btrfs_bio *bbio = NULL;
+	struct duet_block blk;
+
+	if (!duet_wants_verified(fs_info->sb))
+		return;
+
+	if (btrfs_map_block(fs_info, READ, eb->start, &mapped_length, &bbio,
+			    mirror) || !bbio || !bbio->stripes[0].dev->bdev) {
+		map_dbg(KERN_INFO "btrfs_duet_tree_verified: btrfs_map_block failed\n");
+		goto out;
+	}
+
+	blk.dev = new_encode_dev(bbio->stripes[0].dev->bdev->bd_dev);
+	blk.sector = bbio->stripes[0].physical >> 9;
+	blk.len = min_t(u64, mapped_length, eb->len);
+	duet_hook_verified(fs_info->sb, &blk);
+
+out:
+	kfree(bbio);
+}
+#endif /* CONFIG_DUET */
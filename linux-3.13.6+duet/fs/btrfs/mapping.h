@@ -25,5 +25,12 @@ int btrfs_iget_ino(struct btrfs_fs_info *fs_info, unsigned long ino,
 	struct inode **inode, int *ondisk);
 int btrfs_get_logical(struct inode *inode, unsigned long index,
 	struct extent_map **em, int *ondisk);
+#ifdef CONFIG_DUET
+struct duet_block;
+int btrfs_duet_map_page(struct inode *inode, unsigned long index,
+	struct duet_block *blk);
+void btrfs_duet_tree_verified(struct btrfs_fs_info *fs_info,
+	struct extent_buffer *eb, int mirror);
+#endif /* CONFIG_DUET */
 
 #endif /* __BTRFS_MAPPING_ */
@@ -31,6 +31,16 @@
 #include "async-thread.h"
 #include "free-space-cache.h"
 #include "inode-map.h"
+#ifdef CONFIG_BTRFS_DUET_RELOC
+#include "backref.h"
+#include "mapping.h"
+#endif /* CONFIG_BTRFS_DUET_RELOC */
+
+#ifdef CONFIG_BTRFS_DUET_RELOC_DEBUG
+#define reloc_dbg(...)	printk(__VA_ARGS__)
+#else
+#define reloc_dbg(...)
+#endif
 
 /*
  * backref_node, mapping_node and tree_block start with this
@@ -179,6 +189,10 @@ struct reloc_control {
 
 	u64 search_start;
 	u64 extents_found;
+#ifdef CONFIG_BTRFS_DUET_RELOC
+	/* bytes copied from the page cache instead of read from disk */
+	u64 bytes_cached;
+#endif /* CONFIG_BTRFS_DUET_RELOC */
 
 	unsigned int stage:8;
 	unsigned int create_reloc_tree:1;
@@ -3096,7 +3110,207 @@ int setup_extent_mapping(struct inode *inode, u64 start, u64 end,
 	return ret;
 }
 
-static int relocate_file_extent_cluster(struct inode *inode,
+#ifdef CONFIG_BTRFS_DUET_RELOC
+/* Max number of referencing inodes we consult per data extent */
+#define RELOC_CACHED_MAX_REFS	8
+
+struct reloc_cached_ref {
+	u64 inum;
+	u64 offset;	/* file offset that maps to the start of the extent */
+	u64 root;
+};
+
+struct reloc_cached_ctx {
+	int nr;
+	struct reloc_cached_ref refs[RELOC_CACHED_MAX_REFS];
+};
+
+/* Remember every (inode, offset, root) referencing the start of an extent */
+static int reloc_collect_ref(u64 inum, u64 offset, u64 root, void *ctx)
+{
+	struct reloc_cached_ctx *cctx = ctx;
+
+	if (cctx->nr == RELOC_CACHED_MAX_REFS)
+		return 1;
+
+	cctx->refs[cctx->nr].inum = inum;
+	cctx->refs[cctx->nr].offset = offset;
+	cctx->refs[cctx->nr].root = root;
+	cctx->nr++;
+	return 0;
+}
+
+static struct inode *reloc_iget_ref(struct btrfs_fs_info *fs_info,
+				    struct reloc_cached_ref *ref)
+{
+	struct btrfs_key key;
+	struct btrfs_root *local_root;
+	struct inode *inode;
+	int srcu_index;
+
+	key.objectid = ref->root;
+	key.type = BTRFS_ROOT_ITEM_KEY;
+	key.offset = (u64)-1;
+
+	srcu_index = srcu_read_lock(&fs_info->subvol_srcu);
+	local_root = btrfs_read_fs_root_no_name(fs_info, &key);
+	if (IS_ERR(local_root)) {
+		srcu_read_unlock(&fs_info->subvol_srcu, srcu_index);
+		return NULL;
+	}
+
+	/* Inodes that aren't cached have no cached pages either */
+	key.objectid = ref->inum;
+	key.type = BTRFS_INODE_ITEM_KEY;
+	key.offset = 0;
+	inode = btrfs_ilookup(fs_info->sb, &key, local_root);
+	srcu_read_unlock(&fs_info->subvol_srcu, srcu_index);
+
+	return inode;
+}
+
+/*
+ * Copies the page of a referencing inode into the relocation inode's page,
+ * provided it is cached, clean and up-to-date, and still maps to the logical
+ * address we are relocating. Returns 1 if the page was copied.
+ */
+static int reloc_copy_cached_page(struct inode *src_inode, u64 file_offset,
+				  u64 logical, struct page *dst)
+{
+	struct page *page;
+	struct extent_map *em = NULL;
+	int ret = 0;
+
+	if (file_offset & (PAGE_CACHE_SIZE - 1))
+		return 0;
+
+	/* Pages straddling EOF may not match what's on disk */
+	if (file_offset + PAGE_CACHE_SIZE > i_size_read(src_inode))
+		return 0;
+
+	page = find_get_page(src_inode->i_mapping,
+			     file_offset >> PAGE_CACHE_SHIFT);
+	if (!page)
+		return 0;
+
+	/* Make sure the page is still backed by the extent we're moving */
+	if (btrfs_get_logical(src_inode, page->index, &em, NULL))
+		goto out;
+
+	if (test_bit(EXTENT_FLAG_COMPRESSED, &em->flags) ||
+	    test_bit(EXTENT_FLAG_PREALLOC, &em->flags) ||
+	    em->block_start + (file_offset - em->start) != logical)
+		goto out;
+
+	if (!trylock_page(page))
+		goto out;
+
+	if (PageUptodate(page) && !PageDirty(page) && !PageWriteback(page) &&
+	    page->mapping == src_inode->i_mapping) {
+		copy_highpage(dst, page);
+		SetPageUptodate(dst);
+		ret = 1;
+	}
+	unlock_page(page);
+
+out:
+	if (em && !IS_ERR(em))
+		free_extent_map(em);
+	page_cache_release(page);
+	return ret;
+}
+
+/*
+ * Before reading a cluster of data extents from disk, populate the pages of
+ * the relocation inode using the page cache of the inodes referencing the
+ * extents. Readahead skips pages already present in the mapping, so only
+ * the uncached ranges will be read from disk afterwards.
+ */
+static void reloc_prefill_cached_cluster(struct reloc_control *rc,
+					 struct inode *inode,
+					 struct file_extent_cluster *cluster)
+{
+	struct btrfs_fs_info *fs_info = BTRFS_I(inode)->root->fs_info;
+	u64 offset = BTRFS_I(inode)->index_cnt;
+	u64 extent_start, extent_end, logical;
+	gfp_t mask = btrfs_alloc_write_mask(inode->i_mapping);
+	struct reloc_cached_ctx *cctx;
+	struct inode *src_inodes[RELOC_CACHED_MAX_REFS];
+	struct page *page;
+	unsigned long index;
+	int nr, i, ret;
+
+	cctx = kmalloc(sizeof(*cctx), GFP_NOFS);
+	if (!cctx)
+		return;
+
+	for (nr = 0; nr < cluster->nr; nr++) {
+		extent_start = cluster->boundary[nr];
+		if (nr + 1 < cluster->nr)
+			extent_end = cluster->boundary[nr + 1] - 1;
+		else
+			extent_end = cluster->end;
+
+		cctx->nr = 0;
+		ret = iterate_extent_inodes(fs_info, extent_start, 0, 0,
+					    reloc_collect_ref, cctx);
+		if (ret < 0 || !cctx->nr)
+			continue;
+
+		for (i = 0; i < cctx->nr; i++)
+			src_inodes[i] = reloc_iget_ref(fs_info, &cctx->refs[i]);
+
+		for (logical = extent_start; logical <= extent_end;
+		     logical += PAGE_CACHE_SIZE) {
+			index = (logical - offset) >> PAGE_CACHE_SHIFT;
+
+			page = find_get_page(inode->i_mapping, index);
+			if (page) {
+				page_cache_release(page);
+				continue;
+			}
+
+			page = find_or_create_page(inode->i_mapping, index,
+						   mask);
+			if (!page)
+				break;
+
+			for (i = 0; i < cctx->nr && !PageUptodate(page); i++) {
+				if (!src_inodes[i])
+					continue;
+				if (reloc_copy_cached_page(src_inodes[i],
+						cctx->refs[i].offset +
+						(logical - extent_start),
+						logical, page))
+					rc->bytes_cached += PAGE_CACHE_SIZE;
+			}
+
+			/* Let readahead pick up what we couldn't find */
+			if (!PageUptodate(page)) {
+				delete_from_page_cache(page);
+				unlock_page(page);
+				page_cache_release(page);
+				continue;
+			}
+
+			unlock_page(page);
+			page_cache_release(page);
+		}
+
+		for (i = 0; i < cctx->nr; i++)
+			if (src_inodes[i])
+				iput(src_inodes[i]);
+	}
+
+	reloc_dbg(KERN_INFO "btrfs: reloc cluster [%llu, %llu]: %llu bytes "
+		  "cached so far\n", cluster->start, cluster->end,
+		  rc->bytes_cached);
+	kfree(cctx);
+}
+#endif /* CONFIG_BTRFS_DUET_RELOC */
+
+static int relocate_file_extent_cluster(struct reloc_control *rc,
+					struct inode *inode,
 					struct file_extent_cluster *cluster)
 {
 	u64 page_start;
@@ -3128,6 +3342,10 @@ static int relocate_file_extent_cluster(struct inode *inode,
 	if (ret)
 		goto out;
 
+#ifdef CONFIG_BTRFS_DUET_RELOC
+	reloc_prefill_cached_cluster(rc, inode, cluster);
+#endif /* CONFIG_BTRFS_DUET_RELOC */
+
 	index = (cluster->start - offset) >> PAGE_CACHE_SHIFT;
 	last_index = (cluster->end - offset) >> PAGE_CACHE_SHIFT;
 	while (index <= last_index) {
@@ -3203,13 +3421,14 @@ out:
 }
 
 static noinline_for_stack
-int relocate_data_extent(struct inode *inode, struct btrfs_key *extent_key,
+int relocate_data_extent(struct reloc_control *rc, struct inode *inode,
+			 struct btrfs_key *extent_key,
 			 struct file_extent_cluster *cluster)
 {
 	int ret;
 
 	if (cluster->nr > 0 && extent_key->objectid != cluster->end + 1) {
-		ret = relocate_file_extent_cluster(inode, cluster);
+		ret = relocate_file_extent_cluster(rc, inode, cluster);
 		if (ret)
 			return ret;
 		cluster->nr = 0;
@@ -3224,7 +3443,7 @@ int relocate_data_extent(struct inode *inode, struct btrfs_key *extent_key,
 	cluster->nr++;
 
 	if (cluster->nr >= MAX_EXTENTS) {
-		ret = relocate_file_extent_cluster(inode, cluster);
+		ret = relocate_file_extent_cluster(rc, inode, cluster);
 		if (ret)
 			return ret;
 		cluster->nr = 0;
@@ -4033,7 +4252,7 @@ restart:
 		if (rc->stage == MOVE_DATA_EXTENTS &&
 		    (flags & BTRFS_EXTENT_FLAG_DATA)) {
 			rc->found_file_extent = 1;
-			ret = relocate_data_extent(rc->data_inode,
+			ret = relocate_data_extent(rc, rc->data_inode,
 						   &key, &rc->cluster);
 			if (ret < 0) {
 				err = ret;
@@ -4061,7 +4280,7 @@ restart:
 	}
 
 	if (!err) {
-		ret = relocate_file_extent_cluster(rc->data_inode,
+		ret = relocate_file_extent_cluster(rc, rc->data_inode,
 						   &rc->cluster);
 		if (ret < 0)
 			err = ret;
@@ -4294,6 +4513,16 @@ int btrfs_relocate_block_group(struct btrfs_root *extent_root, u64 group_start)
 	WARN_ON(rc->block_group->reserved > 0);
 	WARN_ON(btrfs_block_group_used(&rc->block_group->item) > 0);
 out:
+#ifdef CONFIG_BTRFS_DUET_RELOC
+	if (rc->bytes_cached) {
+		printk(KERN_INFO "btrfs: reused %llu bytes from the page cache\n",
+		       rc->bytes_cached);
+		spin_lock(&fs_info->balance_lock);
+		if (fs_info->balance_ctl)
+			fs_info->balance_ctl->bytes_cached += rc->bytes_cached;
+		spin_unlock(&fs_info->balance_lock);
+	}
+#endif /* CONFIG_BTRFS_DUET_RELOC */
 	if (err && rw)
 		btrfs_set_block_group_rw(extent_root, rc->block_group);
 	iput(rc->data_inode);
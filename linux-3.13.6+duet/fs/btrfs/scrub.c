@@ -643,6 +643,42 @@ out:
 #endif /* CONFIG_BTRFS_FS_SCRUB_ADAPT */
 
 #ifdef CONFIG_BTRFS_DUET_SCRUB
+/*
+ * Tree blocks are read and checksummed by btrfs itself, through the btree
+ * inode, which page events don't cover. Instead, btrfs reports each tree block
+ * that passed its checksum, with the physical location of the copy it read. We
+ * mark the ones on our device done, so scrub_extent() doesn't read them again.
+ */
+static void process_duet_verified(struct scrub_ctx *sctx)
+{
+	__u16 i, count;
+	struct duet_block blks[16];
+	u64 dstart = sctx->scrub_dev->bd_part->start_sect << 9;
+	u32 dev = new_encode_dev(sctx->scrub_dev->bd_dev);
+
+	do {
+		count = ARRAY_SIZE(blks);
+		if (duet_fetch_verified(sctx->taskid, blks, &count)) {
+			printk(KERN_ERR "duet-scrub: duet_fetch_verified failed\n");
+			return;
+		}
+
+		for (i = 0; i < count; i++) {
+			if (blks[i].dev != dev)
+				continue;
+
+			scrub_dbg(KERN_INFO "duet-scrub: marking tree block "
+				"[%llu, %llu]\n", dstart + (blks[i].sector << 9),
+				dstart + (blks[i].sector << 9) + blks[i].len);
+			if (duet_set_done(sctx->taskid,
+			    dstart + (blks[i].sector << 9), blks[i].len) == -1)
+				printk(KERN_ERR "duet-scrub: failed to mark tree "
+					"block at sector %llu for task #%d\n",
+					blks[i].sector, sctx->taskid);
+		}
+	} while (count == ARRAY_SIZE(blks));
+}
+
 /*
  * This is the core of the synergistic scrubber. We fetch page-related events,
  * and mark or unmark the corresponding LBN range(s), depending on whether the
@@ -674,6 +710,8 @@ static int process_duet_events(struct scrub_ctx *sctx)
 	struct btrfs_fs_info *fs_info = sctx->dev_root->fs_info;
 	struct btrfs_device *pdev;
 
+	process_duet_verified(sctx);
+
 	while (ret) {
 		if (duet_fetch(sctx->taskid, &itm, &itret)) {
 			printk(KERN_ERR "duet-scrub: duet_fetch failed\n");
@@ -926,7 +964,8 @@ struct scrub_ctx *scrub_setup_ctx(struct btrfs_device *dev, u64 deadline,
 
 	/* Register the task with the Duet framework */
 	if (duet_online() && duet_register((char *)fs_info->sb,
-	    DUET_REG_SBLOCK | DUET_PAGE_ADDED | DUET_PAGE_DIRTY,
+	    DUET_REG_SBLOCK | DUET_PAGE_ADDED | DUET_PAGE_DIRTY |
+	    DUET_META_VERIFIED,
 	    fs_info->sb->s_blocksize, "btrfs-scrub", &sctx->taskid)) {
 		printk(KERN_ERR "scrub: failed to register with duet\n");
 		return ERR_PTR(-EFAULT);
@@ -3117,9 +3156,16 @@ static int scrub_extent(struct scrub_ctx *sctx, u64 logical, u64 len,
 		if (!sctx->is_dev_replace && (duet_check_done(sctx->taskid,
 		    dstart + physical, l) == 1)) {
 			scrub_dbg(KERN_INFO "duet-scrub: found!\n");
+			duet_account_io(sctx->taskid, 0, l);
+			if (flags & BTRFS_EXTENT_FLAG_TREE_BLOCK) {
+				spin_lock(&sctx->stat_lock);
+				sctx->stat.tree_bytes_skipped += l;
+				spin_unlock(&sctx->stat_lock);
+			}
 			goto behind_scrub_pages;
 		} else if (!sctx->is_dev_replace) {
 			/* We're actually getting verified */
+			duet_account_io(sctx->taskid, l, 0);
 			if (flags & BTRFS_EXTENT_FLAG_DATA) {
 				spin_lock(&sctx->stat_lock);
 				sctx->stat.data_bytes_verified += l;
@@ -3617,6 +3663,7 @@ again:
 			    dstart + extent_physical, extent_len) == 1)) {
 				scrub_dbg(KERN_INFO "duet-scrub: found!\n");
 				tot_skipped++;
+				duet_account_io(sctx->taskid, 0, extent_len);
 				if (flags & BTRFS_EXTENT_FLAG_DATA) {
 					spin_lock(&sctx->stat_lock);
 					sctx->stat.data_bytes_scrubbed += extent_len;
@@ -3624,6 +3671,7 @@ again:
 				} else if (flags & BTRFS_EXTENT_FLAG_TREE_BLOCK) {
 					spin_lock(&sctx->stat_lock);
 					sctx->stat.tree_bytes_scrubbed += extent_len;
+					sctx->stat.tree_bytes_skipped += extent_len;
 					spin_unlock(&sctx->stat_lock);
 				}
 				goto skip_extent;
@@ -3997,6 +4045,10 @@ int btrfs_scrub_dev(struct btrfs_fs_info *fs_info, u64 devid, u64 start,
 	struct scrub_ctx *sctx;
 	int ret;
 	struct btrfs_device *dev;
+#ifdef CONFIG_BTRFS_DUET_SCRUB
+	int old_ioprio = 0;
+	int ioprio_set = 0;
+#endif /* CONFIG_BTRFS_DUET_SCRUB */
 
 	if (btrfs_fs_closing(fs_info))
 		return -EINVAL;
@@ -4098,6 +4150,13 @@ int btrfs_scrub_dev(struct btrfs_fs_info *fs_info, u64 devid, u64 start,
 	atomic_inc(&fs_info->scrubs_running);
 	mutex_unlock(&fs_info->scrub_lock);
 
+#ifdef CONFIG_BTRFS_DUET_SCRUB
+	/* Submit our reads with the I/O priority Duet has for us */
+	if (sctx->taskid && !is_dev_replace &&
+	    !duet_apply_ioprio(sctx->taskid, &old_ioprio))
+		ioprio_set = 1;
+#endif /* CONFIG_BTRFS_DUET_SCRUB */
+
 	if (!is_dev_replace) {
 		/*
 		 * by holding device list mutex, we can
@@ -4130,6 +4189,10 @@ int btrfs_scrub_dev(struct btrfs_fs_info *fs_info, u64 devid, u64 start,
 	scrub_workers_put(fs_info);
 	mutex_unlock(&fs_info->scrub_lock);
 
+#ifdef CONFIG_BTRFS_DUET_SCRUB
+	if (ioprio_set)
+		duet_restore_ioprio(old_ioprio);
+#endif /* CONFIG_BTRFS_DUET_SCRUB */
 	scrub_free_ctx(sctx);
 
 	return ret;
@@ -57,6 +57,9 @@
 #include "free-space-cache.h"
 #include "backref.h"
 #include "tests/btrfs-tests.h"
+#ifdef CONFIG_BTRFS_FS_MAPPING
+#include "mapping.h"
+#endif /* CONFIG_BTRFS_FS_MAPPING */
 
 #define CREATE_TRACE_POINTS
 #include <trace/events/btrfs.h>
@@ -1747,6 +1750,9 @@ static const struct super_operations btrfs_super_ops = {
 	.remount_fs	= btrfs_remount,
 	.freeze_fs	= btrfs_freeze,
 	.unfreeze_fs	= btrfs_unfreeze,
+#if defined(CONFIG_DUET) && defined(CONFIG_BTRFS_FS_MAPPING)
+	.duet_map_page	= btrfs_duet_map_page,
+#endif /* CONFIG_DUET && CONFIG_BTRFS_FS_MAPPING */
 };
 
 static const struct file_operations btrfs_ctl_fops = {
@@ -3266,6 +3266,11 @@ int btrfs_balance(struct btrfs_balance_control *bctl,
 	mutex_lock(&fs_info->balance_mutex);
 	atomic_dec(&fs_info->balance_running);
 
+#ifdef CONFIG_BTRFS_DUET_RELOC
+	printk(KERN_INFO "btrfs: balance reused %llu bytes from the page cache\n",
+	       bctl->bytes_cached);
+#endif /* CONFIG_BTRFS_DUET_RELOC */
+
 	if (bctl->sys.flags & BTRFS_BALANCE_ARGS_CONVERT) {
 		fs_info->num_tolerated_disk_barrier_failures =
 			btrfs_calc_num_tolerated_disk_barrier_failures(fs_info);
@@ -275,6 +275,9 @@ struct btrfs_balance_control {
 	u64 flags;
 
 	struct btrfs_balance_progress stat;
+#ifdef CONFIG_BTRFS_DUET_RELOC
+	u64 bytes_cached;	/* relocated bytes found in the page cache */
+#endif /* CONFIG_BTRFS_DUET_RELOC */
 };
 
 int btrfs_account_dev_extents_size(struct btrfs_device *device, u64 start,
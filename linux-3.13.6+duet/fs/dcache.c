@@ -1522,6 +1522,9 @@ struct dentry *__d_alloc(struct super_block *sb, const struct qstr *name)
 	dentry->d_sb = sb;
 	dentry->d_op = NULL;
 	dentry->d_fsdata = NULL;
+#ifdef CONFIG_DUET
+	dentry->d_duet_scope = 0;
+#endif /* CONFIG_DUET */
 	INIT_HLIST_BL_NODE(&dentry->d_hash);
 	INIT_LIST_HEAD(&dentry->d_lru);
 	INIT_LIST_HEAD(&dentry->d_subdirs);
@@ -1939,6 +1942,10 @@ struct dentry *d_splice_alias(struct inode *inode, struct dentry *dentry)
 			spin_unlock(&inode->i_lock);
 			security_d_instantiate(new, inode);
 			d_move(new, dentry);
+#ifdef CONFIG_DUET
+			/* The subtree of new just got a new set of ancestors */
+			d_duet_scope_bump();
+#endif /* CONFIG_DUET */
 			iput(inode);
 		} else {
 			/* already taking inode->i_lock, so d_add() by hand */
@@ -2746,6 +2753,10 @@ struct dentry *d_materialise_unique(struct dentry *dentry, struct inode *inode)
 		alias = __d_find_alias(inode, 0);
 		if (alias) {
 			actual = alias;
+#ifdef CONFIG_DUET
+			/* The alias may be moved, subtree and all */
+			d_duet_scope_bump();
+#endif /* CONFIG_DUET */
 			write_seqlock(&rename_lock);
 
 			if (d_ancestor(alias, dentry)) {
@@ -3439,6 +3450,61 @@ void __init vfs_caches_init(unsigned long mempages)
 }
 
 #ifdef CONFIG_DUET
+/*
+ * Generation of the duet scope tags kept in d_duet_scope. Bumping it
+ * invalidates every tag at once, e.g. when a directory alias is spliced into
+ * the tree behind the back of the duet rename hook.
+ */
+atomic_t duet_scope_gen = ATOMIC_INIT(1);
+EXPORT_SYMBOL(duet_scope_gen);
+
+/*
+ * Tags keep the generation in the upper half of a long, so it wraps around
+ * every 2^16 bumps on 32-bit machines. Generation 0 is skipped, or the zeroed
+ * tags of new dentries would look valid.
+ */
+void d_duet_scope_bump(void)
+{
+	unsigned int gen;
+
+	do {
+		gen = atomic_inc_return(&duet_scope_gen);
+	} while (!((unsigned long)gen << (BITS_PER_LONG / 2)));
+}
+EXPORT_SYMBOL(d_duet_scope_bump);
+
+struct d_duet_walk_data {
+	void *data;
+	void (*fn)(void *, struct dentry *);
+};
+
+static enum d_walk_ret d_duet_walk_enter(void *_data, struct dentry *dentry)
+{
+	struct d_duet_walk_data *wd = _data;
+
+	wd->fn(wd->data, dentry);
+	return D_WALK_CONTINUE;
+}
+
+/**
+ * d_duet_walk - call fn on every dentry of a cached subtree
+ * @parent: the root of the subtree
+ * @data: passed on to fn
+ * @fn: called with the dentry's d_lock held, so it must not sleep
+ *
+ * On a concurrent rename the walk restarts, so fn may see a dentry twice.
+ * The restarted walk holds rename_lock, so fn must not wait on it either,
+ * e.g. by looking up paths with d_find_path().
+ */
+void d_duet_walk(struct dentry *parent, void *data,
+		 void (*fn)(void *, struct dentry *))
+{
+	struct d_duet_walk_data wd = { .data = data, .fn = fn };
+
+	d_walk(parent, &wd, d_duet_walk_enter, NULL);
+}
+EXPORT_SYMBOL(d_duet_walk);
+
 /**
  * __d_get_path - Get path from target to parent
  * @tgt: the dentry we're starting from
@@ -3538,10 +3604,14 @@ restart:
 /*
  * Tries to find a path from cnode to p_dentry. If getpath is not zero, we also
  * return the full path to it in buf. p points to start of path within buf.
+ * Hard-linked inodes have several aliases; we try all cached ones, and report
+ * the path of the first one found under p_dentry. The alias list is protected
+ * by cnode->i_lock, which we hold throughout.
  *
  * We assume that:
- * 1) The p_dentry points to the parent dir. No hard links, no hard feelings.
+ * 1) The p_dentry points to the parent dir.
  * 2) You already hold a refcount on c_inode and p_inode, so we won't bother
+ * 3) We're not called from a d_walk() callback, which may hold rename_lock
  *
  * Return values: success (0), not found (1), error (<0)
  */
@@ -3549,27 +3619,26 @@ int d_find_path(struct inode *cnode, struct dentry *p_dentry, int getpath,
 	char *buf, int len, char **p)
 {
 	int tlen, ret = 1;
-	struct dentry *alias, *c_dentry = NULL;
-
-	if (!hlist_empty(&cnode->i_dentry)) {
-		hlist_for_each_entry(alias, &cnode->i_dentry, d_alias) {
- 			if (!(IS_ROOT(alias) &&
-			    (alias->d_flags & DCACHE_DISCONNECTED))) {
-				c_dentry = alias;
-
-				if (getpath) {
-					*p = buf + len;
-					tlen = len;
-					prepend(p, &tlen, "\0", 1);
-				}
-
-				ret = __d_get_path(c_dentry, p_dentry,
-						getpath, p, &tlen);
-				if (!ret)
-					break;
-			}
+	struct dentry *alias;
+
+	spin_lock(&cnode->i_lock);
+	hlist_for_each_entry(alias, &cnode->i_dentry, d_alias) {
+		/* Unhashed non-root aliases are names that were just removed */
+		if (IS_ROOT(alias) ? (alias->d_flags & DCACHE_DISCONNECTED) :
+		    d_unhashed(alias))
+			continue;
+
+		if (getpath) {
+			*p = buf + len;
+			tlen = len;
+			prepend(p, &tlen, "\0", 1);
 		}
+
+		ret = __d_get_path(alias, p_dentry, getpath, p, &tlen);
+		if (!ret)
+			break;
 	}
+	spin_unlock(&cnode->i_lock);
 
 	return ret;
 }
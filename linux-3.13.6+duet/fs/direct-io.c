@@ -38,6 +38,9 @@
 #include <linux/atomic.h>
 #include <linux/prefetch.h>
 #include <linux/aio.h>
+#ifdef CONFIG_DUET
+#include <linux/duet.h>
+#endif /* CONFIG_DUET */
 
 /*
  * How many user pages to map in one call to get_user_pages().  This determines
@@ -237,6 +240,9 @@ static ssize_t dio_complete(struct dio *dio, loff_t offset, ssize_t ret,
 		bool is_async)
 {
 	ssize_t transferred = 0;
+#ifdef CONFIG_DUET
+	duet_dio_hook_t *ddhfp = NULL;
+#endif /* CONFIG_DUET */
 
 	/*
 	 * AIO submission can race with bio completion to get here while
@@ -265,6 +271,23 @@ static ssize_t dio_complete(struct dio *dio, loff_t offset, ssize_t ret,
 	if (dio->end_io && dio->result)
 		dio->end_io(dio->iocb, offset, transferred, dio->private);
 
+#ifdef CONFIG_DUET
+	/*
+	 * The write bypassed the page cache hooks, so tell Duet about it. We
+	 * may only do so from process context; AIO writes are deferred to the
+	 * dio workqueue for this, unless the hook showed up after submission.
+	 */
+	if ((dio->rw & WRITE) && transferred > 0 &&
+	    (!is_async || dio->defer_completion)) {
+		rcu_read_lock();
+		ddhfp = rcu_dereference(duet_dio_hook_fp);
+
+		if (ddhfp)
+			ddhfp(dio->inode, offset, transferred);
+		rcu_read_unlock();
+	}
+#endif /* CONFIG_DUET */
+
 	inode_dio_done(dio->inode);
 	if (is_async) {
 		if (dio->rw & WRITE) {
@@ -1222,6 +1245,18 @@ do_blockdev_direct_IO(int rw, struct kiocb *iocb, struct inode *inode,
 		}
 	}
 
+#ifdef CONFIG_DUET
+	/* The Duet hook can't run from the bio completion interrupt */
+	if (dio->is_async && (rw & WRITE) &&
+	    rcu_access_pointer(duet_dio_hook_fp)) {
+		retval = dio_set_defer_completion(dio);
+		if (retval) {
+			kmem_cache_free(dio_cache, dio);
+			goto out;
+		}
+	}
+#endif /* CONFIG_DUET */
+
 	/*
 	 * Will be decremented at I/O completion time.
 	 */
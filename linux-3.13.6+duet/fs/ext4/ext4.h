@@ -2733,6 +2733,11 @@ extern int ext4_convert_unwritten_extents(handle_t *handle, struct inode *inode,
 					  loff_t offset, ssize_t len);
 extern int ext4_map_blocks(handle_t *handle, struct inode *inode,
 			   struct ext4_map_blocks *map, int flags);
+#ifdef CONFIG_DUET
+struct duet_block;
+extern int ext4_duet_map_page(struct inode *inode, unsigned long idx,
+			      struct duet_block *blk);
+#endif /* CONFIG_DUET */
 extern int ext4_ext_calc_metadata_amount(struct inode *inode,
 					 ext4_lblk_t lblocks);
 extern int ext4_extent_tree_init(handle_t *, struct inode *);
@@ -38,6 +38,9 @@
 #include <linux/slab.h>
 #include <linux/ratelimit.h>
 #include <linux/aio.h>
+#ifdef CONFIG_DUET
+#include <linux/duet.h>
+#endif /* CONFIG_DUET */
 
 #include "ext4_jbd2.h"
 #include "xattr.h"
@@ -2916,6 +2919,35 @@ static sector_t ext4_bmap(struct address_space *mapping, sector_t block)
 	return generic_block_bmap(mapping, block, ext4_get_block);
 }
 
+#ifdef CONFIG_DUET
+/*
+ * Maps a page of the inode to its physical location for the duet framework.
+ * Unlike ext4_bmap, this is a pure lookup: we neither flush delayed
+ * allocations nor the journal, so unallocated blocks are reported unmapped.
+ */
+int ext4_duet_map_page(struct inode *inode, unsigned long idx,
+		       struct duet_block *blk)
+{
+	struct ext4_map_blocks map;
+	int ret;
+
+	if (ext4_has_inline_data(inode))
+		return 1;
+
+	map.m_lblk = (ext4_lblk_t)idx << (PAGE_CACHE_SHIFT - inode->i_blkbits);
+	map.m_len = 1 << (PAGE_CACHE_SHIFT - inode->i_blkbits);
+
+	ret = ext4_map_blocks(NULL, inode, &map, 0);
+	if (ret <= 0 || !(map.m_flags & EXT4_MAP_MAPPED))
+		return 1;
+
+	blk->dev = new_encode_dev(inode->i_sb->s_bdev->bd_dev);
+	blk->sector = (u64)map.m_pblk << (inode->i_blkbits - 9);
+	blk->len = ret << inode->i_blkbits;
+	return 0;
+}
+#endif /* CONFIG_DUET */
+
 static int ext4_readpage(struct file *file, struct page *page)
 {
 	int ret = -EAGAIN;
@@ -1116,6 +1116,9 @@ static const struct super_operations ext4_sops = {
 	.quota_write	= ext4_quota_write,
 #endif
 	.bdev_try_to_free_page = bdev_try_to_free_page,
+#ifdef CONFIG_DUET
+	.duet_map_page	= ext4_duet_map_page,
+#endif /* CONFIG_DUET */
 };
 
 static const struct super_operations ext4_nojournal_sops = {
@@ -1135,6 +1138,9 @@ static const struct super_operations ext4_nojournal_sops = {
 	.quota_write	= ext4_quota_write,
 #endif
 	.bdev_try_to_free_page = bdev_try_to_free_page,
+#ifdef CONFIG_DUET
+	.duet_map_page	= ext4_duet_map_page,
+#endif /* CONFIG_DUET */
 };
 
 static const struct export_operations ext4_export_ops = {
@@ -294,7 +294,8 @@ static int stat_show(struct seq_file *s, void *v)
 			si->t_gc.tv64 / NSEC_PER_SEC,
 			(si->t_gc.tv64 % NSEC_PER_SEC) / NSEC_PER_MSEC);
 
-		seq_printf(s, "Total GC pagecache hits: %u\n", si->gc_cache_hits);
+		seq_printf(s, "Total GC blocks read: %u, reused from pagecache: %u\n",
+			si->gc_blks_read, si->gc_cache_hits);
 		seq_printf(s, "Total in memory estimates: %u\n", si->gc_inmem);
 #endif /* CONFIG_F2FS_DUET_STAT */
 	}
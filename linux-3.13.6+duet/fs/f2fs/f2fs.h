@@ -1177,6 +1177,7 @@ struct f2fs_stat_info {
 	ktime_t t_duet; /* total duet time */
 	ktime_t t_gc;	 /* total gc time (w/o duet) */
 	unsigned int gc_cache_hits; /* number of gc pagecache hits */
+	unsigned int gc_blks_read; /* number of blocks gc read from disk */
 	unsigned int gc_inmem; /* estimated in memory blocks */
 #endif /* CONFIG_F2FS_DUET_STAT */
 };
@@ -1248,6 +1249,16 @@ static inline void __init f2fs_create_root_stats(void) { }
 static inline void f2fs_destroy_root_stats(void) { }
 #endif
 
+#ifdef CONFIG_F2FS_DUET_STAT
+#define stat_inc_gc_read_count(sbi, blks)				\
+		(F2FS_STAT(sbi)->gc_blks_read += (blks))
+#define stat_inc_gc_hit_count(sbi, blks)				\
+		(F2FS_STAT(sbi)->gc_cache_hits += (blks))
+#else
+#define stat_inc_gc_read_count(sbi, blks)
+#define stat_inc_gc_hit_count(sbi, blks)
+#endif /* CONFIG_F2FS_DUET_STAT */
+
 extern const struct file_operations f2fs_dir_operations;
 extern const struct file_operations f2fs_file_operations;
 extern const struct inode_operations f2fs_file_inode_operations;
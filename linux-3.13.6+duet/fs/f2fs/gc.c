@@ -451,6 +451,15 @@ static int gc_thread_func(void *data)
 	struct f2fs_gc_kthread *gc_th = sbi->gc_thread;
 	wait_queue_head_t *wq = &sbi->gc_thread->gc_wait_queue_head;
 	long wait_ms;
+#ifdef CONFIG_F2FS_DUET_GC
+	int old_ioprio;
+
+	/* Clean in the background with the I/O priority Duet has for us */
+	if (sbi->duet_task_id &&
+	    duet_apply_ioprio(sbi->duet_task_id, &old_ioprio))
+		f2fs_duet_debug(KERN_ERR "f2fs: duet-gc: "
+				"failed to set I/O priority\n");
+#endif /* CONFIG_F2FS_DUET_GC */
 
 	wait_ms = gc_th->min_sleep_time;
 
@@ -598,6 +607,19 @@ static void select_policy(struct f2fs_sb_info *sbi, int gc_type,
 	if (p->max_search > MAX_VICTIM_SEARCH)
 		p->max_search = MAX_VICTIM_SEARCH;
 
+#ifdef CONFIG_F2FS_DUET_GC
+	/*
+	 * Foreground GC blocks checkpointing, so let it pick victims based on
+	 * the blocks it actually has to read. If we are about to run out of
+	 * free sections, reclaiming space comes first, and cached blocks only
+	 * break ties.
+	 */
+	p->cache_aware = sbi->duet_task_id && p->alloc_mode == LFS &&
+			gc_type == FG_GC && p->gc_mode == GC_GREEDY;
+	p->cache_critical = p->cache_aware &&
+			free_sections(sbi) <= reserved_sections(sbi);
+#endif /* CONFIG_F2FS_DUET_GC */
+
 	p->offset = sbi->last_victim[p->gc_mode];
 }
 
@@ -607,6 +629,13 @@ static unsigned int get_max_cost(struct f2fs_sb_info *sbi,
 	/* SSR allocates in a segment unit */
 	if (p->alloc_mode == SSR)
 		return 1 << sbi->log_blocks_per_seg;
+#ifdef CONFIG_F2FS_DUET_GC
+	if (p->cache_critical)
+		return (GC_CACHE_TIEBREAK << sbi->log_blocks_per_seg) *
+			p->ofs_unit;
+	if (p->cache_aware)
+		return (2 << sbi->log_blocks_per_seg) * p->ofs_unit;
+#endif /* CONFIG_F2FS_DUET_GC */
 	if (p->gc_mode == GC_GREEDY)
 		return (1 << sbi->log_blocks_per_seg) * p->ofs_unit;
 	else if (p->gc_mode == GC_CB)
@@ -686,12 +715,50 @@ static unsigned int get_cb_cost(struct f2fs_sb_info *sbi, unsigned int segno)
 	return UINT_MAX - ((100 * (100 - u) * age) / (100 + u));
 }
 
+#ifdef CONFIG_F2FS_DUET_GC
+/*
+ * Cost of cleaning a section in the foreground: every valid block has to be
+ * written out, but only the ones that are not in the page cache have to be
+ * read first. When free sections are critically low, what matters is the
+ * space we get back, so valid blocks decide as in plain greedy GC, and the
+ * fraction of uncached blocks only breaks ties among sections with equally
+ * many of them. A full section frees nothing, however cached it is.
+ */
+static unsigned int get_fg_cost(struct f2fs_sb_info *sbi, unsigned int segno,
+				struct victim_sel_policy *p)
+{
+	unsigned int start = GET_SECNO(sbi, segno) * sbi->segs_per_sec;
+	unsigned int vblocks, inmem = 0;
+	unsigned int i;
+
+	vblocks = get_valid_blocks(sbi, segno, sbi->segs_per_sec);
+	if (vblocks >= (sbi->segs_per_sec << sbi->log_blocks_per_seg))
+		return get_max_cost(sbi, p);
+
+	for (i = 0; i < sbi->segs_per_sec; i++)
+		inmem += get_seg_entry(sbi, start + i)->page_cached_blocks;
+
+	/* The cached block counters are only an estimate */
+	inmem = min(inmem, vblocks);
+
+	if (p->cache_critical)
+		return vblocks * GC_CACHE_TIEBREAK + (vblocks ? ((vblocks - inmem) *
+			(GC_CACHE_TIEBREAK - 1)) / vblocks : 0);
+	return 2 * vblocks - inmem;
+}
+#endif /* CONFIG_F2FS_DUET_GC */
+
 static inline unsigned int get_gc_cost(struct f2fs_sb_info *sbi,
 			unsigned int segno, struct victim_sel_policy *p)
 {
 	if (p->alloc_mode == SSR)
 		return get_seg_entry(sbi, segno)->ckpt_valid_blocks;
 
+#ifdef CONFIG_F2FS_DUET_GC
+	if (p->cache_aware)
+		return get_fg_cost(sbi, segno, p);
+#endif /* CONFIG_F2FS_DUET_GC */
+
 	/* alloc_mode == LFS */
 	if (p->gc_mode == GC_GREEDY)
 		return get_valid_blocks(sbi, segno, sbi->segs_per_sec);
@@ -699,6 +766,18 @@ static inline unsigned int get_gc_cost(struct f2fs_sb_info *sbi,
 		return get_cb_cost(sbi, segno);
 }
 
+static inline bool use_bg_victims(struct victim_sel_policy *p, int gc_type)
+{
+	if (p->alloc_mode != LFS || gc_type != FG_GC)
+		return false;
+#ifdef CONFIG_F2FS_DUET_GC
+	/* BG victims are cheap to write back, not necessarily to read */
+	if (p->cache_critical)
+		return false;
+#endif /* CONFIG_F2FS_DUET_GC */
+	return true;
+}
+
 /*
  * This function is called from two paths.
  * One is garbage collection and the other is SSR segment selection.
@@ -723,7 +802,7 @@ static int get_victim_by_default(struct f2fs_sb_info *sbi,
 
 	mutex_lock(&dirty_i->seglist_lock);
 
-	if (p.alloc_mode == LFS && gc_type == FG_GC) {
+	if (use_bg_victims(&p, gc_type)) {
 		p.min_segno = check_bg_victims(sbi);
 		if (p.min_segno != NULL_SEGNO)
 			goto got_it;
@@ -827,6 +906,35 @@ static void put_gc_inode(struct list_head *ilist)
 	}
 }
 
+#if defined(CONFIG_F2FS_DUET_GC) || defined(CONFIG_F2FS_DUET_STAT)
+/* Account a block GC is about to move as read from disk or from the cache */
+static void account_gc_block(struct f2fs_sb_info *sbi,
+			struct address_space *mapping, pgoff_t index)
+{
+	struct page *page;
+	bool cached;
+
+	page = find_get_page(mapping, index);
+	cached = page && PageUptodate(page);
+	if (page)
+		page_cache_release(page);
+
+	if (cached)
+		stat_inc_gc_hit_count(sbi, 1);
+	else
+		stat_inc_gc_read_count(sbi, 1);
+
+#ifdef CONFIG_F2FS_DUET_GC
+	if (sbi->duet_task_id)
+		duet_account_io(sbi->duet_task_id, cached ? 0 : sbi->blocksize,
+				cached ? sbi->blocksize : 0);
+#endif /* CONFIG_F2FS_DUET_GC */
+}
+#else
+static inline void account_gc_block(struct f2fs_sb_info *sbi,
+			struct address_space *mapping, pgoff_t index) { }
+#endif /* CONFIG_F2FS_DUET_GC || CONFIG_F2FS_DUET_STAT */
+
 static int check_valid_map(struct f2fs_sb_info *sbi,
 				unsigned int segno, int offset)
 {
@@ -868,6 +976,7 @@ next_step:
 			continue;
 
 		if (initial) {
+			account_gc_block(sbi, sbi->node_inode->i_mapping, nid);
 			ra_node_page(sbi, nid);
 			continue;
 		}
@@ -1007,6 +1116,7 @@ static void gc_data_segment(struct f2fs_sb_info *sbi, struct f2fs_summary *sum,
 	block_t start_addr;
 	int off;
 	int phase = 0;
+	bool retry = false;
 
 	start_addr = START_BLOCK(sbi, segno);
 
@@ -1050,6 +1160,9 @@ next_step:
 
 			start_bidx = start_bidx_of_node(nofs, F2FS_I(inode));
 
+			if (!retry)
+				account_gc_block(sbi, inode->i_mapping,
+						start_bidx + ofs_in_node);
 			data_page = find_data_page(inode,
 					start_bidx + ofs_in_node, false);
 			if (IS_ERR(data_page))
@@ -1086,6 +1199,7 @@ next_iput:
 		 * completely.
 		 */
 		if (get_valid_blocks(sbi, segno, 1) != 0) {
+			retry = true;
 			phase = 2;
 			goto next_step;
 		}
@@ -22,6 +22,9 @@
 /* Search max. number of dirty segments to select a victim segment */
 #define MAX_VICTIM_SEARCH 4096 /* covers 8GB */
 
+/* Weight of a valid block over the uncached tiebreak, in critical FG GC */
+#define GC_CACHE_TIEBREAK	16
+
 struct f2fs_gc_kthread {
 	struct task_struct *f2fs_gc_task;
 	wait_queue_head_t gc_wait_queue_head;
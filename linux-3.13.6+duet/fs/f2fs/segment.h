@@ -151,6 +151,10 @@ struct victim_sel_policy {
 	unsigned int ofs_unit;		/* bitmap search unit */
 	unsigned int min_cost;		/* minimum cost */
 	unsigned int min_segno;		/* segment # having min. cost */
+#ifdef CONFIG_F2FS_DUET_GC
+	bool cache_aware;		/* cost accounts for cached blocks */
+	bool cache_critical;		/* cached blocks only break ties */
+#endif /* CONFIG_F2FS_DUET_GC */
 };
 
 struct seg_entry {
@@ -3664,7 +3664,15 @@ out:
 	/* We don't d_delete() NFS sillyrenamed files--they still exist. */
 	if (!error && !(dentry->d_flags & DCACHE_NFSFS_RENAMED)) {
 		fsnotify_link_count(target);
-		d_delete(dentry);
+		if (target->i_nlink) {
+			/* d_delete() may drop the last reference to it */
+			ihold(target);
+			d_delete(dentry);
+			fsnotify_unlink(target);
+			iput(target);
+		} else {
+			d_delete(dentry);
+		}
 	}
 
 	return error;
@@ -39,6 +39,9 @@
 #include <linux/mpage.h>
 #include <linux/pagevec.h>
 #include <linux/writeback.h>
+#ifdef CONFIG_DUET
+#include <linux/duet.h>
+#endif /* CONFIG_DUET */
 
 void
 xfs_count_page_state(
@@ -72,6 +75,52 @@ xfs_find_bdev_for_inode(
 		return mp->m_ddev_targp->bt_bdev;
 }
 
+#ifdef CONFIG_DUET
+/*
+ * Maps a page of the inode to its physical location for the duet framework.
+ * Holes, delayed allocations and unwritten extents are reported as unmapped.
+ */
+int
+xfs_duet_map_page(
+	struct inode		*inode,
+	unsigned long		idx,
+	struct duet_block	*blk)
+{
+	struct xfs_inode	*ip = XFS_I(inode);
+	struct xfs_mount	*mp = ip->i_mount;
+	struct xfs_bmbt_irec	imap;
+	xfs_fileoff_t		offset_fsb;
+	xfs_filblks_t		skip_fsb;
+	uint			lock_mode;
+	int			nimaps = 1;
+	int			error;
+
+	if (XFS_FORCED_SHUTDOWN(mp))
+		return 1;
+
+	offset_fsb = XFS_B_TO_FSBT(mp, (xfs_off_t)idx << PAGE_CACHE_SHIFT);
+
+	lock_mode = xfs_ilock_map_shared(ip);
+	error = xfs_bmapi_read(ip, offset_fsb, XFS_B_TO_FSB(mp, PAGE_CACHE_SIZE),
+			       &imap, &nimaps, 0);
+	xfs_iunlock_map_shared(ip, lock_mode);
+
+	if (error || !nimaps ||
+	    imap.br_startblock == HOLESTARTBLOCK ||
+	    imap.br_startblock == DELAYSTARTBLOCK ||
+	    imap.br_state == XFS_EXT_UNWRITTEN)
+		return 1;
+
+	skip_fsb = offset_fsb - imap.br_startoff;
+	blk->dev = new_encode_dev(xfs_find_bdev_for_inode(inode)->bd_dev);
+	blk->sector = xfs_fsb_to_db(ip, imap.br_startblock) +
+		      BTOBBT(XFS_FSB_TO_B(mp, skip_fsb));
+	blk->len = min_t(xfs_fsize_t, PAGE_CACHE_SIZE,
+			 XFS_FSB_TO_B(mp, imap.br_blockcount - skip_fsb));
+	return 0;
+}
+#endif /* CONFIG_DUET */
+
 /*
  * We're now finished for good with this ioend structure.
  * Update the page state via the associated buffer_heads,
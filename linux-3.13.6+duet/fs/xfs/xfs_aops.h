@@ -60,4 +60,10 @@ extern int xfs_get_blocks(struct inode *, sector_t, struct buffer_head *, int);
 
 extern void xfs_count_page_state(struct page *, int *, int *);
 
+#ifdef CONFIG_DUET
+struct duet_block;
+extern int xfs_duet_map_page(struct inode *, unsigned long,
+			     struct duet_block *);
+#endif /* CONFIG_DUET */
+
 #endif /* __XFS_AOPS_H__ */
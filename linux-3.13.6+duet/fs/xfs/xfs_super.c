@@ -1552,6 +1552,9 @@ static const struct super_operations xfs_super_operations = {
 	.show_options		= xfs_fs_show_options,
 	.nr_cached_objects	= xfs_fs_nr_cached_objects,
 	.free_cached_objects	= xfs_fs_free_cached_objects,
+#ifdef CONFIG_DUET
+	.duet_map_page		= xfs_duet_map_page,
+#endif /* CONFIG_DUET */
 };
 
 static struct file_system_type xfs_fs_type = {
@@ -93,13 +93,20 @@ extern unsigned int full_name_hash(const unsigned char *, unsigned int);
  * give reasonable cacheline footprint with larger lines without the
  * large memory footprint increase).
  */
+#ifdef CONFIG_DUET
+/* Give up one word of inline name to d_duet_scope */
+# define DNAME_DUET_LEN sizeof(unsigned long)
+#else
+# define DNAME_DUET_LEN 0
+#endif /* CONFIG_DUET */
+
 #ifdef CONFIG_64BIT
-# define DNAME_INLINE_LEN 32 /* 192 bytes */
+# define DNAME_INLINE_LEN (32 - DNAME_DUET_LEN) /* 192 bytes */
 #else
 # ifdef CONFIG_SMP
-#  define DNAME_INLINE_LEN 36 /* 128 bytes */
+#  define DNAME_INLINE_LEN (36 - DNAME_DUET_LEN) /* 128 bytes */
 # else
-#  define DNAME_INLINE_LEN 40 /* 128 bytes */
+#  define DNAME_INLINE_LEN (40 - DNAME_DUET_LEN) /* 128 bytes */
 # endif
 #endif
 
@@ -133,6 +140,9 @@ struct dentry {
 	} d_u;
 	struct list_head d_subdirs;	/* our children */
 	struct hlist_node d_alias;	/* inode alias list */
+#ifdef CONFIG_DUET
+	unsigned long d_duet_scope;	/* duet task scope tag */
+#endif /* CONFIG_DUET */
 };
 
 /*
@@ -465,4 +475,9 @@ static inline unsigned long vfs_pressure_ratio(unsigned long val)
 {
 	return mult_frac(val, sysctl_vfs_cache_pressure, 100);
 }
+
+#ifdef CONFIG_DUET
+extern atomic_t duet_scope_gen;
+extern void d_duet_scope_bump(void);
+#endif /* CONFIG_DUET */
 #endif	/* __LINUX_DCACHE_H */
@@ -33,7 +33,9 @@
  * Add and remove events are triggered when a page __descriptor__ is inserted or
  * removed from the page cache. Modification events are triggered when the page
  * is dirtied (nb: during writes, pages are added, then dirtied), and flush
- * events are triggered when a page is marked for writeback.
+ * events are triggered when a page is marked for writeback. Direct I/O writes
+ * bypass the page cache, so they are reported as dirtying every page in the
+ * range they wrote, whether the page is cached or not.
  * State-based Duet monitors changes in the page cache. Registering for EXISTS
  * events means that fetch will be returning ADDED or REMOVED events if the
  * state of the page changes since the last fetch (i.e. the two events cancel
@@ -64,33 +66,92 @@
 /* Used only during registration */
 #define DUET_REG_SBLOCK		0x8000
 #define DUET_FILE_TASK		0x10000	/* we register a 32-bit flag due to this */
+#define DUET_MAP_BLOCKS		0x20000	/* translate pages to device blocks */
+#define DUET_LRU_HINTS		0x40000	/* report LRU class, inactive first */
+#define DUET_META_VERIFIED	0x80000	/* queue verified metadata blocks */
 
 /* Some macros, to make our lives easier */
 #define DUET_IN_EVENTS		(DUET_IN_ACCESS | DUET_IN_ATTRIB | DUET_IN_WCLOSE | \
 				 DUET_IN_RCLOSE | DUET_IN_CREATE | DUET_IN_DELETE | \
 				 DUET_IN_MODIFY | DUET_IN_MOVED | DUET_IN_OPEN)
 
+/*
+ * A task may span several filesystems, each with its own registered dir (a
+ * scope), so the top bits of the UUID hold the index of the task scope that the
+ * inode was found in. Tasks on a single filesystem only ever see scope 0.
+ */
+#define DUET_MAX_SCOPES		8
 #define DUET_UUID_INO(uuid)	((unsigned long)(uuid & 0xffffffff))
-#define DUET_UUID_GEN(uuid)	((unsigned long)(uuid >> 32))
+#define DUET_UUID_GEN(uuid)	((unsigned long)((uuid >> 32) & 0xffffff))
+#define DUET_UUID_FS(uuid)	((unsigned int)(uuid >> 56))
 
 /* Some structures to communicate file events to Duet */
 struct duet_move_data {
 	struct inode *target;
 	struct inode *old_dir;
 	struct inode *new_dir;
+	struct dentry *dentry;	/* moved dentry, at its new location */
 };
 
 /*
  * Item struct returned for processing.
- * The UUID currently consists of the inode number and generation.
+ * The UUID consists of the inode number, generation, and task scope.
  * For state-based duet, we mark a page if it EXISTS or is MODIFIED.
  * For event-based duet, we mark a page added, removed, dirtied, and/or flushed.
  * Acceptable event combinations will differ based on the task's subscription.
+ * Tasks registered with DUET_LRU_HINTS also get the LRU class of the page, as
+ * of the last event on it, and get pages on the inactive list first.
  */
 struct duet_item {
 	unsigned long long	uuid;
 	unsigned long		idx;
 	__u16			state;
+	__u8			lru;
+};
+
+/* LRU classes of an item's page, in order of increasing reclaim distance */
+#define DUET_LRU_UNKNOWN	0	/* page removed, or no hints requested */
+#define DUET_LRU_INACTIVE	1	/* inactive list, likely reclaimed next */
+#define DUET_LRU_REFERENCED	2	/* inactive list, but recently referenced */
+#define DUET_LRU_ACTIVE		3	/* active list */
+
+/*
+ * Physical location of an item's page, returned alongside the item to tasks
+ * registered with DUET_MAP_BLOCKS. The first len bytes of the page are stored
+ * contiguously on dev, starting at the given 512-byte sector. A zero len means
+ * the page could not be mapped, e.g. because it's a hole, delayed allocation,
+ * or its inode has been evicted.
+ */
+struct duet_block {
+	__u32			dev;	/* new_encode_dev() format */
+	__u32			len;
+	__u64			sector;
+};
+
+/*
+ * Filter on the files a task gets page events for, checked before the events
+ * reach the ItemTable. Only the checks in mask apply. Inode flags are given as
+ * in FS_IOC_GETFLAGS, and only those the VFS tracks (sync, immutable, append,
+ * noatime) can be filtered on. The allowlist holds the UUIDs of the files the
+ * task wants events for, and is filled with duet_filter_allow().
+ */
+#define DUET_FILTER_SIZE	0x01	/* min_size <= i_size <= max_size */
+#define DUET_FILTER_FLAGS	0x02	/* all of set_flags, none of clear_flags */
+#define DUET_FILTER_UID		0x04	/* owned by uid */
+#define DUET_FILTER_GID		0x08	/* owned by gid */
+#define DUET_FILTER_ALLOW	0x10	/* UUID on the task's allowlist */
+#define DUET_FILTER_ALL		(DUET_FILTER_SIZE | DUET_FILTER_FLAGS | \
+				 DUET_FILTER_UID | DUET_FILTER_GID | \
+				 DUET_FILTER_ALLOW)
+
+struct duet_filter {
+	__u32			mask;
+	__u32			set_flags;
+	__u32			clear_flags;
+	__u32			uid;
+	__u32			gid;
+	__u64			min_size;
+	__u64			max_size;
 };
 
 /*
@@ -106,12 +167,50 @@ struct inode_tree {
 int duet_register(char *path, __u32 regmask, __u32 bitrange, const char *name,
 		  __u8 *taskid);
 int duet_deregister(__u8 taskid);
+int duet_add_scope(__u8 taskid, char *path);
 int duet_fetch(__u8 taskid, struct duet_item *items, __u16 *count);
 int duet_check_done(__u8 taskid, __u64 idx, __u32 count);
 int duet_set_done(__u8 taskid, __u64 idx, __u32 count);
 int duet_unset_done(__u8 taskid, __u64 idx, __u32 count);
+int duet_map_item(__u8 taskid, struct duet_item *item, struct duet_block *blk);
 int duet_online(void);
 
+/* I/O priority and accounting of the work done on behalf of a task */
+int duet_set_ioprio(__u8 taskid, __u16 ioprio);
+int duet_apply_ioprio(__u8 taskid, int *old_ioprio);
+void duet_restore_ioprio(int old_ioprio);
+void duet_account_io(__u8 taskid, __u64 read, __u64 skipped);
+
+/* Page leases, keeping the pages a task is told about cached until it's done */
+int duet_set_lease(__u8 taskid, __u32 pages, __u32 msecs);
+int duet_release_lease(__u8 taskid, __u64 uuid, __u64 idx, __u32 count);
+
+/* Filters dropping the page events of files the task doesn't care for */
+int duet_set_filter(__u8 taskid, struct duet_filter *filter);
+int duet_filter_allow(__u8 taskid, __u64 uuid, __u32 count);
+int duet_filter_disallow(__u8 taskid, __u64 uuid, __u32 count);
+
+/*
+ * Pre-eviction callbacks of kernel tasks. The callback sees clean, uptodate
+ * pages of interesting inodes right before reclaim frees them, with the page
+ * locked. It runs in reclaim context under RCU, so it must not sleep or block
+ * on locks, and is disabled if it repeatedly takes longer than its budget.
+ */
+struct page;
+typedef void (duet_evict_cb_t) (__u8 taskid, struct page *page, void *data);
+int duet_set_evict_cb(__u8 taskid, duet_evict_cb_t *cb, void *data,
+		      __u32 budget_us);
+
+/*
+ * Metadata blocks that the filesystem read from disk and verified, reported
+ * with the physical location of the copy read. Delivered to tasks registered
+ * with DUET_META_VERIFIED, which fetch them separately from page items.
+ */
+struct super_block;
+int duet_wants_verified(struct super_block *sb);
+void duet_hook_verified(struct super_block *sb, struct duet_block *blk);
+int duet_fetch_verified(__u8 taskid, struct duet_block *blks, __u16 *count);
+
 /* Framework debugging functions */
 int duet_print_bitmap(__u8 taskid);
 int duet_print_events(__u8 taskid);
@@ -121,6 +220,15 @@ typedef void (duet_hook_t) (__u16, void *);
 void duet_hook(__u16 evtcode, void *data);
 extern duet_hook_t *duet_hook_fp;
 
+typedef void (duet_evict_hook_t) (struct page *);
+void duet_evict_hook(struct page *page);
+extern duet_evict_hook_t *duet_evict_hook_fp;
+
+struct inode;
+typedef void (duet_dio_hook_t) (struct inode *, loff_t, ssize_t);
+void duet_dio_hook(struct inode *inode, loff_t offset, ssize_t len);
+extern duet_dio_hook_t *duet_dio_hook_fp;
+
 /* InodeTree interface functions */
 typedef int (itree_get_inode_t)(void *, unsigned long, struct inode **);
 void itree_init(struct inode_tree *itree);
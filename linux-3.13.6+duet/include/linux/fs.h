@@ -1606,6 +1606,10 @@ extern ssize_t vfs_readv(struct file *, const struct iovec __user *,
 extern ssize_t vfs_writev(struct file *, const struct iovec __user *,
 		unsigned long, loff_t *);
 
+#ifdef CONFIG_DUET
+struct duet_block;
+#endif /* CONFIG_DUET */
+
 struct super_operations {
    	struct inode *(*alloc_inode)(struct super_block *sb);
 	void (*destroy_inode)(struct inode *);
@@ -1633,6 +1637,9 @@ struct super_operations {
 	int (*bdev_try_to_free_page)(struct super_block*, struct page*, gfp_t);
 	long (*nr_cached_objects)(struct super_block *, int);
 	long (*free_cached_objects)(struct super_block *, long, int);
+#ifdef CONFIG_DUET
+	int (*duet_map_page)(struct inode *, unsigned long, struct duet_block *);
+#endif /* CONFIG_DUET */
 };
 
 /*
@@ -99,7 +99,8 @@ static inline void fsnotify_move(struct inode *old_dir, struct inode *new_dir,
 	duet_hook_t *dhfp = NULL;
 	struct duet_move_data mdata = { .target = (target ? target : source),
 									.old_dir = old_dir,
-									.new_dir = new_dir };
+									.new_dir = new_dir,
+									.dentry = moved };
 
 	/*
 	 * We only trigger the hook if the source dentry is not negative.
@@ -179,6 +180,23 @@ static inline void fsnotify_inoderemove(struct inode *inode)
 	__fsnotify_inode_delete(inode);
 }
 
+/*
+ * fsnotify_unlink - a link to inode was removed, and it has others left
+ */
+static inline void fsnotify_unlink(struct inode *inode)
+{
+#ifdef CONFIG_DUET
+	duet_hook_t *dhfp = NULL;
+
+	/* The removed link may be what made the inode relevant to a task */
+	rcu_read_lock();
+	dhfp = rcu_dereference(duet_hook_fp);
+	if (dhfp)
+		dhfp(DUET_IN_DELETE, (void *)inode);
+	rcu_read_unlock();
+#endif /* CONFIG_DUET */
+}
+
 /*
  * fsnotify_create - 'name' was linked in
  */
@@ -196,6 +214,16 @@ static inline void fsnotify_create(struct inode *inode, struct dentry *dentry)
  */
 static inline void fsnotify_link(struct inode *dir, struct inode *inode, struct dentry *new_dentry)
 {
+#ifdef CONFIG_DUET
+	duet_hook_t *dhfp = NULL;
+
+	/* The new link may change whether the inode is relevant to a task */
+	rcu_read_lock();
+	dhfp = rcu_dereference(duet_hook_fp);
+	if (dhfp)
+		dhfp(DUET_IN_CREATE, (void *)inode);
+	rcu_read_unlock();
+#endif /* CONFIG_DUET */
 	fsnotify_link_count(inode);
 	audit_inode_child(dir, new_dentry, AUDIT_TYPE_CHILD_CREATE);
 
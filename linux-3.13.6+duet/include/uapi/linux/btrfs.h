@@ -90,6 +90,7 @@ struct btrfs_scrub_progress {
 #ifdef CONFIG_BTRFS_DUET_SCRUB
 	__u64 data_bytes_verified;	/* # of data bytes actually verified */
 	__u64 tree_bytes_verified;	/* # of tree bytes actually verified */
+	__u64 tree_bytes_skipped;	/* # of tree bytes known to be verified */
 #endif /* CONFIG_BTRFS_DUET_SCRUB */
 #ifdef CONFIG_BTRFS_FS_SCRUB_ADAPT
 	__u64 sync_errors;		/* # of sync errors encountered */
@@ -775,6 +775,9 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 	unsigned long nr_reclaimed = 0;
 	unsigned long nr_writeback = 0;
 	unsigned long nr_immediate = 0;
+#ifdef CONFIG_DUET
+	duet_evict_hook_t *dehfp = NULL;
+#endif /* CONFIG_DUET */
 
 	cond_resched();
 
@@ -1047,6 +1050,24 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 			}
 		}
 
+#ifdef CONFIG_DUET
+		/*
+		 * Give Duet tasks a last look at clean pages before they go.
+		 * Pages with references besides ours and the page cache's,
+		 * e.g. leased ones, won't get past __remove_mapping(), so we
+		 * skip them rather than call back for them on every pass.
+		 */
+		if (mapping && PageUptodate(page) && !PageDirty(page) &&
+		    page_count(page) == 2) {
+			rcu_read_lock();
+			dehfp = rcu_dereference(duet_evict_hook_fp);
+
+			if (dehfp)
+				dehfp(page);
+			rcu_read_unlock();
+		}
+#endif /* CONFIG_DUET */
+
 		if (!mapping || !__remove_mapping(mapping, page))
 			goto keep_locked;
 
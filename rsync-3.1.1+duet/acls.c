@@ -96,6 +96,19 @@ static item_list default_acl_list = EMPTY_ITEM_LIST;
 static size_t prior_access_count = (size_t)-1;
 static size_t prior_default_count = (size_t)-1;
 
+/* Each ACL list is indexed by a hash of the ACLs' contents, so that finding
+ * a match for a new ACL doesn't have to compare it against every ACL. */
+typedef struct acl_ref {
+	struct acl_ref *next;
+	int ndx;
+} acl_ref;
+
+static struct hashtable *access_acl_hash = NULL;
+static struct hashtable *default_acl_hash = NULL;
+
+#define ACL_HASH(type) ((type) == SMB_ACL_TYPE_ACCESS ? &access_acl_hash \
+						      : &default_acl_hash)
+
 /* === Calculations on ACL types === */
 
 static const char *str_acl_type(SMB_ACL_TYPE_T type)
@@ -453,28 +466,82 @@ static BOOL pack_smb_acl(SMB_ACL_T *smb_acl, const rsync_acl *racl)
 	return False;
 }
 
+/* Hashes everything that rsync_acl_equal() compares. */
+static int32 rsync_acl_hash(const rsync_acl *racl)
+{
+	const id_access *ida = racl->names.idas;
+	uint32 key;
+	int count;
+
+	key = hash_bytes(&racl->user_obj, sizeof racl->user_obj, 0);
+	key = hash_bytes(&racl->group_obj, sizeof racl->group_obj, key);
+	key = hash_bytes(&racl->mask_obj, sizeof racl->mask_obj, key);
+	key = hash_bytes(&racl->other_obj, sizeof racl->other_obj, key);
+	key = hash_bytes(&racl->names.count, sizeof racl->names.count, key);
+	for (count = racl->names.count; count--; ida++) {
+		key = hash_bytes(&ida->id, sizeof ida->id, key);
+		key = hash_bytes(&ida->access, sizeof ida->access, key);
+	}
+
+	/* 0 is not a legal hashtable key. */
+	return key ? (int32)key : 1;
+}
+
+static void acl_index_add(struct hashtable **tblp, int ndx, int32 key)
+{
+	struct ht_int32_node *node;
+	acl_ref *ref, **refp;
+
+	if (!*tblp)
+		*tblp = hashtable_create(512, 0);
+
+	if (!(ref = new(acl_ref)))
+		out_of_memory("acl_index_add");
+	ref->next = NULL;
+	ref->ndx = ndx;
+
+	/* Append, so that the earliest matching ACL is still the one found. */
+	node = hashtable_find(*tblp, key, 1);
+	for (refp = (acl_ref **)&node->data; *refp; refp = &(*refp)->next) {}
+	*refp = ref;
+}
+
+static void acl_index_del(struct hashtable **tblp, int ndx, int32 key)
+{
+	struct ht_int32_node *node;
+	acl_ref *ref, **refp;
+
+	if (!*tblp || !(node = hashtable_find(*tblp, key, 0)))
+		return;
+
+	for (refp = (acl_ref **)&node->data; (ref = *refp) != NULL; refp = &ref->next) {
+		if (ref->ndx == ndx) {
+			*refp = ref->next;
+			free(ref);
+			if (!node->data)
+				hashtable_delete(*tblp, key);
+			return;
+		}
+	}
+}
+
 static int find_matching_rsync_acl(const rsync_acl *racl, SMB_ACL_TYPE_T type,
 				   const item_list *racl_list)
 {
-	static int access_match = -1, default_match = -1;
-	int *match = type == SMB_ACL_TYPE_ACCESS ? &access_match : &default_match;
-	size_t count = racl_list->count;
-
-	/* If this is the first time through or we didn't match the last
-	 * time, then start at the end of the list, which should be the
-	 * best place to start hunting. */
-	if (*match == -1)
-		*match = racl_list->count - 1;
-	while (count--) {
-		rsync_acl *base = racl_list->items;
-		if (rsync_acl_equal(base + *match, racl))
-			return *match;
-		if (!(*match)--)
-			*match = racl_list->count - 1;
+	struct hashtable *tbl = *ACL_HASH(type);
+	acl_duo *duo_item = racl_list->items;
+	struct ht_int32_node *node;
+	acl_ref *ref;
+
+	if (!tbl || !(node = hashtable_find(tbl, rsync_acl_hash(racl), 0)))
+		return -1;
+
+	for (ref = node->data; ref; ref = ref->next) {
+		if (rsync_acl_equal(&duo_item[ref->ndx].racl, racl))
+			return ref->ndx;
 	}
 
-	*match = -1;
-	return *match;
+	return -1;
 }
 
 static int get_rsync_acl(const char *fname, rsync_acl *racl,
@@ -622,7 +689,7 @@ static void send_rsync_acl(int f, rsync_acl *racl, SMB_ACL_TYPE_T type,
 	write_varint(f, ndx + 1);
 
 	if (ndx < 0) {
-		rsync_acl *new_racl = EXPAND_ITEM_LIST(racl_list, rsync_acl, 1000);
+		acl_duo *new_duo = EXPAND_ITEM_LIST(racl_list, acl_duo, 1000);
 		uchar flags = 0;
 
 		if (racl->user_obj != NO_ENTRY)
@@ -650,8 +717,11 @@ static void send_rsync_acl(int f, rsync_acl *racl, SMB_ACL_TYPE_T type,
 			send_ida_entries(f, &racl->names);
 
 		/* Give the allocated data to the new list object. */
-		*new_racl = *racl;
+		new_duo->racl = *racl;
+		new_duo->sacl = NULL;
 		*racl = empty_rsync_acl;
+		acl_index_add(ACL_HASH(type), racl_list->count - 1,
+			      rsync_acl_hash(&new_duo->racl));
 	}
 }
 
@@ -790,6 +860,7 @@ static int recv_rsync_acl(int f, item_list *racl_list, SMB_ACL_TYPE_T type, mode
 #endif
 
 	duo_item->sacl = NULL;
+	acl_index_add(ACL_HASH(type), ndx, rsync_acl_hash(&duo_item->racl));
 
 	return ndx;
 }
@@ -816,6 +887,7 @@ static int cache_rsync_acl(rsync_acl *racl, SMB_ACL_TYPE_T type, item_list *racl
 		new_duo->racl = *racl;
 		new_duo->sacl = NULL;
 		*racl = empty_rsync_acl;
+		acl_index_add(ACL_HASH(type), ndx, rsync_acl_hash(&new_duo->racl));
 	}
 
 	return ndx;
@@ -839,7 +911,7 @@ void cache_tmp_acl(struct file_struct *file, stat_x *sxp)
 	}
 }
 
-static void uncache_duo_acls(item_list *duo_list, size_t start)
+static void uncache_duo_acls(item_list *duo_list, SMB_ACL_TYPE_T type, size_t start)
 {
 	acl_duo *duo_item = duo_list->items;
 	acl_duo *duo_start = duo_item + start;
@@ -848,6 +920,8 @@ static void uncache_duo_acls(item_list *duo_list, size_t start)
 	duo_list->count = start;
 
 	while (duo_item-- > duo_start) {
+		acl_index_del(ACL_HASH(type), duo_item - (acl_duo *)duo_list->items,
+			      rsync_acl_hash(&duo_item->racl));
 		rsync_acl_free(&duo_item->racl);
 		if (duo_item->sacl)
 			sys_acl_free_acl(duo_item->sacl);
@@ -857,12 +931,12 @@ static void uncache_duo_acls(item_list *duo_list, size_t start)
 void uncache_tmp_acls(void)
 {
 	if (prior_access_count != (size_t)-1) {
-		uncache_duo_acls(&access_acl_list, prior_access_count);
+		uncache_duo_acls(&access_acl_list, SMB_ACL_TYPE_ACCESS, prior_access_count);
 		prior_access_count = (size_t)-1;
 	}
 
 	if (prior_default_count != (size_t)-1) {
-		uncache_duo_acls(&default_acl_list, prior_default_count);
+		uncache_duo_acls(&default_acl_list, SMB_ACL_TYPE_DEFAULT, prior_default_count);
 		prior_default_count = (size_t)-1;
 	}
 }
@@ -1073,26 +1147,34 @@ int set_acl(const char *fname, const struct file_struct *file, stat_x *sxp, mode
 
 /* Non-incremental recursion needs to convert all the received IDs.
  * This is done in a single pass after receiving the whole file-list. */
-static void match_racl_ids(const item_list *racl_list)
+static void match_racl_ids(const item_list *racl_list, SMB_ACL_TYPE_T type)
 {
 	int list_cnt, name_cnt;
+	int32 old_key, new_key;
 	acl_duo *duo_item = racl_list->items;
 	for (list_cnt = racl_list->count; list_cnt--; duo_item++) {
 		ida_entries *idal = &duo_item->racl.names;
 		id_access *ida = idal->idas;
+		old_key = rsync_acl_hash(&duo_item->racl);
 		for (name_cnt = idal->count; name_cnt--; ida++) {
 			if (ida->access & NAME_IS_USER)
 				ida->id = match_uid(ida->id);
 			else
 				ida->id = match_gid(ida->id, NULL);
 		}
+		/* The ACL's contents changed, so it has to move in the index. */
+		if ((new_key = rsync_acl_hash(&duo_item->racl)) != old_key) {
+			int ndx = duo_item - (acl_duo *)racl_list->items;
+			acl_index_del(ACL_HASH(type), ndx, old_key);
+			acl_index_add(ACL_HASH(type), ndx, new_key);
+		}
 	}
 }
 
 void match_acl_ids(void)
 {
-	match_racl_ids(&access_acl_list);
-	match_racl_ids(&default_acl_list);
+	match_racl_ids(&access_acl_list, SMB_ACL_TYPE_ACCESS);
+	match_racl_ids(&default_acl_list, SMB_ACL_TYPE_DEFAULT);
 }
 
 /* This is used by dest_mode(). */
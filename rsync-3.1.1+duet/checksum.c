@@ -46,6 +46,53 @@ uint32 get_checksum1(char *buf1, int32 len)
     return (s1 & 0xffff) + (s2 << 16);
 }
 
+/*
+  the length of the next content-defined chunk of buf (see --cdc).  The
+  cut point is where the top bits of a gear hash of the last 32 bytes
+  are all zero, so an insertion only moves the boundaries near it.  The
+  blength must be a power of 2; it is the average chunk length, and the
+  chunks are from CDC_MIN_LEN() to CDC_MAX_LEN() bytes long.
+  */
+int32 cdc_chunk_len(const char *buf1, int32 len, int32 blength)
+{
+	static uint32 gear[256];
+	uchar *buf = (uchar *)buf1;
+	uint32 h, mask;
+	int32 i, bits;
+
+	if (!gear[0]) {
+		/* Both sides must use the same table, so it is generated
+		 * from a fixed seed rather than from any random source. */
+		uint32 x = 0;
+		for (i = 0; i < 256; i++) {
+			x += 0x9E3779B9;
+			h = (x ^ (x >> 16)) * 0x85EBCA6B;
+			h = (h ^ (h >> 13)) * 0xC2B2AE35;
+			gear[i] = h ^ (h >> 16);
+		}
+	}
+
+	if (len > CDC_MAX_LEN(blength))
+		len = CDC_MAX_LEN(blength);
+	if (len <= CDC_MIN_LEN(blength))
+		return len;
+
+	/* A cut is harder to find before the average length and easier
+	 * after it, which keeps most of the chunks close to that length. */
+	for (bits = 0; ((int32)1 << bits) < blength; bits++) {}
+	mask = ~(uint32)0 << (31 - bits);
+
+	for (h = 0, i = CDC_MIN_LEN(blength); i < len; i++) {
+		if (i == blength)
+			mask <<= 2;
+		h = (h << 1) + gear[buf[i]];
+		if (!(h & mask))
+			return i + 1;
+	}
+
+	return len;
+}
+
 
 void get_checksum2(char *buf, int32 len, char *sum)
 {
@@ -207,6 +254,43 @@ void sum_update(const char *p, int32 len)
 		memcpy(md.buffer, p, sumresidue);
 }
 
+/* Start the file checksum of a resumed transfer as if the len bytes before
+ * the resume point had already been summed into the given MD5 state (see
+ * sum_get_state()).  Resuming is only negotiated with protocol 30+. */
+void sum_resume(OFF_T len, const char *state)
+{
+	md5_begin(&md);
+	md.A = IVAL(state, 0);
+	md.B = IVAL(state, 4);
+	md.C = IVAL(state, 8);
+	md.D = IVAL(state, 12);
+	md.totalN = (uint32)len;
+	md.totalN2 = (uint32)((int64)len >> 32);
+}
+
+/* Store the MD5 state of the file checksum into state and return how many
+ * of the summed bytes it covers -- the rest are still in its buffer. */
+OFF_T sum_get_state(char *state)
+{
+	int64 len = ((int64)md.totalN2 << 32) | md.totalN;
+
+	SIVAL(state, 0, md.A);
+	SIVAL(state, 4, md.B);
+	SIVAL(state, 8, md.C);
+	SIVAL(state, 12, md.D);
+
+	return len - len % CSUM_CHUNK;
+}
+
+/* Holes don't have their zeros summed, just their length. */
+void sum_update_hole(int32 len)
+{
+	char buf[4];
+
+	SIVAL(buf, 0, len);
+	sum_update(buf, 4);
+}
+
 int sum_end(char *sum)
 {
 	if (protocol_version >= 30) {
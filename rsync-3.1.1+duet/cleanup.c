@@ -33,6 +33,7 @@ extern int am_daemon;
 extern int am_receiver;
 extern int io_error;
 extern int keep_partial;
+extern int recv_files_pending;
 extern int got_xfer_error;
 extern int protocol_version;
 extern int output_needs_newline;
@@ -187,6 +188,8 @@ NORETURN void _exit_cleanup(int code, const char *file, int line)
 						cleanup_file, tweak_modtime, !partial_dir);
 			}
 		}
+		if (recv_files_pending)
+			cleanup_recv_pending();
 
 		/* FALLTHROUGH */
 #include "case_N.h"
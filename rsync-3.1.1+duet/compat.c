@@ -36,6 +36,9 @@ extern int recurse;
 extern int use_qsort;
 extern int allow_inc_recurse;
 extern int preallocate_files;
+extern int recv_threads;
+extern int cdc_blocks;
+extern int keep_partial;
 extern int append_mode;
 extern int fuzzy_basis;
 extern int read_batch;
@@ -68,6 +71,8 @@ int uid_ndx, gid_ndx, acls_ndx, xattrs_ndx, unsort_ndx;
 
 int receiver_symlink_times = 0; /* receiver can set the time on a symlink */
 int sender_symlink_iconv = 0;	/* sender should convert symlink content */
+int sparse_holes = 0;		/* hole tokens may be used with --sparse */
+int resume_partials = 0;	/* partial files are checkpointed and resumed */
 
 #ifdef ICONV_OPTION
 int filesfrom_convert = 0;
@@ -78,6 +83,9 @@ int filesfrom_convert = 0;
 #define CF_SYMLINK_ICONV (1<<2)
 #define CF_SAFE_FLIST	 (1<<3)
 #define CF_AVOID_XATTR_OPTIM (1<<4)
+#define CF_SPARSE_HOLES (1<<5)
+#define CF_CDC_BLOCKS (1<<6)
+#define CF_RESUME_PARTIALS (1<<7)
 
 static const char *client_info;
 
@@ -200,9 +208,18 @@ void setup_protocol(int f_out,int f_in)
 	}
 #endif
 
+#ifndef HAVE_PTHREADS
+	if (recv_threads && !am_sender) {
+		rprintf(FERROR, "--recv-threads is not supported on this %s\n",
+			am_server ? "Server" : "Client");
+		exit_cleanup(RERR_SYNTAX);
+	}
+#endif
+
 	if (protocol_version < 30) {
 		if (append_mode == 1)
 			append_mode = 2;
+		cdc_blocks = 0;
 		if (preserve_acls && !local_server) {
 			rprintf(FERROR,
 			    "--acls requires protocol 30 or higher"
@@ -271,12 +288,23 @@ void setup_protocol(int f_out,int f_in)
 				compat_flags |= CF_SAFE_FLIST;
 			if (local_server || strchr(client_info, 'x') != NULL)
 				compat_flags |= CF_AVOID_XATTR_OPTIM;
+			if (local_server || strchr(client_info, 'H') != NULL)
+				compat_flags |= CF_SPARSE_HOLES;
+			if (local_server ? cdc_blocks && !append_mode
+			    : strchr(client_info, 'B') != NULL)
+				compat_flags |= CF_CDC_BLOCKS;
+			if (local_server ? keep_partial && !delay_updates
+			    : strchr(client_info, 'P') != NULL)
+				compat_flags |= CF_RESUME_PARTIALS;
 			write_byte(f_out, compat_flags);
 		} else
 			compat_flags = read_byte(f_in);
 		/* The inc_recurse var MUST be set to 0 or 1. */
 		inc_recurse = compat_flags & CF_INC_RECURSE ? 1 : 0;
 		want_xattr_optim = protocol_version >= 31 && !(compat_flags & CF_AVOID_XATTR_OPTIM);
+		sparse_holes = compat_flags & CF_SPARSE_HOLES ? 1 : 0;
+		cdc_blocks = compat_flags & CF_CDC_BLOCKS ? 1 : 0;
+		resume_partials = compat_flags & CF_RESUME_PARTIALS ? 1 : 0;
 		if (am_sender) {
 			receiver_symlink_times = am_server
 			    ? strchr(client_info, 'L') != NULL
@@ -67,6 +67,39 @@ static filter_rule **mergelist_parents;
 static int mergelist_cnt = 0;
 static int mergelist_size = 0;
 
+/* A run of at least FILTER_INDEX_MIN consecutive rules that are either a
+ * literal name or a "*suffix" pattern (both of which only look at the last
+ * element of a path) gets compiled into a filter_index, which hangs off the
+ * first rule of the run.  The literal names go into a hashtable, and the
+ * suffixes into a trie that is walked from the end of the name.  Every
+ * entry remembers its position in the run, so check_filter() can still
+ * pick the first rule that matches without trying the rules one by one.
+ * Wildcards that need wildmatch() stay in the list and break up runs. */
+#define FILTER_INDEX_MIN 8
+
+struct filter_entry {
+	struct filter_entry *next;
+	filter_rule *rule;
+	int ord;
+};
+
+struct filter_suffix {
+	struct filter_suffix *child, *sibling;
+	struct filter_entry *rules; /* "*suffix" rules that end here */
+	uchar ch;
+};
+
+struct filter_index {
+	filter_rule *last; /* the last rule in the run */
+	struct hashtable *literals;
+	struct filter_suffix suffixes;
+	int count;
+};
+
+/* parse_filter_file() and recv_filter_list() add rules one line at a time,
+ * so they compile the list once they are done instead. */
+static int defer_compile = 0;
+
 /* Each filter_list_struct describes a singly-linked list by keeping track
  * of both the head and tail pointers.  The list is slightly unusual in that
  * a parent-dir's content can be appended to the end of the local list in a
@@ -118,8 +151,43 @@ static void teardown_mergelist(filter_rule *ex)
 	mergelist_cnt--;
 }
 
+static void free_filter_entries(struct filter_entry *fe)
+{
+	while (fe) {
+		struct filter_entry *next = fe->next;
+		free(fe);
+		fe = next;
+	}
+}
+
+static void free_filter_suffix(struct filter_suffix *node)
+{
+	struct filter_suffix *child, *next;
+
+	for (child = node->child; child; child = next) {
+		next = child->sibling;
+		free_filter_suffix(child);
+		free(child);
+	}
+	free_filter_entries(node->rules);
+}
+
+static void free_filter_index(struct filter_index *fix)
+{
+	struct ht_int32_node *node;
+	int iter = 0;
+
+	while ((node = hashtable_iterate(fix->literals, &iter)) != NULL)
+		free_filter_entries(node->data);
+	hashtable_destroy(fix->literals);
+	free_filter_suffix(&fix->suffixes);
+	free(fix);
+}
+
 static void free_filter(filter_rule *ex)
 {
+	if (ex->compiled)
+		free_filter_index(ex->compiled);
 	free(ex->pattern);
 	free(ex);
 }
@@ -702,6 +770,181 @@ static int rule_matches(const char *fname, filter_rule *ex, int name_is_dir)
 	return !ret_match;
 }
 
+/* Can this rule be matched by looking at just the last element of a name? */
+static BOOL rule_is_indexable(const filter_rule *ex)
+{
+	const char *pat = ex->pattern;
+
+	if (ex->rflags & (FILTRULE_PERDIR_MERGE | FILTRULE_CVS_IGNORE
+			| FILTRULE_NEGATE | FILTRULE_PERISHABLE | FILTRULE_WILD2)
+	 || ex->u.slash_cnt || !*pat)
+		return False;
+	if (!(ex->rflags & FILTRULE_WILD))
+		return True;
+	return *pat == '*' && !strpbrk(pat + 1, "*[?\\");
+}
+
+static int32 filter_name_key(const char *name, size_t len)
+{
+	uint32 key = hash_bytes(name, len, 0);
+
+	/* 0 is not a legal hashtable key. */
+	return key ? (int32)key : 1;
+}
+
+static void filter_index_add(struct filter_index *fix, filter_rule *ex)
+{
+	struct filter_entry *fe, **fep;
+
+	if (!(fe = new(struct filter_entry)))
+		out_of_memory("filter_index_add");
+	fe->next = NULL;
+	fe->rule = ex;
+	fe->ord = fix->count++;
+
+	if (ex->rflags & FILTRULE_WILD) {
+		struct filter_suffix *node = &fix->suffixes, *child;
+		const char *suf = ex->pattern + 1;
+		const char *cp = suf + strlen(suf);
+
+		while (cp-- > suf) {
+			for (child = node->child; child; child = child->sibling) {
+				if (child->ch == (uchar)*cp)
+					break;
+			}
+			if (!child) {
+				if (!(child = new0(struct filter_suffix)))
+					out_of_memory("filter_index_add");
+				child->ch = *cp;
+				child->sibling = node->child;
+				node->child = child;
+			}
+			node = child;
+		}
+		fep = &node->rules;
+	} else {
+		struct ht_int32_node *node = hashtable_find(fix->literals,
+			filter_name_key(ex->pattern, strlen(ex->pattern)), 1);
+		fep = (struct filter_entry **)&node->data;
+	}
+
+	/* Keep every chain in rule order, so its first hit is the earliest. */
+	while (*fep)
+		fep = &(*fep)->next;
+	*fep = fe;
+	fix->last = ex;
+}
+
+static void compile_filter_run(filter_rule *run, int run_len)
+{
+	struct filter_index *fix;
+
+	if (run_len < FILTER_INDEX_MIN)
+		return;
+
+	if (!(fix = new0(struct filter_index)))
+		out_of_memory("compile_filter_run");
+	fix->literals = hashtable_create(run_len, 0);
+
+	run->compiled = fix;
+	for ( ; run_len--; run = run->next)
+		filter_index_add(fix, run);
+}
+
+/* Index any runs of indexable rules in the local part of the list.  Runs
+ * that were indexed by an earlier call are extended with the rules that
+ * have been added after them since, and are otherwise left alone. */
+static void compile_filter_list(filter_rule_list *listp)
+{
+	filter_rule *ent, *run = NULL;
+	struct filter_index *fix = NULL;
+	int run_len = 0;
+
+	if (!listp->tail)
+		return;
+
+	for (ent = listp->head; ; ent = ent->next) {
+		if (ent->compiled) {
+			compile_filter_run(run, run_len);
+			run_len = 0;
+			fix = ent->compiled;
+			ent = fix->last;
+		} else if (!rule_is_indexable(ent)) {
+			compile_filter_run(run, run_len);
+			run_len = 0;
+			fix = NULL;
+		} else if (fix)
+			filter_index_add(fix, ent);
+		else if (!run_len++)
+			run = ent;
+		if (ent == listp->tail)
+			break;
+	}
+
+	compile_filter_run(run, run_len);
+}
+
+static void uncompile_filter_list(filter_rule_list *listp)
+{
+	filter_rule *ent;
+
+	for (ent = listp->head; ent; ent = ent->next) {
+		if (ent->compiled) {
+			free_filter_index(ent->compiled);
+			ent->compiled = NULL;
+		}
+	}
+}
+
+/* Return the first rule of an indexed run that matches, or NULL.  This
+ * gives the same answer as calling rule_matches() on each rule in turn. */
+static filter_rule *filter_index_match(struct filter_index *fix,
+				       const char *fname, int name_is_dir)
+{
+	const char *name = fname + (*fname == '/'), *cp;
+	struct filter_entry *fe, *best = NULL;
+	struct filter_suffix *node, *child;
+	struct ht_int32_node *lit;
+	size_t len;
+
+	if (!*name)
+		return NULL;
+	if ((cp = strrchr(name, '/')) != NULL)
+		name = cp + 1;
+	len = strlen(name);
+
+	lit = hashtable_find(fix->literals, filter_name_key(name, len), 0);
+	for (fe = lit ? lit->data : NULL; fe; fe = fe->next) {
+		if ((name_is_dir || !(fe->rule->rflags & FILTRULE_DIRECTORY))
+		 && strcmp(fe->rule->pattern, name) == 0) {
+			best = fe;
+			break;
+		}
+	}
+
+	for (node = &fix->suffixes, cp = name + len; ; node = child) {
+		for (fe = node->rules; fe; fe = fe->next) {
+			if (best && fe->ord > best->ord)
+				break;
+			if (name_is_dir || !(fe->rule->rflags & FILTRULE_DIRECTORY)) {
+				best = fe;
+				break;
+			}
+		}
+		if (cp == name)
+			break;
+		cp--;
+		for (child = node->child; child; child = child->sibling) {
+			if (child->ch == (uchar)*cp)
+				break;
+		}
+		if (!child)
+			break;
+	}
+
+	return best ? best->rule : NULL;
+}
+
 static void report_filter_result(enum logcode code, char const *name,
 				 filter_rule const *ent,
 				 int name_is_dir, const char *type)
@@ -729,6 +972,17 @@ int check_filter(filter_rule_list *listp, enum logcode code,
 	filter_rule *ent;
 
 	for (ent = listp->head; ent; ent = ent->next) {
+		if (ent->compiled) {
+			filter_rule *hit = filter_index_match(ent->compiled,
+							      name, name_is_dir);
+			if (hit) {
+				report_filter_result(code, name, hit, name_is_dir,
+						     listp->debug_type);
+				return hit->rflags & FILTRULE_INCLUDE ? 1 : -1;
+			}
+			ent = ent->compiled->last;
+			continue;
+		}
 		if (ignore_perishable && ent->rflags & FILTRULE_PERISHABLE)
 			continue;
 		if (ent->rflags & FILTRULE_PERDIR_MERGE) {
@@ -1139,6 +1393,9 @@ void parse_filter_str(filter_rule_list *listp, const char *rulestr,
 		    && !(new_rflags & FILTRULE_MERGE_FILE))
 			get_cvs_excludes(new_rflags);
 	}
+
+	if (!defer_compile)
+		compile_filter_list(listp);
 }
 
 void parse_filter_file(filter_rule_list *listp, const char *fname, const filter_rule *template, int xflags)
@@ -1182,6 +1439,7 @@ void parse_filter_file(filter_rule_list *listp, const char *fname, const filter_
 	}
 	dirbuf[dirbuf_len] = '\0';
 
+	defer_compile++;
 	while (1) {
 		char *s = line;
 		int ch, overflow = 0;
@@ -1214,6 +1472,9 @@ void parse_filter_file(filter_rule_list *listp, const char *fname, const filter_
 			break;
 	}
 	fclose(fp);
+
+	if (!--defer_compile)
+		compile_filter_list(listp);
 }
 
 /* If the "for_xfer" flag is set, the prefix is made compatible with the
@@ -1285,6 +1546,9 @@ static void send_rules(int f_out, filter_rule_list *flp)
 {
 	filter_rule *ent, *prev = NULL;
 
+	/* Eliding rules can split up an indexed run, so start over. */
+	uncompile_filter_list(flp);
+
 	for (ent = flp->head; ent; ent = ent->next) {
 		unsigned int len, plen, dlen;
 		int elide = 0;
@@ -1341,6 +1605,8 @@ static void send_rules(int f_out, filter_rule_list *flp)
 			write_byte(f_out, '/');
 	}
 	flp->tail = prev;
+
+	compile_filter_list(flp);
 }
 
 /* This is only called by the client. */
@@ -1381,12 +1647,15 @@ void recv_filter_list(int f_in)
 	unsigned int len;
 
 	if (!local_server && (am_sender || receiver_wants_list)) {
+		defer_compile++;
 		while ((len = read_int(f_in)) != 0) {
 			if (len >= sizeof line)
 				overflow_exit("recv_rules");
 			read_sbuf(f_in, line, len);
 			parse_filter_str(&filter_list, line, rule_template(0), xflags);
 		}
+		if (!--defer_compile)
+			compile_filter_list(&filter_list);
 	}
 
 	if (cvs_exclude) {
@@ -97,6 +97,28 @@ static int write_sparse(int f, char *buf, int len)
 }
 
 
+/* Write len zero bytes that the sender told us are a hole.  With --sparse
+ * we just seek over them (see sparse_end()). */
+int write_hole(int f, int32 len)
+{
+	static char zeros[CHUNK_SIZE];
+	int32 n, done;
+
+	if (sparse_files > 0) {
+		sparse_seek += len;
+		return len;
+	}
+
+	for (done = 0; done < len; done += n) {
+		n = MIN(len - done, CHUNK_SIZE);
+		if (write_file(f, zeros, n) != n)
+			return -1;
+	}
+
+	return len;
+}
+
+
 static char *wf_writeBuf;
 static size_t wf_writeBufSize;
 static size_t wf_writeBufCnt;
@@ -272,6 +294,34 @@ char *map_ptr(struct map_struct *map, OFF_T offset, int32 len)
 }
 
 
+/* Find the first hole of at least MIN_SPARSE_HOLE bytes that starts at or
+ * after offset in the mapped file.  Returns its start (len if there is no
+ * such hole before len) and sets *end_p to the offset of the data after it. */
+OFF_T map_next_hole(struct map_struct *map, OFF_T offset, OFF_T len, OFF_T *end_p)
+{
+#if defined SEEK_HOLE && defined SEEK_DATA
+	OFF_T start, end;
+
+	while (offset < len) {
+		if ((start = do_lseek(map->fd, offset, SEEK_HOLE)) < 0 || start >= len)
+			break;
+		/* ENXIO means that the hole runs to the end of the file. */
+		if ((end = do_lseek(map->fd, start, SEEK_DATA)) < 0 || end > len)
+			end = len;
+		if (end - start >= MIN_SPARSE_HOLE) {
+			map->p_fd_offset = -1; /* make map_ptr() seek again */
+			*end_p = end;
+			return start;
+		}
+		offset = end;
+	}
+	map->p_fd_offset = -1;
+#endif
+	*end_p = len;
+	return len;
+}
+
+
 int unmap_file(struct map_struct *map)
 {
 	int	ret;
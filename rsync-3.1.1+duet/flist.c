@@ -1504,8 +1504,8 @@ static struct file_struct *send_file_name(int f, struct file_list *flist,
 #ifdef HAVE_DUET
 	if (!stp) {
 		STRUCT_STAT sbuf;
-		if (do_stat(fname, &sbuf)) {
-			rsyserr(FERROR_XFER, errno, "do_stat %s failed", fname);
+		if (link_stat(fname, &sbuf, copy_links)) {
+			rsyserr(FERROR_XFER, errno, "link_stat %s failed", fname);
 			return NULL;
 		}
 		src_ino = sbuf.st_ino;
@@ -35,6 +35,7 @@ extern int inc_recurse;
 extern int relative_paths;
 extern int implied_dirs;
 extern int keep_dirlinks;
+extern int copy_links;
 extern int preserve_acls;
 extern int preserve_xattrs;
 extern int preserve_links;
@@ -60,6 +61,9 @@ extern int ignore_non_existing;
 extern int want_xattr_optim;
 extern int inplace;
 extern int append_mode;
+extern int sparse_files;
+extern int cdc_blocks;
+extern int resume_partials;
 extern int make_backups;
 extern int csum_length;
 extern int ignore_times;
@@ -114,11 +118,149 @@ static int symlink_timeset_failed_flags;
 static int need_retouch_dir_times;
 static int need_retouch_dir_perms;
 static const char *solo_file = NULL;
+#if defined HAVE_FSTATAT && defined HAVE_OPENAT
+/* An open fd for the dir we're currently generating in, and for that same
+ * dir under each basis dir (slot j+1 is basis_dir[j]).  This lets us stat
+ * and open files by their basename instead of having the kernel walk the
+ * whole path every time.  An empty dir name means there's no fd.  A dir that
+ * doesn't exist is remembered too (with an fd of -1 and the open's errno), as
+ * basis dirs often lack whole subtrees, and we'd otherwise walk the path to
+ * find that out twice for every file in them. */
+static struct {
+	int fd;
+	int err;
+	char dir[MAXPATHLEN];
+} gen_dirfds[MAX_BASIS_DIRS+1];
+#endif
 
 enum nonregtype {
     TYPE_DIR, TYPE_SPECIAL, TYPE_DEVICE, TYPE_SYMLINK
 };
 
+#if defined HAVE_FSTATAT && defined HAVE_OPENAT
+static void forget_dirfd(int slot)
+{
+	if (gen_dirfds[slot].dir[0]) {
+		if (gen_dirfds[slot].fd >= 0)
+			close(gen_dirfds[slot].fd);
+		gen_dirfds[slot].dir[0] = '\0';
+	}
+}
+
+static void forget_all_dirfds(void)
+{
+	int j;
+
+	for (j = 0; j <= MAX_BASIS_DIRS; j++)
+		forget_dirfd(j);
+}
+
+/* Drop the cached destination dir if it is fname or is somewhere below it,
+ * since the generator may be about to delete or replace fname. */
+static void forget_dirfds_below(const char *fname)
+{
+	int len = strlen(fname);
+
+	if (gen_dirfds[0].dir[0] && strncmp(gen_dirfds[0].dir, fname, len) == 0
+	 && (gen_dirfds[0].dir[len] == '\0' || gen_dirfds[0].dir[len] == '/'))
+		forget_dirfd(0);
+}
+
+/* Returns an fd for the dir that contains path (reusing the one we have if
+ * it is the same dir) and sets *bname_p to path's last element.  Returns -2
+ * (with errno set) if that dir doesn't exist, or -1 if the caller should just
+ * use the whole path. */
+static int get_dirfd(int slot, const char *path, const char **bname_p)
+{
+	const char *slash = strrchr(path, '/');
+	int len, fd;
+
+	/* get_stat_xattr() needs the name for --fake-super. */
+	if (!slash || slash == path || am_root < 0)
+		return -1;
+	len = slash - path;
+
+	if (!gen_dirfds[slot].dir[0] || gen_dirfds[slot].dir[len] != '\0'
+	 || strncmp(gen_dirfds[slot].dir, path, len) != 0) {
+		char dir[MAXPATHLEN];
+		if (len >= MAXPATHLEN)
+			return -1;
+		memcpy(dir, path, len);
+		dir[len] = '\0';
+#ifdef O_PATH
+		fd = open(dir, O_PATH | O_DIRECTORY);
+#elif defined O_DIRECTORY
+		fd = open(dir, O_RDONLY | O_DIRECTORY);
+#else
+		fd = open(dir, O_RDONLY);
+#endif
+		if (fd < 0 && errno != ENOENT && errno != ENOTDIR)
+			return -1;
+		forget_dirfd(slot);
+		gen_dirfds[slot].fd = fd;
+		gen_dirfds[slot].err = fd < 0 ? errno : 0;
+		memcpy(gen_dirfds[slot].dir, dir, len + 1);
+	}
+
+	if (gen_dirfds[slot].fd < 0) {
+		errno = gen_dirfds[slot].err;
+		return -2;
+	}
+
+	*bname_p = slash + 1;
+	return gen_dirfds[slot].fd;
+}
+#else
+#define forget_dirfd(slot)
+#define forget_all_dirfds()
+#define forget_dirfds_below(fname)
+#endif
+
+/* Like link_stat(), but uses the cached dir fd for the given slot. */
+static int gen_link_stat(int slot, const char *path, STRUCT_STAT *stp,
+			 int follow_dirlinks)
+{
+#if defined HAVE_FSTATAT && defined HAVE_OPENAT
+	const char *bname;
+	int dfd = get_dirfd(slot, path, &bname);
+
+	if (dfd == -2)
+		return -1;
+	if (dfd >= 0) {
+#ifdef SUPPORT_LINKS
+		if (copy_links)
+			return do_fstatat(dfd, bname, stp, 0);
+		if (do_fstatat(dfd, bname, stp, AT_SYMLINK_NOFOLLOW) < 0)
+			return -1;
+		if (follow_dirlinks && S_ISLNK(stp->st_mode)) {
+			STRUCT_STAT st;
+			if (do_fstatat(dfd, bname, &st, 0) == 0 && S_ISDIR(st.st_mode))
+				*stp = st;
+		}
+		return 0;
+#else
+		return do_fstatat(dfd, bname, stp, 0);
+#endif
+	}
+#endif
+	return link_stat(path, stp, follow_dirlinks);
+}
+
+/* Open a basis file for reading, using the cached dir fd for the slot. */
+static int gen_open_basis(int slot, const char *path)
+{
+#if defined HAVE_FSTATAT && defined HAVE_OPENAT
+	const char *bname;
+	int dfd = get_dirfd(slot, path, &bname);
+
+	if (dfd == -2)
+		return -1;
+	if (dfd >= 0)
+		return do_openat(dfd, bname, O_RDONLY, 0);
+#endif
+	return do_open(path, O_RDONLY, 0);
+}
+
 /* Forward declarations. */
 #ifdef SUPPORT_HARD_LINKS
 static void handle_skipped_hlink(struct file_struct *file, int itemizing,
@@ -260,6 +402,8 @@ static void do_delayed_deletions(char *delbuf)
 {
 	int mode, flags;
 
+	forget_dirfd(0);
+
 	if (deldelay_fd >= 0) {
 		if (deldelay_cnt && !flush_delete_delay())
 			return;
@@ -288,6 +432,8 @@ static void delete_in_dir(char *fbuf, struct file_struct *file, dev_t *fs_dev)
 		return;
 	}
 
+	forget_dirfd(0);
+
 	if (DEBUG_GTE(DEL, 2))
 		rprintf(FINFO, "delete_in_dir(%s)\n", fbuf);
 
@@ -690,6 +836,81 @@ static void sum_sizes_sqroot(struct sum_struct *sum, int64 len)
 }
 
 
+/*
+ * Generate and send the signatures of the content-defined chunks of a
+ * buffer (--cdc).  The chunk count goes in the header, so the chunks are
+ * all found before any of their lengths and strong sums are sent.
+ */
+static int generate_and_send_cdc_sums(int fd, OFF_T len, int f_out, int f_copy,
+				      struct sum_struct *sum)
+{
+	struct map_struct *mapbuf;
+	OFF_T offset = 0;
+	int32 *lens = NULL, cnt = 0, alloced = 0, i;
+	char *sum2s = NULL;
+	char sum2[SUM_LENGTH];
+
+	/* The average chunk length must be a power of 2, and since there is
+	 * no rolling checksum to filter the matches, the strong sums get 4
+	 * more bytes. */
+	for (i = 1; i * 2 <= sum->blength; i *= 2) {}
+	sum->blength = i;
+	sum->remainder = 0;
+	sum->s2length = MIN(sum->s2length + 4, SUM_LENGTH);
+
+	if (len > 0)
+		mapbuf = map_file(fd, len, MAX_MAP_SIZE, CDC_MAX_LEN(sum->blength));
+	else
+		mapbuf = NULL;
+
+	while (offset < len) {
+		int32 n1 = (int32)MIN(len - offset, (OFF_T)CDC_MAX_LEN(sum->blength));
+		char *map = map_ptr(mapbuf, offset, n1);
+
+		n1 = cdc_chunk_len(map, n1, sum->blength);
+
+		if (cnt == alloced) {
+			alloced = alloced ? alloced * 2 : 1024;
+			lens = realloc_array(lens, int32, alloced);
+			sum2s = realloc_array(sum2s, char, (size_t)alloced * sum->s2length);
+			if (!lens || !sum2s)
+				out_of_memory("generate_and_send_cdc_sums");
+		}
+		get_checksum2(map, n1, sum2);
+		memcpy(sum2s + (size_t)cnt * sum->s2length, sum2, sum->s2length);
+		lens[cnt++] = n1;
+
+		if (f_copy >= 0)
+			full_write(f_copy, map, n1);
+		offset += n1;
+
+		if (allowed_lull && !(cnt % 1024))
+			maybe_send_keepalive(time(NULL), MSK_ALLOW_FLUSH);
+	}
+
+	sum->count = cnt;
+	write_sum_head(f_out, sum);
+
+	for (i = 0, offset = 0; i < cnt; offset += lens[i++]) {
+		if (DEBUG_GTE(DELTASUM, 3)) {
+			rprintf(FINFO, "chunk[%s] offset=%s len=%ld\n",
+				big_num(i), big_num(offset), (long)lens[i]);
+		}
+		write_int(f_out, lens[i]);
+		write_buf(f_out, sum2s + (size_t)i * sum->s2length, sum->s2length);
+	}
+
+	if (lens) {
+		free(lens);
+		free(sum2s);
+	}
+	if (mapbuf)
+		unmap_file(mapbuf);
+
+	return 0;
+}
+
+
 /*
  * Generate and send a stream of signatures/checksums that describe a buffer
  *
@@ -700,11 +921,17 @@ static int generate_and_send_sums(int fd, OFF_T len, int f_out, int f_copy)
 	int32 i;
 	struct map_struct *mapbuf;
 	struct sum_struct sum;
-	OFF_T offset = 0;
+	OFF_T offset = 0, hole_start, hole_end;
+	static char *zero_buf;
+	static int32 zero_len;
+	static uint32 zero_sum1;
+	static char zero_sum2[SUM_LENGTH];
 
 	sum_sizes_sqroot(&sum, len);
 	if (sum.count < 0)
 		return -1;
+	if (cdc_blocks)
+		return generate_and_send_cdc_sums(fd, len, f_out, f_copy, &sum);
 	write_sum_head(f_out, &sum);
 
 	if (append_mode > 0 && f_copy < 0)
@@ -715,12 +942,37 @@ static int generate_and_send_sums(int fd, OFF_T len, int f_out, int f_copy)
 	else
 		mapbuf = NULL;
 
+	/* With --sparse, the blocks that are in a hole of the basis file all
+	 * get the sums of a zero block without our reading them. */
+	if (sparse_files > 0 && f_copy < 0 && mapbuf) {
+		hole_start = map_next_hole(mapbuf, 0, len, &hole_end);
+		if (hole_start < len && zero_len != sum.blength) {
+			if (!zero_buf && !(zero_buf = new_array0(char, MAX_BLOCK_SIZE)))
+				out_of_memory("generate_and_send_sums");
+			zero_len = sum.blength;
+			zero_sum1 = get_checksum1(zero_buf, zero_len);
+			get_checksum2(zero_buf, zero_len, zero_sum2);
+		}
+	} else
+		hole_start = hole_end = len;
+
 	for (i = 0; i < sum.count; i++) {
 		int32 n1 = (int32)MIN(len, (OFF_T)sum.blength);
-		char *map = map_ptr(mapbuf, offset, n1);
+		char *map;
 		char sum2[SUM_LENGTH];
 		uint32 sum1;
 
+		if (offset + n1 > hole_end && hole_end < mapbuf->file_size)
+			hole_start = map_next_hole(mapbuf, offset, mapbuf->file_size, &hole_end);
+		if (offset >= hole_start && offset + n1 <= hole_end && n1 == zero_len) {
+			len -= n1;
+			offset += n1;
+			write_int(f_out, zero_sum1);
+			write_buf(f_out, zero_sum2, sum.s2length);
+			continue;
+		}
+
+		map = map_ptr(mapbuf, offset, n1);
 		len -= n1;
 		offset += n1;
 
@@ -882,7 +1134,7 @@ static int try_dests_reg(struct file_struct *file, char *fname, int ndx,
 
 	do {
 		pathjoin(cmpbuf, MAXPATHLEN, basis_dir[j], fname);
-		if (link_stat(cmpbuf, &sxp->st, 0) < 0 || !S_ISREG(sxp->st.st_mode))
+		if (gen_link_stat(j + 1, cmpbuf, &sxp->st, 0) < 0 || !S_ISREG(sxp->st.st_mode))
 			continue;
 		switch (match_level) {
 		case 0:
@@ -913,7 +1165,7 @@ static int try_dests_reg(struct file_struct *file, char *fname, int ndx,
 	if (j != best_match) {
 		j = best_match;
 		pathjoin(cmpbuf, MAXPATHLEN, basis_dir[j], fname);
-		if (link_stat(cmpbuf, &sxp->st, 0) < 0)
+		if (gen_link_stat(j + 1, cmpbuf, &sxp->st, 0) < 0)
 			return -1;
 	}
 
@@ -1021,7 +1273,7 @@ static int try_dests_non(struct file_struct *file, char *fname, int ndx,
 
 	do {
 		pathjoin(cmpbuf, MAXPATHLEN, basis_dir[j], fname);
-		if (link_stat(cmpbuf, &sxp->st, 0) < 0)
+		if (gen_link_stat(j + 1, cmpbuf, &sxp->st, 0) < 0)
 			continue;
 		switch (type) {
 		case TYPE_DIR:
@@ -1087,7 +1339,7 @@ static int try_dests_non(struct file_struct *file, char *fname, int ndx,
 	if (j != best_match) {
 		j = best_match;
 		pathjoin(cmpbuf, MAXPATHLEN, basis_dir[j], fname);
-		if (link_stat(cmpbuf, &sxp->st, 0) < 0)
+		if (gen_link_stat(j + 1, cmpbuf, &sxp->st, 0) < 0)
 			return -1;
 	}
 
@@ -1201,7 +1453,9 @@ static void recv_generator(char *fname, struct file_struct *file, int ndx,
 	int fd = -1, f_copy = -1;
 	stat_x sx, real_sx;
 	STRUCT_STAT partial_st;
+	struct sum_struct resume;
 	struct file_struct *back_file = NULL;
+	OFF_T resume_len = 0;
 	int statret, real_ret, stat_errno;
 	char *fnamecmp, *partialptr, *backupptr = NULL;
 	char fnamecmpbuf[MAXPATHLEN];
@@ -1350,7 +1604,8 @@ static void recv_generator(char *fname, struct file_struct *file, int ndx,
 			need_fuzzy_dirlist = 0;
 		}
 
-		statret = link_stat(fname, &sx.st, keep_dirlinks && is_dir);
+		forget_dirfds_below(fname);
+		statret = gen_link_stat(0, fname, &sx.st, keep_dirlinks && is_dir);
 		stat_errno = errno;
 	}
 
@@ -1836,7 +2091,20 @@ static void recv_generator(char *fname, struct file_struct *file, int ndx,
 	if (!do_xfers)
 		goto notify_others;
 
-	if (read_batch || whole_file) {
+	/* A partial file whose transfer got interrupted resumes from its
+	 * last checkpoint, as long as the source file hasn't changed. */
+	if (resume_partials && !inplace && !phase && !read_batch && !write_batch
+	 && (fnamecmp_type == FNAMECMP_PARTIAL_DIR
+	  || (fnamecmp_type == FNAMECMP_FNAME && !partial_dir && make_backups <= 0))) {
+		resume_len = read_checkpoint(fnamecmp, file, &sx.st,
+					     resume.prefix_sum);
+		if (resume_len && INFO_GTE(NAME, 2)) {
+			rprintf(FINFO, "resuming %s at %s\n",
+				fname, big_num(resume_len));
+		}
+	}
+
+	if (read_batch || whole_file || resume_len) {
 		if (inplace && make_backups > 0 && fnamecmp_type == FNAMECMP_FNAME) {
 			if (!(backupptr = get_backup_name(fname)))
 				goto cleanup;
@@ -1858,7 +2126,13 @@ static void recv_generator(char *fname, struct file_struct *file, int ndx,
 	}
 
 	/* open the file */
-	if ((fd = do_open(fnamecmp, O_RDONLY, 0)) < 0) {
+	if (fnamecmp_type == FNAMECMP_FNAME)
+		fd = gen_open_basis(0, fnamecmp);
+	else if (fnamecmp_type <= FNAMECMP_BASIS_DIR_HIGH)
+		fd = gen_open_basis(fnamecmp_type + 1, fnamecmp);
+	else
+		fd = do_open(fnamecmp, O_RDONLY, 0);
+	if (fd < 0) {
 		rsyserr(FERROR, errno, "failed to open %s, continuing",
 			full_fname(fnamecmp));
 	  pretend_missing:
@@ -1956,7 +2230,12 @@ static void recv_generator(char *fname, struct file_struct *file, int ndx,
 	if (read_batch)
 		goto cleanup;
 
-	if (statret != 0 || whole_file)
+	if (resume_len) {
+		resume.count = resume.blength = resume.remainder = 0;
+		resume.s2length = 0;
+		resume.prefix_len = resume_len;
+		write_sum_head(f_out, &resume);
+	} else if (statret != 0 || whole_file)
 		write_sum_head(f_out, NULL);
 	else if (sx.st.st_size <= 0) {
 		write_sum_head(f_out, NULL);
@@ -2572,6 +2851,8 @@ o3_empty_3:
 	info_levels[INFO_FLIST] = save_info_flist;
 	info_levels[INFO_PROGRESS] = save_info_progress;
 
+	forget_all_dirfds();
+
 	if (delete_during == 2)
 		do_delayed_deletions(fbuf);
 	if (delete_after && !solo_file && file_total > 0)
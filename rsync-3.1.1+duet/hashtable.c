@@ -19,7 +19,38 @@
 
 #include "rsync.h"
 
+/* The table is open-addressed with Robin Hood probing: an entry sits at or
+ * after its home slot, and an insert takes the slot of any entry that is
+ * closer to its own home than the new one would be.  That keeps probe
+ * sequences short and sorted by distance, so a lookup can stop as soon as
+ * it passes a slot whose entry is nearer its home than the key would be,
+ * and a delete just shifts the rest of its run back a slot (no tombstones).
+ *
+ * Growing doesn't rehash the whole table at once.  The old array is kept
+ * (read-only) next to the doubled one, and each insert moves the next few
+ * of its slots over until it is empty.  Lookups check both arrays until
+ * then. */
+
 #define HASH_LOAD_LIMIT(size) ((size)*3/4)
+#define HASH_MIGRATE_STEP 16
+
+#define HASH_MUL32 0x9E3779B9u /* 2^32 / golden ratio */
+
+/* Fibonacci hashing: the top bits of the key times a large odd constant. */
+static inline uint32 hash_key(int64 key, int key64)
+{
+	uint32 h = (uint32)key;
+
+#if SIZEOF_INT64 >= 8
+	if (key64)
+		h ^= (uint32)(key >> 32) * 0x85EBCA77u;
+#endif
+
+	return h * HASH_MUL32;
+}
+
+#define HOME(tbl, h) ((h) >> (tbl)->shift)
+#define DIST(tbl, ndx, h) (((ndx) - HOME(tbl, h)) & ((tbl)->size - 1))
 
 struct hashtable *hashtable_create(int size, int key64)
 {
@@ -35,22 +66,24 @@ struct hashtable *hashtable_create(int size, int key64)
 			size *= 2;
 	}
 
-	if (!(tbl = new(struct hashtable))
+	if (!(tbl = new0(struct hashtable))
 	 || !(tbl->nodes = new_array0(char, size * node_size)))
 		out_of_memory("hashtable_create");
 	tbl->size = size;
 	tbl->entries = 0;
 	tbl->node_size = node_size;
 	tbl->key64 = key64 ? 1 : 0;
+	for (tbl->shift = 32; size > 1; size /= 2)
+		tbl->shift--;
 
 	if (DEBUG_GTE(HASH, 1)) {
 		char buf[32];
-		if (req != size)
+		if (req != tbl->size)
 			snprintf(buf, sizeof buf, "req: %d, ", req);
 		else
 			*buf = '\0';
 		rprintf(FINFO, "[%s] created hashtable %lx (%ssize: %d, keys: %d-bit)\n",
-			who_am_i(), (long)tbl, buf, size, key64 ? 64 : 32);
+			who_am_i(), (long)tbl, buf, tbl->size, key64 ? 64 : 32);
 	}
 
 	return tbl;
@@ -62,111 +95,241 @@ void hashtable_destroy(struct hashtable *tbl)
 		rprintf(FINFO, "[%s] destroyed hashtable %lx (size: %d, keys: %d-bit)\n",
 			who_am_i(), (long)tbl, tbl->size, tbl->key64 ? 64 : 32);
 	}
+	free(tbl->old_nodes);
 	free(tbl->nodes);
 	free(tbl);
 }
 
-/* This returns the node for the indicated key, either newly created or
- * already existing.  Returns NULL if not allocating and not found. */
-void *hashtable_find(struct hashtable *tbl, int64 key, int allocate_if_missing)
+static inline void set_node(void *node, int64 key, void *data, int key64)
+{
+	if (key64)
+		((struct ht_int64_node*)node)->key = key;
+	else
+		((struct ht_int32_node*)node)->key = (int32)key;
+	((struct ht_int32_node*)node)->data = data;
+}
+
+/* Returns the node in the current array holding key, or NULL.  A miss sets
+ * *ndx_p and *dist_p to where the key would have to be inserted. */
+static void *lookup(struct hashtable *tbl, int64 key, uint32 h,
+		    uint32 *ndx_p, uint32 *dist_p)
 {
 	int key64 = tbl->key64;
-	struct ht_int32_node *node;
-	uint32 ndx;
+	uint32 mask = tbl->size - 1;
+	uint32 ndx = HOME(tbl, h), dist;
 
-	if (key64 ? key == 0 : (int32)key == 0) {
-		rprintf(FERROR, "Internal hashtable error: illegal key supplied!\n");
-		exit_cleanup(RERR_MESSAGEIO);
+	for (dist = 0; ; dist++, ndx = (ndx + 1) & mask) {
+		void *node = HT_NODE(tbl, tbl->nodes, ndx);
+		int64 nkey = HT_KEY(node, key64);
+		if (nkey == key)
+			return node;
+		if (nkey == 0 || DIST(tbl, ndx, hash_key(nkey, key64)) < dist) {
+			*ndx_p = ndx;
+			*dist_p = dist;
+			return NULL;
+		}
+	}
+}
+
+/* Returns the node in the old array (while it is being emptied) holding
+ * key, or NULL.  Its slots below old_moved were already copied over. */
+static void *lookup_old(struct hashtable *tbl, int64 key, uint32 h)
+{
+	int key64 = tbl->key64;
+	int shift = tbl->shift + 1;
+	uint32 mask = tbl->old_size - 1;
+	uint32 ndx = h >> shift, dist;
+
+	for (dist = 0; ; dist++, ndx = (ndx + 1) & mask) {
+		void *node = HT_NODE(tbl, tbl->old_nodes, ndx);
+		int64 nkey = HT_KEY(node, key64);
+		if (nkey == 0 || ((ndx - (hash_key(nkey, key64) >> shift)) & mask) < dist)
+			return NULL;
+		if (nkey == key)
+			return (int32)ndx < tbl->old_moved ? NULL : node;
 	}
+}
 
-	if (allocate_if_missing && tbl->entries > HASH_LOAD_LIMIT(tbl->size)) {
-		void *old_nodes = tbl->nodes;
-		int size = tbl->size * 2;
-		int i;
+/* Puts a key that isn't in the current array into it, starting at slot ndx,
+ * which is dist slots past its home, and returns its node. */
+static void *insert(struct hashtable *tbl, int64 key, void *data,
+		    uint32 ndx, uint32 dist)
+{
+	int key64 = tbl->key64;
+	uint32 mask = tbl->size - 1;
+	void *ret = NULL;
 
-		if (!(tbl->nodes = new_array0(char, size * tbl->node_size)))
-			out_of_memory("hashtable_node");
-		tbl->size = size;
-		tbl->entries = 0;
+	for ( ; ; dist++, ndx = (ndx + 1) & mask) {
+		void *node = HT_NODE(tbl, tbl->nodes, ndx);
+		int64 nkey = HT_KEY(node, key64);
+		uint32 ndist;
+		void *ndata;
 
-		if (DEBUG_GTE(HASH, 1)) {
-			rprintf(FINFO, "[%s] growing hashtable %lx (size: %d, keys: %d-bit)\n",
-				who_am_i(), (long)tbl, size, key64 ? 64 : 32);
+		if (nkey == 0) {
+			set_node(node, key, data, key64);
+			return ret ? ret : node;
 		}
+		if ((ndist = DIST(tbl, ndx, hash_key(nkey, key64))) >= dist)
+			continue;
+		/* Take this spot from the entry that is nearer its home,
+		 * and carry on looking for a spot for that one. */
+		ndata = ((struct ht_int32_node*)node)->data;
+		set_node(node, key, data, key64);
+		if (!ret)
+			ret = node;
+		key = nkey;
+		data = ndata;
+		dist = ndist;
+	}
+}
+
+/* Copy the next few slots of the old array into the current one. */
+static void migrate(struct hashtable *tbl, int32 step)
+{
+	int key64 = tbl->key64;
 
-		for (i = size / 2; i-- > 0; ) {
-			struct ht_int32_node *move_node = HT_NODE(tbl, old_nodes, i);
-			int64 move_key = HT_KEY(move_node, key64);
-			if (move_key == 0)
-				continue;
-			node = hashtable_find(tbl, move_key, 1);
-			node->data = move_node->data;
+	while (step-- > 0 && tbl->old_moved < tbl->old_size) {
+		void *node = HT_NODE(tbl, tbl->old_nodes, tbl->old_moved);
+		int64 nkey = HT_KEY(node, key64);
+		if (nkey != 0) {
+			uint32 h = hash_key(nkey, key64);
+			insert(tbl, nkey, ((struct ht_int32_node*)node)->data, HOME(tbl, h), 0);
 		}
+		tbl->old_moved++;
+	}
 
-		free(old_nodes);
+	if (tbl->old_moved == tbl->old_size) {
+		free(tbl->old_nodes);
+		tbl->old_nodes = NULL;
 	}
+}
 
-	if (!key64) {
-		/* Based on Jenkins One-at-a-time hash. */
-		uchar buf[4], *keyp = buf;
-		int i;
+static void grow(struct hashtable *tbl)
+{
+	tbl->old_nodes = tbl->nodes;
+	tbl->old_size = tbl->size;
+	tbl->old_moved = 0;
 
-		SIVALu(buf, 0, key);
-		for (ndx = 0, i = 0; i < 4; i++) {
-			ndx += keyp[i];
-			ndx += (ndx << 10);
-			ndx ^= (ndx >> 6);
-		}
-		ndx += (ndx << 3);
-		ndx ^= (ndx >> 11);
-		ndx += (ndx << 15);
-	} else {
-		/* Based on Jenkins hashword() from lookup3.c. */
-		uint32 a, b, c;
+	tbl->size *= 2;
+	tbl->shift--;
+	if (!(tbl->nodes = new_array0(char, tbl->size * tbl->node_size)))
+		out_of_memory("hashtable_node");
 
-		/* Set up the internal state */
-		a = b = c = 0xdeadbeef + (8 << 2);
+	if (DEBUG_GTE(HASH, 1)) {
+		rprintf(FINFO, "[%s] growing hashtable %lx (size: %d, keys: %d-bit)\n",
+			who_am_i(), (long)tbl, tbl->size, tbl->key64 ? 64 : 32);
+	}
+}
 
-#define rot(x,k) (((x)<<(k)) ^ ((x)>>(32-(k))))
-#if SIZEOF_INT64 >= 8
-		b += (uint32)(key >> 32);
-#endif
-		a += (uint32)key;
-		c ^= b; c -= rot(b, 14);
-		a ^= c; a -= rot(c, 11);
-		b ^= a; b -= rot(a, 25);
-		c ^= b; c -= rot(b, 16);
-		a ^= c; a -= rot(c, 4);
-		b ^= a; b -= rot(a, 14);
-		c ^= b; c -= rot(b, 24);
-#undef rot
-		ndx = c;
+static void check_key(struct hashtable *tbl, int64 key)
+{
+	if (tbl->key64 ? key == 0 : (int32)key == 0) {
+		rprintf(FERROR, "Internal hashtable error: illegal key supplied!\n");
+		exit_cleanup(RERR_MESSAGEIO);
 	}
+}
 
-	/* If it already exists, return the node.  If we're not
-	 * allocating, return NULL if the key is not found. */
-	while (1) {
-		int64 nkey;
+/* This returns the node for the indicated key, either newly created or
+ * already existing.  Returns NULL if not allocating and not found.  The
+ * node may move when the table is next changed, so don't keep it. */
+void *hashtable_find(struct hashtable *tbl, int64 key, int allocate_if_missing)
+{
+	uint32 h, ndx, dist;
+	void *node;
 
-		ndx &= tbl->size - 1;
-		node = HT_NODE(tbl, tbl->nodes, ndx);
-		nkey = HT_KEY(node, key64);
+	check_key(tbl, key);
 
-		if (nkey == key)
-			return node;
-		if (nkey == 0) {
-			if (!allocate_if_missing)
-				return NULL;
-			break;
+	if (allocate_if_missing) {
+		if (tbl->old_nodes)
+			migrate(tbl, HASH_MIGRATE_STEP);
+		else if (tbl->entries >= HASH_LOAD_LIMIT(tbl->size)) {
+			grow(tbl);
+			migrate(tbl, HASH_MIGRATE_STEP);
 		}
-		ndx++;
 	}
 
-	/* Take over this empty spot and then return the node. */
-	if (key64)
-		((struct ht_int64_node*)node)->key = key;
-	else
-		node->key = (int32)key;
+	h = hash_key(key, tbl->key64);
+
+	if ((node = lookup(tbl, key, h, &ndx, &dist)) != NULL)
+		return node;
+	if (tbl->old_nodes && (node = lookup_old(tbl, key, h)) != NULL)
+		return node;
+	if (!allocate_if_missing)
+		return NULL;
+
 	tbl->entries++;
-	return node;
+	return insert(tbl, key, NULL, ndx, dist);
+}
+
+/* Removes the key (if present), returning its data (or NULL). */
+void *hashtable_delete(struct hashtable *tbl, int64 key)
+{
+	int key64 = tbl->key64;
+	uint32 mask = tbl->size - 1;
+	uint32 ndx, dist;
+	void *node, *data;
+
+	check_key(tbl, key);
+
+	if (tbl->old_nodes) /* Deletes are rare, so don't bother with both arrays. */
+		migrate(tbl, tbl->old_size);
+
+	if (!(node = lookup(tbl, key, hash_key(key, key64), &ndx, &dist)))
+		return NULL;
+	data = ((struct ht_int32_node*)node)->data;
+	tbl->entries--;
+
+	/* Shift the rest of the run back one slot, up to an empty slot or
+	 * an entry that is already in its home slot. */
+	ndx = ((char*)node - (char*)tbl->nodes) / tbl->node_size;
+	while (1) {
+		void *next = HT_NODE(tbl, tbl->nodes, (ndx + 1) & mask);
+		int64 nkey = HT_KEY(next, key64);
+		if (nkey == 0 || DIST(tbl, (ndx + 1) & mask, hash_key(nkey, key64)) == 0)
+			break;
+		set_node(node, nkey, ((struct ht_int32_node*)next)->data, key64);
+		node = next;
+		ndx = (ndx + 1) & mask;
+	}
+	set_node(node, 0, NULL, key64);
+
+	return data;
+}
+
+/* Returns the next node in use after the one numbered *iter (start with 0),
+ * or NULL when there are no more.  Don't change the table while iterating. */
+void *hashtable_iterate(struct hashtable *tbl, int *iter)
+{
+	int key64 = tbl->key64;
+
+	if (tbl->old_nodes)
+		migrate(tbl, tbl->old_size);
+
+	while (*iter < tbl->size) {
+		void *node = HT_NODE(tbl, tbl->nodes, *iter);
+		(*iter)++;
+		if (HT_KEY(node, key64) != 0)
+			return node;
+	}
+
+	return NULL;
+}
+
+/* Jenkins one-at-a-time hash of a buffer, for turning variable-length data
+ * into a hashtable key.  Discontiguous data can be hashed by passing the
+ * result of the prior call as the seed.  The result is not finalized (the
+ * hashtable scrambles its keys anyway), and it may be 0, which the caller
+ * must map to a legal key. */
+uint32 hash_bytes(const void *buf, size_t len, uint32 seed)
+{
+	const uchar *p = buf;
+	uint32 h = seed;
+
+	while (len--) {
+		h += *p++;
+		h += (h << 10);
+		h ^= (h >> 6);
+	}
+
+	return h;
 }
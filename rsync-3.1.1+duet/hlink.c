@@ -90,10 +90,10 @@ struct ht_int64_node *idev_find(int64 dev, int64 ino)
 
 void idev_destroy(void)
 {
-	int i;
+	struct ht_int64_node *node;
+	int iter = 0;
 
-	for (i = 0; i < dev_tbl->size; i++) {
-		struct ht_int32_node *node = HT_NODE(dev_tbl, dev_tbl->nodes, i);
+	while ((node = hashtable_iterate(dev_tbl, &iter)) != NULL) {
 		if (node->data)
 			hashtable_destroy(node->data);
 	}
@@ -101,32 +101,21 @@ void idev_destroy(void)
 	hashtable_destroy(dev_tbl);
 }
 
-static int hlink_compare_gnum(int *int1, int *int2)
-{
-	struct file_struct *f1 = hlink_flist->sorted[*int1];
-	struct file_struct *f2 = hlink_flist->sorted[*int2];
-	int32 gnum1 = F_HL_GNUM(f1);
-	int32 gnum2 = F_HL_GNUM(f2);
-
-	if (gnum1 != gnum2)
-		return gnum1 > gnum2 ? 1 : -1;
-
-	return *int1 > *int2 ? 1 : -1;
-}
+/* The gnum_list holds a hard-linked file's group number in the upper 32 bits
+ * and its sorted ndx in the lower 32, sorted by group and then ndx. */
+#define GL_GNUM(v) ((int32)((v) >> 32))
+#define GL_NDX(v) ((int32)(v))
 
-static void match_gnums(int32 *ndx_list, int ndx_count)
+static void match_gnums(int64 *gnum_list, int ndx_count)
 {
 	int32 from, prev;
-	struct file_struct *file, *file_next;
+	struct file_struct *file;
 	struct ht_int32_node *node = NULL;
-	int32 gnum, gnum_next;
-
-	qsort(ndx_list, ndx_count, sizeof ndx_list[0],
-	     (int (*)()) hlink_compare_gnum);
+	int32 gnum;
 
 	for (from = 0; from < ndx_count; from++) {
-		file = hlink_flist->sorted[ndx_list[from]];
-		gnum = F_HL_GNUM(file);
+		file = hlink_flist->sorted[GL_NDX(gnum_list[from])];
+		gnum = GL_GNUM(gnum_list[from]);
 		if (inc_recurse) {
 			node = hashtable_find(prior_hlinks, gnum, 1);
 			if (!node->data) {
@@ -153,17 +142,16 @@ static void match_gnums(int32 *ndx_list, int ndx_count)
 			file->flags |= FLAG_HLINK_FIRST;
 			prev = -1;
 		}
-		for ( ; from < ndx_count-1; file = file_next, gnum = gnum_next, from++) { /*SHARED ITERATOR*/
-			file_next = hlink_flist->sorted[ndx_list[from+1]];
-			gnum_next = F_HL_GNUM(file_next);
-			if (gnum != gnum_next)
+		for ( ; from < ndx_count-1; from++) { /*SHARED ITERATOR*/
+			if (GL_GNUM(gnum_list[from+1]) != gnum)
 				break;
 			F_HL_PREV(file) = prev;
 			/* The linked list uses over-the-wire ndx values. */
 			if (unsort_ndx)
 				prev = F_NDX(file);
 			else
-				prev = ndx_list[from] + hlink_flist->ndx_start;
+				prev = GL_NDX(gnum_list[from]) + hlink_flist->ndx_start;
+			file = hlink_flist->sorted[GL_NDX(gnum_list[from+1])];
 		}
 		if (prev < 0 && !inc_recurse) {
 			/* Disable hard-link bit and set DONE so that
@@ -179,39 +167,46 @@ static void match_gnums(int32 *ndx_list, int ndx_count)
 			if (unsort_ndx)
 				prev = F_NDX(file);
 			else
-				prev = ndx_list[from] + hlink_flist->ndx_start;
+				prev = GL_NDX(gnum_list[from]) + hlink_flist->ndx_start;
 			SIVAL(node->data, 1, prev);
 		}
 	}
 }
 
 /* Analyze the hard-links in the file-list by creating a list of all the
- * items that have hlink data, sorting them, and matching up identical
- * values into clusters.  These will be a single linked list from last
- * to first when we're done. */
+ * items that have hlink data, radix-sorting them by group number, and
+ * matching up identical values into clusters.  These will be a single
+ * linked list from last to first when we're done. */
 void match_hard_links(struct file_list *flist)
 {
 	if (!list_only && flist->used) {
 		int i, ndx_count = 0;
-		int32 *ndx_list;
+		int64 *gnum_list, *tmp, *list;
 
-		if (!(ndx_list = new_array(int32, flist->used)))
+		if (!(gnum_list = new_array(int64, flist->used)))
 			out_of_memory("match_hard_links");
 
 		for (i = 0; i < flist->used; i++) {
-			if (F_IS_HLINKED(flist->sorted[i]))
-				ndx_list[ndx_count++] = i;
+			struct file_struct *file = flist->sorted[i];
+			if (F_IS_HLINKED(file))
+				gnum_list[ndx_count++] = (int64)F_HL_GNUM(file) << 32 | (uint32)i;
 		}
 
 		hlink_flist = flist;
 
-		if (ndx_count)
-			match_gnums(ndx_list, ndx_count);
+		if (ndx_count) {
+			if (!(tmp = new_array(int64, ndx_count)))
+				out_of_memory("match_hard_links");
+			/* The list is built in ndx order, so a stable sort on
+			 * just the group number leaves each group in ndx order. */
+			list = (int64 *)radix_sort((char *)gnum_list, (char *)tmp,
+						    ndx_count, sizeof (int64), 0, 4);
+			match_gnums(list, ndx_count);
+			free(tmp);
+		}
 
-		free(ndx_list);
+		free(gnum_list);
 	}
-	if (protocol_version < 30)
-		idev_destroy();
 }
 
 static int maybe_hard_link(struct file_struct *file, int ndx,
@@ -54,8 +54,10 @@ extern int compat_flags;
 extern int protect_args;
 extern int checksum_seed;
 extern int protocol_version;
+extern int resume_partials;
 extern int remove_source_files;
 extern int preserve_hard_links;
+extern int recv_files_pending;
 extern BOOL extra_flist_sending_enabled;
 extern BOOL flush_ok_after_signal;
 extern struct stats stats;
@@ -95,6 +97,9 @@ static struct {
 	size_t raw_data_header_pos;      /* in the out xbuf */
 	size_t raw_flushing_ends_before; /* in the out xbuf */
 	size_t raw_input_ends_before;    /* in the in xbuf */
+	const char *out_ext;  /* write_buf() data that follows the out xbuf */
+	size_t out_ext_len;
+	BOOL out_ext_framed;  /* out_ext ends the MSG_DATA being flushed */
 } iobuf = { .in_fd = -1, .out_fd = -1 };
 
 static time_t last_io_in;
@@ -624,11 +629,25 @@ static char *perform_io(size_t needed, int flags)
 		case PIO_NEED_INPUT:
 			if (iobuf.in.len >= needed)
 				goto double_break;
+			/* The receiver must not sit on files that are done
+			 * while it waits: the generator (and thus the sender)
+			 * may be waiting to hear about them. */
+			if (recv_files_pending) {
+				int keep = 0;
+				if (iobuf.in_fd >= 0) {
+					FD_ZERO(&r_fds);
+					FD_SET(iobuf.in_fd, &r_fds);
+					tv.tv_sec = tv.tv_usec = 0;
+					if (select(iobuf.in_fd + 1, &r_fds, NULL, NULL, &tv) > 0)
+						keep = recv_files_pending;
+				}
+				finish_recv_pending(keep);
+			}
 			break;
 		case PIO_NEED_OUTROOM:
 			/* Note that iobuf.out_empty_len doesn't factor into this check
 			 * because iobuf.out.len already holds any needed header len. */
-			if (iobuf.out.len + needed <= iobuf.out.size)
+			if (iobuf.out.len + needed <= iobuf.out.size && !iobuf.out_ext_len)
 				goto double_break;
 			break;
 		case PIO_NEED_MSGROOM:
@@ -651,7 +670,8 @@ static char *perform_io(size_t needed, int flags)
 		}
 
 		/* Only do more filesfrom processing if there is enough room in the out buffer. */
-		if (ff_forward_fd >= 0 && iobuf.out.size - iobuf.out.len > FILESFROM_BUFLEN*2) {
+		if (ff_forward_fd >= 0 && iobuf.out.size - iobuf.out.len > FILESFROM_BUFLEN*2
+		 && !iobuf.out_ext_len) {
 			FD_SET(ff_forward_fd, &r_fds);
 			if (ff_forward_fd > max_fd)
 				max_fd = ff_forward_fd;
@@ -659,19 +679,23 @@ static char *perform_io(size_t needed, int flags)
 
 		FD_ZERO(&w_fds);
 		if (iobuf.out_fd >= 0) {
-			if (iobuf.raw_flushing_ends_before
-			 || (!iobuf.msg.len && iobuf.out.len > iobuf.out_empty_len && !(flags & PIO_NEED_MSGROOM))) {
-				if (OUT_MULTIPLEXED && !iobuf.raw_flushing_ends_before) {
+			if (iobuf.raw_flushing_ends_before || iobuf.out_ext_framed
+			 || (!iobuf.msg.len && (iobuf.out.len > iobuf.out_empty_len || iobuf.out_ext_len)
+			  && !(flags & PIO_NEED_MSGROOM))) {
+				if (OUT_MULTIPLEXED && !iobuf.raw_flushing_ends_before && !iobuf.out_ext_framed) {
 					/* The iobuf.raw_flushing_ends_before value can point off the end
 					 * of the iobuf.out buffer for a while, for easier subtracting. */
 					iobuf.raw_flushing_ends_before = iobuf.out.pos + iobuf.out.len;
 
+					/* Any out_ext data is sent at the end of this MSG_DATA. */
 					SIVAL(iobuf.out.buf + iobuf.raw_data_header_pos, 0,
-					      ((MPLEX_BASE + (int)MSG_DATA)<<24) + iobuf.out.len - 4);
+					      ((MPLEX_BASE + (int)MSG_DATA)<<24) + iobuf.out.len - 4 + iobuf.out_ext_len);
+					iobuf.out_ext_framed = iobuf.out_ext_len != 0;
 
 					if (msgs2stderr && DEBUG_GTE(IO, 1)) {
 						rprintf(FINFO, "[%s] send_msg(%d, %ld)\n",
-							who_am_i(), (int)MSG_DATA, (long)iobuf.out.len - 4);
+							who_am_i(), (int)MSG_DATA,
+							(long)(iobuf.out.len - 4 + iobuf.out_ext_len));
 					}
 
 					/* reserve room for the next MSG_DATA header */
@@ -770,12 +794,28 @@ static char *perform_io(size_t needed, int flags)
 		if (iobuf.in_fd >= 0 && FD_ISSET(iobuf.in_fd, &r_fds)) {
 			size_t len, pos = iobuf.in.pos + iobuf.in.len;
 			int n;
+#ifdef HAVE_READV
+			struct iovec iov[2];
+			int iovcnt = 1;
+#endif
 			if (pos >= iobuf.in.size) {
 				pos -= iobuf.in.size;
 				len = iobuf.in.size - iobuf.in.len;
 			} else
 				len = iobuf.in.size - pos;
+#ifdef HAVE_READV
+			/* Fill the free space at both ends of the circular buffer. */
+			iov[0].iov_base = iobuf.in.buf + pos;
+			iov[0].iov_len = len;
+			if (pos + len == iobuf.in.size && iobuf.in.pos) {
+				iov[1].iov_base = iobuf.in.buf;
+				iov[1].iov_len = iobuf.in.pos;
+				iovcnt = 2;
+			}
+			if ((n = readv(iobuf.in_fd, iov, iovcnt)) <= 0) {
+#else
 			if ((n = read(iobuf.in_fd, iobuf.in.buf + pos, len)) <= 0) {
+#endif
 				if (n == 0) {
 					/* Signal that input has become invalid. */
 					if (!read_batch || batch_fd < 0 || am_generator)
@@ -811,14 +851,42 @@ static char *perform_io(size_t needed, int flags)
 
 		if (out && FD_ISSET(iobuf.out_fd, &w_fds)) {
 			size_t len = iobuf.raw_flushing_ends_before ? iobuf.raw_flushing_ends_before - out->pos : out->len;
+			size_t out_n, ext_n;
 			int n;
+#ifdef HAVE_WRITEV
+			struct iovec iov[3];
+			int iovcnt = 0;
+#endif
+
+			/* Only the out_ext data is left of this MSG_DATA? */
+			if (iobuf.out_ext_framed && out == &iobuf.out && !iobuf.raw_flushing_ends_before)
+				len = 0;
 
 			if (bwlimit_writemax && len > bwlimit_writemax)
 				len = bwlimit_writemax;
 
+#ifdef HAVE_WRITEV
+			/* Gather the bytes at both ends of the circular buffer
+			 * and the caller's data that follows them. */
+			if (len > out->size - out->pos) {
+				iov[iovcnt].iov_base = out->buf + out->pos;
+				iov[iovcnt++].iov_len = out->size - out->pos;
+				iov[iovcnt].iov_base = out->buf;
+				iov[iovcnt++].iov_len = len - (out->size - out->pos);
+			} else if (len) {
+				iov[iovcnt].iov_base = out->buf + out->pos;
+				iov[iovcnt++].iov_len = len;
+			}
+			if (iobuf.out_ext_framed && out == &iobuf.out) {
+				iov[iovcnt].iov_base = (char *)iobuf.out_ext;
+				iov[iovcnt++].iov_len = iobuf.out_ext_len;
+			}
+			if ((n = writev(iobuf.out_fd, iov, iovcnt)) <= 0) {
+#else
 			if (out->pos + len > out->size)
 				len = out->size - out->pos;
 			if ((n = write(iobuf.out_fd, out->buf + out->pos, len)) <= 0) {
+#endif
 				if (errno == EINTR || errno == EWOULDBLOCK || errno == EAGAIN)
 					n = 0;
 				else {
@@ -826,6 +894,8 @@ static char *perform_io(size_t needed, int flags)
 					msgs2stderr = 1;
 					iobuf.out_fd = -2;
 					iobuf.out.len = iobuf.msg.len = iobuf.raw_flushing_ends_before = 0;
+					iobuf.out_ext_len = 0;
+					iobuf.out_ext_framed = False;
 					rsyserr(FERROR_SOCKET, errno, "[%s] write error", who_am_i());
 					drain_multiplex_messages();
 					exit_cleanup(RERR_SOCKETIO);
@@ -843,18 +913,29 @@ static char *perform_io(size_t needed, int flags)
 			if (bwlimit_writemax)
 				sleep_for_bwlimit(n);
 
-			if ((out->pos += n) == out->size) {
-				if (iobuf.raw_flushing_ends_before)
-					iobuf.raw_flushing_ends_before -= out->size;
-				out->pos = 0;
-				restore_iobuf_size(out);
-			} else if (out->pos == iobuf.raw_flushing_ends_before)
-				iobuf.raw_flushing_ends_before = 0;
-			if ((out->len -= n) == empty_buf_len) {
-				out->pos = 0;
-				restore_iobuf_size(out);
-				if (empty_buf_len)
-					iobuf.raw_data_header_pos = 0;
+			out_n = MIN((size_t)n, len);
+			ext_n = n - out_n;
+			while (out_n) {
+				size_t m = MIN(out_n, out->size - out->pos);
+				if ((out->pos += m) == out->size) {
+					if (iobuf.raw_flushing_ends_before)
+						iobuf.raw_flushing_ends_before -= out->size;
+					out->pos = 0;
+					restore_iobuf_size(out);
+				} else if (out->pos == iobuf.raw_flushing_ends_before)
+					iobuf.raw_flushing_ends_before = 0;
+				if ((out->len -= m) == empty_buf_len) {
+					out->pos = 0;
+					restore_iobuf_size(out);
+					if (empty_buf_len)
+						iobuf.raw_data_header_pos = 0;
+				}
+				out_n -= m;
+			}
+			if (ext_n) {
+				iobuf.out_ext += ext_n;
+				if ((iobuf.out_ext_len -= ext_n) == 0)
+					iobuf.out_ext_framed = False;
 			}
 		}
 
@@ -1949,6 +2030,15 @@ void read_sum_head(int f, struct sum_struct *sum)
 			(long)sum->remainder, who_am_i());
 		exit_cleanup(RERR_PROTOCOL);
 	}
+	sum->prefix_len = resume_partials ? read_varlong(f, 1) : 0;
+	if (sum->prefix_len) {
+		if (sum->prefix_len < 0 || sum->prefix_len % CSUM_CHUNK) {
+			rprintf(FERROR, "Invalid resume length %s [%s]\n",
+				big_num(sum->prefix_len), who_am_i());
+			exit_cleanup(RERR_PROTOCOL);
+		}
+		read_buf(f, sum->prefix_sum, MD5_DIGEST_LEN);
+	}
 }
 
 /* Send the values from a sum_struct over the socket.  Set sum to
@@ -1966,6 +2056,13 @@ void write_sum_head(int f, struct sum_struct *sum)
 	if (protocol_version >= 27)
 		write_int(f, sum->s2length);
 	write_int(f, sum->remainder);
+	if (resume_partials) {
+		/* A resumed file's prefix is followed by the MD5 state that
+		 * both sides start the file's checksum from. */
+		write_varlong(f, sum->prefix_len, 1);
+		if (sum->prefix_len)
+			write_buf(f, sum->prefix_sum, MD5_DIGEST_LEN);
+	}
 }
 
 /* Sleep after writing to limit I/O bandwidth usage.
@@ -2145,6 +2242,20 @@ void write_buf(int f, const char *buf, size_t len)
 		goto batch_copy;
 	}
 
+#ifdef HAVE_WRITEV
+	/* Rather than copying a big block (such as a chunk of file data) into
+	 * the out buffer, have perform_io() send it right from the caller's
+	 * buffer, after what is already buffered and as part of that MSG_DATA. */
+	if (len >= IO_DIRECT_WRITE_MIN && OUT_MULTIPLEXED && !iobuf.out_ext_len
+	 && !bwlimit_writemax && len < 0xFFFFFF - iobuf.out.size) {
+		iobuf.out_ext = buf;
+		iobuf.out_ext_len = len;
+		perform_io(0, PIO_NEED_OUTROOM);
+		total_data_written += len;
+		goto batch_copy;
+	}
+#endif
+
 	if (iobuf.out.len + len > iobuf.out.size)
 		perform_io(len, PIO_NEED_OUTROOM);
 
@@ -1672,6 +1672,11 @@ int main(int argc,char *argv[])
 		rprintf(FERROR, "failed to register with Duet\n");
 		exit_cleanup(RERR_DUET);
 	}
+
+	/* Out-of-order transfers are maintenance; stay out of the way */
+	if (duet_set_ioprio(duet_fd, tid,
+			    DUET_IOPRIO(DUET_IOPRIO_CLASS_IDLE, 0)))
+		rprintf(FWARNING, "failed to set Duet I/O priority\n");
 start:
 #endif /* HAVE_DUET */
 
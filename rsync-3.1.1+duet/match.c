@@ -25,6 +25,10 @@
 extern int checksum_seed;
 extern int append_mode;
 extern int checksum_len;
+extern int sparse_files;
+extern int sparse_holes;
+extern int do_compression;
+extern int cdc_blocks;
 
 int updating_basis_file;
 char sender_file_sum[MAX_DIGEST_LEN];
@@ -89,6 +93,9 @@ static void build_hash_table(struct sum_struct *s)
 
 
 static OFF_T last_match;
+/* The next hole in the file that we're going to skip (see map_next_hole()).
+ * If we're not skipping holes, hole_start is the file's length. */
+static OFF_T hole_start, hole_end;
 
 
 /* Transmit a literal and/or match token.
@@ -137,6 +144,23 @@ static void matched(int f, struct sum_struct *s, struct map_struct *buf,
 		show_progress(last_match, buf->file_size);
 }
 
+/* Send the hole that runs from last_match to hole_end without reading or
+ * checksumming its zeros, and find the next one. */
+static void skip_hole(int f, struct map_struct *buf, OFF_T len)
+{
+	while (last_match < hole_end) {
+		int32 n = (int32)MIN(hole_end - last_match, (OFF_T)MAX_HOLE_TOKEN);
+		send_hole_token(f, n);
+		sum_update_hole(n);
+		last_match += n;
+	}
+
+	if (INFO_GTE(PROGRESS, 1))
+		show_progress(last_match, buf->file_size);
+
+	hole_start = map_next_hole(buf, last_match, len, &hole_end);
+}
+
 
 static void hash_search(int f,struct sum_struct *s,
 			struct map_struct *buf, OFF_T len)
@@ -186,6 +210,25 @@ static void hash_search(int f,struct sum_struct *s,
 				big_num(offset), s2 & 0xFFFF, s1 & 0xFFFF);
 		}
 
+		if (offset >= hole_start) {
+			/* A match may have taken us part way into the hole. */
+			if (offset > hole_start)
+				hole_start = map_next_hole(buf, offset, len, &hole_end);
+			if (offset == hole_start) {
+				matched(f, s, buf, offset, -2);
+				skip_hole(f, buf, len);
+				/* Restart the rolling checksum just as we would
+				 * after a match that ended at the hole's end. */
+				offset = last_match - 1;
+				k = (int32)MIN((OFF_T)s->blength, len-offset);
+				map = (schar *)map_ptr(buf, offset, k);
+				sum = get_checksum1((char *)map, k);
+				s1 = sum & 0xFFFF;
+				s2 = sum >> 16;
+				goto null_hash;
+			}
+		}
+
 		if (tablesize == TRADITIONAL_TABLESIZE) {
 			hash_entry = SUM2HASH2(s1,s2);
 			if ((i = hash_table[hash_entry]) < 0)
@@ -344,6 +387,87 @@ static void hash_search(int f,struct sum_struct *s,
 }
 
 
+/* Cut the file into content-defined chunks the same way the generator cut
+ * the basis file (see --cdc), and look each chunk up by its strong sum. */
+static void cdc_search(int f, struct sum_struct *s,
+		       struct map_struct *buf, OFF_T len)
+{
+	OFF_T offset = 0;
+	int32 want_i = 0;
+	char sum2[SUM_LENGTH];
+
+	if (DEBUG_GTE(DELTASUM, 2)) {
+		rprintf(FINFO, "cdc search b=%ld len=%s\n",
+			(long)s->blength, big_num(len));
+	}
+
+	while (offset < len) {
+		int32 n1, i;
+		uint32 sum;
+		char *map;
+
+		if (offset >= hole_start) {
+			if (offset > hole_start)
+				hole_start = map_next_hole(buf, offset, len, &hole_end);
+			if (offset == hole_start) {
+				matched(f, s, buf, offset, -2);
+				skip_hole(f, buf, len);
+				offset = last_match;
+				continue;
+			}
+		}
+
+		n1 = (int32)MIN(len - offset, (OFF_T)CDC_MAX_LEN(s->blength));
+		if (offset + n1 > hole_start)
+			n1 = (int32)(hole_start - offset);
+		map = map_ptr(buf, offset, n1);
+		n1 = cdc_chunk_len(map, n1, s->blength);
+		get_checksum2(map, n1, sum2);
+		sum = IVAL(sum2, 0);
+
+		if (tablesize == TRADITIONAL_TABLESIZE)
+			i = hash_table[SUM2HASH(sum)];
+		else
+			i = hash_table[BIG_SUM2HASH(sum)];
+		if (i >= 0)
+			hash_hits++;
+
+		for ( ; i >= 0; i = s->sums[i].chain) {
+			/* When updating in-place, we can't use a chunk that
+			 * we have already written over. */
+			if (sum != s->sums[i].sum1 || n1 != s->sums[i].len
+			 || (updating_basis_file && s->sums[i].offset < offset))
+				continue;
+			if (memcmp(sum2, s->sums[i].sum2, s->s2length) == 0)
+				break;
+			false_alarms++;
+		}
+
+		if (i < 0) {
+			offset += n1;
+			if (offset - last_match >= CHUNK_SIZE)
+				matched(f, s, buf, offset, -2);
+			continue;
+		}
+
+		/* Prefer the chunk that follows the last match so that the
+		 * RLL coding of the output works more efficiently. */
+		if (i != want_i && want_i < s->count
+		 && n1 == s->sums[want_i].len
+		 && (!updating_basis_file || s->sums[want_i].offset >= offset)
+		 && memcmp(sum2, s->sums[want_i].sum2, s->s2length) == 0)
+			i = want_i;
+		want_i = i + 1;
+
+		matched(f, s, buf, offset, i);
+		offset += n1;
+		matches++;
+	}
+
+	matched(f, s, buf, len, -1);
+}
+
+
 /**
  * Scan through a origin file, looking for sections that match
  * checksums from the generator, and transmit either literal or token
@@ -360,6 +484,8 @@ static void hash_search(int f,struct sum_struct *s,
  **/
 void match_sums(int f, struct sum_struct *s, struct map_struct *buf, OFF_T len)
 {
+	int bad_sum = 0;
+
 	last_match = 0;
 	false_alarms = 0;
 	hash_hits = 0;
@@ -368,6 +494,8 @@ void match_sums(int f, struct sum_struct *s, struct map_struct *buf, OFF_T len)
 
 	sum_init(checksum_seed);
 
+	hole_start = hole_end = len;
+
 	if (append_mode > 0) {
 		if (append_mode == 2) {
 			OFF_T j = 0;
@@ -389,21 +517,44 @@ void match_sums(int f, struct sum_struct *s, struct map_struct *buf, OFF_T len)
 		s->count = 0;
 	}
 
+	if (s->prefix_len) {
+		/* The receiver resumes an interrupted transfer of this file
+		 * after the prefix that it already has.  If our file has
+		 * shrunk since then, make the receiver's verification fail. */
+		sum_resume(s->prefix_len, s->prefix_sum);
+		if (s->prefix_len > len)
+			bad_sum = 1;
+		last_match = MIN(s->prefix_len, len);
+		s->count = 0;
+	}
+
+	if (sparse_holes && sparse_files > 0 && !do_compression && len > 0)
+		hole_start = map_next_hole(buf, last_match, len, &hole_end);
+
 	if (len > 0 && s->count > 0) {
 		build_hash_table(s);
 
 		if (DEBUG_GTE(DELTASUM, 2))
 			rprintf(FINFO,"built hash table\n");
 
-		hash_search(f, s, buf, len);
+		if (cdc_blocks)
+			cdc_search(f, s, buf, len);
+		else
+			hash_search(f, s, buf, len);
 
 		if (DEBUG_GTE(DELTASUM, 2))
 			rprintf(FINFO,"done hash search\n");
 	} else {
 		OFF_T j;
-		/* by doing this in pieces we avoid too many seeks */
-		for (j = last_match + CHUNK_SIZE; j < len; j += CHUNK_SIZE)
-			matched(f, s, buf, j, -2);
+		while (1) {
+			/* by doing this in pieces we avoid too many seeks */
+			for (j = last_match + CHUNK_SIZE; j < hole_start; j += CHUNK_SIZE)
+				matched(f, s, buf, j, -2);
+			if (hole_start >= len)
+				break;
+			matched(f, s, buf, hole_start, -2);
+			skip_hole(f, buf, len);
+		}
 		matched(f, s, buf, len, -1);
 	}
 
@@ -413,7 +564,7 @@ void match_sums(int f, struct sum_struct *s, struct map_struct *buf, OFF_T len)
 	/* If we had a read error, send a bad checksum.  We use all bits
 	 * off as long as the checksum doesn't happen to be that, in
 	 * which case we turn the last 0 bit into a 1. */
-	if (buf && buf->status != 0) {
+	if (bad_sum || (buf && buf->status != 0)) {
 		int i;
 		for (i = 0; i < checksum_len && sender_file_sum[i] == 0; i++) {}
 		memset(sender_file_sum, 0, checksum_len);
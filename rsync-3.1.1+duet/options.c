@@ -124,7 +124,9 @@ int blocking_io = -1;
 int checksum_seed = 0;
 int inplace = 0;
 int delay_updates = 0;
+int recv_threads = 0;
 long block_size = 0; /* "long" because popt can't set an int32. */
+int cdc_blocks = 0;
 char *skip_compress = NULL;
 item_list dparam_list = EMPTY_ITEM_LIST;
 #ifdef HAVE_DUET
@@ -731,6 +733,7 @@ void usage(enum logcode F)
   rprintf(F," -W, --whole-file            copy files whole (without delta-xfer algorithm)\n");
   rprintf(F," -x, --one-file-system       don't cross filesystem boundaries\n");
   rprintf(F," -B, --block-size=SIZE       force a fixed checksum block-size\n");
+  rprintf(F,"     --cdc                   use content-defined blocks for the delta-xfer\n");
   rprintf(F," -e, --rsh=COMMAND           specify the remote shell to use\n");
   rprintf(F,"     --rsync-path=PROGRAM    specify the rsync to run on the remote machine\n");
   rprintf(F,"     --existing              skip creating new files on receiver\n");
@@ -753,6 +756,7 @@ void usage(enum logcode F)
   rprintf(F,"     --partial               keep partially transferred files\n");
   rprintf(F,"     --partial-dir=DIR       put a partially transferred file into DIR\n");
   rprintf(F,"     --delay-updates         put all updated files into place at transfer's end\n");
+  rprintf(F,"     --recv-threads=NUM      close received files using NUM threads\n");
   rprintf(F," -m, --prune-empty-dirs      prune empty directory chains from the file-list\n");
   rprintf(F,"     --numeric-ids           don't map uid/gid values by user/group name\n");
   rprintf(F,"     --usermap=STRING        custom username mapping\n");
@@ -975,6 +979,8 @@ static struct poptOption long_options[] = {
   {"no-checksum",      0,  POPT_ARG_VAL,    &always_checksum, 0, 0, 0 },
   {"no-c",             0,  POPT_ARG_VAL,    &always_checksum, 0, 0, 0 },
   {"block-size",      'B', POPT_ARG_LONG,   &block_size, 0, 0, 0 },
+  {"cdc",              0,  POPT_ARG_VAL,    &cdc_blocks, 1, 0, 0 },
+  {"no-cdc",           0,  POPT_ARG_VAL,    &cdc_blocks, 0, 0, 0 },
   {"compare-dest",     0,  POPT_ARG_STRING, 0, OPT_COMPARE_DEST, 0, 0 },
   {"copy-dest",        0,  POPT_ARG_STRING, 0, OPT_COPY_DEST, 0, 0 },
   {"link-dest",        0,  POPT_ARG_STRING, 0, OPT_LINK_DEST, 0, 0 },
@@ -996,6 +1002,7 @@ static struct poptOption long_options[] = {
   {"partial-dir",      0,  POPT_ARG_STRING, &partial_dir, 0, 0, 0 },
   {"delay-updates",    0,  POPT_ARG_VAL,    &delay_updates, 1, 0, 0 },
   {"no-delay-updates", 0,  POPT_ARG_VAL,    &delay_updates, 0, 0, 0 },
+  {"recv-threads",     0,  POPT_ARG_INT,    &recv_threads, 0, 0, 0 },
   {"prune-empty-dirs",'m', POPT_ARG_VAL,    &prune_empty_dirs, 1, 0, 0 },
   {"no-prune-empty-dirs",0,POPT_ARG_VAL,    &prune_empty_dirs, 0, 0, 0 },
   {"no-m",             0,  POPT_ARG_VAL,    &prune_empty_dirs, 0, 0, 0 },
@@ -2018,6 +2025,13 @@ int parse_arguments(int *argc_p, const char ***argv_p)
 		return 0;
 	}
 
+	if (recv_threads < 0 || recv_threads > MAX_RECV_THREADS) {
+		snprintf(err_buf, sizeof err_buf,
+			"--recv-threads must be between 0 and %d.\n",
+			MAX_RECV_THREADS);
+		return 0;
+	}
+
 	if (max_delete < 0 && max_delete != INT_MIN) {
 		/* Negative numbers are treated as "no deletions". */
 		max_delete = 0;
@@ -2527,6 +2541,11 @@ void server_options(char **args, int *argc_p)
 #endif
 		argstr[x++] = 'f'; /* flist I/O-error safety support */
 		argstr[x++] = 'x'; /* xattr hardlink optimization not desired */
+		argstr[x++] = 'H'; /* sparse hole tokens supported */
+		if (cdc_blocks && !append_mode)
+			argstr[x++] = 'B'; /* content-defined blocks wanted */
+		if (keep_partial && !delay_updates)
+			argstr[x++] = 'P'; /* resumable partial files wanted */
 	}
 
 	if (x >= (int)sizeof argstr) { /* Not possible... */
@@ -2658,6 +2677,11 @@ void server_options(char **args, int *argc_p)
 			args[ac++] = "--size-only";
 		if (do_stats)
 			args[ac++] = "--stats";
+		if (recv_threads) {
+			if (asprintf(&arg, "--recv-threads=%d", recv_threads) < 0)
+				goto oom;
+			args[ac++] = arg;
+		}
 	} else {
 		if (skip_compress) {
 			if (asprintf(&arg, "--skip-compress=%s", skip_compress) < 0)
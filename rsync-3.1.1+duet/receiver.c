@@ -27,6 +27,7 @@ extern int do_xfers;
 extern int am_root;
 extern int am_server;
 extern int inc_recurse;
+extern int cdc_blocks;
 extern int log_before_transfer;
 extern int stdout_format_has_i;
 extern int logfile_format_has_i;
@@ -48,11 +49,13 @@ extern int append_mode;
 extern int sparse_files;
 extern int preallocate_files;
 extern int keep_partial;
+extern int resume_partials;
 extern int checksum_len;
 extern int checksum_seed;
 extern int inplace;
 extern int allowed_lull;
 extern int delay_updates;
+extern int recv_threads;
 extern mode_t orig_umask;
 extern struct stats stats;
 extern char *tmpdir;
@@ -71,6 +74,8 @@ static int phase = 0, redoing = 0;
 static flist_ndx_list batch_redo_list;
 /* We're either updating the basis file or an identical copy: */
 static int updating_basis_or_equiv;
+/* How many received files are waiting in finish_recv_pending(). */
+int recv_files_pending = 0;
 
 #define TMPNAME_SUFFIX ".XXXXXX"
 #define TMPNAME_SUFFIX_LEN ((int)sizeof TMPNAME_SUFFIX - 1)
@@ -236,14 +241,126 @@ int open_tmpfile(char *fnametmp, const char *fname, struct file_struct *file)
 	return fd;
 }
 
-static int receive_data(int f_in, char *fname_r, int fd_r, OFF_T size_r,
-			const char *fname, int fd, OFF_T total_size)
+#define CHECKPOINT_MAGIC 0x4B435352 /* "RSCK" */
+#define CHECKPOINT_LEN 80
+
+/* The checkpoint of a partial file is kept next to it as ".NAME.ckpt". */
+static char *checkpoint_fname(const char *fname)
+{
+	static char ckpt_fname[MAXPATHLEN];
+	const char *fn;
+	int dlen;
+
+	if ((fn = strrchr(fname, '/')) != NULL)
+		dlen = ++fn - fname;
+	else {
+		fn = fname;
+		dlen = 0;
+	}
+	if (snprintf(ckpt_fname, sizeof ckpt_fname, "%.*s.%s.ckpt",
+		     dlen, fname, fn) >= (int)sizeof ckpt_fname)
+		return NULL;
+
+	return ckpt_fname;
+}
+
+/* Record that the first len bytes of the partial file fname have been
+ * received for file, and that state is the MD5 state of the file's
+ * checksum after them.  The data itself is in the open file data_fd (which
+ * is usually a temp-file that only gets renamed to fname if the transfer is
+ * interrupted cleanly), so its device and inode are recorded too: a crash
+ * leaves fname holding whatever it held before.  Returns 1 on success. */
+int write_checkpoint(const char *fname, struct file_struct *file,
+		     int data_fd, OFF_T len, const char *state)
+{
+	char buf[CHECKPOINT_LEN], *ckpt;
+	STRUCT_STAT st;
+	int fd, ok;
+
+	if (!(ckpt = checkpoint_fname(fname)) || do_fstat(data_fd, &st) < 0)
+		return 0;
+
+	memset(buf, 0, sizeof buf);
+	SIVAL(buf, 0, CHECKPOINT_MAGIC);
+	SIVAL64(buf, 8, F_LENGTH(file));
+	SIVAL64(buf, 16, (int64)file->modtime);
+	SIVAL64(buf, 24, len);
+	SIVAL64(buf, 32, (int64)st.st_dev);
+	SIVAL64(buf, 40, (int64)st.st_ino);
+	memcpy(buf + 48, state, MD5_DIGEST_LEN);
+	get_md5((uchar *)buf + 64, (uchar *)buf, 64);
+
+	if ((fd = do_open(ckpt, O_WRONLY|O_CREAT|O_TRUNC, 0600)) < 0)
+		return 0;
+	ok = write(fd, buf, sizeof buf) == sizeof buf;
+	if (close(fd) < 0)
+		ok = 0;
+
+	return ok;
+}
+
+/* Return the length of the prefix of the partial file fname (whose stat is
+ * in stp) that its checkpoint says was received for this version of file,
+ * and put the MD5 state after that prefix into state.  The checkpoint only
+ * applies if fname is still the very file the data was written to.  A
+ * checkpoint that doesn't apply is removed, and 0 is returned. */
+OFF_T read_checkpoint(const char *fname, struct file_struct *file,
+		      STRUCT_STAT *stp, char *state)
+{
+	char buf[CHECKPOINT_LEN], sum[MD5_DIGEST_LEN], *ckpt;
+	OFF_T len;
+	int fd, n;
+
+	if (!(ckpt = checkpoint_fname(fname))
+	 || (fd = do_open(ckpt, O_RDONLY, 0)) < 0)
+		return 0;
+	n = read(fd, buf, sizeof buf);
+	close(fd);
+
+	if (n == sizeof buf && IVAL(buf, 0) == CHECKPOINT_MAGIC) {
+		get_md5((uchar *)sum, (uchar *)buf, 64);
+		len = IVAL64(buf, 24);
+		if (memcmp(sum, buf + 64, MD5_DIGEST_LEN) == 0
+		 && IVAL64(buf, 8) == F_LENGTH(file)
+		 && IVAL64(buf, 16) == (int64)file->modtime
+		 && IVAL64(buf, 32) == (int64)stp->st_dev
+		 && IVAL64(buf, 40) == (int64)stp->st_ino
+		 && S_ISREG(stp->st_mode)
+		 && len > 0 && len <= stp->st_size && len % CSUM_CHUNK == 0) {
+			memcpy(state, buf + 48, MD5_DIGEST_LEN);
+			return len;
+		}
+	}
+
+	do_unlink(ckpt);
+	return 0;
+}
+
+void remove_checkpoint(const char *fname)
+{
+	char *ckpt;
+
+	if ((ckpt = checkpoint_fname(fname)) != NULL)
+		do_unlink(ckpt);
+}
+
+/* If partial is set, the MD5 state of the data received so far is written to
+ * a checkpoint next to that partial-file name every CHECKPOINT_SIZE bytes, so
+ * that an interrupted transfer can be resumed from there (see read_checkpoint).
+ * The caller has already read the sum head into sum. */
+static int receive_data(int f_in, struct sum_struct *sum, char *fname_r,
+			int fd_r, OFF_T size_r, const char *fname, int fd,
+			OFF_T total_size, struct file_struct *file,
+			const char *partial)
 {
 	static char file_sum1[MAX_DIGEST_LEN];
+	static OFF_T *cdc_offsets;
+	static int32 cdc_alloced;
 	struct map_struct *mapbuf;
-	struct sum_struct sum;
 	int32 len;
 	OFF_T offset = 0;
+	OFF_T next_checkpoint = 0;
+	int checkpoints = 0;
 	OFF_T offset2;
 	char *data;
 	int32 i;
@@ -265,11 +382,30 @@ static int receive_data(int f_in, char *fname_r, int fd_r, OFF_T size_r,
 	}
 #endif
 
-	read_sum_head(f_in, &sum);
+	if (cdc_blocks && sum->count > 0) {
+		/* The sender follows the header with the length of each of
+		 * the generator's content-defined chunks (see --cdc). */
+		if (sum->count >= cdc_alloced) {
+			cdc_alloced = sum->count + 1;
+			cdc_offsets = realloc_array(cdc_offsets, OFF_T, cdc_alloced);
+			if (!cdc_offsets)
+				out_of_memory("receive_data");
+		}
+		cdc_offsets[0] = 0;
+		for (i = 0; i < sum->count; i++) {
+			len = read_int(f_in);
+			if (len <= 0 || len > CDC_MAX_LEN(sum->blength)) {
+				rprintf(FERROR, "Invalid chunk length %ld [%s]\n",
+					(long)len, who_am_i());
+				exit_cleanup(RERR_PROTOCOL);
+			}
+			cdc_offsets[i+1] = cdc_offsets[i] + len;
+		}
+	}
 
-	if (fd_r >= 0 && size_r > 0) {
-		int32 read_size = MAX(sum.blength * 2, 16*1024);
-		mapbuf = map_file(fd_r, size_r, read_size, sum.blength);
+	if (fd_r >= 0 && size_r > 0 && !sum->prefix_len) {
+		int32 read_size = MAX(sum->blength * 2, 16*1024);
+		mapbuf = map_file(fd_r, size_r, read_size, sum->blength);
 		if (DEBUG_GTE(DELTASUM, 2)) {
 			rprintf(FINFO, "recv mapped %s of size %s\n",
 				fname_r, big_num(size_r));
@@ -277,29 +413,43 @@ static int receive_data(int f_in, char *fname_r, int fd_r, OFF_T size_r,
 	} else
 		mapbuf = NULL;
 
-	sum_init(checksum_seed);
+	if (sum->prefix_len) {
+		/* Resuming a checkpointed partial file: its verified prefix
+		 * stays put and the sender's data follows it. */
+		sum_resume(sum->prefix_len, sum->prefix_sum);
+		offset = sum->prefix_len;
+		if (fd != -1 && (offset2 = do_lseek(fd, offset, SEEK_SET)) != offset) {
+			rsyserr(FERROR_XFER, errno, "lseek of %s returned %s, not %s",
+				full_fname(fname), big_num(offset2), big_num(offset));
+			exit_cleanup(RERR_FILEIO);
+		}
+	} else
+		sum_init(checksum_seed);
+
+	if (partial && fd != -1)
+		next_checkpoint = offset + CHECKPOINT_SIZE;
 
 	if (append_mode > 0) {
 		OFF_T j;
-		sum.flength = (OFF_T)sum.count * sum.blength;
-		if (sum.remainder)
-			sum.flength -= sum.blength - sum.remainder;
+		sum->flength = (OFF_T)sum->count * sum->blength;
+		if (sum->remainder)
+			sum->flength -= sum->blength - sum->remainder;
 		if (append_mode == 2 && mapbuf) {
-			for (j = CHUNK_SIZE; j < sum.flength; j += CHUNK_SIZE) {
+			for (j = CHUNK_SIZE; j < sum->flength; j += CHUNK_SIZE) {
 				if (INFO_GTE(PROGRESS, 1))
 					show_progress(offset, total_size);
 				sum_update(map_ptr(mapbuf, offset, CHUNK_SIZE),
 					   CHUNK_SIZE);
 				offset = j;
 			}
-			if (offset < sum.flength) {
-				int32 len = (int32)(sum.flength - offset);
+			if (offset < sum->flength) {
+				int32 len = (int32)(sum->flength - offset);
 				if (INFO_GTE(PROGRESS, 1))
 					show_progress(offset, total_size);
 				sum_update(map_ptr(mapbuf, offset, len), len);
 			}
 		}
-		offset = sum.flength;
+		offset = sum->flength;
 		if (fd != -1 && (j = do_lseek(fd, offset, SEEK_SET)) != offset) {
 			rsyserr(FERROR_XFER, errno, "lseek of %s returned %s, not %s",
 				full_fname(fname), big_num(j), big_num(offset));
@@ -311,9 +461,41 @@ static int receive_data(int f_in, char *fname_r, int fd_r, OFF_T size_r,
 		if (INFO_GTE(PROGRESS, 1))
 			show_progress(offset, total_size);
 
+		if (next_checkpoint && offset >= next_checkpoint) {
+			char state[MD5_DIGEST_LEN];
+			OFF_T len0;
+			/* The data must be on disk before the checkpoint
+			 * vouches for it. */
+			if (flush_write_file(fd) < 0 || fsync(fd) < 0)
+				goto report_write_error;
+			len0 = sum_get_state(state);
+			if (!checkpoints && partial_dir
+			 && !handle_partial_dir(partial, PDIR_CREATE))
+				next_checkpoint = 0;
+			else {
+				if (write_checkpoint(partial, file, fd, len0, state))
+					checkpoints++;
+				next_checkpoint = offset + CHECKPOINT_SIZE;
+			}
+		}
+
 		if (allowed_lull)
 			maybe_send_keepalive(time(NULL), MSK_ALLOW_FLUSH | MSK_ACTIVE_RECEIVER);
 
+		if (i > 0 && !data) {
+			if (DEBUG_GTE(DELTASUM, 3)) {
+				rprintf(FINFO,"hole recv %d at %s\n",
+					i, big_num(offset));
+			}
+
+			sum_update_hole(i);
+
+			if (fd != -1 && write_hole(fd, i) != i)
+				goto report_write_error;
+			offset += i;
+			continue;
+		}
+
 		if (i > 0) {
 			if (DEBUG_GTE(DELTASUM, 3)) {
 				rprintf(FINFO,"data recv %d at %s\n",
@@ -332,10 +514,20 @@ static int receive_data(int f_in, char *fname_r, int fd_r, OFF_T size_r,
 		}
 
 		i = -(i+1);
-		offset2 = i * (OFF_T)sum.blength;
-		len = sum.blength;
-		if (i == (int)sum.count-1 && sum.remainder != 0)
-			len = sum.remainder;
+		if (cdc_blocks) {
+			if (i >= sum->count) {
+				rprintf(FERROR, "Invalid chunk token %ld [%s]\n",
+					(long)i, who_am_i());
+				exit_cleanup(RERR_PROTOCOL);
+			}
+			offset2 = cdc_offsets[i];
+			len = (int32)(cdc_offsets[i+1] - offset2);
+		} else {
+			offset2 = i * (OFF_T)sum->blength;
+			len = sum->blength;
+			if (i == (int)sum->count-1 && sum->remainder != 0)
+				len = sum->remainder;
+		}
 
 		stats.matched_data += len;
 
@@ -381,7 +573,7 @@ static int receive_data(int f_in, char *fname_r, int fd_r, OFF_T size_r,
 	/* inplace: New data could be shorter than old data.
 	 * preallocate_files: total_size could have been an overestimate.
 	 *     Cut off any extra preallocated zeros from dest file. */
-	if ((inplace
+	if ((inplace || sum->prefix_len
 #ifdef PREALLOCATE_NEEDS_TRUNCATE
 	  || preallocated_len > offset
 #endif
@@ -407,6 +599,16 @@ static int receive_data(int f_in, char *fname_r, int fd_r, OFF_T size_r,
 	if (mapbuf)
 		unmap_file(mapbuf);
 
+	if (partial && (checkpoints || sum->prefix_len)) {
+		remove_checkpoint(partial);
+		if (checkpoints && partial_dir)
+			handle_partial_dir(partial, PDIR_DELETE);
+	}
+	/* A checkpoint left next to the file by an earlier run is stale now,
+	 * whether or not this run checkpoints. */
+	if (fd != -1 && fname && fname != partial)
+		remove_checkpoint(fname);
+
 	read_buf(f_in, sender_file_sum, checksum_len);
 	if (DEBUG_GTE(DELTASUM, 2))
 		rprintf(FINFO,"got file_sum\n");
@@ -416,9 +618,16 @@ static int receive_data(int f_in, char *fname_r, int fd_r, OFF_T size_r,
 }
 
 
-static void discard_receive_data(int f_in, OFF_T length)
+/* Pass a NULL sum if the sum head hasn't been read yet. */
+static void discard_receive_data(int f_in, struct sum_struct *sum, OFF_T length)
 {
-	receive_data(f_in, NULL, -1, 0, NULL, -1, length);
+	struct sum_struct head;
+
+	if (!sum) {
+		read_sum_head(f_in, &head);
+		sum = &head;
+	}
+	receive_data(f_in, sum, NULL, -1, 0, NULL, -1, length, NULL, NULL);
 }
 
 static void handle_delayed_updates(char *local_name)
@@ -518,6 +727,219 @@ static int gen_wants_ndx(int desired_ndx, int flist_num)
 	return 0;
 }
 
+#ifdef HAVE_PTHREADS
+/* With --recv-threads, the close() of a received temp-file (which is where
+ * a network filesystem flushes the data back to the server) is handed off
+ * to a worker thread while we go on reading the next file from the sender.
+ * Putting the file into place, setting its attributes, and telling the
+ * generator about it is still done by this thread, in the same order that
+ * the files were received. */
+#define RECV_PENDING_PER_THREAD 4
+
+struct recv_pending {
+	struct file_struct *file;
+	int ndx, fd1, fd2;
+	int closed, close_errno;
+	char *fnamecmp, *partialptr; /* point into this struct or are NULL */
+	char fname[MAXPATHLEN];
+	char fnametmp[MAXPATHLEN];
+	char cmpbuf[MAXPATHLEN];
+	char partialbuf[MAXPATHLEN];
+};
+
+static struct recv_pending *rp_queue;
+static pthread_t *rp_threads;
+static int rp_size, rp_stopping;
+static int rp_head, rp_next, rp_tail; /* ever-increasing; mod rp_size */
+static pthread_mutex_t rp_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t rp_work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t rp_done_cond = PTHREAD_COND_INITIALIZER;
+
+static void *recv_close_worker(UNUSED(void *arg))
+{
+	struct recv_pending *rp;
+
+	pthread_mutex_lock(&rp_lock);
+	while (1) {
+		while (rp_next == rp_tail && !rp_stopping)
+			pthread_cond_wait(&rp_work_cond, &rp_lock);
+		if (rp_next == rp_tail)
+			break;
+		rp = &rp_queue[rp_next++ % rp_size];
+		pthread_mutex_unlock(&rp_lock);
+
+		if (rp->fd1 != -1)
+			close(rp->fd1);
+		rp->close_errno = close(rp->fd2) < 0 ? errno : 0;
+
+		pthread_mutex_lock(&rp_lock);
+		rp->closed = 1;
+		pthread_cond_broadcast(&rp_done_cond);
+	}
+	pthread_mutex_unlock(&rp_lock);
+
+	return NULL;
+}
+
+static void start_recv_threads(void)
+{
+	sigset_t sigmask, oldmask;
+	int i, err;
+
+	rp_size = recv_threads * RECV_PENDING_PER_THREAD;
+	if (!(rp_queue = new_array(struct recv_pending, rp_size))
+	 || !(rp_threads = new_array(pthread_t, recv_threads)))
+		out_of_memory("start_recv_threads");
+
+	/* Our signal handlers must only ever run in the main thread. */
+	sigfillset(&sigmask);
+	pthread_sigmask(SIG_BLOCK, &sigmask, &oldmask);
+	for (i = 0; i < recv_threads; i++) {
+		if ((err = pthread_create(&rp_threads[i], NULL, recv_close_worker, NULL)) != 0) {
+			rsyserr(FWARNING, err, "unable to start receiver thread %d", i + 1);
+			break;
+		}
+	}
+	pthread_sigmask(SIG_SETMASK, &oldmask, NULL);
+
+	if ((recv_threads = i) == 0) {
+		free(rp_queue);
+		free(rp_threads);
+		rp_queue = NULL;
+		rp_size = 0;
+	}
+}
+
+static void stop_recv_threads(void)
+{
+	int i;
+
+	pthread_mutex_lock(&rp_lock);
+	rp_stopping = 1;
+	pthread_cond_broadcast(&rp_work_cond);
+	pthread_mutex_unlock(&rp_lock);
+
+	for (i = 0; i < recv_threads; i++)
+		pthread_join(rp_threads[i], NULL);
+}
+
+/* Hand the closing of a successfully received file to a worker thread.
+ * The rest of finishing it off happens in finish_recv_pending(). */
+static void queue_recv_pending(struct file_struct *file, int ndx, int fd1, int fd2,
+			       const char *fname, const char *fnametmp,
+			       const char *fnamecmp, const char *partialptr)
+{
+	struct recv_pending *rp;
+
+	/* The temp-file is now ours to remove (see cleanup_recv_pending()). */
+	cleanup_disable();
+
+	if (rp_tail - rp_head == rp_size)
+		finish_recv_pending(rp_size - 1);
+
+	rp = &rp_queue[rp_tail % rp_size];
+	rp->file = file;
+	rp->ndx = ndx;
+	rp->fd1 = fd1;
+	rp->fd2 = fd2;
+	rp->closed = 0;
+	strlcpy(rp->fname, fname, MAXPATHLEN);
+	strlcpy(rp->fnametmp, fnametmp, MAXPATHLEN);
+	if (partialptr && partialptr != fname) {
+		strlcpy(rp->partialbuf, partialptr, MAXPATHLEN);
+		rp->partialptr = rp->partialbuf;
+	} else
+		rp->partialptr = NULL;
+	/* finish_transfer() cares if fnamecmp is the same pointer as fname. */
+	if (fnamecmp == fname)
+		rp->fnamecmp = rp->fname;
+	else if (rp->partialptr && fnamecmp == partialptr)
+		rp->fnamecmp = rp->partialptr;
+	else {
+		strlcpy(rp->cmpbuf, fnamecmp, MAXPATHLEN);
+		rp->fnamecmp = rp->cmpbuf;
+	}
+
+	pthread_mutex_lock(&rp_lock);
+	rp_tail++;
+	pthread_cond_signal(&rp_work_cond);
+	pthread_mutex_unlock(&rp_lock);
+
+	recv_files_pending = rp_tail - rp_head;
+}
+#endif
+
+/* Finish off the files queued by queue_recv_pending() in the order they
+ * were received, waiting for their close() until no more than "keep" of
+ * them are still pending.  This is also called by perform_io() before it
+ * waits for more input, since the generator may be waiting to hear about
+ * one of these files before it lets the sender continue. */
+void finish_recv_pending(int keep)
+{
+#ifdef HAVE_PTHREADS
+	static int finishing = 0;
+	struct recv_pending *rp;
+	int recv_ok;
+
+	if (finishing)
+		return;
+	finishing = 1;
+
+	while (rp_head != rp_tail) {
+		rp = &rp_queue[rp_head % rp_size];
+
+		pthread_mutex_lock(&rp_lock);
+		if (!rp->closed && rp_tail - rp_head <= keep) {
+			pthread_mutex_unlock(&rp_lock);
+			break;
+		}
+		while (!rp->closed)
+			pthread_cond_wait(&rp_done_cond, &rp_lock);
+		pthread_mutex_unlock(&rp_lock);
+
+		if (rp->close_errno) {
+			rsyserr(FERROR, rp->close_errno, "close failed on %s",
+				full_fname(rp->fnametmp));
+			exit_cleanup(RERR_FILEIO);
+		}
+
+		if (!finish_transfer(rp->fname, rp->fnametmp, rp->fnamecmp,
+				     rp->partialptr, rp->file, 1, 1))
+			recv_ok = -1;
+		else {
+			recv_ok = 1;
+			if (rp->partialptr && rp->fnamecmp == rp->partialptr) {
+				do_unlink(rp->partialptr);
+				handle_partial_dir(rp->partialptr, PDIR_DELETE);
+			}
+		}
+		recv_files_pending = rp_tail - ++rp_head;
+
+		if (read_batch)
+			rp->file->flags |= FLAG_FILE_SENT;
+
+		if (recv_ok == 1) {
+			if (remove_source_files || inc_recurse
+			 || (preserve_hard_links && F_IS_HLINKED(rp->file)))
+				send_msg_int(MSG_SUCCESS, rp->ndx);
+		} else if (inc_recurse)
+			send_msg_int(MSG_NO_SEND, rp->ndx);
+	}
+
+	finishing = 0;
+#endif
+}
+
+/* Called by exit_cleanup(): remove the temp-files that never got finished. */
+void cleanup_recv_pending(void)
+{
+#ifdef HAVE_PTHREADS
+	while (rp_head != rp_tail)
+		do_unlink(rp_queue[rp_head++ % rp_size].fnametmp);
+	recv_files_pending = 0;
+#endif
+}
+
 /**
  * main routine for receiver process.
  *
@@ -534,6 +956,7 @@ int recv_files(int f_in, int f_out, char *local_name)
 	char fnamecmpbuf[MAXPATHLEN];
 	uchar fnamecmp_type;
 	struct file_struct *file;
+	struct sum_struct sum;
 	int itemizing = am_server ? logfile_format_has_i : stdout_format_has_i;
 	enum logcode log_code = log_before_transfer ? FLOG : FINFO;
 	int max_phase = protocol_version >= 29 ? 2 : 1;
@@ -549,6 +972,11 @@ int recv_files(int f_in, int f_out, char *local_name)
 	if (delay_updates)
 		delayed_bits = bitbag_create(cur_flist->used + 1);
 
+#ifdef HAVE_PTHREADS
+	if (recv_threads && !inplace)
+		start_recv_threads();
+#endif
+
 	while (1) {
 		cleanup_disable();
 
@@ -557,6 +985,7 @@ int recv_files(int f_in, int f_out, char *local_name)
 					 xname, &xlen);
 #ifdef HAVE_DUET
 		if (ndx == NDX_O3_DONE) {
+			finish_recv_pending(0);
 			if (!am_server && INFO_GTE(PROGRESS, 2))
 				end_progress(0);
 			if (first_o3_flist)
@@ -566,6 +995,7 @@ int recv_files(int f_in, int f_out, char *local_name)
 		}
 #endif /* HAVE_DUET */
 		if (ndx == NDX_DONE) {
+			finish_recv_pending(0);
 			if (!am_server && INFO_GTE(PROGRESS, 2) && cur_flist) {
 				set_current_file_index(NULL, 0);
 				end_progress(0);
@@ -714,7 +1144,7 @@ process_file:
 					"(Skipping batched update for%s \"%s\")\n",
 					redoing ? " resend of" : "",
 					fname);
-				discard_receive_data(f_in, F_LENGTH(file));
+				discard_receive_data(f_in, NULL, F_LENGTH(file));
 				file->flags |= FLAG_FILE_SENT;
 				continue;
 			}
@@ -726,13 +1156,13 @@ process_file:
 		if (!do_xfers) { /* log the transfer */
 			log_item(FCLIENT, file, iflags, NULL);
 			if (read_batch)
-				discard_receive_data(f_in, F_LENGTH(file));
+				discard_receive_data(f_in, NULL, F_LENGTH(file));
 			continue;
 		}
 		if (write_batch < 0) {
 			log_item(FCLIENT, file, iflags, NULL);
 			if (!am_server)
-				discard_receive_data(f_in, F_LENGTH(file));
+				discard_receive_data(f_in, NULL, F_LENGTH(file));
 			if (inc_recurse)
 				send_msg_int(MSG_SUCCESS, ndx);
 			continue;
@@ -822,7 +1252,7 @@ process_file:
 		} else if (do_fstat(fd1,&st) != 0) {
 			rsyserr(FERROR_XFER, errno, "fstat %s failed",
 				full_fname(fnamecmp));
-			discard_receive_data(f_in, F_LENGTH(file));
+			discard_receive_data(f_in, NULL, F_LENGTH(file));
 			close(fd1);
 			if (inc_recurse)
 				send_msg_int(MSG_NO_SEND, ndx);
@@ -837,7 +1267,7 @@ process_file:
 			 */
 			rprintf(FERROR_XFER, "recv_files: %s is a directory\n",
 				full_fname(fnamecmp));
-			discard_receive_data(f_in, F_LENGTH(file));
+			discard_receive_data(f_in, NULL, F_LENGTH(file));
 			close(fd1);
 			if (inc_recurse)
 				send_msg_int(MSG_NO_SEND, ndx);
@@ -865,6 +1295,8 @@ process_file:
 					       dflt_perms, exists);
 		}
 
+		read_sum_head(f_in, &sum);
+
 		/* We now check to see if we are writing the file "inplace" */
 		if (inplace)  {
 			fd2 = do_open(fname, O_WRONLY|O_CREAT, 0600);
@@ -873,6 +1305,19 @@ process_file:
 					full_fname(fname));
 			} else if (updating_basis_or_equiv)
 				cleanup_set(NULL, NULL, file, fd1, fd2);
+		} else if (sum.prefix_len) {
+			/* The generator is resuming the partial file from its
+			 * checkpoint, so the rest of the data is written into
+			 * the partial file itself rather than a temp-file. */
+			if (fd1 == -1)
+				fd2 = -1;
+			else if ((fd2 = do_open(fnamecmp, O_WRONLY, 0)) == -1) {
+				rsyserr(FERROR_XFER, errno, "open %s failed",
+					full_fname(fnamecmp));
+			} else {
+				strlcpy(fnametmp, fnamecmp, sizeof fnametmp);
+				cleanup_set(fnametmp, partialptr, file, fd1, fd2);
+			}
 		} else {
 			fd2 = open_tmpfile(fnametmp, fname, file);
 			if (fd2 != -1)
@@ -880,7 +1325,7 @@ process_file:
 		}
 
 		if (fd2 == -1) {
-			discard_receive_data(f_in, F_LENGTH(file));
+			discard_receive_data(f_in, &sum, F_LENGTH(file));
 			if (fd1 != -1)
 				close(fd1);
 			if (inc_recurse)
@@ -895,11 +1340,25 @@ process_file:
 			rprintf(FINFO, "%s\n", fname);
 
 		/* recv file data */
-		recv_ok = receive_data(f_in, fnamecmp, fd1, st.st_size,
-				       fname, fd2, F_LENGTH(file));
+		recv_ok = receive_data(f_in, &sum, fnamecmp, fd1, st.st_size,
+				       fname, fd2, F_LENGTH(file), file,
+				       resume_partials && !inplace ? partialptr : NULL);
 
 		log_item(log_code, file, iflags, NULL);
 
+#ifdef HAVE_PTHREADS
+		/* A resumed file is its own partial file, so it mustn't be
+		 * left for cleanup_recv_pending() to unlink. */
+		if (rp_size && recv_ok == 1 && (!delay_updates || !partialptr)
+		 && !sum.prefix_len) {
+			queue_recv_pending(file, ndx, fd1, fd2, fname, fnametmp,
+					   fnamecmp, partialptr);
+			continue;
+		}
+#endif
+		/* Don't let this file overtake the ones still pending. */
+		finish_recv_pending(0);
+
 		if (fd1 != -1)
 			close(fd1);
 		if (close(fd2) < 0) {
@@ -988,6 +1447,12 @@ process_file:
 			break;
 		}
 	}
+	finish_recv_pending(0);
+#ifdef HAVE_PTHREADS
+	if (rp_size)
+		stop_recv_threads();
+#endif
+
 	if (make_backups < 0)
 		make_backups = -make_backups;
 
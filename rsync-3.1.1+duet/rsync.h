@@ -23,6 +23,9 @@
 #include <duet/duet.h>
 #include <duet/itree.h>
 #endif /* HAVE_DUET */
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
 
 #define False 0
 #define True 1
@@ -151,8 +154,24 @@
 #define CHUNK_SIZE (32*1024)
 #define MAX_MAP_SIZE (256*1024)
 #define IO_BUFFER_SIZE (32*1024)
+#define IO_DIRECT_WRITE_MIN (16*1024) /* write_buf() this much without copying */
 #define MAX_BLOCK_SIZE ((int32)1 << 17)
 
+/* The bounds of a content-defined chunk for an average length (--cdc). */
+#define CDC_MIN_LEN(blen) ((blen) / 4)
+#define CDC_MAX_LEN(blen) ((blen) * 4)
+
+/* With --sparse, the sender skips over holes that are at least this long
+ * and sends them as a TOKEN_HOLE of up to MAX_HOLE_TOKEN bytes each. */
+#define MIN_SPARSE_HOLE (64*1024)
+#define MAX_HOLE_TOKEN ((int32)1 << 30)
+#define TOKEN_HOLE ((int32)0x80000000)
+
+/* With --partial, the receiver records how much of a file it has received
+ * every CHECKPOINT_SIZE bytes, so that an interrupted transfer of the file
+ * can resume from there (see write_checkpoint()). */
+#define CHECKPOINT_SIZE ((OFF_T)64 * 1024 * 1024)
+
 /* For compatibility with older rsyncs */
 #define OLD_MAX_BLOCK_SIZE ((int32)1 << 29)
 
@@ -165,6 +184,7 @@
 #define MAX_ARGS 1000
 #define MAX_BASIS_DIRS 20
 #define MAX_SERVER_ARGS (MAX_BASIS_DIRS*2 + 100)
+#define MAX_RECV_THREADS 64
 
 #define MPLEX_BASE 7
 
@@ -418,6 +438,10 @@ enum delret {
 #include <sys/select.h>
 #endif
 
+#ifdef HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#endif
+
 #ifdef HAVE_SYS_MODE_H
 /* apparently AIX needs this for S_ISLNK */
 #ifndef S_ISLNK
@@ -636,6 +660,9 @@ struct hashtable {
 	int32 size, entries;
 	uint32 node_size;
 	short key64;
+	short shift;		/* 32 - log2(size) */
+	void *old_nodes;	/* the pre-growth array, until it is emptied */
+	int32 old_size, old_moved;
 };
 
 struct ht_int32_node {
@@ -870,6 +897,8 @@ struct sum_struct {
 	int32 blength;		/**< block_length */
 	int32 remainder;	/**< flength % block_length */
 	int s2length;		/**< sum2_length */
+	OFF_T prefix_len;	/**< length of a resumed prefix to skip */
+	char prefix_sum[SUM_LENGTH]; /**< file-checksum state after it */
 };
 
 struct map_struct {
@@ -915,6 +944,7 @@ typedef struct filter_struct {
 		int slash_cnt;
 		struct filter_list_struct *mergelist;
 	} u;
+	struct filter_index *compiled; /* set on the first rule of an indexed run */
 } filter_rule;
 
 typedef struct filter_list_struct {
@@ -32,6 +32,7 @@ extern int logfile_format_has_i;
 extern int want_xattr_optim;
 extern int csum_length;
 extern int append_mode;
+extern int cdc_blocks;
 extern int io_error;
 extern int flist_eof;
 extern int allowed_lull;
@@ -97,17 +98,37 @@ static struct sum_struct *receive_sums(int f)
 	if (!(s->sums = new_array(struct sum_buf, s->count)))
 		out_of_memory("receive_sums");
 
+	if (cdc_blocks && (s->blength < 4 || s->blength & (s->blength - 1)
+			|| s->s2length < 4)) {
+		rprintf(FERROR, "Invalid content-defined block length %ld [%s]\n",
+			(long)s->blength, who_am_i());
+		exit_cleanup(RERR_PROTOCOL);
+	}
+
 	for (i = 0; i < s->count; i++) {
-		s->sums[i].sum1 = read_int(f);
-		read_buf(f, s->sums[i].sum2, s->s2length);
+		if (cdc_blocks) {
+			/* Each chunk has its own length and no rolling
+			 * checksum, so we hash on the strong sum instead. */
+			s->sums[i].len = read_int(f);
+			if (s->sums[i].len <= 0 || s->sums[i].len > CDC_MAX_LEN(s->blength)) {
+				rprintf(FERROR, "Invalid chunk length %ld [%s]\n",
+					(long)s->sums[i].len, who_am_i());
+				exit_cleanup(RERR_PROTOCOL);
+			}
+			read_buf(f, s->sums[i].sum2, s->s2length);
+			s->sums[i].sum1 = IVAL(s->sums[i].sum2, 0);
+		} else {
+			s->sums[i].sum1 = read_int(f);
+			read_buf(f, s->sums[i].sum2, s->s2length);
+
+			if (i == s->count-1 && s->remainder != 0)
+				s->sums[i].len = s->remainder;
+			else
+				s->sums[i].len = s->blength;
+		}
 
 		s->sums[i].offset = offset;
 		s->sums[i].flags = 0;
-
-		if (i == s->count-1 && s->remainder != 0)
-			s->sums[i].len = s->remainder;
-		else
-			s->sums[i].len = s->blength;
 		offset += s->sums[i].len;
 
 		if (lull_mod && !(i % lull_mod))
@@ -523,6 +544,12 @@ process_file:
 		write_ndx_and_attrs(f_out, ndx, iflags, fname, file,
 				    fnamecmp_type, xname, xlen);
 		write_sum_head(f_xfer, s);
+		if (cdc_blocks) {
+			/* The receiver needs the chunk lengths to find where
+			 * each matched chunk is in its basis file. */
+			for (j = 0; j < s->count; j++)
+				write_int(f_xfer, s->sums[j].len);
+		}
 
 		if (DEBUG_GTE(DELTASUM, 2))
 			rprintf(FINFO, "calling match_sums %s%s%s\n", path,slash,fname);
@@ -571,8 +598,12 @@ process_file:
 	match_report();
 
 	write_ndx(f_out, NDX_DONE);
-	rprintf(FINFO, "Total time spent updating inode tree: %s seconds.\n",
-			comma_dnum((double)total_update_time / 1000, 3));
-	rprintf(FINFO, "Total time spent fetching o3 inodes: %s seconds.\n",
-			comma_dnum((double)total_fetch_time / 1000, 3));
+#ifdef HAVE_DUET
+	if (INFO_GTE(STATS, 2)) {
+		rprintf(FINFO, "Total time spent updating inode tree: %s seconds.\n",
+				comma_dnum((double)total_update_time / 1000, 3));
+		rprintf(FINFO, "Total time spent fetching o3 inodes: %s seconds.\n",
+				comma_dnum((double)total_fetch_time / 1000, 3));
+	}
+#endif /* HAVE_DUET */
 }
@@ -0,0 +1,64 @@
+#!/bin/bash
+# Compares the delta transfer with fixed blocks against --cdc.  It makes a
+# random basis file of MB megabytes and a new version of it with EDITS
+# random insertions and deletions of 1-299 bytes.  Then it updates a copy
+# of the basis with each set of options.  For each set it reports the
+# literal data, the bytes sent both ways, and the best user+sys time of RUNS
+# runs (default 3).  The sets default to "", --cdc, "-B 4096" and
+# "--cdc -B 4096", and can be replaced by passing them as arguments.
+#
+# usage: cdc-bench.sh DIR MB EDITS RSYNC [OPTIONS...]
+
+[ $# -lt 4 ] && { echo "usage: $0 DIR MB EDITS RSYNC [OPTIONS...]"; exit 1; }
+dir="$1" mb="$2" edits="$3" rsync="$4"
+shift 4
+[ $# = 0 ] && set -- "" "--cdc" "-B 4096" "--cdc -B 4096"
+runs=${RUNS:-3}
+
+mkdir -p "$dir" || exit 1
+cd "$dir" || exit 1
+
+if [ ! -f .done-$mb-$edits ]; then
+    rm -f basis new .done-*
+    echo "making a ${mb}MB basis file with $edits edits..."
+    head -c $((mb * 1024 * 1024)) /dev/urandom > basis || exit 1
+    # Apply the edits back to front so each offset is into the basis
+    perl -e '
+	my ($edits) = @ARGV;
+	local $/;
+	my $data = <STDIN>;
+	srand(1);
+	my @offs = sort { $b <=> $a } map { int(rand(length $data)) } 1 .. $edits;
+	foreach my $off (@offs) {
+	    my $len = 1 + int(rand(299));
+	    if (rand() < 0.5) {
+		substr($data, $off, $len) = "";
+	    } else {
+		substr($data, $off, 0) = join("", map { chr(int(rand(256))) } 1 .. $len);
+	    }
+	}
+	print $data;
+    ' $edits < basis > new || exit 1
+    touch .done-$mb-$edits
+fi
+
+TIMEFORMAT='%U %S'
+for opts in "$@"; do
+    best=
+    for i in $(seq 1 $runs); do
+	rm -rf dst
+	mkdir dst && cp -p basis dst/new || exit 1
+	t=$( { time "$rsync" -a --no-whole-file --stats $opts new dst/ \
+	    > stats.out; } 2>&1 ) || exit 1
+	cpu=$(echo $t | awk '{ print $1 + $2 }')
+	if [ -z "$best" ] || awk "BEGIN { exit !($cpu < $best) }"; then
+	    best=$cpu
+	fi
+    done
+    cmp -s new dst/new || { echo "$opts: dst/new differs from new"; exit 1; }
+    literal=$(sed -n 's/^Literal data: \([0-9,]*\).*/\1/p' stats.out)
+    sent=$(sed -n 's/^Total bytes sent: \([0-9,]*\).*/\1/p' stats.out)
+    recvd=$(sed -n 's/^Total bytes received: \([0-9,]*\).*/\1/p' stats.out)
+    printf '%-16s %12s literal %12s sent %10s received %6.2fs cpu\n' \
+	"${opts:-fixed}" $literal $sent $recvd $best
+done
@@ -0,0 +1,57 @@
+#!/bin/bash
+# Times the generator's per-file stat work on a deep tree, for one or more
+# rsync binaries.  The tree has FILES empty files spread over leaf dirs that
+# are DEPTH levels down.  Every run copies it into an empty destination with
+# two --compare-dest dirs, the second of which already has every file, so
+# each file is looked up three times (destination, alt1, alt2) and nothing
+# but the dirs gets transferred.  Extra rsync options (e.g. -n, to leave out
+# the cost of making the destination dirs) can be given in RSYNC_OPTS.
+#
+# usage: deep-tree-bench.sh DIR FILES DEPTH RSYNC [RSYNC...]
+
+[ $# -lt 4 ] && { echo "usage: $0 DIR FILES DEPTH RSYNC [RSYNC...]"; exit 1; }
+dir="$1" files="$2" depth="$3"
+shift 3
+runs=${RUNS:-3}
+per_leaf=100
+
+mkdir -p "$dir" || exit 1
+cd "$dir" || exit 1
+
+if [ ! -f src/.done-$files-$depth ]; then
+    rm -rf src alt1 alt2
+    echo "building $files files, $depth levels deep..."
+    # Leaf dir i is d<digits of i in base 4>, one level per digit
+    awk -v leaves=$(( (files + per_leaf - 1) / per_leaf )) -v depth=$depth \
+	-v per=$per_leaf -v files=$files 'BEGIN {
+	for (i = 0; i < leaves; i++) {
+	    p = "src"; n = i
+	    for (d = 0; d < depth; d++) { p = p "/d" (n % 4); n = int(n / 4) }
+	    p = p "/l" i
+	    print "mkdir -p " p
+	    for (f = 0; f < per && i * per + f < files; f++)
+		print ": > " p "/f" f
+	}
+    }' | sh || exit 1
+    mkdir alt1
+    cp -a src alt2 || exit 1
+    touch src/.done-$files-$depth
+fi
+
+TIMEFORMAT='%R %U %S'
+for rsync in "$@"; do
+    best=
+    for i in $(seq 0 $runs); do
+	rm -rf dst
+	t=$( { time "$rsync" -a $RSYNC_OPTS --compare-dest="$dir/alt1" \
+	    --compare-dest="$dir/alt2" src/ dst/ > /dev/null; } 2>&1 ) || exit 1
+	# The first run only warms up the caches
+	[ $i = 0 ] && continue
+	set -- $t
+	if [ -z "$best" ] || awk "BEGIN { exit !($1 < ${best%% *}) }"; then
+	    best="$t"
+	fi
+    done
+    set -- $best
+    echo "$rsync: best of $runs: ${1}s real, ${2}s user, ${3}s sys"
+done
@@ -0,0 +1,83 @@
+#!/bin/bash
+# Measures the throughput of whole-file transfers over a loopback TCP
+# connection to an rsync daemon, for one or more rsync binaries.  Each
+# binary serves a module of its own (as a daemon on 127.0.0.1:PORT, default
+# 8873) and pushes and pulls FILES random files of MB megabytes each.  The
+# best of RUNS runs (default 3) is reported, as MB/s of file data and the
+# client's user+sys time.
+#
+# usage: loopback-bench.sh DIR MB RSYNC [RSYNC...]
+
+[ $# -lt 3 ] && { echo "usage: $0 DIR MB RSYNC [RSYNC...]"; exit 1; }
+dir="$1" mb="$2"
+shift 2
+port=${PORT:-8873}
+runs=${RUNS:-3}
+files=${FILES:-1}
+
+mkdir -p "$dir" || exit 1
+cd "$dir" || exit 1
+dir=`pwd`
+
+if [ ! -f src/.done-$mb-$files ]; then
+    rm -rf src
+    mkdir src || exit 1
+    echo "making $files ${mb}MB file(s)..."
+    for i in $(seq 1 $files); do
+	head -c $((mb * 1024 * 1024)) /dev/urandom > src/f$i || exit 1
+    done
+    touch src/.done-$mb-$files
+fi
+
+cat > rsyncd.conf <<EOF
+use chroot = no
+uid = `id -u`
+gid = `id -g`
+pid file = $dir/rsyncd.pid
+[bench]
+    path = $dir/module
+    read only = no
+EOF
+
+# Runs "$@" RUNS times after clearing out $clean, and sets best and cpu to
+# the lowest wall-clock and user+sys seconds.
+best_of() {
+    local clean="$1" i t real user sys
+    shift
+    best= cpu=
+    TIMEFORMAT='%R %U %S'
+    for i in $(seq 1 $runs); do
+	rm -rf "$clean"
+	mkdir "$clean" || exit 1
+	t=$( { time "$@" >/dev/null; } 2>&1 ) || { echo "failed: $*"; exit 1; }
+	read real user sys <<< "$t"
+	if [ -z "$best" ] || awk "BEGIN { exit !($real < $best) }"; then
+	    best=$real
+	fi
+	t=$(awk "BEGIN { print $user + $sys }")
+	if [ -z "$cpu" ] || awk "BEGIN { exit !($t < $cpu) }"; then
+	    cpu=$t
+	fi
+    done
+}
+
+for rsync in "$@"; do
+    rm -f rsyncd.pid
+    "$rsync" --daemon --no-detach --config="$dir/rsyncd.conf" \
+	--address=127.0.0.1 --port=$port &
+    daemon=$!
+    for i in $(seq 1 50); do
+	"$rsync" rsync://127.0.0.1:$port/ >/dev/null 2>&1 && break
+	sleep 0.1
+    done
+
+    best_of module "$rsync" -a --whole-file src/ rsync://127.0.0.1:$port/bench/
+    push=$(awk "BEGIN { printf \"%.1f\", $mb * $files / $best }") push_cpu=$cpu
+    best_of pulled "$rsync" -a --whole-file rsync://127.0.0.1:$port/bench/ pulled/
+    pull=$(awk "BEGIN { printf \"%.1f\", $mb * $files / $best }") pull_cpu=$cpu
+
+    kill $daemon
+    wait $daemon 2>/dev/null
+    cmp -s src/f1 pulled/f1 || { echo "$rsync: pulled/f1 differs from src/f1"; exit 1; }
+    echo "$rsync: push $push MB/s (${push_cpu}s cpu), pull $pull MB/s (${pull_cpu}s cpu)"
+done
@@ -193,6 +193,18 @@ int do_open(const char *pathname, int flags, mode_t mode)
 	return open(pathname, flags | O_BINARY, mode);
 }
 
+#ifdef HAVE_OPENAT
+int do_openat(int dirfd, const char *pathname, int flags, mode_t mode)
+{
+	if (flags != O_RDONLY) {
+		RETURN_ERROR_IF(dry_run, 0);
+		RETURN_ERROR_IF_RO_OR_LO;
+	}
+
+	return openat(dirfd, pathname, flags | O_BINARY, mode);
+}
+#endif
+
 #ifdef HAVE_CHMOD
 int do_chmod(const char *path, mode_t mode)
 {
@@ -334,6 +346,17 @@ int do_fstat(int fd, STRUCT_STAT *st)
 #endif
 }
 
+#ifdef HAVE_FSTATAT
+int do_fstatat(int dirfd, const char *fname, STRUCT_STAT *st, int flags)
+{
+#ifdef USE_STAT64_FUNCS
+	return fstatat64(dirfd, fname, st, flags);
+#else
+	return fstatat(dirfd, fname, st, flags);
+#endif
+}
+#endif
+
 OFF_T do_lseek(int fd, OFF_T offset, int whence)
 {
 #ifdef HAVE_LSEEK64
@@ -0,0 +1,259 @@
+/*
+ * Test harness for hashtable.c.  Not linked into rsync itself.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, visit the http://fsf.org website.
+ */
+
+/* With no args, runs random inserts, lookups, and deletes against a table
+ * of 32-bit keys and one of 64-bit keys, starting small so that they grow
+ * (and get looked up mid-growth) several times, and checks every result
+ * against a plain array.  Prints nothing and returns 0 if all is well.
+ * With args, it instead times COUNT inserts, hits, and misses of sequential
+ * and random keys, and prints the best of 5 runs in ns per operation, along
+ * with the slowest single insert. */
+
+#include "rsync.h"
+
+int dry_run = 0;
+int am_root = 0;
+int am_sender = 1;
+int read_only = 1;
+int list_only = 0;
+int human_readable = 0;
+int preserve_perms = 0;
+int preserve_executability = 0;
+short info_levels[COUNT_INFO], debug_levels[COUNT_DEBUG];
+
+static uint32 rand_state = 1;
+
+static uint32 next_rand(void)
+{
+	rand_state ^= rand_state << 13;
+	rand_state ^= rand_state >> 17;
+	rand_state ^= rand_state << 5;
+	return rand_state;
+}
+
+/* Turns i into a distinct non-zero key.  Keys that only differ in their
+ * upper 32 bits make sure a 64-bit table hashes all of each key. */
+static int64 make_key(int32 i, int key64, int random)
+{
+	uint32 k = random ? ((uint32)i + 1) * 2654435761u : (uint32)i + 1;
+
+	if (key64 && i % 2)
+		return (int64)k << 32;
+	return key64 ? (int64)k << 32 | k : (int64)(int32)k;
+}
+
+static double usecs(struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) * 1000000.0
+	     + (now.tv_usec - start->tv_usec);
+}
+
+/* Checks the table against have[], in which a set entry means key i is in
+ * the table with &have[i] as its data. */
+static int check_all(struct hashtable *tbl, char *have, int32 cnt, int key64)
+{
+	int32 i, found = 0, expected = 0;
+	int iter = 0;
+	void *node;
+
+	for (i = 0; i < cnt; i++) {
+		node = hashtable_find(tbl, make_key(i, key64, 1), 0);
+		if (have[i])
+			expected++;
+		if (!node != !have[i]
+		 || (node && ((struct ht_int32_node*)node)->data != &have[i])) {
+			fprintf(stderr, "%d-bit key %ld is wrong\n", key64 ? 64 : 32, (long)i);
+			return 0;
+		}
+	}
+
+	while ((node = hashtable_iterate(tbl, &iter)) != NULL) {
+		char *data = ((struct ht_int32_node*)node)->data;
+		if (data < have || data >= have + cnt || !*data
+		 || HT_KEY(node, key64) != make_key(data - have, key64, 1)) {
+			fprintf(stderr, "%d-bit iterate found a bad node\n", key64 ? 64 : 32);
+			return 0;
+		}
+		found++;
+	}
+	if (found != expected || tbl->entries != expected) {
+		fprintf(stderr, "%d-bit table has %ld entries (iterated %ld), not %ld\n",
+			key64 ? 64 : 32, (long)tbl->entries, (long)found, (long)expected);
+		return 0;
+	}
+
+	return 1;
+}
+
+static int stress(int key64)
+{
+	struct hashtable *tbl = hashtable_create(16, key64);
+	int32 cnt = 100000, i, n;
+	char *have;
+	void *node;
+
+	if (!(have = new_array0(char, cnt)))
+		out_of_memory("stress");
+
+	/* Grow from 16 slots with inserts only, looking up an earlier key
+	 * and a missing one after each, so that some lookups land in the
+	 * old array while it is being emptied. */
+	for (i = 0; i < cnt / 2; i++) {
+		node = hashtable_find(tbl, make_key(i, key64, 1), 1);
+		if (((struct ht_int32_node*)node)->data) {
+			fprintf(stderr, "%d-bit insert of new key %ld found data\n",
+				key64 ? 64 : 32, (long)i);
+			return 0;
+		}
+		((struct ht_int32_node*)node)->data = &have[i];
+		have[i] = 1;
+		n = next_rand() % (i + 1);
+		node = hashtable_find(tbl, make_key(n, key64, 1), 0);
+		if (!node || ((struct ht_int32_node*)node)->data != &have[n]) {
+			fprintf(stderr, "%d-bit key %ld went missing mid-growth\n",
+				key64 ? 64 : 32, (long)n);
+			return 0;
+		}
+		if (hashtable_find(tbl, make_key(cnt / 2 + n, key64, 1), 0)) {
+			fprintf(stderr, "%d-bit table found a key it never had\n",
+				key64 ? 64 : 32);
+			return 0;
+		}
+	}
+	if (!check_all(tbl, have, cnt, key64))
+		return 0;
+
+	/* Then mix inserts, lookups, and deletes over all the keys. */
+	for (i = 0; i < 1000000; i++) {
+		uint32 r = next_rand();
+		n = (r >> 2) % cnt;
+		switch (r & 3) {
+		case 0:
+		case 1:
+			node = hashtable_find(tbl, make_key(n, key64, 1), 1);
+			if (!((struct ht_int32_node*)node)->data != !have[n]) {
+				fprintf(stderr, "%d-bit insert of key %ld is wrong\n",
+					key64 ? 64 : 32, (long)n);
+				return 0;
+			}
+			((struct ht_int32_node*)node)->data = &have[n];
+			have[n] = 1;
+			break;
+		case 2:
+			node = hashtable_find(tbl, make_key(n, key64, 1), 0);
+			if (!node != !have[n]) {
+				fprintf(stderr, "%d-bit lookup of key %ld is wrong\n",
+					key64 ? 64 : 32, (long)n);
+				return 0;
+			}
+			break;
+		case 3:
+			if (hashtable_delete(tbl, make_key(n, key64, 1)) != (have[n] ? &have[n] : NULL)) {
+				fprintf(stderr, "%d-bit delete of key %ld is wrong\n",
+					key64 ? 64 : 32, (long)n);
+				return 0;
+			}
+			have[n] = 0;
+			break;
+		}
+		if (i % 100000 == 0 && !check_all(tbl, have, cnt, key64))
+			return 0;
+	}
+	if (!check_all(tbl, have, cnt, key64))
+		return 0;
+
+	hashtable_destroy(tbl);
+	free(have);
+	return 1;
+}
+
+static void bench(int32 cnt, int key64, int random)
+{
+	double best[4] = { 0, 0, 0, 0 };
+	int run, j;
+
+	for (run = 0; run < 5; run++) {
+		struct hashtable *tbl;
+		struct timeval start, one;
+		double t[4], worst = 0;
+		int32 i;
+
+		tbl = hashtable_create(16, key64);
+		gettimeofday(&start, NULL);
+		for (i = 0; i < cnt; i++)
+			hashtable_find(tbl, make_key(i, key64, random), 1);
+		t[0] = usecs(&start);
+
+		gettimeofday(&start, NULL);
+		for (i = 0; i < cnt; i++)
+			hashtable_find(tbl, make_key(i, key64, random), 0);
+		t[1] = usecs(&start);
+
+		gettimeofday(&start, NULL);
+		for (i = cnt; i < 2 * cnt; i++)
+			hashtable_find(tbl, make_key(i, key64, random), 0);
+		t[2] = usecs(&start);
+		hashtable_destroy(tbl);
+
+		/* Time each insert on its own to find the slowest one. */
+		tbl = hashtable_create(16, key64);
+		for (i = 0; i < cnt; i++) {
+			gettimeofday(&one, NULL);
+			hashtable_find(tbl, make_key(i, key64, random), 1);
+			if ((t[3] = usecs(&one)) > worst)
+				worst = t[3];
+		}
+		t[3] = worst;
+		hashtable_destroy(tbl);
+
+		for (j = 0; j < 4; j++) {
+			if (!run || t[j] < best[j])
+				best[j] = t[j];
+		}
+	}
+
+	printf("%ld %s %d-bit keys: insert %6.1f  hit %6.1f  miss %6.1f ns, worst insert %6.2f ms\n",
+		(long)cnt, random ? "random" : "sequential", key64 ? 64 : 32,
+		best[0] * 1000 / cnt, best[1] * 1000 / cnt, best[2] * 1000 / cnt,
+		best[3] / 1000);
+}
+
+int
+main(int argc, char **argv)
+{
+	int32 cnt;
+
+	if (argc > 1) {
+		if (argc != 2 || (cnt = atoi(argv[1])) <= 0) {
+			fprintf(stderr, "usage: t_hashtable [COUNT]\n");
+			return 1;
+		}
+		bench(cnt, 1, 0);
+		bench(cnt, 1, 1);
+		bench(cnt, 0, 0);
+		bench(cnt, 0, 1);
+		return 0;
+	}
+
+	if (!stress(0) || !stress(1))
+		return 1;
+
+	return 0;
+}
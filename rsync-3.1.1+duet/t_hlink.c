@@ -0,0 +1,400 @@
+/*
+ * Test harness for radix_sort() and the way hlink.c uses it to group
+ * hard links.  Not linked into rsync itself.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, visit the http://fsf.org website.
+ */
+
+/* With no args, checks radix_sort() against a stable qsort(), and checks
+ * that the nested dev->ino hashtables that idev_find() uses and a radix
+ * sort of a flat dev+inode list both find the right groups.  Prints nothing
+ * and returns 0 if all is well.  With args, it instead times both ways of
+ * grouping FILES files in hard-link groups of LINKS (spread over DEVS
+ * devices), and sorting their group numbers with qsort() and radix_sort(),
+ * and prints the best of 5 runs and the memory each way holds at its peak. */
+
+#include "rsync.h"
+
+int dry_run = 0;
+int am_root = 0;
+int am_sender = 1;
+int read_only = 1;
+int list_only = 0;
+int human_readable = 0;
+int preserve_perms = 0;
+int preserve_executability = 0;
+short info_levels[COUNT_INFO], debug_levels[COUNT_DEBUG];
+
+struct item {
+	int64 key;
+	int32 seq;
+};
+
+/* An entry of a flat dev+inode list, for grouping without hashtables. */
+struct idev_ent {
+	int64 dev, ino;
+	int32 *gnum_p;
+};
+
+struct tfile {
+	int64 dev, ino;
+	int32 gnum;
+};
+
+static struct tfile *files;
+static int32 *gnums;
+static size_t peak_mem;
+
+static uint32 rand_state = 1;
+
+static uint32 next_rand(void)
+{
+	rand_state ^= rand_state << 13;
+	rand_state ^= rand_state >> 17;
+	rand_state ^= rand_state << 5;
+	return rand_state;
+}
+
+static int64 rand64(void)
+{
+	return (int64)next_rand() << 32 | next_rand();
+}
+
+static double msecs(struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) * 1000.0
+	     + (now.tv_usec - start->tv_usec) / 1000.0;
+}
+
+static int item_cmp(const void *v1, const void *v2)
+{
+	const struct item *i1 = v1, *i2 = v2;
+	unsigned long long k1 = i1->key, k2 = i2->key;
+
+	if (k1 != k2)
+		return k1 < k2 ? -1 : 1;
+	return i1->seq - i2->seq;
+}
+
+/* Sort cnt items whose keys are masked by mask and compare the result with
+ * a qsort() that breaks ties by the original order. */
+static int check_sort(size_t cnt, unsigned long long mask)
+{
+	struct item *list, *tmp, *ref, *out;
+	size_t i;
+
+	if (!(list = new_array(struct item, cnt + 1))
+	 || !(tmp = new_array(struct item, cnt + 1))
+	 || !(ref = new_array(struct item, cnt + 1)))
+		out_of_memory("check_sort");
+
+	for (i = 0; i < cnt; i++) {
+		list[i].key = (int64)((unsigned long long)rand64() & mask);
+		list[i].seq = (int32)i;
+	}
+	memcpy(ref, list, cnt * sizeof ref[0]);
+	qsort(ref, cnt, sizeof ref[0], item_cmp);
+
+	out = (struct item *)radix_sort((char *)list, (char *)tmp, cnt,
+					 sizeof list[0], offsetof(struct item, key), 0);
+	for (i = 0; i < cnt; i++) {
+		if (out[i].key != ref[i].key || out[i].seq != ref[i].seq) {
+			fprintf(stderr, "radix_sort of %ld items (mask %llx) is wrong at %ld\n",
+				(long)cnt, mask, (long)i);
+			return 0;
+		}
+	}
+
+	free(list);
+	free(tmp);
+	free(ref);
+	return 1;
+}
+
+/* Sort a gnum_list the way match_hard_links() does, on the group number in
+ * the upper 32 bits only, and check that each group stays in ndx order. */
+static int check_gnum_sort(int32 cnt, int32 groups)
+{
+	int64 *list, *tmp, *out;
+	int32 i;
+
+	if (!(list = new_array(int64, cnt + 1))
+	 || !(tmp = new_array(int64, cnt + 1)))
+		out_of_memory("check_gnum_sort");
+
+	for (i = 0; i < cnt; i++)
+		list[i] = (int64)(next_rand() % groups) << 32 | (uint32)i;
+
+	out = (int64 *)radix_sort((char *)list, (char *)tmp, cnt, sizeof (int64), 0, 4);
+	for (i = 1; i < cnt; i++) {
+		if ((out[i] >> 32) < (out[i-1] >> 32)
+		 || ((out[i] >> 32) == (out[i-1] >> 32) && (int32)out[i] <= (int32)out[i-1])) {
+			fprintf(stderr, "gnum sort of %ld items is out of order at %ld\n",
+				(long)cnt, (long)i);
+			return 0;
+		}
+	}
+
+	free(list);
+	free(tmp);
+	return 1;
+}
+
+/* Make cnt files in hard-link groups of links, with the links of each
+ * group scattered over the list. */
+static void make_files(int32 cnt, int32 links, int32 devs)
+{
+	int32 i;
+
+	if (!(files = new_array(struct tfile, cnt))
+	 || !(gnums = new_array(int32, cnt)))
+		out_of_memory("make_files");
+
+	for (i = 0; i < cnt; i++) {
+		int32 g = i / links;
+		files[i].dev = g % devs;
+		files[i].ino = ((int64)(g / devs) + 1) * 7919 + (g % 3 ? (int64)1 << 40 : 0);
+		files[i].gnum = g;
+	}
+	for (i = cnt - 1; i > 0; i--) {
+		int32 j = next_rand() % (i + 1);
+		struct tfile t = files[i];
+		files[i] = files[j];
+		files[j] = t;
+	}
+}
+
+static size_t table_mem(struct hashtable *tbl)
+{
+	return sizeof *tbl + (size_t)tbl->size * tbl->node_size
+	     + (tbl->old_nodes ? (size_t)tbl->old_size * tbl->node_size : 0);
+}
+
+/* What idev_find() does: a hashtable of devices, each with a hashtable of
+ * inodes, looked up for every file as its entry arrives. */
+static int32 group_by_hashtable(int32 cnt)
+{
+	struct hashtable *dev_tbl = hashtable_create(16, 1);
+	struct ht_int64_node *dev_node;
+	int32 i, next_gnum = 0;
+	int iter = 0;
+	size_t mem = 0;
+
+	for (i = 0; i < cnt; i++) {
+		struct ht_int64_node *node;
+		struct hashtable *tbl;
+
+		dev_node = hashtable_find(dev_tbl, files[i].dev + 1, 1);
+		if (!(tbl = dev_node->data))
+			tbl = dev_node->data = hashtable_create(512, 1);
+		node = hashtable_find(tbl, files[i].ino, 1);
+		if (!node->data)
+			node->data = (void *)(long)++next_gnum;
+		gnums[i] = (int32)(long)node->data - 1;
+	}
+
+	mem = table_mem(dev_tbl);
+	while ((dev_node = hashtable_iterate(dev_tbl, &iter)) != NULL) {
+		mem += table_mem(dev_node->data);
+		hashtable_destroy(dev_node->data);
+	}
+	hashtable_destroy(dev_tbl);
+	peak_mem = mem;
+
+	return next_gnum;
+}
+
+/* Append every file's dev+inode to a flat list, sort it once, and number
+ * the runs of equal values. */
+static int32 group_by_sort(int32 cnt)
+{
+	struct idev_ent *list, *tmp, *out;
+	size_t size = 0;
+	int32 i, gnum = -1;
+
+	for (list = NULL, i = 0; i < cnt; i++) {
+		if ((size_t)i == size) {
+			size = size ? size * 2 : 4096;
+			if (!(list = realloc_array(list, struct idev_ent, size)))
+				out_of_memory("group_by_sort");
+		}
+		list[i].dev = files[i].dev;
+		list[i].ino = files[i].ino;
+		list[i].gnum_p = &gnums[i];
+	}
+
+	if (!(tmp = new_array(struct idev_ent, cnt + 1)))
+		out_of_memory("group_by_sort");
+	out = (struct idev_ent *)radix_sort((char *)list, (char *)tmp, cnt,
+		sizeof (struct idev_ent), offsetof(struct idev_ent, ino), 0);
+	out = (struct idev_ent *)radix_sort((char *)out, out == tmp ? (char *)list : (char *)tmp,
+		cnt, sizeof (struct idev_ent), offsetof(struct idev_ent, dev), 0);
+
+	for (i = 0; i < cnt; i++) {
+		if (!i || out[i].dev != out[i-1].dev || out[i].ino != out[i-1].ino)
+			gnum++;
+		*out[i].gnum_p = gnum;
+	}
+	peak_mem = (size + cnt) * sizeof (struct idev_ent);
+
+	free(tmp);
+	free(list);
+	return gnum + 1;
+}
+
+/* Check that gnums[] puts the files into the groups they were made with. */
+static int check_groups(int32 cnt, int32 groups, int32 found, const char *how)
+{
+	int32 i, *map;
+
+	if (found != groups) {
+		fprintf(stderr, "%s found %ld groups, not %ld\n", how, (long)found, (long)groups);
+		return 0;
+	}
+	if (!(map = new_array(int32, groups)))
+		out_of_memory("check_groups");
+	for (i = 0; i < groups; i++)
+		map[i] = -1;
+	for (i = 0; i < cnt; i++) {
+		int32 g = files[i].gnum;
+		if (map[g] < 0)
+			map[g] = gnums[i];
+		else if (map[g] != gnums[i]) {
+			fprintf(stderr, "%s split group %ld\n", how, (long)g);
+			return 0;
+		}
+	}
+	free(map);
+	return 1;
+}
+
+static int gnum_cmp(const void *v1, const void *v2)
+{
+	int32 n1 = *(const int32 *)v1, n2 = *(const int32 *)v2;
+	int32 g1 = gnums[n1], g2 = gnums[n2];
+
+	if (g1 != g2)
+		return g1 < g2 ? -1 : 1;
+	return n1 - n2;
+}
+
+static void bench(int32 cnt, int32 links, int32 devs)
+{
+	double best[4] = { 0, 0, 0, 0 };
+	size_t mem[4];
+	int32 groups = (cnt + links - 1) / links;
+	int run, j;
+
+	make_files(cnt, links, devs);
+
+	for (run = 0; run < 5; run++) {
+		struct timeval start;
+		double t[4];
+		int32 *ndx_list, i;
+		int64 *list, *tmp;
+
+		gettimeofday(&start, NULL);
+		group_by_hashtable(cnt);
+		t[0] = msecs(&start);
+		mem[0] = peak_mem;
+
+		gettimeofday(&start, NULL);
+		group_by_sort(cnt);
+		t[1] = msecs(&start);
+		mem[1] = peak_mem;
+
+		/* What match_hard_links() used to do: qsort() the ndx values
+		 * with a comparator that looks up each one's group number. */
+		gettimeofday(&start, NULL);
+		if (!(ndx_list = new_array(int32, cnt)))
+			out_of_memory("bench");
+		for (i = 0; i < cnt; i++)
+			ndx_list[i] = i;
+		qsort(ndx_list, cnt, sizeof (int32), gnum_cmp);
+		free(ndx_list);
+		t[2] = msecs(&start);
+		mem[2] = cnt * sizeof (int32);
+
+		/* What it does now: radix-sort packed group number + ndx values. */
+		gettimeofday(&start, NULL);
+		if (!(list = new_array(int64, cnt)) || !(tmp = new_array(int64, cnt)))
+			out_of_memory("bench");
+		for (i = 0; i < cnt; i++)
+			list[i] = (int64)gnums[i] << 32 | (uint32)i;
+		radix_sort((char *)list, (char *)tmp, cnt, sizeof (int64), 0, 4);
+		free(list);
+		free(tmp);
+		t[3] = msecs(&start);
+		mem[3] = 2 * cnt * sizeof (int64);
+
+		for (j = 0; j < 4; j++) {
+			if (!run || t[j] < best[j])
+				best[j] = t[j];
+		}
+	}
+
+	printf("%ld files in %ld groups of %ld on %ld devs, best of 5:\n",
+		(long)cnt, (long)groups, (long)links, (long)devs);
+	printf("  dev+ino, hashtables: %8.1f ms %8.1f MB\n", best[0], mem[0] / 1048576.0);
+	printf("  dev+ino, radix sort: %8.1f ms %8.1f MB\n", best[1], mem[1] / 1048576.0);
+	printf("  gnum, qsort:         %8.1f ms %8.1f MB\n", best[2], mem[2] / 1048576.0);
+	printf("  gnum, radix sort:    %8.1f ms %8.1f MB\n", best[3], mem[3] / 1048576.0);
+}
+
+int
+main(int argc, char **argv)
+{
+	static const unsigned long long masks[] = {
+		~(unsigned long long)0, 0xFF, 0xFF00000000000000ULL, 0x0000FFFF0000FF00ULL, 0
+	};
+	static const size_t counts[] = { 0, 1, 2, 255, 256, 1000, 65537 };
+	int32 cnt, links, devs, found;
+	size_t i, j;
+
+	if (argc > 1) {
+		if (argc < 3 || argc > 4 || (cnt = atoi(argv[1])) <= 0
+		 || (links = atoi(argv[2])) <= 0
+		 || (devs = argc > 3 ? atoi(argv[3]) : 1) <= 0) {
+			fprintf(stderr, "usage: t_hlink [FILES LINKS [DEVS]]\n");
+			return 1;
+		}
+		bench(cnt, links, devs);
+		return 0;
+	}
+
+	for (i = 0; i < sizeof counts / sizeof counts[0]; i++) {
+		for (j = 0; j < sizeof masks / sizeof masks[0]; j++) {
+			if (!check_sort(counts[i], masks[j]))
+				return 1;
+		}
+		if (counts[i] && (!check_gnum_sort(counts[i], 1)
+		 || !check_gnum_sort(counts[i], 300)
+		 || !check_gnum_sort(counts[i], 0x7FFFFFFF)))
+			return 1;
+	}
+
+	cnt = 100000, links = 3;
+	make_files(cnt, links, 3);
+	found = group_by_hashtable(cnt);
+	if (!check_groups(cnt, (cnt + links - 1) / links, found, "the hashtables"))
+		return 1;
+	found = group_by_sort(cnt);
+	if (!check_groups(cnt, (cnt + links - 1) / links, found, "the radix sort"))
+		return 1;
+
+	return 0;
+}
@@ -27,6 +27,7 @@ extern int do_compression;
 extern int protocol_version;
 extern int module_id;
 extern int def_compress_level;
+extern int sparse_holes;
 extern char *skip_compress;
 
 static int compression_level, per_file_default_level;
@@ -226,6 +227,16 @@ static int32 simple_recv_token(int f, char **data)
 
 	if (residue == 0) {
 		int32 i = read_int(f);
+		if (i == TOKEN_HOLE && sparse_holes) {
+			/* A NULL data pointer tells the caller this is a hole. */
+			if ((i = read_int(f)) <= 0 || i > MAX_HOLE_TOKEN) {
+				rprintf(FERROR, "invalid hole length: %ld [%s]\n",
+					(long)i, who_am_i());
+				exit_cleanup(RERR_PROTOCOL);
+			}
+			*data = NULL;
+			return i;
+		}
 		if (i <= 0)
 			return i;
 		residue = i;
@@ -638,6 +649,14 @@ void send_token(int f, int32 token, struct map_struct *buf, OFF_T offset,
 		send_deflated_token(f, token, buf, offset, n, toklen);
 }
 
+/* Send a run of len zero bytes that the receiver can seek over instead of
+ * writing.  This is only used when we're not compressing. */
+void send_hole_token(int f, int32 len)
+{
+	write_int(f, TOKEN_HOLE);
+	write_int(f, len);
+}
+
 /*
  * receive a token or buffer from the other end. If the reurn value is >0 then
  * it is a data buffer of that length, and *data will point at the data.
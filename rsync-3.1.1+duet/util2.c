@@ -96,6 +96,46 @@ const char *sum_as_hex(const char *sum)
 	return buf;
 }
 
+/* Do a stable LSD radix sort of the cnt items of size len in *list by the
+ * 64-bit key at offset off in each item, skipping the key's low skip bytes.
+ * The sorted items end up in whichever of *list and *tmp is returned. */
+char *radix_sort(char *list, char *tmp, size_t cnt, size_t len,
+		 size_t off, int skip)
+{
+	size_t counts[8][256], i, pos;
+	char *src, *dst, *t;
+	int b, k;
+
+	memset(counts, 0, sizeof counts);
+	for (i = 0, src = list; i < cnt; i++, src += len) {
+		int64 key;
+		memcpy(&key, src + off, sizeof key);
+		for (b = skip; b < 8; b++)
+			counts[b][(key >> (b * 8)) & 0xFF]++;
+	}
+
+	for (b = skip, src = list, dst = tmp; b < 8; b++) {
+		size_t *cp = counts[b];
+		/* A byte that is the same in every key needs no pass. */
+		for (k = 0; k < 256 && cp[k] != cnt; k++) {}
+		if (k < 256)
+			continue;
+		for (k = 0, pos = 0; k < 256; k++) {
+			size_t n = cp[k];
+			cp[k] = pos;
+			pos += n;
+		}
+		for (i = 0, t = src; i < cnt; i++, t += len) {
+			int64 key;
+			memcpy(&key, t + off, sizeof key);
+			memcpy(dst + cp[(key >> (b * 8)) & 0xFF]++ * len, t, len);
+		}
+		t = src, src = dst, dst = t;
+	}
+
+	return src;
+}
+
 NORETURN void out_of_memory(const char *str)
 {
 	rprintf(FERROR, "ERROR: out of memory in %s [%s]\n", str, who_am_i());
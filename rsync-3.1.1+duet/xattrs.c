@@ -87,6 +87,15 @@ static item_list rsync_xal_l = EMPTY_ITEM_LIST;
 
 static size_t prior_xattr_count = (size_t)-1;
 
+/* rsync_xal_l is indexed by a hash of each list's contents, so that finding
+ * a match for a new list doesn't have to compare it against every list. */
+typedef struct rsync_xal_ref {
+	struct rsync_xal_ref *next;
+	int ndx;
+} rsync_xal_ref;
+
+static struct hashtable *rsync_xal_h = NULL;
+
 /* ------------------------------------------------------------------------- */
 
 static void rsync_xal_free(item_list *xalp)
@@ -360,17 +369,82 @@ int copy_xattrs(const char *source, const char *dest)
 	return 0;
 }
 
+/* Hashes everything that find_matching_xattr() compares.  The names are
+ * sorted, so equal lists always hash alike. */
+static int32 xattr_lookup_hash(const item_list *xalp)
+{
+	const rsync_xa *rxas = xalp->items;
+	uint32 key = hash_bytes(&xalp->count, sizeof xalp->count, 0);
+	size_t i;
+
+	for (i = 0; i < xalp->count; i++) {
+		key = hash_bytes(rxas[i].name, rxas[i].name_len, key);
+		key = hash_bytes(&rxas[i].datum_len, sizeof rxas[i].datum_len, key);
+		if (rxas[i].datum_len > MAX_FULL_DATUM)
+			key = hash_bytes(rxas[i].datum + 1, MAX_DIGEST_LEN, key);
+		else
+			key = hash_bytes(rxas[i].datum, rxas[i].datum_len, key);
+	}
+
+	/* 0 is not a legal hashtable key. */
+	return key ? (int32)key : 1;
+}
+
+static void xattr_index_add(int ndx, int32 key)
+{
+	struct ht_int32_node *node;
+	rsync_xal_ref *ref, **refp;
+
+	if (!rsync_xal_h)
+		rsync_xal_h = hashtable_create(512, 0);
+
+	if (!(ref = new(rsync_xal_ref)))
+		out_of_memory("xattr_index_add");
+	ref->next = NULL;
+	ref->ndx = ndx;
+
+	/* Append, so that the earliest matching list is still the one found. */
+	node = hashtable_find(rsync_xal_h, key, 1);
+	for (refp = (rsync_xal_ref **)&node->data; *refp; refp = &(*refp)->next) {}
+	*refp = ref;
+}
+
+static void xattr_index_del(int ndx, int32 key)
+{
+	struct ht_int32_node *node;
+	rsync_xal_ref *ref, **refp;
+
+	if (!rsync_xal_h || !(node = hashtable_find(rsync_xal_h, key, 0)))
+		return;
+
+	for (refp = (rsync_xal_ref **)&node->data; (ref = *refp) != NULL; refp = &ref->next) {
+		if (ref->ndx == ndx) {
+			*refp = ref->next;
+			free(ref);
+			if (!node->data)
+				hashtable_delete(rsync_xal_h, key);
+			return;
+		}
+	}
+}
+
 static int find_matching_xattr(item_list *xalp)
 {
-	size_t i, j;
+	size_t j;
 	item_list *lst = rsync_xal_l.items;
+	struct ht_int32_node *node;
+	rsync_xal_ref *ref;
+
+	if (!rsync_xal_h
+	 || !(node = hashtable_find(rsync_xal_h, xattr_lookup_hash(xalp), 0)))
+		return -1;
 
-	for (i = 0; i < rsync_xal_l.count; i++) {
-		rsync_xa *rxas1 = lst[i].items;
+	for (ref = node->data; ref; ref = ref->next) {
+		rsync_xa *rxas1 = lst[ref->ndx].items;
 		rsync_xa *rxas2 = xalp->items;
 
 		/* Wrong number of elements? */
-		if (lst[i].count != xalp->count)
+		if (lst[ref->ndx].count != xalp->count)
 			continue;
 		/* any elements different? */
 		for (j = 0; j < xalp->count; j++) {
@@ -391,7 +465,7 @@ static int find_matching_xattr(item_list *xalp)
 		}
 		/* no differences found.  This is The One! */
 		if (j == xalp->count)
-			return i;
+			return ref->ndx;
 	}
 
 	return -1;
@@ -400,6 +474,7 @@ static int find_matching_xattr(item_list *xalp)
 /* Store *xalp on the end of rsync_xal_l */
 static void rsync_xal_store(item_list *xalp)
 {
+	int ndx = rsync_xal_l.count;
 	item_list *new_lst = EXPAND_ITEM_LIST(&rsync_xal_l, item_list, RSYNC_XAL_LIST_INITIAL);
 	/* Since the following call starts a new list, we know it will hold the
 	 * entire initial-count, not just enough space for one new item. */
@@ -408,6 +483,7 @@ static void rsync_xal_store(item_list *xalp)
 	memcpy(new_lst->items, xalp->items, xalp->count * sizeof (rsync_xa));
 	new_lst->count = xalp->count;
 	xalp->count = 0;
+	xattr_index_add(ndx, xattr_lookup_hash(new_lst));
 }
 
 /* Send the make_xattr()-generated xattr list for this flist entry. */
@@ -599,12 +675,14 @@ int recv_xattr_request(struct file_struct *file, int f_in)
 	char *old_datum, *name;
 	rsync_xa *rxa;
 	int rel_pos, cnt, num, got_xattr_data = 0;
+	int32 old_key;
 
 	if (F_XATTR(file) < 0) {
 		rprintf(FERROR, "recv_xattr_request: internal data error!\n");
 		exit_cleanup(RERR_PROTOCOL);
 	}
 	lst += F_XATTR(file);
+	old_key = am_sender ? 0 : xattr_lookup_hash(lst);
 
 	cnt = lst->count;
 	rxa = lst->items;
@@ -648,6 +726,12 @@ int recv_xattr_request(struct file_struct *file, int f_in)
 		got_xattr_data = 1;
 	}
 
+	/* The list's contents changed, so it has to move in the index. */
+	if (got_xattr_data) {
+		xattr_index_del(F_XATTR(file), old_key);
+		xattr_index_add(F_XATTR(file), xattr_lookup_hash(lst));
+	}
+
 	return got_xattr_data;
 }
 
@@ -778,8 +862,11 @@ void uncache_tmp_xattrs(void)
 		item_list *xattr_start = xattr_item + prior_xattr_count;
 		xattr_item += rsync_xal_l.count;
 		rsync_xal_l.count = prior_xattr_count;
-		while (xattr_item-- > xattr_start)
+		while (xattr_item-- > xattr_start) {
+			xattr_index_del(xattr_item - (item_list *)rsync_xal_l.items,
+					xattr_lookup_hash(xattr_item));
 			rsync_xal_free(xattr_item);
+		}
 		prior_xattr_count = (size_t)-1;
 	}
 }